@@ -0,0 +1,99 @@
+/*
+ * Benchmark de copia y borrado de árboles con muchos archivos chicos (cp -r, rm -r).
+ * Genera $HOME/bench_arbol/origen con [archivos] archivos de [bytes] bytes repartidos en directorios de
+ * 1000 y compara, sobre el mismo árbol:
+ * - 'cp -r' y 'rm -r' de coreutils (un proceso, secuencial).
+ * - 'ejecutar_cp'/'ejecutar_rm' con -r: recorrido + pool de hilos con openat/unlinkat relativos a
+ * descriptores de directorio, con 1 hilo y con más (FLSH_ARBOL_HILOS).
+ * Los tiempos incluyen la verificación del Sandbox y la auditoría de cada operación.
+ *
+ * Compilación: gcc -O2 -pthread bench/bench_arbol.c -o bench_arbol
+ * Uso:         HOME=/ruta/de/prueba ./bench_arbol [archivos] [bytes] [hilos,hilos,...]
+ */
+#define FLSH_SIN_MAIN
+#include "../flsh_shell.c"
+
+static double ahora_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static void reportar(const char *nombre, double ms, long archivos, long long bytes) {
+    printf("%-28s %9.1f ms  %9.0f archivos/s  %7.1f MB/s\n", nombre, ms, archivos / (ms / 1e3),
+           bytes / (1024.0 * 1024.0) / (ms / 1e3));
+}
+
+static double ejecutar_externo(const char *comando) {
+    double t0 = ahora_ms();
+    if (system(comando) != 0) fprintf(stderr, "falló: %s\n", comando);
+    return ahora_ms() - t0;
+}
+
+int main(int argc, char **argv) {
+    long archivos = (argc > 1) ? atol(argv[1]) : 100000;
+    size_t bytes = (argc > 2) ? (size_t)atol(argv[2]) : 2048;
+    const char *lista_hilos = (argc > 3) ? argv[3] : "1,2,4,8";
+    const char *home = getenv("HOME");
+    if (!home || iniciar_sandbox(home) != 0) { fprintf(stderr, "HOME inaccesible\n"); return 1; }
+    if (chdir(sandbox.home_real) != 0) { perror("chdir"); return 1; }
+    snprintf(sandbox.cwd, sizeof(sandbox.cwd), "%s", sandbox.home_real); // lo que haría 'cd'
+
+    // Árbol de origen: d0000/ ... con 1000 archivos cada uno
+    char *contenido = malloc(bytes + 1);
+    memset(contenido, 'x', bytes);
+    mkdir("bench_arbol", 0755);
+    mkdir("bench_arbol/origen", 0755);
+    for (long i = 0; i < archivos; i++) {
+        char ruta[96];
+        if (i % 1000 == 0) {
+            snprintf(ruta, sizeof(ruta), "bench_arbol/origen/d%04ld", i / 1000);
+            mkdir(ruta, 0755);
+        }
+        snprintf(ruta, sizeof(ruta), "bench_arbol/origen/d%04ld/archivo_%ld", i / 1000, i);
+        int fd = open(ruta, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || write(fd, contenido, bytes) != (ssize_t)bytes) { perror(ruta); return 1; }
+        close(fd);
+    }
+    free(contenido);
+    long long total = (long long)archivos * (long long)bytes;
+    printf("%ld archivos de %zu bytes en %s/bench_arbol/origen\n", archivos, bytes, sandbox.home_real);
+
+    reportar("cp -r (coreutils)", ejecutar_externo("cp -r bench_arbol/origen bench_arbol/copia"), archivos, total);
+    reportar("rm -r (coreutils)", ejecutar_externo("rm -r bench_arbol/copia"), archivos, 0);
+
+    // rm -r pide una confirmación: se responde desde un lector en memoria, como en modo por lotes
+    lector_t respuestas;
+    lector_desde_cadena(&respuestas, "s\ns\ns\ns\ns\ns\ns\ns\ns\ns\ns\ns\ns\ns\ns\ns\n");
+    lector_stdin = &respuestas;
+    int nulo = open("/dev/null", O_WRONLY);
+    int salida = dup(STDOUT_FILENO);
+
+    char copia_lista[256];
+    snprintf(copia_lista, sizeof(copia_lista), "%s", lista_hilos);
+    for (char *h = strtok(copia_lista, ","); h; h = strtok(NULL, ",")) {
+        setenv("FLSH_ARBOL_HILOS", h, 1);
+        char nombre[64];
+        char *cp[] = { "cp", "-r", "bench_arbol/origen", "bench_arbol/copia", NULL };
+        double t0 = ahora_ms();
+        ejecutar_cp(cp);
+        double ms_cp = ahora_ms() - t0;
+
+        char *rm[] = { "rm", "-r", "bench_arbol/copia", NULL };
+        dup2(nulo, STDOUT_FILENO); // El prompt de confirmación
+        t0 = ahora_ms();
+        ejecutar_rm(rm);
+        salida_volcar();
+        double ms_rm = ahora_ms() - t0;
+        dup2(salida, STDOUT_FILENO);
+
+        snprintf(nombre, sizeof(nombre), "cp -r flsh (%s hilos)", h);
+        reportar(nombre, ms_cp, archivos, total);
+        snprintf(nombre, sizeof(nombre), "rm -r flsh (%s hilos)", h);
+        reportar(nombre, ms_rm, archivos, 0);
+        if (estado_builtin != 0) fprintf(stderr, "  (estado %d)\n", estado_builtin);
+    }
+
+    ejecutar_externo("rm -r bench_arbol");
+    return 0;
+}
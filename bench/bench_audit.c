@@ -0,0 +1,113 @@
+/*
+ * Micro-benchmark de consultas de auditoría ('audit').
+ * Genera un 'shell.log' sintético de [días] días (por defecto un año) con [líneas] eventos por día,
+ * varios usuarios, IPs y comandos, y compara para varias consultas:
+ * - Recorrido completo del log mapeado, parseando y filtrando cada línea (lo que haría grep).
+ * - 'auditar_log': índice disperso + solo los bloques candidatos.
+ * También mide la construcción inicial del índice (la hace una vez el hilo escritor del logger).
+ *
+ * Compilación: gcc -O2 -pthread bench/bench_audit.c -o bench_audit
+ * Uso:         ./bench_audit [días] [líneas por día]
+ */
+#define FLSH_SIN_MAIN
+#include "../flsh_shell.c"
+
+static double ahora_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static const char *const usuarios[] = { "ana", "bruno", "carla", "diego", "elena", "root" };
+static const char *const comandos[] = { "ls", "cd", "cat", "grep", "cp", "echo", "pwd", "stats", "rm" };
+
+static void consultar(const char *ruta, const char *nombre, consulta_auditoria_t *q) {
+    if (q->usuario) q->h_usuario = hash_campo(q->usuario, strlen(q->usuario));
+    if (q->origen) q->h_origen = hash_campo(q->origen, strlen(q->origen));
+    if (q->comando) q->h_comando = hash_campo(q->comando, strlen(q->comando));
+
+    resultados_audit_t r;
+    memset(&r, 0, sizeof(r));
+    double t0 = ahora_ms();
+    int fd = open(ruta, O_RDONLY);
+    struct stat st;
+    fstat(fd, &st);
+    char *mapa = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    buscar_en_region(q, mapa, (size_t)st.st_size, &r);
+    double lineal = ahora_ms() - t0;
+    size_t esperadas = r.n;
+    munmap(mapa, (size_t)st.st_size);
+    free(r.v);
+
+    memset(&r, 0, sizeof(r));
+    t0 = ahora_ms();
+    auditar_log(ruta, q, &r, 0);
+    double indexada = ahora_ms() - t0;
+    printf("%-34s %8zu coincidencias  recorrido %9.2f ms  indice %8.2f ms (%ld/%ld bloques)%s\n", nombre, r.n,
+           lineal, indexada, r.bloques_leidos, r.bloques_totales, r.n == esperadas ? "" : "  DISTINTO");
+    if (r.logs[0].mapa) munmap(r.logs[0].mapa, r.logs[0].tam);
+    free(r.v);
+}
+
+int main(int argc, char **argv) {
+    int dias = (argc > 1) ? atoi(argv[1]) : 365;
+    int por_dia = (argc > 2) ? atoi(argv[2]) : 5000;
+    char dir[PATH_MAX], ruta[PATH_MAX + 16];
+    snprintf(dir, sizeof(dir), "%s/flsh_bench_audit.XXXXXX", getenv("HOME") ? getenv("HOME") : "/tmp");
+    if (mkdtemp(dir) == NULL) { perror("mkdtemp"); return 1; }
+    snprintf(ruta, sizeof(ruta), "%s/shell.log", dir);
+
+    FILE *f = fopen(ruta, "w");
+    if (!f) { perror(ruta); return 1; }
+    time_t t = time(NULL) - (time_t)dias * 86400;
+    unsigned semilla = 1;
+    for (int d = 0; d < dias; d++) {
+        for (int i = 0; i < por_dia; i++, t += 86400 / por_dia) {
+            struct tm tm;
+            char fecha[32];
+            localtime_r(&t, &tm);
+            strftime(fecha, sizeof(fecha), "%Y-%m-%d %H:%M:%S", &tm);
+            semilla = semilla * 1103515245u + 12345u;
+            unsigned u = (semilla >> 8) % 6, c = (semilla >> 12) % 9, ip = (semilla >> 16) % 40;
+            if (c == 8 && (semilla >> 20) % 50) c = 5; // 'rm' es raro
+            fprintf(f, "[%s] [%s] SRC:10.0.0.%u | USER:%s | CMD:%s | MSG:Exito | PERF:t=0.012ms usr=0.000ms sys=0.010ms\n",
+                    fecha, c == 2 && ip == 7 ? "WARNING" : "INFO", ip, usuarios[u], comandos[c]);
+        }
+    }
+    long tam = ftell(f);
+    fclose(f);
+    printf("%s: %d días x %d eventos, %.1f MB\n", ruta, dias, por_dia, tam / 1048576.0);
+
+    double t0 = ahora_ms();
+    uint64_t indexado = indice_extender(ruta);
+    printf("construcción del índice: %.2f ms (%.1f MB indexados)\n", ahora_ms() - t0, indexado / 1048576.0);
+
+    uint64_t hace_una_semana, hace_dos_dias;
+    parsear_fecha_audit("-7d", 0, &hace_una_semana);
+    parsear_fecha_audit("-2d", 1, &hace_dos_dias);
+    consulta_auditoria_t q;
+
+    memset(&q, 0, sizeof(q));
+    q.desde = hace_una_semana; q.hasta = hace_dos_dias; q.comando = "rm";
+    consultar(ruta, "rm entre hace 7 y 2 días", &q);
+
+    memset(&q, 0, sizeof(q));
+    q.hasta = UINT64_MAX; q.origen = "10.0.0.7"; q.niveles = 1u << BINLOG_WARNING;
+    consultar(ruta, "WARNING desde 10.0.0.7 (un año)", &q);
+
+    memset(&q, 0, sizeof(q));
+    q.hasta = UINT64_MAX; q.usuario = "mallory";
+    consultar(ruta, "usuario inexistente (un año)", &q);
+
+    memset(&q, 0, sizeof(q));
+    q.desde = hace_una_semana; q.hasta = UINT64_MAX; q.usuario = "root"; q.comando = "rm";
+    consultar(ruta, "root + rm, última semana", &q);
+
+    char idx[PATH_MAX + 40];
+    ruta_indice(idx, sizeof(idx), ruta);
+    unlink(idx);
+    unlink(ruta);
+    rmdir(dir);
+    return 0;
+}
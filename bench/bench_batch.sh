@@ -0,0 +1,34 @@
+#!/bin/sh
+# Benchmark de throughput del modo por lotes (comandos/segundo).
+# Genera scripts de N comandos y los ejecuta como archivo (mmap), por stdin (bloques) y con
+# el log volcado por evento (FLSH_LOG_FLUSH=evento) para comparar contra el volcado por lotes.
+#
+# Uso: sh bench/bench_batch.sh [./flsh] [N]
+FLSH=${1:-./flsh}
+N=${2:-100000}
+DIR=$(mktemp -d "${HOME:-/tmp}/flsh_bench.XXXXXX")
+trap 'rm -rf "$DIR"' EXIT
+
+ahora() { date +%s.%N; }
+
+# medir NOMBRE CANTIDAD COMANDO...: ejecuta el comando y reporta comandos/segundo
+medir() {
+    nombre=$1; cantidad=$2; shift 2
+    t0=$(ahora)
+    "$@" > /dev/null 2>&1
+    t1=$(ahora)
+    awk -v n="$nombre" -v c="$cantidad" -v a="$t0" -v b="$t1" \
+        'BEGIN { s = b - a; printf "%-34s %8.3f s %12.0f cmd/s\n", n, s, c / s }'
+}
+
+# Built-ins: echo/pwd/hash (sin crear procesos)
+awk -v n="$N" 'BEGIN { for (i = 0; i < n; i++) { m = i % 3; if (m == 0) print "echo linea " i; else if (m == 1) print "pwd"; else print "hash" } }' > "$DIR/builtins.flsh"
+# Externos: 1 de cada 10 comandos es 'true' (usa el lanzador y la tabla de rutas)
+EXT=$((N / 10))
+awk -v n="$EXT" 'BEGIN { for (i = 0; i < n; i++) print "true" }' > "$DIR/externos.flsh"
+
+echo "flsh: $FLSH, $N comandos built-in, $EXT externos"
+medir "built-ins (script, mmap)" "$N" "$FLSH" "$DIR/builtins.flsh"
+medir "built-ins (stdin, bloques)" "$N" sh -c "\"$FLSH\" < \"$DIR/builtins.flsh\""
+medir "built-ins (log por evento)" "$N" env FLSH_LOG_FLUSH=evento "$FLSH" "$DIR/builtins.flsh"
+medir "externos 'true' (script)" "$EXT" "$FLSH" "$DIR/externos.flsh"
@@ -0,0 +1,177 @@
+/*
+ * Benchmark del editor de línea.
+ * Corre el editor en un proceso hijo sobre una pseudoterminal y mide, desde el write() de cada tecla en
+ * el maestro hasta el primer byte del redibujado, la latencia p50/p99 de:
+ * - Insertar al final (se escribe solo el carácter) y en medio de una línea de 40 caracteres.
+ * - Flecha izquierda/derecha.
+ * - Flecha arriba recorriendo un historial de [N] entradas.
+ * - Ctrl-R con una consulta que solo coincide con la entrada más vieja (recorre todo el historial).
+ * - Tab en un directorio de [M] archivos: la primera vez (apertura y lectura), con el listado en cache
+ *   y tras crear un archivo (inotify invalida el listado y se vuelve a leer).
+ * También mide la carga del historial (mapeo e índice) en el proceso del benchmark.
+ *
+ * Compilación: gcc -O2 -pthread bench/bench_editor.c -o bench_editor
+ * Uso:         HOME=/ruta/de/prueba ./bench_editor [N] [M] [muestras]
+ */
+#define FLSH_SIN_MAIN
+#include "../flsh_shell.c"
+
+typedef struct {
+    double *ms;
+    int n;
+} muestras_t;
+
+static double ahora_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static int comparar_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Descarta la salida hasta que el editor queda callado 'silencio_ms'
+static void drenar(int maestro, int silencio_ms) {
+    char buf[65536];
+    struct pollfd p = { .fd = maestro, .events = POLLIN };
+    while (poll(&p, 1, silencio_ms) > 0 && read(maestro, buf, sizeof(buf)) > 0) {}
+}
+
+static void enviar(int maestro, const char *teclas) {
+    if (write(maestro, teclas, strlen(teclas)) < 0) perror("write");
+    drenar(maestro, 5);
+}
+
+// Envía 'tecla' y retorna los ms hasta el primer byte del redibujado (luego drena el resto)
+static double medir_tecla(int maestro, const char *tecla) {
+    struct pollfd p = { .fd = maestro, .events = POLLIN };
+    double t0 = ahora_ms();
+    if (write(maestro, tecla, strlen(tecla)) < 0) return -1;
+    if (poll(&p, 1, 5000) <= 0) return -1;
+    double ms = ahora_ms() - t0;
+    drenar(maestro, 2);
+    return ms;
+}
+
+static void agregar(muestras_t *m, double ms) {
+    if (ms >= 0) m->ms[m->n++] = ms;
+}
+
+static void reportar(const char *caso, muestras_t *m) {
+    if (m->n == 0) { printf("%-38s %10s\n", caso, "sin datos"); return; }
+    qsort(m->ms, (size_t)m->n, sizeof(double), comparar_double);
+    printf("%-38s %8.1f us %8.1f us %6d\n", caso, m->ms[m->n / 2] * 1e3, m->ms[(int)(0.99 * (m->n - 1))] * 1e3, m->n);
+    m->n = 0;
+}
+
+int main(int argc, char **argv) {
+    long n_historial = (argc > 1) ? atol(argv[1]) : 100000;
+    long n_archivos = (argc > 2) ? atol(argv[2]) : 10000;
+    int n = (argc > 3) ? atoi(argv[3]) : 500;
+    const char *home = getenv("HOME");
+    if (!home || iniciar_sandbox(home) != 0) { fprintf(stderr, "HOME inaccesible\n"); return 1; }
+    if (chdir(sandbox.home_real) != 0) { perror("chdir"); return 1; }
+    snprintf(sandbox.cwd, sizeof(sandbox.cwd), "%s", sandbox.home_real);
+    logger.omitir_info = 1;
+
+    // Historial: la entrada 0 es la única con "QZX"
+    const char *archivo_historial = "bench_editor.historial";
+    FILE *f = fopen(archivo_historial, "w");
+    if (!f) { perror(archivo_historial); return 1; }
+    fprintf(f, "echo QZX primera%c", '\0');
+    for (long i = 1; i < n_historial; i++) fprintf(f, "grep -c patron_%ld registro_%ld.log%c", i % 977, i, '\0');
+    fclose(f);
+    setenv("FLSH_HISTORIAL", archivo_historial, 1);
+    double t0 = ahora_ms();
+    historial_iniciar();
+    printf("carga del historial: %ld entradas en %.2f ms\n", (long)historial.n, ahora_ms() - t0);
+
+    if (mkdir("bench_editor", 0755) != 0) { perror("bench_editor"); return 1; }
+    char nombre[64];
+    for (long i = 0; i < n_archivos; i++) {
+        snprintf(nombre, sizeof(nombre), "bench_editor/archivo_%06ld", i);
+        close(open(nombre, O_WRONLY | O_CREAT, 0644));
+    }
+
+    int maestro = posix_openpt(O_RDWR | O_NOCTTY);
+    if (maestro < 0 || grantpt(maestro) != 0 || unlockpt(maestro) != 0) { perror("pty"); return 1; }
+    struct winsize ws = { .ws_row = 24, .ws_col = 120 };
+    ioctl(maestro, TIOCSWINSZ, &ws);
+    pid_t hijo = fork();
+    if (hijo == 0) {
+        int esclavo = open(ptsname(maestro), O_RDWR);
+        if (esclavo < 0) _exit(1);
+        dup2(esclavo, STDIN_FILENO);
+        dup2(esclavo, STDOUT_FILENO);
+        close(maestro);
+        setenv("TERM", "xterm", 1);
+        if (!editor_iniciar()) _exit(1);
+        char *linea = NULL;
+        size_t cap = 0;
+        while (editor_leer_linea("$ ", &linea, &cap) != -1) {}
+        _exit(0);
+    }
+    drenar(maestro, 100);
+    printf("%-38s %11s %11s %6s\n", "caso", "p50", "p99", "n");
+
+    muestras_t m = { calloc((size_t)n + 1, sizeof(double)), 0 };
+    for (int i = 0; i < n; i++) {
+        if (i % 60 == 0) enviar(maestro, "\x15");
+        agregar(&m, medir_tecla(maestro, "a"));
+    }
+    reportar("insertar al final", &m);
+
+    enviar(maestro, "\x15" "echo 0123456789012345678901234567890123\x01");
+    for (int i = 0; i < n; i++) {
+        if (i % 40 == 39) enviar(maestro, "\x15" "echo 0123456789012345678901234567890123\x01");
+        agregar(&m, medir_tecla(maestro, "b"));
+    }
+    reportar("insertar en medio (40 caracteres)", &m);
+
+    enviar(maestro, "\x15" "echo 0123456789012345678901234567890123");
+    for (int i = 0; i < n; i++) agregar(&m, medir_tecla(maestro, (i / 20) % 2 ? "\x1b[C" : "\x1b[D"));
+    reportar("flecha izquierda/derecha", &m);
+
+    enviar(maestro, "\x15");
+    for (int i = 0; i < n; i++) agregar(&m, medir_tecla(maestro, "\x1b[A"));
+    reportar("flecha arriba (historial)", &m);
+
+    for (int i = 0; i < n / 10 + 1; i++) {
+        enviar(maestro, "\x12");
+        agregar(&m, medir_tecla(maestro, "Q"));
+        enviar(maestro, "\x07");
+    }
+    reportar("Ctrl-R, coincidencia en la más vieja", &m);
+
+    enviar(maestro, "\x15");
+    enviar(maestro, "cat bench_editor/archivo_0042");
+    agregar(&m, medir_tecla(maestro, "\t"));
+    reportar("Tab, primera vez", &m);
+    for (int i = 0; i < n; i++) {
+        enviar(maestro, "\x15" "cat bench_editor/archivo_0042");
+        agregar(&m, medir_tecla(maestro, "\t"));
+    }
+    reportar("Tab, listado en cache", &m);
+    for (int i = 0; i < n / 10 + 1; i++) {
+        snprintf(nombre, sizeof(nombre), "bench_editor/nuevo_%d", i);
+        close(open(nombre, O_WRONLY | O_CREAT, 0644));
+        enviar(maestro, "\x15" "cat bench_editor/archivo_0042");
+        agregar(&m, medir_tecla(maestro, "\t"));
+        unlink(nombre);
+    }
+    reportar("Tab, tras un cambio en el directorio", &m);
+
+    enviar(maestro, "\x15\x04");
+    waitpid(hijo, NULL, 0);
+    close(maestro);
+    for (long i = 0; i < n_archivos; i++) {
+        snprintf(nombre, sizeof(nombre), "bench_editor/archivo_%06ld", i);
+        unlink(nombre);
+    }
+    rmdir("bench_editor");
+    unlink(archivo_historial);
+    free(m.ms);
+    return 0;
+}
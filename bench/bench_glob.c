@@ -0,0 +1,144 @@
+/*
+ * Benchmark de la expansión de comodines.
+ * Crea $HOME/bench_glob/ con [N] archivos (mitad '.log', mitad '.c') y un árbol de 100 directorios con
+ * 100 archivos cada uno, y mide 'expandir_comodines' sobre líneas ya analizadas (la lectura del
+ * directorio incluida, page cache caliente) contra glob(3) de la libc:
+ * - Un patrón: '*', '*.log' y 'f00001*.c'.
+ * - Tres patrones sobre el mismo directorio en un comando (una sola lectura por la cache de listados)
+ *   contra los mismos tres en comandos separados y contra tres llamadas a glob(3).
+ * - '**' seguido de '*.c' bajo arbol/. glob(3) no tiene '**': se compara con '*' seguido de '*.c', que
+ *   en este árbol de un nivel da las mismas rutas.
+ * Ambos ordenan los resultados (locale C: el mismo orden por bytes).
+ *
+ * Compilación: gcc -O2 -pthread bench/bench_glob.c -o bench_glob
+ * Uso:         HOME=/ruta/de/prueba ./bench_glob [N] [repeticiones]
+ */
+#define FLSH_SIN_MAIN
+#include "../flsh_shell.c"
+#include <glob.h>
+
+static double ahora_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+// Analiza y expande cada línea; retorna el mejor tiempo total en ms y deja en 'argumentos' el total de argv
+static double medir_expansion(const char **lineas, int n, int repeticiones, long *argumentos) {
+    arena_t arena = { 0 };
+    double mejor = 1e18;
+    char buffer[256];
+    for (int r = 0; r < repeticiones; r++) {
+        double ms = 0;
+        *argumentos = 0;
+        for (int i = 0; i < n; i++) {
+            snprintf(buffer, sizeof(buffer), "%s", lineas[i]);
+            arena_reiniciar(&arena);
+            linea_t linea;
+            if (parsear_linea(&arena, buffer, &linea) != 0) return -1;
+            double t0 = ahora_ms();
+            if (expandir_comodines(&arena, &linea) != 0) return -1;
+            ms += ahora_ms() - t0;
+            *argumentos += linea.comandos[0].argc - 1;
+        }
+        if (ms < mejor) mejor = ms;
+    }
+    return mejor;
+}
+
+static double medir_glob(const char **patrones, int n, int repeticiones, long *rutas) {
+    double mejor = 1e18;
+    for (int r = 0; r < repeticiones; r++) {
+        double t0 = ahora_ms();
+        *rutas = 0;
+        for (int i = 0; i < n; i++) {
+            glob_t g;
+            if (glob(patrones[i], 0, NULL, &g) == 0) *rutas += (long)g.gl_pathc;
+            globfree(&g);
+        }
+        double ms = ahora_ms() - t0;
+        if (ms < mejor) mejor = ms;
+    }
+    return mejor;
+}
+
+static void reportar(const char *caso, double ms, long rutas, double ms_libc, long rutas_libc) {
+    if (ms_libc < 0) printf("%-34s %9.2f ms %8ld %14s\n", caso, ms, rutas, "-");
+    else printf("%-34s %9.2f ms %8ld %11.2f ms %8ld\n", caso, ms, rutas, ms_libc, rutas_libc);
+}
+
+int main(int argc, char **argv) {
+    long n = (argc > 1) ? atol(argv[1]) : 100000;
+    int repeticiones = (argc > 2) ? atoi(argv[2]) : 5;
+    const char *home = getenv("HOME");
+    if (!home || iniciar_sandbox(home) != 0) { fprintf(stderr, "HOME inaccesible\n"); return 1; }
+    if (chdir(sandbox.home_real) != 0) { perror("chdir"); return 1; }
+    snprintf(sandbox.cwd, sizeof(sandbox.cwd), "%s", sandbox.home_real);
+    logger.omitir_info = 1;
+
+    if (mkdir("bench_glob", 0755) != 0 || chdir("bench_glob") != 0) { perror("bench_glob"); return 1; }
+    char nombre[64];
+    for (long i = 0; i < n; i++) {
+        snprintf(nombre, sizeof(nombre), "f%07ld.%s", i, (i & 1) ? "c" : "log");
+        int fd = open(nombre, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd < 0) { perror(nombre); return 1; }
+        close(fd);
+    }
+    mkdir("arbol", 0755);
+    for (int d = 0; d < 100; d++) {
+        snprintf(nombre, sizeof(nombre), "arbol/d%03d", d);
+        mkdir(nombre, 0755);
+        for (int f = 0; f < 100; f++) {
+            snprintf(nombre, sizeof(nombre), "arbol/d%03d/a%03d.%s", d, f, (f & 1) ? "c" : "h");
+            close(open(nombre, O_WRONLY | O_CREAT, 0644));
+        }
+    }
+    if (chdir("..") != 0) return 1;
+    printf("bench_glob/: %ld entradas + arbol/ (100 x 100)\n", n);
+    printf("%-34s %12s %8s %14s %8s\n", "caso", "flsh", "rutas", "glob(3)", "rutas");
+
+    const char *casos[][2] = {
+        { "echo bench_glob/*", "bench_glob/*" },
+        { "echo bench_glob/*.log", "bench_glob/*.log" },
+        { "echo bench_glob/f00001*.c", "bench_glob/f00001*.c" },
+    };
+    long rutas, rutas_libc;
+    for (int k = 0; k < 3; k++) {
+        double ms = medir_expansion(&casos[k][0], 1, repeticiones, &rutas);
+        double ms_libc = medir_glob(&casos[k][1], 1, repeticiones, &rutas_libc);
+        reportar(casos[k][1], ms, rutas, ms_libc, rutas_libc);
+    }
+
+    // Tres patrones sobre el mismo directorio: un comando (cache) contra tres comandos
+    const char *junto[] = { "echo bench_glob/*.log bench_glob/*.c bench_glob/f00*" };
+    const char *separados[] = { "echo bench_glob/*.log", "echo bench_glob/*.c", "echo bench_glob/f00*" };
+    const char *patrones[] = { "bench_glob/*.log", "bench_glob/*.c", "bench_glob/f00*" };
+    double ms_libc = medir_glob(patrones, 3, repeticiones, &rutas_libc);
+    double ms = medir_expansion(junto, 1, repeticiones, &rutas);
+    reportar("3 patrones, un comando", ms, rutas, ms_libc, rutas_libc);
+    ms = medir_expansion(separados, 3, repeticiones, &rutas);
+    reportar("3 patrones, tres comandos", ms, rutas, ms_libc, rutas_libc);
+
+    const char *recursivo[] = { "echo bench_glob/arbol/**/*.c" };
+    const char *un_nivel = "bench_glob/arbol/*/*.c";
+    ms_libc = medir_glob(&un_nivel, 1, repeticiones, &rutas_libc);
+    ms = medir_expansion(recursivo, 1, repeticiones, &rutas);
+    reportar("bench_glob/arbol/**/*.c", ms, rutas, ms_libc, rutas_libc);
+
+    // Limpieza
+    for (long i = 0; i < n; i++) {
+        snprintf(nombre, sizeof(nombre), "bench_glob/f%07ld.%s", i, (i & 1) ? "c" : "log");
+        unlink(nombre);
+    }
+    for (int d = 0; d < 100; d++) {
+        for (int f = 0; f < 100; f++) {
+            snprintf(nombre, sizeof(nombre), "bench_glob/arbol/d%03d/a%03d.%s", d, f, (f & 1) ? "c" : "h");
+            unlink(nombre);
+        }
+        snprintf(nombre, sizeof(nombre), "bench_glob/arbol/d%03d", d);
+        rmdir(nombre);
+    }
+    rmdir("bench_glob/arbol");
+    rmdir("bench_glob");
+    return 0;
+}
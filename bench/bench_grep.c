@@ -0,0 +1,97 @@
+/*
+ * Micro-benchmark del motor de búsqueda de grep.
+ * Compara el bucle histórico (fgets de 1KB + strstr por línea) contra el motor por bloques
+ * (filtro SIMD primer/último byte, escalar forzado y Aho-Corasick multi-patrón) sobre el mismo buffer.
+ *
+ * Compilación: gcc -O2 -pthread bench/bench_grep.c -o bench_grep
+ * Uso:         ./bench_grep [MB] [patron]
+ */
+#define FLSH_SIN_MAIN
+#include "../flsh_shell.c"
+
+static double ahora_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+// Genera líneas con formato de shell.log; el patrón aparece en ~1 de cada 1000 líneas.
+static char *generar_log(size_t tamano, const char *patron) {
+    char *buf = malloc(tamano + 1);
+    size_t usado = 0;
+    unsigned semilla = 1;
+    for (long n = 0; usado + 256 < tamano; n++) {
+        semilla = semilla * 1103515245u + 12345u;
+        int len = snprintf(buf + usado, 256, "[2026-10-16 11:%02u:%02u] [INFO] SRC:10.0.%u.%u | USER:u%u | CMD:ls | MSG:%s\n",
+                           (semilla >> 8) % 60, (semilla >> 14) % 60, (semilla >> 4) & 255, semilla & 255,
+                           (semilla >> 20) % 97, (n % 1000 == 999) ? patron : "Listado exitoso");
+        usado += (size_t)len;
+    }
+    buf[usado] = '\0';
+    return buf;
+}
+
+// Réplica del bucle original de ejecutar_grep sobre un FILE* en memoria.
+static long long grep_strstr(char *buf, size_t len, const char *patron) {
+    FILE *fp = fmemopen(buf, len, "r");
+    char linea[1024];
+    long long count = 0;
+    while (fgets(linea, sizeof(linea), fp)) if (strstr(linea, patron)) count++;
+    fclose(fp);
+    return count;
+}
+
+static long long grep_motor(const char *buf, size_t len, busqueda_t *b) {
+    estado_grep_t e = { .num_linea = 1, .coincidencias = 0, .salida = NULL };
+    procesar_bloque_grep(b, &e, buf, buf + len);
+    return e.coincidencias;
+}
+
+static void reportar(const char *nombre, double ms, size_t len, long long hits) {
+    printf("%-28s %10.2f ms %10.1f MB/s  (coincidencias: %lld)\n", nombre, ms, (len / 1048576.0) / (ms / 1e3), hits);
+}
+
+int main(int argc, char **argv) {
+    size_t mb = (argc > 1) ? (size_t)atol(argv[1]) : 256;
+    const char *patron = (argc > 2) ? argv[2] : "sesion_critica";
+    size_t len = mb << 20;
+    char *buf = generar_log(len, patron);
+    len = strlen(buf);
+
+    double t0 = ahora_ms();
+    long long hits = grep_strstr(buf, len, patron);
+    reportar("fgets+strstr (original)", ahora_ms() - t0, len, hits);
+
+    busqueda_t b;
+    memset(&b, 0, sizeof(b));
+    b.patrones[0] = patron; b.n_patrones = 1;
+    preparar_busqueda(&b);
+    t0 = ahora_ms();
+    hits = grep_motor(buf, len, &b);
+    reportar("motor SIMD (auto)", ahora_ms() - t0, len, hits);
+
+    // Filtro escalar puro (sin SIMD) recorriendo todas las coincidencias del patrón
+    t0 = ahora_ms();
+    hits = 0;
+    for (const char *p = buf; (p = filtro_escalar(&b, p, buf + len)) != NULL; p++) hits++;
+    reportar("filtro escalar", ahora_ms() - t0, len, hits);
+
+    b.ignorar_mayus = 1;
+    preparar_busqueda(&b);
+    t0 = ahora_ms();
+    hits = grep_motor(buf, len, &b);
+    reportar("motor SIMD -i", ahora_ms() - t0, len, hits);
+    liberar_busqueda(&b);
+
+    busqueda_t m;
+    memset(&m, 0, sizeof(m));
+    m.patrones[0] = patron; m.patrones[1] = "CMD:rm"; m.patrones[2] = "USER:root"; m.n_patrones = 3;
+    preparar_busqueda(&m);
+    t0 = ahora_ms();
+    hits = grep_motor(buf, len, &m);
+    reportar("Aho-Corasick (3 patrones)", ahora_ms() - t0, len, hits);
+    liberar_busqueda(&m);
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * Benchmark del backend de I/O asíncrono (io_uring) contra el camino sincrónico.
+ * Genera $HOME/bench_io.dat de [MB] megabytes de texto y mide, con el page cache caliente y frío
+ * (POSIX_FADV_DONTNEED sobre el origen antes de cada corrida):
+ * - cat: 'ejecutar_cat' con stdout en /dev/null (read de 64 KB contra lecturas en vuelo).
+ * - grep: 'buscar_en_fd' con un patrón ausente (mmap contra lecturas en vuelo solapadas con la búsqueda).
+ * - cp: 'copiar_rango' con el nivel buffer (pread/pwrite) y con io_uring, y 'copiar_contenido' completo
+ * (copy_file_range) como referencia.
+ * La profundidad y el tamaño de buffer se toman de FLSH_IO_QD y FLSH_IO_BUF.
+ *
+ * Compilación: gcc -O2 -pthread bench/bench_io.c -o bench_io
+ * Uso:         HOME=/ruta/de/prueba FLSH_IO_QD=8 FLSH_IO_BUF=1M ./bench_io [MB] [repeticiones]
+ */
+#define FLSH_SIN_MAIN
+#include "../flsh_shell.c"
+
+static double ahora_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static void enfriar(const char *ruta) {
+    int fd = open(ruta, O_RDONLY);
+    if (fd < 0) return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static void calentar(const char *ruta) {
+    static char buffer[1 << 20];
+    int fd = open(ruta, O_RDONLY);
+    while (fd >= 0 && read(fd, buffer, sizeof(buffer)) > 0) {}
+    if (fd >= 0) close(fd);
+}
+
+// 0 = cat, 1 = grep, 2 = cp buffer, 3 = cp io_uring, 4 = cp copy_file_range
+static double medir(int prueba, int uring, const char *origen, const char *destino, off_t tam) {
+    anillo_io.estado = uring ? 1 : -1;
+    double t0 = ahora_ms();
+    if (prueba == 0) {
+        char *args[] = { "cat", (char *)origen, NULL };
+        ejecutar_cat(args[1]);
+        salida_volcar();
+    } else if (prueba == 1) {
+        busqueda_t b;
+        memset(&b, 0, sizeof(b));
+        b.patrones[0] = "patron_inexistente";
+        b.n_patrones = 1;
+        preparar_busqueda(&b);
+        estado_grep_t e = { .num_linea = 1 };
+        int fd = open(origen, O_RDONLY);
+        buscar_en_fd(&b, &e, fd);
+        close(fd);
+        liberar_busqueda(&b);
+    } else {
+        int fd_in = open(origen, O_RDONLY);
+        int fd_out = open(destino, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        off_t copiados = 0;
+        metodo_copia_t metodo = prueba == 2 ? COPIA_BUFFER : COPIA_URING;
+        struct stat st;
+        fstat(fd_in, &st);
+        if (prueba == 4) copiar_contenido(fd_in, fd_out, &st, &copiados, &metodo);
+        else copiar_rango(fd_in, fd_out, 0, tam, &metodo, &copiados);
+        if (copiados != tam) fprintf(stderr, "copia incompleta (%lld de %lld)\n", (long long)copiados, (long long)tam);
+        close(fd_in);
+        close(fd_out);
+    }
+    return ahora_ms() - t0;
+}
+
+int main(int argc, char **argv) {
+    long mb = (argc > 1) ? atol(argv[1]) : 512;
+    int repeticiones = (argc > 2) ? atoi(argv[2]) : 3;
+    const char *home = getenv("HOME");
+    if (!home || iniciar_sandbox(home) != 0) { fprintf(stderr, "HOME inaccesible\n"); return 1; }
+    if (chdir(sandbox.home_real) != 0) { perror("chdir"); return 1; }
+    snprintf(sandbox.cwd, sizeof(sandbox.cwd), "%s", sandbox.home_real);
+
+    const char *origen = "bench_io.dat", *destino = "bench_io.copia";
+    FILE *f = fopen(origen, "w");
+    if (!f) { perror(origen); return 1; }
+    char linea[128];
+    for (long i = 0; ftell(f) < mb * 1048576; i++) {
+        int n = snprintf(linea, sizeof(linea), "%08ld registro de prueba para el benchmark de io_uring %ld\n", i, i * 7919);
+        fwrite(linea, 1, (size_t)n, f);
+    }
+    fclose(f);
+    struct stat st;
+    stat(origen, &st);
+
+    // Inicializa el anillo una vez (como haría el primer comando de la sesión)
+    setenv("FLSH_IO", "uring", 1);
+    if (anillo_io_tomar(st.st_size)) anillo_io_soltar();
+    if (anillo_io.estado != 1) { fprintf(stderr, "io_uring no disponible en este kernel\n"); return 1; }
+    printf("%s: %.0f MB, %u lecturas en vuelo, buffers de %zu KB%s\n", origen, st.st_size / 1048576.0,
+           anillo_io.profundidad, anillo_io.tam_buffer / 1024, anillo_io.registrados ? " (registrados)" : "");
+
+    int nulo = open("/dev/null", O_WRONLY), salida = dup(STDOUT_FILENO);
+    const char *nombres[] = { "cat", "grep", "cp (buffer / io_uring)", "cp (copy_file_range)" };
+    for (int frio = 0; frio <= 1; frio++) {
+        printf("-- page cache %s --\n", frio ? "frío" : "caliente");
+        for (int k = 0; k < 4; k++) {
+            double mejor[2] = { 1e18, 1e18 };
+            for (int modo = 0; modo < 2; modo++) {
+                if (k == 3 && modo == 1) break;
+                int prueba = k < 2 ? k : k == 2 ? 2 + modo : 4;
+                for (int r = 0; r < repeticiones; r++) {
+                    unlink(destino);
+                    if (frio) enfriar(origen); else calentar(origen);
+                    dup2(nulo, STDOUT_FILENO);
+                    salida_configurar();
+                    double ms = medir(prueba, k < 2 ? modo : 1, origen, destino, st.st_size);
+                    dup2(salida, STDOUT_FILENO);
+                    if (ms < mejor[modo]) mejor[modo] = ms;
+                }
+            }
+            double mbs = st.st_size / 1048576.0;
+            if (k == 3) printf("%-24s %9.1f ms %8.1f MB/s\n", nombres[k], mejor[0], mbs / (mejor[0] / 1e3));
+            else printf("%-24s sync %9.1f ms %8.1f MB/s   io_uring %9.1f ms %8.1f MB/s\n", nombres[k], mejor[0],
+                        mbs / (mejor[0] / 1e3), mejor[1], mbs / (mejor[1] / 1e3));
+        }
+    }
+    unlink(destino);
+    unlink(origen);
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * Micro-benchmark del listado de directorios grandes.
+ * Crea N archivos vacíos en $HOME/bench_ls y compara, con la salida descartada en /dev/null:
+ * - readdir + printf por entrada (el 'ls' original, sin orden)
+ * - ejecutar_ls: getdents64 + orden por claves + writev, con y sin -l (statx en paralelo)
+ * Los resultados (y el pico de memoria residente) se imprimen en stderr.
+ *
+ * Compilación: gcc -O2 -pthread bench/bench_ls.c -o bench_ls
+ * Uso:         HOME=/ruta/de/prueba ./bench_ls [entradas]
+ */
+#define FLSH_SIN_MAIN
+#include "../flsh_shell.c"
+#include <sys/resource.h>
+
+static double ahora_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+// Réplica del ejecutar_ls original (readdir + printf por entrada)
+static void ls_readdir(const char *ruta) {
+    DIR *d = opendir(ruta);
+    if (!d) return;
+    struct dirent *dir;
+    while ((dir = readdir(d)) != NULL) {
+        if (dir->d_name[0] != '.') printf("%s  ", dir->d_name);
+    }
+    printf("\n");
+    closedir(d);
+}
+
+static void reportar(const char *nombre, double ms, long entradas) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    fprintf(stderr, "%-30s %10.2f ms %8.0f ns/entrada  (pico RSS %ld MB)\n", nombre, ms, ms * 1e6 / entradas, ru.ru_maxrss / 1024);
+}
+
+int main(int argc, char **argv) {
+    long entradas = (argc > 1) ? atol(argv[1]) : 200000;
+    const char *home = getenv("HOME");
+    if (!home || iniciar_sandbox(home) != 0) { fprintf(stderr, "HOME inaccesible\n"); return 1; }
+    if (chdir(sandbox.home_real) != 0) { perror("chdir"); return 1; }
+    snprintf(sandbox.cwd, sizeof(sandbox.cwd), "%s", sandbox.home_real); // lo que haría 'cd'
+
+    mkdir("bench_ls", 0755);
+    int dir = open("bench_ls", O_RDONLY | O_DIRECTORY);
+    if (dir < 0) { perror("bench_ls"); return 1; }
+    for (long i = 0; i < entradas; i++) {
+        char nombre[32];
+        snprintf(nombre, sizeof(nombre), "archivo_%08lx", (unsigned long)(i * 2654435761u) & 0xffffffffu);
+        int fd = openat(dir, nombre, O_WRONLY | O_CREAT, 0644);
+        if (fd >= 0) close(fd);
+    }
+    close(dir);
+    fprintf(stderr, "%ld entradas en %s/bench_ls\n", entradas, sandbox.home_real);
+
+    int nulo = open("/dev/null", O_WRONLY);
+    dup2(nulo, STDOUT_FILENO);
+
+    double t0 = ahora_ms();
+    ls_readdir("bench_ls");
+    fflush(stdout);
+    reportar("readdir+printf (original)", ahora_ms() - t0, entradas);
+
+    char *simple[] = { "ls", "bench_ls", NULL };
+    t0 = ahora_ms();
+    ejecutar_ls(simple);
+    reportar("ls (ordenado, writev)", ahora_ms() - t0, entradas);
+
+    char *largo[] = { "ls", "-l", "bench_ls", NULL };
+    t0 = ahora_ms();
+    ejecutar_ls(largo);
+    reportar("ls -l (statx en paralelo)", ahora_ms() - t0, entradas);
+
+    char *tiempo[] = { "ls", "-t", "bench_ls", NULL };
+    t0 = ahora_ms();
+    ejecutar_ls(tiempo);
+    reportar("ls -t", ahora_ms() - t0, entradas);
+    return 0;
+}
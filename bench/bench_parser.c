@@ -0,0 +1,95 @@
+/*
+ * Micro-benchmark del analizador de líneas de comando.
+ * Compara el parser histórico (strtok sobre blancos, 1024 bytes y 64 argumentos como máximo, sin
+ * comillas ni operadores) contra 'parsear_linea' (arena por comando + árbol con pipelines y
+ * redirecciones). Ambos trabajan sobre una copia escribible de la línea, como en el REPL.
+ *
+ * Compilación: gcc -O2 -pthread bench/bench_parser.c -o bench_parser
+ * Uso:         ./bench_parser [iteraciones]
+ */
+#define FLSH_SIN_MAIN
+#include "../flsh_shell.c"
+
+#define MAX_INPUT_SIZE 1024
+#define MAX_ARGS 64
+#define DELIMITADORES " \t\r\n\a"
+
+// Réplica del parsear_comando original
+static int parsear_comando(char *input, char **args) {
+    int i = 0;
+    char *token = strtok(input, DELIMITADORES);
+    while (token != NULL && i < MAX_ARGS - 1) {
+        args[i] = token;
+        i++;
+        token = strtok(NULL, DELIMITADORES);
+    }
+    args[i] = NULL;
+    return i;
+}
+
+static double ahora_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static void reportar(const char *nombre, double ms, long lineas, size_t bytes) {
+    printf("%-34s %10.2f ms %8.0f ns/línea %8.1f MB/s\n", nombre, ms, ms * 1e6 / lineas, bytes / (ms * 1e3));
+}
+
+int main(int argc, char **argv) {
+    long iteraciones = (argc > 1) ? atol(argv[1]) : 1000000;
+    // Líneas típicas de un script (sin comillas: el parser strtok no las entiende)
+    const char *lineas[] = {
+        "ls -l",
+        "cp documentos/informe_final.txt respaldo/informe_final.txt",
+        "grep -r error logs > errores.txt",
+        "cat datos.csv | grep 2024 | wc -l",
+        "echo compilando modulo principal con optimizaciones activadas y registro detallado",
+        "sleep 5 &",
+    };
+    int n_lineas = sizeof(lineas) / sizeof(lineas[0]);
+    size_t largos[sizeof(lineas) / sizeof(lineas[0])], bytes = 0;
+    for (int i = 0; i < n_lineas; i++) largos[i] = strlen(lineas[i]);
+    for (long i = 0; i < iteraciones; i++) bytes += largos[i % n_lineas];
+
+    char buffer[MAX_INPUT_SIZE];
+    char *args[MAX_ARGS];
+    long total = 0;
+    double t0 = ahora_ms();
+    for (long i = 0; i < iteraciones; i++) {
+        int k = i % n_lineas;
+        memcpy(buffer, lineas[k], largos[k] + 1);
+        total += parsear_comando(buffer, args);
+    }
+    reportar("strtok (original)", ahora_ms() - t0, iteraciones, bytes);
+
+    arena_t arena = { 0 };
+    linea_t linea;
+    t0 = ahora_ms();
+    for (long i = 0; i < iteraciones; i++) {
+        int k = i % n_lineas;
+        memcpy(buffer, lineas[k], largos[k] + 1);
+        arena_reiniciar(&arena);
+        if (parsear_linea(&arena, buffer, &linea) == 0) total += linea.comandos[0].argc;
+    }
+    reportar("parsear_linea (arena + AST)", ahora_ms() - t0, iteraciones, bytes);
+
+    // Línea larga con comillas: fuera del alcance del parser original (1024 bytes / 64 argumentos)
+    size_t largo = 1 << 20;
+    char *grande = malloc(largo + 1), *copia = malloc(largo + 1);
+    for (size_t i = 0; i < largo; i++) grande[i] = (i % 8 == 7) ? ' ' : (i % 64 == 1 || i % 64 == 5) ? '"' : 'a';
+    grande[0] = 'e'; grande[largo] = '\0';
+    long repeticiones = 200;
+    t0 = ahora_ms();
+    for (long i = 0; i < repeticiones; i++) {
+        memcpy(copia, grande, largo + 1);
+        arena_reiniciar(&arena);
+        if (parsear_linea(&arena, copia, &linea) == 0) total += linea.comandos[0].argc;
+    }
+    reportar("parsear_linea (1 MiB, comillas)", ahora_ms() - t0, repeticiones, largo * repeticiones);
+
+    printf("(argumentos contados: %ld)\n", total);
+    free(grande); free(copia);
+    return 0;
+}
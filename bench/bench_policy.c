@@ -0,0 +1,143 @@
+/*
+ * Micro-benchmark de consultas de la política del Sandbox.
+ * Genera una política con [raíces] raíces permitidas (mitad r, mitad rw), un 'denegar' dentro de cada
+ * una y reglas por comando, la compila y compara para rutas de varias profundidades:
+ * - Recorrido lineal de las reglas quedándose con el prefijo más largo (lo que haría un motor sin compilar).
+ * - 'consultar_politica': descenso por el trie, O(profundidad).
+ * - Verificación completa sin abrir: normalización + consulta + referencia ('politica_adquirir').
+ * También mide la compilación (la que repite el hilo de recarga en cada SIGHUP).
+ *
+ * Compilación: gcc -O2 -pthread bench/bench_policy.c -o bench_policy
+ * Uso:         HOME=/ruta/de/prueba ./bench_policy [iteraciones] [raíces]
+ */
+#define FLSH_SIN_MAIN
+#include "../flsh_shell.c"
+
+static double ahora_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+typedef struct {
+    char ruta[PATH_MAX];
+    size_t largo;
+    int acceso;
+    int comando;                // -1 = todos
+} regla_lineal_t;
+
+// Prefijo más largo con frontera de componente; a igual ruta gana la regla específica del comando
+static int consultar_lineal(const regla_lineal_t *r, int n, const char *abs, int comando) {
+    int acceso = ACCESO_HEREDADO;
+    size_t mejor = 0;
+    int especifica = 0;
+    for (int i = 0; i < n; i++) {
+        if (r[i].comando >= 0 && r[i].comando != comando) continue;
+        if (r[i].largo < mejor || (r[i].largo == mejor && especifica && r[i].comando < 0)) continue;
+        if (strncmp(abs, r[i].ruta, r[i].largo) != 0 || (abs[r[i].largo] != '/' && abs[r[i].largo] != '\0')) continue;
+        mejor = r[i].largo;
+        especifica = r[i].comando >= 0;
+        acceso = r[i].acceso;
+    }
+    return acceso;
+}
+
+int main(int argc, char **argv) {
+    long iteraciones = (argc > 1) ? atol(argv[1]) : 2000000;
+    int raices = (argc > 2) ? atoi(argv[2]) : 200;
+    const char *home = getenv("HOME");
+    if (!home || iniciar_sandbox(home) != 0) { fprintf(stderr, "HOME inaccesible\n"); return 1; }
+
+    // Raíces bench_pol/rNNN/datos con 'denegar rNNN/datos/privado' y 'cat' de solo lectura en las rw
+    char base[3072], archivo[PATH_MAX];
+    snprintf(base, sizeof(base), "%.3000s/bench_pol", sandbox.home_real);
+    mkdir(base, 0755);
+    snprintf(archivo, sizeof(archivo), "%s/politica", base);
+    FILE *f = fopen(archivo, "w");
+    if (!f) { perror(archivo); return 1; }
+    int n_lineal = 0;
+    regla_lineal_t *lineal = calloc((size_t)raices * 3 + 1, sizeof(*lineal));
+    int cat = indice_builtin("cat");
+    fprintf(f, "permitir ~ rw\n");
+    lineal[n_lineal++] = (regla_lineal_t){ .acceso = ACCESO_ESCRITURA, .comando = -1 };
+    snprintf(lineal[0].ruta, PATH_MAX, "%s", sandbox.home_real);
+    for (int i = 0; i < raices; i++) {
+        char dir[PATH_MAX + 64];
+        snprintf(dir, sizeof(dir), "%s/r%03d", base, i);
+        mkdir(dir, 0755);
+        snprintf(dir + strlen(dir), sizeof(dir) - strlen(dir), "/datos");
+        mkdir(dir, 0755);
+        int rw = i % 2;
+        fprintf(f, "permitir %s %s\ndenegar %s/privado\n", dir, rw ? "rw" : "r", dir);
+        lineal[n_lineal++] = (regla_lineal_t){ .acceso = rw ? ACCESO_ESCRITURA : ACCESO_LECTURA, .comando = -1 };
+        snprintf(lineal[n_lineal - 1].ruta, PATH_MAX, "%s", dir);
+        lineal[n_lineal++] = (regla_lineal_t){ .acceso = ACCESO_NINGUNO, .comando = -1 };
+        snprintf(lineal[n_lineal - 1].ruta, PATH_MAX, "%s/privado", dir);
+        if (rw) {
+            fprintf(f, "permitir %s r cat\n", dir);
+            lineal[n_lineal++] = (regla_lineal_t){ .acceso = ACCESO_LECTURA, .comando = cat };
+            snprintf(lineal[n_lineal - 1].ruta, PATH_MAX, "%s", dir);
+        }
+    }
+    fclose(f);
+    for (int i = 0; i < n_lineal; i++) lineal[i].largo = strlen(lineal[i].ruta);
+
+    char error[512];
+    double t0 = ahora_ms();
+    politica_t *p = compilar_politica(archivo, error, sizeof(error));
+    if (!p) { fprintf(stderr, "%s\n", error); return 1; }
+    printf("%d reglas, %zu nodos, compilación %.2f ms\n", p->reglas, p->n_nodos, ahora_ms() - t0);
+    politica_publicar(p);
+
+    // Rutas de prueba: dentro de una raíz a varias profundidades, en un subárbol denegado y fuera de todo
+    char rutas[6][PATH_MAX];
+    const char *nombres[6] = { "raíz, profundidad 2", "raíz, profundidad 8", "raíz, profundidad 16",
+                               "subárbol denegado", "HOME (sin raíz propia)", "fuera de toda raíz" };
+    int r = raices / 2 | 1;
+    snprintf(rutas[0], PATH_MAX, "%s/r%03d/datos/a/b", base, r);
+    snprintf(rutas[1], PATH_MAX, "%s/r%03d/datos/a/b/c/d/e/f/g/h", base, r);
+    snprintf(rutas[2], PATH_MAX, "%s/r%03d/datos/a/b/c/d/e/f/g/h/i/j/k/l/m/n/o/p", base, r);
+    snprintf(rutas[3], PATH_MAX, "%s/r%03d/datos/privado/clave", base, r);
+    snprintf(rutas[4], PATH_MAX, "%.3000s/documentos/informe.txt", sandbox.home_real);
+    snprintf(rutas[5], PATH_MAX, "/var/lib/algo/archivo");
+
+    volatile int sumidero = 0;
+    for (int k = 0; k < 6; k++) {
+        consulta_politica_t c;
+        consultar_politica(p, rutas[k], cat, &c);
+        if (c.acceso != consultar_lineal(lineal, n_lineal, rutas[k], cat)) printf("  DISTINTO en %s\n", rutas[k]);
+
+        t0 = ahora_ms();
+        for (long i = 0; i < iteraciones; i++) sumidero += consultar_lineal(lineal, n_lineal, rutas[k], cat);
+        double ms_lineal = ahora_ms() - t0;
+
+        t0 = ahora_ms();
+        for (long i = 0; i < iteraciones; i++) { consultar_politica(p, rutas[k], cat, &c); sumidero += c.acceso; }
+        double ms_trie = ahora_ms() - t0;
+
+        t0 = ahora_ms();
+        for (long i = 0; i < iteraciones; i++) {
+            char normal[PATH_MAX];
+            politica_t *q = politica_adquirir();
+            normalizar_ruta_absoluta(rutas[k], normal, sizeof(normal));
+            consultar_politica(q, normal, cat, &c);
+            sumidero += c.acceso;
+            politica_soltar(q);
+        }
+        double ms_completa = ahora_ms() - t0;
+        printf("%-24s lineal %8.1f ns  trie %6.1f ns  verificación completa %6.1f ns\n", nombres[k],
+               ms_lineal * 1e6 / iteraciones, ms_trie * 1e6 / iteraciones, ms_completa * 1e6 / iteraciones);
+    }
+
+    unlink(archivo);
+    for (int i = 0; i < raices; i++) {
+        char dir[PATH_MAX + 16];
+        snprintf(dir, sizeof(dir), "%s/r%03d/datos", base, i);
+        rmdir(dir);
+        *strrchr(dir, '/') = '\0';
+        rmdir(dir);
+    }
+    rmdir(base);
+    free(lineal);
+    return sumidero == -1;
+}
@@ -0,0 +1,76 @@
+/*
+ * Micro-benchmark de la resolución del Sandbox.
+ * Compara el camino histórico (realpath + strncmp contra $HOME y luego open por ruta) contra
+ * 'abrir_en_sandbox' (un único openat2 con RESOLVE_BENEATH relativo al descriptor de HOME),
+ * sobre rutas con varios niveles de profundidad.
+ *
+ * Compilación: gcc -O2 -pthread bench/bench_sandbox.c -o bench_sandbox
+ * Uso:         HOME=/ruta/de/prueba ./bench_sandbox [iteraciones] [profundidad]
+ */
+#define FLSH_SIN_MAIN
+#include "../flsh_shell.c"
+
+static double ahora_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+// Réplica del validar_ruta_en_home original seguido del open() que hacía cada builtin.
+static int abrir_realpath(const char *ruta, const char *home) {
+    char resuelta[PATH_MAX];
+    if (realpath(ruta, resuelta) == NULL) return -1;
+    if (strncmp(resuelta, home, strlen(home)) != 0) return SANDBOX_DENEGADO;
+    return open(ruta, O_RDONLY | O_CLOEXEC);
+}
+
+static void reportar(const char *nombre, double ms, long iteraciones) {
+    printf("%-34s %10.2f ms %10.0f ns/apertura\n", nombre, ms, ms * 1e6 / iteraciones);
+}
+
+int main(int argc, char **argv) {
+    long iteraciones = (argc > 1) ? atol(argv[1]) : 200000;
+    int profundidad = (argc > 2) ? atoi(argv[2]) : 6;
+    const char *home = getenv("HOME");
+    if (!home || iniciar_sandbox(home) != 0) { fprintf(stderr, "HOME inaccesible\n"); return 1; }
+    if (chdir(sandbox.home_real) != 0) { perror("chdir"); return 1; }
+    snprintf(sandbox.cwd, sizeof(sandbox.cwd), "%s", sandbox.home_real); // lo que haría 'cd'
+
+    // Árbol bench_sb/d0/d1/.../archivo dentro de HOME
+    char relativa[PATH_MAX] = "bench_sb";
+    mkdir(relativa, 0755);
+    for (int i = 0; i < profundidad; i++) {
+        size_t len = strlen(relativa);
+        snprintf(relativa + len, sizeof(relativa) - len, "/d%d", i);
+        mkdir(relativa, 0755);
+    }
+    strncat(relativa, "/archivo", sizeof(relativa) - strlen(relativa) - 1);
+    int fd = open(relativa, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { perror("archivo"); return 1; }
+    close(fd);
+    char absoluta[PATH_MAX * 2];
+    snprintf(absoluta, sizeof(absoluta), "%s/%s", sandbox.home_real, relativa);
+
+    printf("%s (openat2 %s)\n", absoluta, sandbox.openat2_disponible ? "disponible" : "no disponible");
+    const char *rutas[2] = { relativa, absoluta };
+    const char *tipo[2] = { "relativa", "absoluta" };
+    for (int r = 0; r < 2; r++) {
+        char nombre[64];
+        double t0 = ahora_ms();
+        for (long i = 0; i < iteraciones; i++) {
+            fd = abrir_realpath(rutas[r], sandbox.home_real);
+            if (fd >= 0) close(fd);
+        }
+        snprintf(nombre, sizeof(nombre), "realpath+strncmp+open (%s)", tipo[r]);
+        reportar(nombre, ahora_ms() - t0, iteraciones);
+
+        t0 = ahora_ms();
+        for (long i = 0; i < iteraciones; i++) {
+            fd = abrir_en_sandbox(rutas[r], O_RDONLY, 0, "bench");
+            if (fd >= 0) close(fd);
+        }
+        snprintf(nombre, sizeof(nombre), "abrir_en_sandbox (%s)", tipo[r]);
+        reportar(nombre, ahora_ms() - t0, iteraciones);
+    }
+    return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * Prueba de carga de 'flsh --servidor'.
+ * Arranca el daemon en un proceso hijo ('ejecutar_servidor') y, para cada cantidad de sesiones, conecta
+ * ese número de clientes a la vez. Cada cliente envía como descriptores 0-2 un extremo de un socketpair
+ * y conversa con su sesión por lotes, de a un comando por vez (lazo cerrado):
+ * - Arranque: desde el connect hasta la respuesta al primer comando (fork del daemon, identidad,
+ *   compilación de la política).
+ * - builtin: 'echo ok', que corre dentro del proceso de la sesión.
+ * - externo: 'uname', lanzado por la sesión con posix_spawn/clone.
+ * Por fase reporta comandos por segundo (todas las sesiones) y latencia p50/p99 de cada comando.
+ * Los eventos de todas las sesiones pasan por el escritor compartido del daemon (FLSH_LOG_FLUSH aplica).
+ *
+ * Compilación: gcc -O2 -pthread bench/bench_servidor.c -o bench_servidor
+ * Uso:         HOME=/ruta/de/prueba ./bench_servidor [segundos por fase] [sesiones,sesiones,...]
+ */
+#define FLSH_SIN_MAIN
+#include "../flsh_shell.c"
+#include <poll.h>
+
+typedef struct {
+    int datos, control;
+    double enviado;                    // Instante del comando en curso (ms)
+    size_t usado;
+    char buffer[256];
+} cliente_bench_t;
+
+typedef struct {
+    double *ms;
+    size_t n, cap;
+} latencias_t;
+
+static double ahora_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static void agregar_latencia(latencias_t *l, double ms) {
+    if (l->n == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 4096;
+        l->ms = realloc(l->ms, l->cap * sizeof(double));
+    }
+    l->ms[l->n++] = ms;
+}
+
+static int comparar_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentil_ms(latencias_t *l, double p) {
+    if (l->n == 0) return 0;
+    qsort(l->ms, l->n, sizeof(double), comparar_double);
+    return l->ms[(size_t)(p * (double)(l->n - 1))];
+}
+
+static int conectar_sesion(const struct sockaddr_un *dir, cliente_bench_t *c) {
+    int par[2];
+    c->control = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (c->control < 0 || connect(c->control, (const struct sockaddr *)dir, sizeof(*dir)) != 0) return -1;
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, par) != 0) return -1;
+    int fds[3] = { par[1], par[1], par[1] };
+    if (enviar_mensaje_servidor(c->control, MENSAJE_SOLICITUD, 0, "LOCAL/CONSOLE", NULL, fds, 3) != 0) return -1;
+    close(par[1]);
+    c->datos = par[0];
+    c->usado = 0;
+    return 0;
+}
+
+static void enviar_comando(cliente_bench_t *c, const char *comando) {
+    c->enviado = ahora_ms();
+    if (write(c->datos, comando, strlen(comando)) < 0) perror("write");
+}
+
+// Lee lo disponible; retorna 1 si completó una línea de respuesta
+static int leer_respuesta(cliente_bench_t *c) {
+    ssize_t n = read(c->datos, c->buffer + c->usado, sizeof(c->buffer) - c->usado);
+    if (n <= 0) return n < 0 && errno == EAGAIN ? 0 : -1;
+    c->usado += (size_t)n;
+    char *nl = memchr(c->buffer, '\n', c->usado);
+    if (!nl) { if (c->usado == sizeof(c->buffer)) c->usado = 0; return 0; }
+    size_t resto = c->usado - (size_t)(nl + 1 - c->buffer);
+    memmove(c->buffer, nl + 1, resto);
+    c->usado = resto;
+    return 1;
+}
+
+/*
+ * Lazo cerrado durante 'segundos' (o hasta que cada sesión respondió una vez, con 'segundos' 0):
+ * cada respuesta registra su latencia y dispara el comando siguiente de esa sesión.
+ */
+static long correr_fase(int ep, cliente_bench_t *c, int n, const char *comando, double segundos, latencias_t *l) {
+    long completados = 0;
+    int pendientes = n;
+    for (int i = 0; i < n; i++) if (segundos > 0) enviar_comando(&c[i], comando);
+    double fin = ahora_ms() + segundos * 1e3;
+    struct epoll_event ev[256];
+    while (segundos > 0 ? ahora_ms() < fin : pendientes > 0) {
+        int k = epoll_wait(ep, ev, 256, 100);
+        for (int j = 0; j < k; j++) {
+            cliente_bench_t *x = &c[ev[j].data.u32];
+            int r;
+            while ((r = leer_respuesta(x)) == 1) {
+                agregar_latencia(l, ahora_ms() - x->enviado);
+                completados++;
+                if (segundos > 0) enviar_comando(x, comando);
+                else pendientes--;
+            }
+            if (r < 0) { fprintf(stderr, "sesión %u cerrada\n", ev[j].data.u32); epoll_ctl(ep, EPOLL_CTL_DEL, x->datos, NULL); pendientes--; }
+        }
+    }
+    // Respuestas en vuelo de la fase: se descartan antes de la siguiente
+    for (int i = 0; i < n && segundos > 0; i++) {
+        while (leer_respuesta(&c[i]) == 0) {
+            struct pollfd p = { .fd = c[i].datos, .events = POLLIN };
+            if (poll(&p, 1, 1000) <= 0) break;
+        }
+    }
+    return completados;
+}
+
+int main(int argc, char **argv) {
+    double segundos = (argc > 1) ? atof(argv[1]) : 3;
+    const char *lista = (argc > 2) ? argv[2] : "1,100,1000";
+    int maximo = 1;
+    char copia[256];
+    snprintf(copia, sizeof(copia), "%s", lista);
+    for (char *s = strtok(copia, ","); s; s = strtok(NULL, ",")) if (atoi(s) > maximo) maximo = atoi(s);
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) { rl.rlim_cur = rl.rlim_max; setrlimit(RLIMIT_NOFILE, &rl); }
+    if ((rlim_t)maximo * 2 + 64 > rl.rlim_cur) { fprintf(stderr, "RLIMIT_NOFILE insuficiente para %d sesiones\n", maximo); return 1; }
+
+    char ruta[64];
+    snprintf(ruta, sizeof(ruta), "/tmp/flsh_bench_%d.sock", (int)getpid());
+    char max_env[16];
+    snprintf(max_env, sizeof(max_env), "%d", maximo);
+    setenv("FLSH_SERVIDOR_MAX", max_env, 1);
+    pid_t daemon = fork();
+    if (daemon == 0) exit(ejecutar_servidor(ruta));
+    struct sockaddr_un dir;
+    direccion_servidor(ruta, &dir);
+    for (int i = 0; i < 100 && access(ruta, F_OK) != 0; i++) usleep(10000);
+
+    printf("%-9s %-22s %-34s %-34s\n", "sesiones", "arranque p50/p99", "builtin (echo)", "externo (uname)");
+    cliente_bench_t *c = calloc((size_t)maximo, sizeof(*c));
+    snprintf(copia, sizeof(copia), "%s", lista);
+    for (char *s = strtok(copia, ","); s; s = strtok(NULL, ",")) {
+        int n = atoi(s);
+        if (n <= 0) continue;
+        int ep = epoll_create1(EPOLL_CLOEXEC);
+        latencias_t arranque = { 0 }, builtin = { 0 }, externo = { 0 };
+
+        // Arranque: todas las sesiones a la vez; la latencia va del connect a la primera respuesta
+        for (int i = 0; i < n; i++) {
+            double t0 = ahora_ms();
+            if (conectar_sesion(&dir, &c[i]) != 0) { perror("sesión"); return 1; }
+            fcntl(c[i].datos, F_SETFL, O_NONBLOCK);
+            struct epoll_event ev = { .events = EPOLLIN, .data.u32 = (uint32_t)i };
+            epoll_ctl(ep, EPOLL_CTL_ADD, c[i].datos, &ev);
+            enviar_comando(&c[i], "echo listo\n");
+            c[i].enviado = t0;
+        }
+        correr_fase(ep, c, n, NULL, 0, &arranque);
+
+        double t0 = ahora_ms();
+        long nb = correr_fase(ep, c, n, "echo ok\n", segundos, &builtin);
+        double ms_b = ahora_ms() - t0;
+        t0 = ahora_ms();
+        long ne = correr_fase(ep, c, n, "uname\n", segundos, &externo);
+        double ms_e = ahora_ms() - t0;
+
+        // Cierre: EOF en stdin, la sesión termina y el daemon responde FIN
+        for (int i = 0; i < n; i++) { shutdown(c[i].datos, SHUT_WR); close(c[i].datos); }
+        for (int i = 0; i < n; i++) {
+            mensaje_servidor_t m;
+            if (recv(c[i].control, &m, sizeof(m), 0) <= 0 || m.tipo != MENSAJE_FIN || m.valor != 0) fprintf(stderr, "sesión %d: sin FIN limpio\n", i);
+            close(c[i].control);
+        }
+        close(ep);
+
+        char a[32], b[48], e[48];
+        snprintf(a, sizeof(a), "%.2f / %.2f ms", percentil_ms(&arranque, 0.5), percentil_ms(&arranque, 0.99));
+        snprintf(b, sizeof(b), "%7.0f cmd/s %6.0f/%6.0f us", nb / (ms_b / 1e3), percentil_ms(&builtin, 0.5) * 1e3, percentil_ms(&builtin, 0.99) * 1e3);
+        snprintf(e, sizeof(e), "%7.0f cmd/s %6.0f/%6.0f us", ne / (ms_e / 1e3), percentil_ms(&externo, 0.5) * 1e3, percentil_ms(&externo, 0.99) * 1e3);
+        printf("%-9d %-22s %-34s %-34s\n", n, a, b, e);
+        fflush(stdout);
+        free(arranque.ms); free(builtin.ms); free(externo.ms);
+    }
+    kill(daemon, SIGTERM);
+    waitpid(daemon, NULL, 0);
+    free(c);
+    return 0;
+}
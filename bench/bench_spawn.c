@@ -0,0 +1,60 @@
+/*
+ * Micro-benchmark de latencia de creación de procesos.
+ * Lanza y espera N veces un comando corto (por defecto 'true') con:
+ * - fork() + execvp() (camino original: copia de tablas de páginas + búsqueda de PATH por execve fallidos)
+ * - posix_spawnp() (sin tabla de rutas)
+ * - lanzar_proceso() del shell (tabla de rutas + posix_spawn, o clone(CLONE_VFORK) si FLSH_LANDLOCK=1)
+ * Para simular un shell con más memoria residente, se reservan y tocan [MB] megabytes antes de medir.
+ *
+ * Compilación: gcc -O2 -pthread bench/bench_spawn.c -o bench_spawn
+ * Uso:         ./bench_spawn [iteraciones] [MB] [comando]
+ */
+#define FLSH_SIN_MAIN
+#include "../flsh_shell.c"
+
+static double ahora_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static void reportar(const char *nombre, double ms, long iteraciones) {
+    printf("%-30s %10.2f ms %10.1f us/proceso\n", nombre, ms, ms * 1e3 / iteraciones);
+}
+
+int main(int argc, char **argv) {
+    long iteraciones = (argc > 1) ? atol(argv[1]) : 2000;
+    size_t mb = (argc > 2) ? (size_t)atol(argv[2]) : 256;
+    char *args[] = { (argc > 3) ? argv[3] : "true", NULL };
+
+    char *lastre = malloc(mb << 20);
+    if (lastre) memset(lastre, 1, mb << 20); // Páginas residentes que fork() debe mapear en el hijo
+    const char *home = getenv("HOME");
+    if (home && iniciar_sandbox(home) == 0) iniciar_landlock();
+    printf("%s x %ld, %zu MB residentes%s\n", args[0], iteraciones, mb, landlock.ruleset_fd >= 0 ? ", Landlock activo" : "");
+
+    double t0 = ahora_ms();
+    for (long i = 0; i < iteraciones; i++) {
+        pid_t pid = fork();
+        if (pid == 0) { execvp(args[0], args); _exit(127); }
+        waitpid(pid, NULL, 0);
+    }
+    reportar("fork+execvp (original)", ahora_ms() - t0, iteraciones);
+
+    t0 = ahora_ms();
+    for (long i = 0; i < iteraciones; i++) {
+        pid_t pid;
+        if (posix_spawnp(&pid, args[0], NULL, NULL, args, environ) == 0) waitpid(pid, NULL, 0);
+    }
+    reportar("posix_spawnp", ahora_ms() - t0, iteraciones);
+
+    t0 = ahora_ms();
+    for (long i = 0; i < iteraciones; i++) {
+        pid_t pid = lanzar_proceso(args, descriptores_estandar, -1);
+        if (pid > 0) waitpid(pid, NULL, 0);
+    }
+    reportar("lanzar_proceso (flsh)", ahora_ms() - t0, iteraciones);
+
+    free(lastre);
+    return 0;
+}
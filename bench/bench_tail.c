@@ -0,0 +1,140 @@
+/*
+ * Benchmark de head/tail y del conteo de saltos de línea.
+ * Genera $HOME/bench_tail.dat de [MB] megabytes de texto (page cache caliente) y mide:
+ * - Conteo de '\n' sobre el archivo mapeado: escalar, SSE2 y AVX2 (si la CPU lo soporta).
+ * - tail -n N con N = 10, 10000 y 1000000: 'ejecutar_tail' (lectura hacia atrás) contra el mismo
+ *   archivo leído como flujo ('cat archivo | tail', ventana de las últimas N líneas) y contra tail(1).
+ * - head -n 10: 'ejecutar_head' contra head(1).
+ * La salida de todos va a /dev/null; los externos se miden con fork + exec + wait.
+ *
+ * Compilación: gcc -O2 -pthread bench/bench_tail.c -o bench_tail
+ * Uso:         HOME=/ruta/de/prueba ./bench_tail [MB] [repeticiones]
+ */
+#define FLSH_SIN_MAIN
+#include "../flsh_shell.c"
+
+static double ahora_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+// Corre un built-in con stdout en 'nulo' (y stdin en 'entrada' si no es -1); retorna el tiempo en ms
+static double medir_builtin(void (*f)(char **), char **args, int nulo, int entrada) {
+    int salida = dup(STDOUT_FILENO), stdin_previo = dup(STDIN_FILENO);
+    dup2(nulo, STDOUT_FILENO);
+    if (entrada >= 0) dup2(entrada, STDIN_FILENO);
+    salida_configurar();
+    double t0 = ahora_ms();
+    f(args);
+    salida_volcar();
+    double ms = ahora_ms() - t0;
+    dup2(salida, STDOUT_FILENO);
+    dup2(stdin_previo, STDIN_FILENO);
+    close(salida);
+    close(stdin_previo);
+    return ms;
+}
+
+static double medir_externo(char **args, int nulo) {
+    double t0 = ahora_ms();
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(nulo, STDOUT_FILENO);
+        execvp(args[0], args);
+        _exit(127);
+    }
+    waitpid(pid, NULL, 0);
+    return ahora_ms() - t0;
+}
+
+int main(int argc, char **argv) {
+    long mb = (argc > 1) ? atol(argv[1]) : 1024;
+    int repeticiones = (argc > 2) ? atoi(argv[2]) : 3;
+    const char *home = getenv("HOME");
+    if (!home || iniciar_sandbox(home) != 0) { fprintf(stderr, "HOME inaccesible\n"); return 1; }
+    if (chdir(sandbox.home_real) != 0) { perror("chdir"); return 1; }
+    snprintf(sandbox.cwd, sizeof(sandbox.cwd), "%s", sandbox.home_real);
+    logger.omitir_info = 1;
+
+    const char *origen = "bench_tail.dat";
+    FILE *f = fopen(origen, "w");
+    if (!f) { perror(origen); return 1; }
+    char linea[128];
+    for (long i = 0; ftell(f) < mb * 1048576; i++) {
+        int n = snprintf(linea, sizeof(linea), "%08ld registro de prueba para head y tail %ld\n", i, i * 7919);
+        fwrite(linea, 1, (size_t)n, f);
+    }
+    fclose(f);
+    int fd = open(origen, O_RDONLY), nulo = open("/dev/null", O_WRONLY);
+    struct stat st;
+    fstat(fd, &st);
+    const char *datos = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (datos == MAP_FAILED) { perror("mmap"); return 1; }
+    double mbs = st.st_size / 1048576.0;
+    printf("%s: %.0f MB\n", origen, mbs);
+
+    long long (*contadores[])(const char *, const char *) = { contar_saltos_escalar, contar_saltos_sse2, contar_saltos_avx2 };
+    const char *nombres[] = { "escalar", "SSE2", "AVX2" };
+    __builtin_cpu_init();
+    for (int k = 0; k < 3; k++) {
+        if (k == 2 && !__builtin_cpu_supports("avx2")) break;
+        double mejor = 1e18;
+        long long saltos = 0;
+        for (int r = 0; r < repeticiones; r++) {
+            double t0 = ahora_ms();
+            saltos = contadores[k](datos, datos + st.st_size);
+            double ms = ahora_ms() - t0;
+            if (ms < mejor) mejor = ms;
+        }
+        printf("contar '\\n' %-8s %9.1f ms %8.1f MB/s (%lld líneas)\n", nombres[k], mejor, mbs / (mejor / 1e3), saltos);
+    }
+
+    const char *cantidades[] = { "10", "10000", "1000000" };
+    printf("%-12s %14s %14s %14s\n", "tail -n", "built-in", "flujo (pipe)", "tail(1)");
+    for (int k = 0; k < 3; k++) {
+        char *args[] = { "tail", "-n", (char *)cantidades[k], (char *)origen, NULL };
+        char *args_flujo[] = { "tail", "-n", (char *)cantidades[k], NULL };
+        double mejor[3] = { 1e18, 1e18, 1e18 };
+        for (int r = 0; r < repeticiones; r++) {
+            double ms = medir_builtin(ejecutar_tail, args, nulo, -1);
+            if (ms < mejor[0]) mejor[0] = ms;
+            // Flujo: la ventana final se alimenta desde un pipe, como en 'cat archivo | tail'
+            int canal[2];
+            if (pipe(canal) != 0) { perror("pipe"); return 1; }
+            pid_t escritor = fork();
+            if (escritor == 0) {
+                close(canal[0]);
+                for (off_t p = 0; p < st.st_size;) {
+                    ssize_t n = write(canal[1], datos + p, (size_t)(st.st_size - p) < (1 << 16) ? (size_t)(st.st_size - p) : (1 << 16));
+                    if (n <= 0) _exit(1);
+                    p += n;
+                }
+                _exit(0);
+            }
+            close(canal[1]);
+            ms = medir_builtin(ejecutar_tail, args_flujo, nulo, canal[0]);
+            close(canal[0]);
+            waitpid(escritor, NULL, 0);
+            if (ms < mejor[1]) mejor[1] = ms;
+            ms = medir_externo(args, nulo);
+            if (ms < mejor[2]) mejor[2] = ms;
+        }
+        printf("%-12s %11.3f ms %11.1f ms %11.3f ms\n", cantidades[k], mejor[0], mejor[1], mejor[2]);
+    }
+
+    char *args_head[] = { "head", "-n", "10", (char *)origen, NULL };
+    double mejor[2] = { 1e18, 1e18 };
+    for (int r = 0; r < repeticiones; r++) {
+        double ms = medir_builtin(ejecutar_head, args_head, nulo, -1);
+        if (ms < mejor[0]) mejor[0] = ms;
+        ms = medir_externo(args_head, nulo);
+        if (ms < mejor[1]) mejor[1] = ms;
+    }
+    printf("%-12s %11.3f ms %14s %11.3f ms\n", "head -n 10", mejor[0], "", mejor[1]);
+
+    munmap((void *)datos, (size_t)st.st_size);
+    close(fd);
+    unlink(origen);
+    return 0;
+}
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Compara dos resultados de bench/suite.sh caso por caso. La variación se expresa como mejora (+) o
+# empeoramiento (-): en 'us' y 'ms' menos es mejor, en 'MB/s' más es mejor. Marca REGRESIÓN lo que
+# empeora más que el umbral (por defecto 5%); los casos por debajo de 1 us solo se informan.
+# Termina con estado 1 si hubo alguna regresión.
+#
+# Uso: sh bench/comparar.sh antes.json despues.json [umbral %]
+[ $# -ge 2 ] || { echo "uso: $0 antes.json despues.json [umbral %]" >&2; exit 2; }
+awk -v umbral="${3:-5}" '
+    FNR == 1 { archivo++ }
+    # Una línea de resultado: {"caso": "x", "valor": 1.234, "unidad": "us"},
+    /"caso":/ {
+        split($0, c, "\"")
+        caso = c[4]; unidad = c[10]
+        valor = $0; sub(/.*"valor": */, "", valor); sub(/,.*/, "", valor)
+        if (archivo == 1) { antes[caso] = valor + 0; orden[n++] = caso }
+        else { despues[caso] = valor + 0; unidades[caso] = unidad }
+    }
+    END {
+        printf "%-32s %12s %12s %9s\n", "caso", "antes", "despues", "cambio"
+        regresiones = 0
+        for (i = 0; i < n; i++) {
+            caso = orden[i]
+            if (!(caso in despues)) { printf "%-32s %12.2f %12s\n", caso, antes[caso], "-"; continue }
+            a = antes[caso]; d = despues[caso]; u = unidades[caso]
+            cambio = (a == 0) ? 0 : (u == "MB/s" ? (d - a) / a : (a - d) / a) * 100
+            marca = ""
+            if (cambio < -umbral && !(u == "us" && a < 1 && d < 1)) { marca = "  REGRESION"; regresiones++ }
+            printf "%-32s %12.2f %12.2f %+8.1f%%%s\n", caso, a, d, cambio, marca
+        }
+        exit (regresiones > 0)
+    }
+' "$1" "$2"
@@ -0,0 +1,26 @@
+# Datos de prueba compartidos por bench/suite.sh y bench/entrenamiento.sh (se incluye con '.').
+
+# generar_texto ARCHIVO KB: líneas tipo log (una de cada 50 con "error") hasta KB kilobytes
+generar_texto() {
+    awk -v kb="$2" 'BEGIN {
+        srand(7); total = kb * 1024
+        for (i = 0; n < total; i++) {
+            l = sprintf("%08d %s registro de prueba modulo_%d valor=%d", i, (i % 50 == 0) ? "error" : "info", i % 97, int(rand() * 100000))
+            if (n + length(l) + 1 > total) l = substr(l, 1, total - n - 1)
+            print l; n += length(l) + 1
+        }
+    }' > "$1"
+}
+
+# generar_arbol DIRECTORIO DIRS ARCHIVOS: DIRS subdirectorios con ARCHIVOS fuentes chicos cada uno
+generar_arbol() {
+    awk -v raiz="$1" -v dirs="$2" -v archivos="$3" 'BEGIN {
+        for (d = 0; d < dirs; d++) {
+            dir = sprintf("%s/d%02d", raiz, d); system("mkdir -p " dir)
+            for (f = 0; f < archivos; f++) {
+                ruta = sprintf("%s/f%02d.%s", dir, f, (f % 2) ? "c" : "h")
+                printf "#include <stdio.h>\nint main(void) { return %d; }\n", f > ruta; close(ruta)
+            }
+        }
+    }'
+}
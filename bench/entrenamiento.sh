@@ -0,0 +1,26 @@
+#!/bin/sh
+# Entrenamiento de PGO ('make pgo'): corre el script de comandos por lotes con el binario instrumentado
+# en un HOME temporal con datos de prueba (texto de 1 KB, 1 MB y 16 MB y un árbol de fuentes).
+# El script pasa tres veces con el log de texto y una con el log binario.
+#
+# Uso: sh bench/entrenamiento.sh [flsh] [script]
+FLSH=${1:-./flsh}
+SCRIPT=${2:-bench/entrenamiento.flsh}
+. "$(dirname "$0")/datos.sh"
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/flsh_pgo.XXXXXX")
+trap 'rm -rf "$DIR"' EXIT
+
+generar_texto "$DIR/texto_1k" 1
+generar_texto "$DIR/texto_1m" 1024
+generar_texto "$DIR/texto_16m" 16384
+generar_arbol "$DIR/arbol" 20 50
+
+# El shell arranca en el directorio actual: se corre dentro del HOME temporal (rutas absolutas)
+FLSH=$(cd "$(dirname "$FLSH")" && pwd)/$(basename "$FLSH")
+SCRIPT=$(cd "$(dirname "$SCRIPT")" && pwd)/$(basename "$SCRIPT")
+cd "$DIR" || exit 1
+for pasada in 1 2 3; do
+    HOME="$DIR" "$FLSH" < "$SCRIPT" > /dev/null 2>&1
+done
+HOME="$DIR" FLSH_LOG_FORMATO=binario "$FLSH" < "$SCRIPT" > /dev/null 2>&1
+echo "entrenamiento: $SCRIPT x4 con $FLSH"
@@ -0,0 +1,155 @@
+#!/bin/sh
+# Suite de benchmarks de flsh: maneja el binario por lotes (script por stdin) en un HOME temporal y
+# escribe los resultados en JSON para comparar entre commits (bench/comparar.sh).
+# Cada caso se corre R veces y se queda el mejor tiempo; el arranque del shell se descuenta.
+# - builtin.<caso>: latencia por comando (us) de N líneas iguales (echo, pwd, cd, ls, cat, grep, ...).
+# - externo.<modo>: latencia de lanzar 'true' (N/10 veces) con posix_spawn/clone y con FLSH_SPAWN=fork.
+# - log.<política>: costo por comando de 'echo' con cada volcado del log y con el formato binario;
+#   log.<política>.sobrecosto es la diferencia contra el volcado al salir (el mínimo de escrituras).
+# - cat/grep/cp.<tamaño>: throughput (MB/s) sobre archivos de texto de cada tamaño de TAMANOS (KB).
+# Cada resultado es una línea {"caso": ..., "valor": ..., "unidad": ...} dentro de "resultados".
+#
+# Uso: sh bench/suite.sh [flsh] [resultados.json]
+# Variables: N (comandos por caso, 20000), R (repeticiones, 5), TAMANOS (KB, "4 1024 65536")
+FLSH=${1:-./flsh}
+SALIDA=${2:-resultados.json}
+N=${N:-20000}
+R=${R:-5}
+TAMANOS=${TAMANOS:-"4 1024 65536"}
+. "$(dirname "$0")/datos.sh"
+REPO=$(cd "$(dirname "$0")/.." && pwd)
+FLSH=$(cd "$(dirname "$FLSH")" && pwd)/$(basename "$FLSH")
+case $SALIDA in /*) ;; *) SALIDA=$(pwd)/$SALIDA ;; esac
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/flsh_suite.XXXXXX")
+trap 'rm -rf "$DIR"' EXIT
+# El shell arranca en el directorio actual: se corre dentro del HOME temporal
+cd "$DIR" || exit 1
+mkdir scripts
+RESULTADOS=$DIR/scripts/resultados
+
+ahora() { date +%s.%N; }
+
+# correr SCRIPT [VAR=valor...]: segundos de una ejecución por lotes
+correr() {
+    script=$1; shift
+    t0=$(ahora)
+    env HOME="$DIR" "$@" "$FLSH" < "$script" > /dev/null 2>&1
+    t1=$(ahora)
+    awk -v a="$t0" -v b="$t1" 'BEGIN { printf "%.6f", b - a }'
+}
+
+# mejor SCRIPT [VAR=valor...]: el menor de R tiempos (LIMPIAR, si está definido, corre antes de cada uno)
+mejor() {
+    m=""
+    i=0
+    while [ "$i" -lt "$R" ]; do
+        [ -n "$LIMPIAR" ] && eval "$LIMPIAR"
+        s=$(correr "$@")
+        m=$(awk -v m="$m" -v s="$s" 'BEGIN { print ((m == "" || s < m) ? s : m) }')
+        i=$((i + 1))
+    done
+    echo "$m"
+}
+
+# repetir CANTIDAD LÍNEA: script con la línea repetida (%d se reemplaza por el número de línea)
+repetir() {
+    archivo=$DIR/scripts/$(echo "$2" | tr -c 'a-zA-Z0-9\n' '_')
+    awk -v n="$1" -v l="$2" 'BEGIN { for (i = 0; i < n; i++) { s = l; gsub("%d", i, s); print s } }' > "$archivo"
+    echo "$archivo"
+}
+
+# resultado CASO VALOR UNIDAD: lo muestra y lo agrega al JSON
+resultado() {
+    printf '%-32s %12.2f %s\n' "$1" "$2" "$3"
+    printf '    {"caso": "%s", "valor": %.3f, "unidad": "%s"},\n' "$1" "$2" "$3" >> "$RESULTADOS"
+}
+
+# por_comando CASO SEGUNDOS CANTIDAD: latencia por comando en us, descontado el arranque
+por_comando() {
+    resultado "$1" "$(awk -v t="$2" -v a="$ARRANQUE" -v n="$3" 'BEGIN { v = (t - a) / n * 1e6; print (v < 0 ? 0 : v) }')" us
+}
+
+# Datos: un directorio chico para ls y archivos de texto por tamaño
+mkdir chico
+generar_arbol chico 1 20
+generar_texto chico/texto 1
+for kb in $TAMANOS; do generar_texto "texto_$kb" "$kb"; done
+: > "$DIR/scripts/vacio"
+: > "$RESULTADOS"
+
+echo "flsh: $FLSH (N=$N, R=$R)"
+ARRANQUE=$(mejor "$DIR/scripts/vacio")
+resultado arranque "$(awk -v a="$ARRANQUE" 'BEGIN { print a * 1e3 }')" ms
+
+# Built-ins: mismo comando N veces (los datos ya están en la page cache)
+while IFS='|' read -r caso linea; do
+    por_comando "builtin.$caso" "$(mejor "$(repetir "$N" "$linea")")" "$N"
+done <<EOF
+comentario|# solo el parser
+echo|echo hola mundo
+pwd|pwd
+cd|cd .
+hash|hash
+ls|ls chico/d00
+cat|cat chico/texto
+head|head -n 5 chico/texto
+tail|tail -n 5 chico/texto
+grep|grep error chico/texto
+mkdir|mkdir -p chico/d00
+comodines|echo chico/d00/*.c
+tuberia|echo hola | grep hola
+EOF
+
+# Externos: el lanzador por defecto (posix_spawn/clone) y el fork clásico
+EXTERNOS=$((N / 10))
+script=$(repetir "$EXTERNOS" "true")
+por_comando externo.spawn "$(mejor "$script")" "$EXTERNOS"
+por_comando externo.fork "$(mejor "$script" FLSH_SPAWN=fork)" "$EXTERNOS"
+
+# Log: cada política de volcado (y el formato binario) contra el volcado al salir
+script=$(repetir "$N" "echo hola")
+BASE_LOG=$(mejor "$script" FLSH_LOG_FLUSH=salida)
+por_comando log.salida "$BASE_LOG" "$N"
+for politica in intervalo:200 n:64 evento binario; do
+    if [ "$politica" = binario ]; then t=$(mejor "$script" FLSH_LOG_FORMATO=binario)
+    else t=$(mejor "$script" FLSH_LOG_FLUSH=$politica); fi
+    nombre=$(echo "$politica" | cut -d: -f1)
+    por_comando "log.$nombre" "$t" "$N"
+    resultado "log.$nombre.sobrecosto" "$(awk -v t="$t" -v b="$BASE_LOG" -v n="$N" 'BEGIN { print (t - b) / n * 1e6 }')" us
+done
+
+# Throughput: cada operación sobre ~256 MB por corrida (entre 3 y 2000 operaciones)
+for kb in $TAMANOS; do
+    ops=$((262144 / kb))
+    [ "$ops" -lt 3 ] && ops=3
+    [ "$ops" -gt 2000 ] && ops=2000
+    mb=$(awk -v k="$kb" -v o="$ops" 'BEGIN { print k * o / 1024 }')
+    for op in cat grep cp; do
+        case $op in
+            cat) script=$(repetir "$ops" "cat texto_$kb"); LIMPIAR="" ;;
+            grep) script=$(repetir "$ops" "grep -c zzz_sin_coincidencias texto_$kb"); LIMPIAR="" ;;
+            cp) script=$(repetir "$ops" "cp texto_$kb copia_%d"); LIMPIAR='rm -f "$DIR"/copia_*' ;;
+        esac
+        t=$(mejor "$script")
+        resultado "$op.${kb}k" "$(awk -v t="$t" -v a="$ARRANQUE" -v mb="$mb" 'BEGIN { d = t - a; print (d > 0 ? mb / d : 0) }')" MB/s
+    done
+    LIMPIAR=""
+    rm -f "$DIR"/copia_*
+done
+
+commit=$(git -C "$REPO" rev-parse --short HEAD 2>/dev/null || echo desconocido)
+{
+    echo "{"
+    echo "  \"flsh\": \"$FLSH\","
+    echo "  \"commit\": \"$commit\","
+    echo "  \"fecha\": \"$(date -u +%Y-%m-%dT%H:%M:%SZ)\","
+    echo "  \"maquina\": \"$(uname -srm)\","
+    echo "  \"cpus\": $(nproc 2>/dev/null || echo 1),"
+    echo "  \"n\": $N,"
+    echo "  \"repeticiones\": $R,"
+    echo "  \"resultados\": ["
+    sed '$ s/,$//' "$RESULTADOS"
+    echo "  ]"
+    echo "}"
+} > "$SALIDA"
+echo "resultados: $SALIDA"
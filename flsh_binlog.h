@@ -0,0 +1,107 @@
+/*
+ * Formato binario del registro de auditoría de flsh (FLSH_LOG_FORMATO=binario).
+ * Lo incluyen el shell (escritor) y tools/flsh_logdump.c (lector, que lo vuelve al formato de texto).
+ *
+ * Un segmento es un archivo 'shell-NNNNNN.flsl' reservado de antemano y mapeado en memoria:
+ *   [cabecera_segmento_t][registro][registro]...[ceros]
+ * Cada registro es un registro_binlog_t, seguido de perf_evento_t si lleva BINLOG_CON_PERF, y luego
+ * el comando y el mensaje (sin '\0'). Todo registro ocupa un múltiplo de 8 bytes. Un 'largo' 0 marca
+ * el fin de los datos (segmento todavía abierto, o cortado por una caída del shell).
+ * Los enteros se guardan en el orden de bytes de la máquina que escribe.
+ * El escritor compartido de 'flsh --servidor' registra sesiones de muchos usuarios en el mismo segmento:
+ * su cabecera lleva el usuario BINLOG_MULTIUSUARIO y el nombre de cada registro sale de su 'uid'.
+ */
+#ifndef FLSH_BINLOG_H
+#define FLSH_BINLOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pwd.h>
+
+#define BINLOG_MAGICO "FLSHLOG1"
+#define BINLOG_VERSION 1
+#define BINLOG_ALINEACION 8
+#define BINLOG_CON_PERF 0x01
+#define BINLOG_MULTIUSUARIO "*"
+
+// Los archivos 'shell.log'/'sistema_error.log' del formato de texto son el nivel de cada registro
+typedef enum { BINLOG_INFO, BINLOG_WARNING, BINLOG_ERROR, BINLOG_CRITICAL } nivel_binlog_t;
+static const char *const nombres_nivel_binlog[] = { "INFO", "WARNING", "ERROR", "CRITICAL" };
+
+typedef struct {
+    char magico[8];
+    uint32_t version;
+    uint32_t tam_cabecera;
+    uint32_t secuencia;
+    uint32_t pid;             // Proceso que escribe el segmento
+    uint64_t tam_segmento;
+    uint64_t base_real_ns;    // CLOCK_REALTIME y CLOCK_MONOTONIC tomados juntos al crear el segmento:
+    uint64_t base_mono_ns;    // fecha de un registro = base_real_ns + (instante_ns - base_mono_ns)
+    uint64_t usado;           // Bytes válidos; definitivo cuando 'cerrado' es 1
+    uint32_t cerrado;
+    uint32_t uid;
+    char usuario[64];
+    char origen[64];          // Texto del origen (IPv6, 'LOCAL/CONSOLE') cuando 'ip' del registro es 0
+} cabecera_segmento_t;
+
+typedef struct {
+    uint32_t largo;           // Bytes totales del registro, con relleno; se escribe al final
+    uint8_t nivel;            // nivel_binlog_t
+    uint8_t banderas;         // BINLOG_CON_PERF
+    uint16_t largo_cmd;
+    uint16_t largo_msg;
+    uint16_t reservado;
+    uint32_t uid;
+    uint32_t ip;              // IPv4 en orden de red; 0 = ver 'origen' en la cabecera
+    uint32_t relleno;
+    uint64_t instante_ns;     // CLOCK_MONOTONIC
+} registro_binlog_t;
+
+/*
+ * Nombre del usuario de un registro: el de la cabecera, o el del 'uid' del registro si el segmento es
+ * multiusuario (con una entrada de caché: los registros de una sesión vienen seguidos).
+ */
+static inline const char *usuario_de_registro(const cabecera_segmento_t *c, const registro_binlog_t *r) {
+    static __thread uint32_t uid_cache = UINT32_MAX;
+    static __thread char nombre_cache[64];
+    if (strncmp(c->usuario, BINLOG_MULTIUSUARIO, sizeof(c->usuario)) != 0) return c->usuario;
+    if (r->uid != uid_cache) {
+        struct passwd pw, *resultado = NULL;
+        char buffer[1024];
+        if (getpwuid_r(r->uid, &pw, buffer, sizeof(buffer), &resultado) == 0 && resultado)
+            snprintf(nombre_cache, sizeof(nombre_cache), "%s", pw.pw_name);
+        else snprintf(nombre_cache, sizeof(nombre_cache), "%u", r->uid);
+        uid_cache = r->uid;
+    }
+    return nombre_cache;
+}
+
+// Métricas de un comando (ver 'telemetria_cerrar' en el shell)
+typedef struct {
+    uint64_t ns, usuario_us, sistema_us;
+    uint64_t leidos, escritos;
+    int64_t rss_kb;
+    uint32_t presente;
+    uint32_t con_hijos;
+} perf_evento_t;
+
+/*
+ * Sufijo " | PERF:..." del formato de texto. Lo usan el logger de texto y flsh-logdump, para que la
+ * conversión de un segmento sea idéntica a lo que el shell habría escrito en 'shell.log'.
+ */
+static inline void formatear_perf(char *destino, size_t tam, const perf_evento_t *p) {
+    destino[0] = '\0';
+    if (!p->presente) return;
+    uint64_t us = p->ns / 1000;
+    int k = snprintf(destino, tam, " | PERF:t=%llu.%03llums usr=%llu.%03llums sys=%llu.%03llums",
+                     (unsigned long long)(us / 1000), (unsigned long long)(us % 1000),
+                     (unsigned long long)(p->usuario_us / 1000), (unsigned long long)(p->usuario_us % 1000),
+                     (unsigned long long)(p->sistema_us / 1000), (unsigned long long)(p->sistema_us % 1000));
+    if (p->con_hijos && k > 0 && (size_t)k < tam)
+        k += snprintf(destino + k, tam - k, " rss=%lldKB", (long long)p->rss_kb);
+    if ((p->leidos || p->escritos) && k > 0 && (size_t)k < tam)
+        snprintf(destino + k, tam - k, " in=%lluB out=%lluB", (unsigned long long)p->leidos, (unsigned long long)p->escritos);
+}
+
+#endif
@@ -0,0 +1,32 @@
+/*
+ * Tipos del registro de comandos internos de flsh (ver flsh_builtins.def).
+ * Lo incluyen el shell y el generador de la tabla de hash perfecto (tools/gen_hash_builtins.c),
+ * que deben usar exactamente la misma función de hash.
+ */
+#ifndef FLSH_BUILTINS_H
+#define FLSH_BUILTINS_H
+
+#include <stdint.h>
+
+// Relación del built-in con el Sandbox
+typedef enum {
+    SB_LIBRE,   // No abre rutas de usuario
+    SB_RUTAS    // Resuelve sus argumentos bajo HOME (openat2); en un hijo además se encierra con Landlock
+} politica_sandbox_t;
+
+typedef struct {
+    const char *nombre;
+    void (*manejador)(char **args);   // args[0] es el nombre; el estado queda en 'estado_builtin'
+    int min_args, max_args;           // Sin contar el nombre; max_args -1 = sin límite
+    politica_sandbox_t politica;
+    const char *nivel_log;            // Nivel del evento "Exito" del despachador (NULL = lo registra el built-in)
+} builtin_t;
+
+// FNV-1a de 32 bits con semilla y mezcla final de los bits altos (la tabla usa los bits bajos)
+static inline uint32_t hash_builtin(const char *nombre, uint32_t semilla) {
+    uint32_t h = 2166136261u ^ semilla;
+    for (; *nombre; nombre++) { h ^= (unsigned char)*nombre; h *= 16777619u; }
+    return h ^ (h >> 15);
+}
+
+#endif
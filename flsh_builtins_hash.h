@@ -0,0 +1,12 @@
+/* Generado por tools/gen_hash_builtins a partir de flsh_builtins.def. No editar a mano. */
+#define BUILTIN_HASH_CANTIDAD 20
+#define BUILTIN_HASH_SEMILLA 1534u
+#define BUILTIN_HASH_TAM 32u
+
+// Ranura -> índice en el registro (-1 = vacía)
+static const int16_t builtin_ranura[BUILTIN_HASH_TAM] = {
+    14, /* fg    */  7, /* cat   */  6, /* cp    */ 10, /* grep  */ 19, /* audit */ -1,              0, /* pwd   */  8, /* head  */
+    16, /* wait  */ -1,             -1,             -1,             -1,              1, /* echo  */  3, /* cd    */  5, /* rm    */
+     2, /* ls    */ -1,             13, /* jobs  */  9, /* tail  */ -1,             -1,             11, /* hash  */ -1,
+    12, /* set   */ 18, /* stats */ 15, /* bg    */ -1,              4, /* mkdir */ -1,             -1,             17, /* kill  */
+};
@@ -0,0 +1,76 @@
+/*
+ * Protocolo de 'flsh --servidor' (daemon multi-sesión). Lo incluyen el shell (daemon), el cliente
+ * tools/flsh_cliente.c y bench/bench_servidor.c.
+ *
+ * Socket AF_UNIX SOCK_SEQPACKET: cada mensaje llega entero o no llega.
+ * 1. El cliente conecta y envía una SOLICITUD con sus descriptores 0, 1 y 2 adjuntos (SCM_RIGHTS). El
+ *    texto es el comando de 'flsh -c'; vacío = sesión interactiva o por lotes sobre el stdin enviado.
+ * 2. El daemon identifica al usuario con SO_PEERCRED (uid, y de ahí HOME y grupos) y lanza la sesión.
+ *    Si no puede, responde RECHAZO con el motivo en 'texto' y cierra.
+ * 3. Mientras la sesión corre, el cliente puede enviar SENAL ('valor' = SIGINT, SIGQUIT o SIGTERM) para
+ *    el grupo de procesos de la sesión. Cerrar la conexión equivale a un SIGHUP (terminal colgada).
+ * 4. Al terminar la sesión el daemon envía FIN ('valor' = código de salida) y cierra.
+ */
+#ifndef FLSH_SERVIDOR_H
+#define FLSH_SERVIDOR_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SERVIDOR_SOCKET_DEFECTO "/run/flsh.sock"
+#define SERVIDOR_VERSION 1
+#define SERVIDOR_MAX_TEXTO 4096
+
+typedef enum { MENSAJE_SOLICITUD = 1, MENSAJE_SENAL, MENSAJE_FIN, MENSAJE_RECHAZO } tipo_mensaje_t;
+
+typedef struct {
+    uint32_t tipo;            // tipo_mensaje_t
+    uint32_t version;
+    int32_t valor;            // Señal (SENAL) o código de salida (FIN)
+    uint32_t largo;           // Bytes usados de 'texto', sin '\0'
+    char origen[48];          // Primer campo de SSH_CONNECTION del cliente, o "LOCAL/CONSOLE"
+    char texto[SERVIDOR_MAX_TEXTO];
+} mensaje_servidor_t;
+
+// Envía un mensaje (solo la parte usada de 'texto') con 'n_fds' descriptores adjuntos
+static inline int enviar_mensaje_servidor(int fd, tipo_mensaje_t tipo, int valor, const char *origen,
+                                          const char *texto, const int *fds, int n_fds) {
+    mensaje_servidor_t m;
+    memset(&m, 0, offsetof(mensaje_servidor_t, texto));
+    m.tipo = tipo;
+    m.version = SERVIDOR_VERSION;
+    m.valor = valor;
+    if (origen) snprintf(m.origen, sizeof(m.origen), "%s", origen);
+    size_t largo = texto ? strnlen(texto, SERVIDOR_MAX_TEXTO - 1) : 0;
+    if (largo) memcpy(m.texto, texto, largo);
+    m.largo = (uint32_t)largo;
+
+    struct iovec iov = { .iov_base = &m, .iov_len = offsetof(mensaje_servidor_t, texto) + largo };
+    union { char buf[CMSG_SPACE(3 * sizeof(int))]; struct cmsghdr alineado; } control;
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+    if (n_fds > 0 && n_fds <= 3) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE((size_t)n_fds * sizeof(int));
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN((size_t)n_fds * sizeof(int));
+        memcpy(CMSG_DATA(c), fds, (size_t)n_fds * sizeof(int));
+    }
+    return sendmsg(fd, &msg, MSG_NOSIGNAL) < 0 ? -1 : 0;
+}
+
+// Dirección del socket; -1 si la ruta no entra en sun_path
+static inline int direccion_servidor(const char *ruta, struct sockaddr_un *dir) {
+    memset(dir, 0, sizeof(*dir));
+    dir->sun_family = AF_UNIX;
+    if (strlen(ruta) >= sizeof(dir->sun_path)) return -1;
+    memcpy(dir->sun_path, ruta, strlen(ruta) + 1);
+    return 0;
+}
+
+#endif
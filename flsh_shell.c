@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,13 +12,75 @@
 #include <fcntl.h>
 #include <libgen.h>
 #include <errno.h> 
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <pwd.h>
+#include <grp.h>
+#include <stdarg.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+#include <linux/landlock.h>
+#include <linux/io_uring.h>
+#include <sys/prctl.h>
+#include <spawn.h>
+#include <sched.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <ctype.h>
+#include <termios.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "flsh_builtins.h"
+#include "flsh_binlog.h"
+#include "flsh_servidor.h"
 
-#define MAX_INPUT_SIZE 1024
-#define MAX_ARGS 64
-#define DELIMITADORES " \t\r\n\a"
+extern char **environ;
 
 // --- Prototipos ---
 void log_shell(char *cmd, char *detalles, char *nivel);
+int salida_volcar(void);
+
+/*
+ * Estado de salida del último built-in (0 = éxito). Los built-ins no retornan valor: lo fijan
+ * 'reportar_error_sistema' y el Sandbox (1), los errores de uso (2) y grep sin coincidencias (1).
+ * Es el código de salida de un built-in que corre como etapa de un pipeline.
+ */
+int estado_builtin = 0;
+
+// 1 mientras un comando simple corre con stdin redirigido ('<'): las confirmaciones leen de ahí
+static int entrada_redirigida = 0;
+
+// Opciones de la sesión modificables con el built-in 'set'
+static struct {
+    int salir_en_error;   // set -e: el modo por lotes aborta ante el primer comando fallido
+    int sin_comodines;    // set -f: las palabras con '*', '?' o '[' pasan literales
+} opciones_shell;
+
+// Control de trabajos (definidos junto a la tabla de trabajos)
+void ejecutar_jobs(char **args);
+void ejecutar_fg(char **args);
+void ejecutar_bg(char **args);
+void ejecutar_wait(char **args);
+void ejecutar_kill(char **args);
+
+// Editor de línea (definido junto al REPL): activo cuando stdin y stdout son terminales
+static int editor_activo = 0;
+int editor_iniciar(void);
+ssize_t editor_leer_linea(const char *prompt, char **linea, size_t *capacidad);
+void historial_agregar(const char *linea, size_t largo);
 
 /* * Determina la ruta absoluta donde se almacenarán los archivos de log ('shell.log' y 'sistema_error.log').
  * La función implementa una estrategia de prioridades para garantizar la persistencia:
@@ -47,601 +110,10171 @@ void obtener_ruta_logs(char *ruta_destino, size_t tamano) {
 }
 
 
+// --- Subsistema de Logging Asíncrono ---
+
 /*
- * Orquesta el sistema de auditoría y registro de eventos del Shell.
- * Funcionalidad:
- * 1. Resolución de Entorno: Obtiene la ruta dinámica de logs y asegura la existencia del
- * directorio destino mediante mkdir (0755), evitando fallos por carpetas inexistentes.
- * 2. Clasificación de Criticidad: Implementa lógica de bifurcación para separar flujos:
- * - Niveles 'ERROR'/'CRITICAL' -> se escriben en 'sistema_error.log'.
- * - Niveles informativos -> se escriben en 'shell.log'.
- * 3. Enriquecimiento de Datos (Contexto de Seguridad):
- * - Identifica al usuario del sistema (getenv USER).
- * - Detecta el origen de la conexión analizando 'SSH_CONNECTION'. Si la sesión es remota,
- * extrae la IP del cliente; si es local, marca como 'LOCAL/CONSOLE'.
- * 4. Persistencia: Escribe una entrada estructurada y temporalizada (timestamp) en modo 'append'.
+ * Estado global del logger. Se inicializa una sola vez por sesión en 'iniciar_logger':
+ * - La ruta de logs, el usuario y la IP de origen se resuelven al arrancar y quedan cacheados.
+ * - 'shell.log' y 'sistema_error.log' permanecen abiertos como descriptores O_APPEND.
+ * - Los eventos informativos se encolan en un anillo en memoria que un hilo escritor drena por lotes.
+ * - Los eventos ERROR/CRITICAL se escriben de forma síncrona (y con fdatasync) antes de retornar.
  */
-void log_shell(char *cmd, char *detalles, char *nivel) {
-    char directorio_logs[PATH_MAX];
-    char ruta_archivo[PATH_MAX];
-    obtener_ruta_logs(directorio_logs, sizeof(directorio_logs));
-    
-    // Intentar crear el directorio por si no existe (mkdir es idempotente si ya existe con -p, 
-    // pero en C estándar validamos o ignoramos error EEXIST).
-    mkdir(directorio_logs, 0755); 
+#define LOG_CAPACIDAD_ANILLO 1024
+#define LOG_MAX_CMD 128
+#define LOG_MAX_MSG 512
+#define LOG_MAX_PERF 160        // Texto de las métricas ya formateado
+#define LOG_BUFFER_LOTE 65536
 
-    time_t t = time(NULL);
-    struct tm *tm = localtime(&t);
-    char fecha[64];
-    strftime(fecha, sizeof(fecha), "%Y-%m-%d %H:%M:%S", tm);
+typedef enum { FLUSH_POR_EVENTO, FLUSH_CADA_N, FLUSH_INTERVALO, FLUSH_AL_SALIR } politica_flush_t;
+typedef enum { FSYNC_NUNCA, FSYNC_POR_LOTE, FSYNC_AL_SALIR } politica_fsync_t;
 
-    // Lógica para separar archivos según criticidad (Requisito TP)
-    if (strcmp(nivel, "ERROR") == 0 || strcmp(nivel, "CRITICAL") == 0) {
-        snprintf(ruta_archivo, sizeof(ruta_archivo), "%s/sistema_error.log", directorio_logs);
-    } else {
-        snprintf(ruta_archivo, sizeof(ruta_archivo), "%s/shell.log", directorio_logs);
-    }
+// Las métricas de un comando (perf_evento_t, flsh_binlog.h) se formatean en el hilo escritor
+typedef struct {
+    struct timespec instante;          // CLOCK_REALTIME; CLOCK_MONOTONIC con el formato binario
+    char nivel[12];
+    char cmd[LOG_MAX_CMD];
+    char msg[LOG_MAX_MSG];
+    perf_evento_t perf;
+    // Identidad de la sesión: con 'flsh --servidor' un único escritor registra eventos de muchos usuarios
+    uint32_t uid, ip;
+    char usuario[32];
+    char origen[48];
+} evento_log_t;
 
-    FILE *f = fopen(ruta_archivo, "a"); 
-    if (f == NULL) return; 
+static struct {
+    int fd_shell, fd_error;
+    char directorio[PATH_MAX];
+    char usuario[32];
+    char ip_origen[48];
+    uint32_t uid, ip;                  // ip: IPv4 de 'ip_origen' en orden de red (0 si no es IPv4)
+    evento_log_t anillo[LOG_CAPACIDAD_ANILLO];
+    unsigned long cabeza, cola;        // Contadores monótonos: cabeza = próximo a escribir, cola = próximo a drenar
+    pthread_mutex_t mutex;
+    pthread_cond_t hay_eventos, hay_espacio;
+    pthread_t hilo;
+    int hilo_activo, terminar;
+    int vaciar;                        // Pedido de 'logger_vaciar': drenar ya, sin esperar a la política
+    politica_flush_t politica_flush;
+    int flush_n, flush_intervalo_ms;
+    politica_fsync_t politica_fsync;
+    pid_t pid_dueno;
+    int binario;                       // FLSH_LOG_FORMATO=binario: segmentos mapeados en lugar de texto
+    int compartido;                    // Escritor de 'flsh --servidor': eventos de muchos usuarios
+    int fd_servidor;                   // Sesión de 'flsh --servidor': los eventos van al escritor del daemon
+    int omitir_info;                   // Etapas de pipeline: el pipeline completo se registra en un solo evento
+    int retener;                       // Comando en medición: su último evento espera las métricas
+    int hay_retenido;
+    int hubo_error;                    // El comando retenido registró un ERROR/CRITICAL
+    evento_log_t retenido;
+} logger = { .fd_shell = -1, .fd_error = -1, .fd_servidor = -1, .mutex = PTHREAD_MUTEX_INITIALIZER,
+             .hay_eventos = PTHREAD_COND_INITIALIZER, .hay_espacio = PTHREAD_COND_INITIALIZER };
 
-    char *usuario = getenv("USER");
-    if (usuario == NULL) usuario = "unknown";
+// Fija la identidad que llevan los eventos de esta sesión (usuario, uid y origen de la conexión)
+static void identificar_sesion_log(uint32_t uid, const char *usuario, const char *origen) {
+    logger.uid = uid;
+    snprintf(logger.usuario, sizeof(logger.usuario), "%s", usuario);
+    snprintf(logger.ip_origen, sizeof(logger.ip_origen), "%s", origen);
+    struct in_addr ip;
+    logger.ip = inet_pton(AF_INET, logger.ip_origen, &ip) == 1 ? ip.s_addr : 0;
+}
 
-    // --- OBTENCIÓN DE IP (Valor Agregado: Seguridad/Red) ---
-    char ip_origen[64] = "LOCAL/CONSOLE";
-    char *ssh_connection = getenv("SSH_CONNECTION"); 
-    // SSH_CONNECTION fmt: "IP_CLIENTE PUERTO IP_SERVER PUERTO"
-    if (ssh_connection != NULL) {
-        char temp_ip[64];
-        // Tomamos solo la primera palabra (la IP del cliente)
-        if (sscanf(ssh_connection, "%63s", temp_ip) == 1) {
-            strncpy(ip_origen, temp_ip, sizeof(ip_origen)-1);
-        }
+static void identificar_evento(evento_log_t *ev) {
+    ev->uid = logger.uid;
+    ev->ip = logger.ip;
+    memcpy(ev->usuario, logger.usuario, sizeof(ev->usuario));
+    memcpy(ev->origen, logger.ip_origen, sizeof(ev->origen));
+}
+
+/*
+ * Formatea un evento con el formato histórico de la shell:
+ * [FECHA] [NIVEL] SRC:IP | USER:usuario | CMD:comando | MSG:detalles [| PERF:métricas]
+ * Retorna la cantidad de bytes escritos en 'destino' (truncando si no hay espacio).
+ */
+static size_t formatear_evento(const evento_log_t *ev, char *destino, size_t tamano) {
+    // Cache de strftime por hilo: solo se reformatea la fecha cuando cambia el segundo
+    static __thread time_t ultimo_segundo = -1;
+    static __thread char fecha_cache[32];
+    if (ev->instante.tv_sec != ultimo_segundo) {
+        struct tm tm;
+        localtime_r(&ev->instante.tv_sec, &tm);
+        strftime(fecha_cache, sizeof(fecha_cache), "%Y-%m-%d %H:%M:%S", &tm);
+        ultimo_segundo = ev->instante.tv_sec;
     }
+    char perf[LOG_MAX_PERF];
+    formatear_perf(perf, sizeof(perf), &ev->perf);
+    int n = snprintf(destino, tamano, "[%s] [%s] SRC:%s | USER:%s | CMD:%s | MSG:%s%s\n",
+                     fecha_cache, ev->nivel, ev->origen, ev->usuario, ev->cmd, ev->msg, perf);
+    if (n < 0) return 0;
+    return ((size_t)n < tamano) ? (size_t)n : tamano - 1;
+}
 
-    // Formato enriquecido: [FECHA] [NIVEL] IP | User | Cmd | Msg
-    fprintf(f, "[%s] [%s] SRC:%s | USER:%s | CMD:%s | MSG:%s\n", 
-            fecha, nivel, ip_origen, usuario, cmd, detalles);
-    fclose(f);
+// Escribe el buffer completo, reintentando ante escrituras parciales o EINTR.
+static void escribir_todo(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) { if (errno == EINTR) continue; return; }
+        buf += n; len -= (size_t)n;
+    }
 }
 
+// --- Registro Binario en Segmentos Mapeados ---
 
 /*
- * Centraliza la gestión de errores del sistema (System Call Errors).
- * Funcionalidad:
- * 1. Traducción: Recupera la variable global 'errno' (establecida por la última llamada al sistema fallida)
- * y la convierte en una descripción textual legible mediante 'strerror'.
- * 2. Visualización: Imprime el error en el flujo estándar de error (stderr), separándolo del flujo 
- * de salida normal (stdout) para mantener la limpieza en redirecciones y pipes.
- * 3. Persistencia: Invoca a 'log_shell' con nivel "ERROR" para asegurar que el incidente quede 
- * registrado en 'sistema_error.log', cumpliendo con los requisitos de auditoría.
+ * Formato opcional del registro (FLSH_LOG_FORMATO=binario, ver flsh_binlog.h). La sesión escribe en
+ * segmentos 'shell-NNNNNN.flsl' del directorio de logs, mapeados con mmap: registrar un evento es copiar
+ * una cabecera fija y dos campos con largo, sin formateo ni write().
+ * - Los bloques se reservan con posix_fallocate por tramos de BINLOG_TRAMO que el hilo escritor adelanta
+ *   (reservar 16M de una vez costaría milisegundos al arrancar cada sesión en tmpfs).
+ * - El hilo escritor prepara el segmento siguiente cuando el actual supera 3/4 de su tamaño
+ *   (FLSH_LOG_SEGMENTO), así la rotación es un intercambio de punteros y no crea archivos en el shell.
+ * - ERROR/CRITICAL se copian de forma síncrona y su rango se fuerza a disco con msync(MS_SYNC).
+ * - Al cerrarse, el segmento se trunca a lo usado y se marca 'cerrado'. Se conservan los últimos
+ *   FLSH_LOG_SEGMENTOS archivos; los abiertos solo se borran si su proceso ya no existe.
  */
-void reportar_error_sistema(char *cmd) {
-    char *error_msg = strerror(errno);
-    // fprintf a stderr asegura que el usuario vea el error incluso si redirige stdout
-    fprintf(stderr, "[flsh_error] %s: %s\n", cmd, error_msg);
-    log_shell(cmd, error_msg, "ERROR"); // Usamos nivel ERROR
+#define BINLOG_SEGMENTO_DEFECTO (16UL << 20)
+#define BINLOG_SEGMENTO_MINIMO (64UL << 10)
+#define BINLOG_SEGMENTOS_DEFECTO 16
+#define BINLOG_TRAMO (1UL << 20)
+
+typedef struct {
+    int fd;
+    uint32_t secuencia;
+    char *mapa;                        // NULL = sin segmento
+    size_t tam, usado, sincronizado;
+    size_t reservado;                  // Bytes con bloques ya asignados (escribir ahí nunca da SIGBUS)
+} segmento_binlog_t;
+
+static struct {
+    char directorio[PATH_MAX];
+    size_t tam_segmento;
+    int max_segmentos;                 // 0 = sin límite
+    uint32_t secuencia;                // Última secuencia usada en el directorio
+    segmento_binlog_t actual, siguiente;
+    pthread_mutex_t mutex;
+} binlog = { .actual = { .fd = -1 }, .siguiente = { .fd = -1 }, .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static void ruta_segmento(char *destino, size_t tam, uint32_t secuencia) {
+    snprintf(destino, tam, "%s/shell-%06u.flsl", binlog.directorio, secuencia);
 }
 
+// Secuencia de un nombre 'shell-NNNNNN.flsl' (0 si no es un segmento)
+static uint32_t secuencia_de_segmento(const char *nombre) {
+    unsigned secuencia;
+    int fin = 0;
+    if (sscanf(nombre, "shell-%u.flsl%n", &secuencia, &fin) != 1 || fin == 0 || nombre[fin] != '\0') return 0;
+    return secuencia;
+}
 
 /*
- * Implementa un mecanismo de seguridad interactivo (Fail-Safe) para validar operaciones críticas.
- * Funcionalidad:
- * 1. Interrupción de Flujo: Detiene la ejecución automática para solicitar consentimiento explícito 
- * del usuario a través de la salida estándar (stdout).
- * 2. Lectura Segura de Buffer: Utiliza 'fgets' en lugar de 'scanf' o 'gets' para leer de 'stdin'. 
- * Esto previene vulnerabilidades de desbordamiento de búfer (buffer overflow) y maneja correctamente 
- * los caracteres de nueva línea.
- * 3. Lógica de Decisión: Evalúa el primer carácter de la entrada. Retorna 1 (verdadero) solo si 
- * la intención es afirmativa ('s' o 'S'); cualquier otra entrada resulta en un retorno 0 (falso), 
- * abortando la operación destructiva por defecto (deny-by-default).
+ * Crea un segmento nuevo con la siguiente secuencia libre (O_EXCL: sesiones concurrentes no se pisan),
+ * reserva su primer tramo para que escribir en el mapa no falle por falta de espacio (SIGBUS) y escribe
+ * la cabecera con el par de relojes que permite convertir los instantes monótonos a fecha.
  */
-int confirmar_accion(const char *mensaje) {
-    printf("%s (s/n): ", mensaje);
-    char respuesta[10];
-    // fgets es seguro porque limitamos la lectura a sizeof(respuesta)
-    if (fgets(respuesta, sizeof(respuesta), stdin) != NULL) {
-        if (respuesta[0] == 's' || respuesta[0] == 'S') return 1;
+static int segmento_crear(segmento_binlog_t *s) {
+    char ruta[PATH_MAX + 32];
+    int fd = -1;
+    uint32_t secuencia = 0;
+    for (int intento = 0; intento < 64 && fd < 0; intento++) {
+        secuencia = __atomic_add_fetch(&binlog.secuencia, 1, __ATOMIC_RELAXED);
+        ruta_segmento(ruta, sizeof(ruta), secuencia);
+        fd = open(ruta, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0640);
+        if (fd < 0 && errno != EEXIST) return -1;
+    }
+    if (fd < 0) return -1;
+
+    char *mapa = MAP_FAILED;
+    size_t reservado = binlog.tam_segmento < BINLOG_TRAMO ? binlog.tam_segmento : BINLOG_TRAMO;
+    if (ftruncate(fd, (off_t)binlog.tam_segmento) == 0 && posix_fallocate(fd, 0, (off_t)reservado) == 0)
+        mapa = mmap(NULL, binlog.tam_segmento, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapa == MAP_FAILED) {
+        unlink(ruta);
+        close(fd);
+        return -1;
     }
+    // Sin lectura anticipada el kernel no arma folios grandes: el primer fallo de página (la cabecera,
+    // en el arranque de la sesión) pasa de milisegundos a microsegundos
+    madvise(mapa, binlog.tam_segmento, MADV_RANDOM);
+
+    cabecera_segmento_t *c = (cabecera_segmento_t *)mapa;
+    struct timespec real, mono;
+    clock_gettime(CLOCK_REALTIME, &real);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    memcpy(c->magico, BINLOG_MAGICO, sizeof(c->magico));
+    c->version = BINLOG_VERSION;
+    c->tam_cabecera = sizeof(cabecera_segmento_t);
+    c->secuencia = secuencia;
+    c->pid = (uint32_t)getpid();
+    c->tam_segmento = binlog.tam_segmento;
+    c->base_real_ns = (uint64_t)real.tv_sec * 1000000000ULL + (uint64_t)real.tv_nsec;
+    c->base_mono_ns = (uint64_t)mono.tv_sec * 1000000000ULL + (uint64_t)mono.tv_nsec;
+    c->uid = logger.uid;
+    snprintf(c->usuario, sizeof(c->usuario), "%s", logger.compartido ? BINLOG_MULTIUSUARIO : logger.usuario);
+    snprintf(c->origen, sizeof(c->origen), "%s", logger.ip_origen);
+
+    s->fd = fd;
+    s->secuencia = secuencia;
+    s->mapa = mapa;
+    s->tam = binlog.tam_segmento;
+    s->usado = s->sincronizado = sizeof(cabecera_segmento_t);
+    s->reservado = reservado;
     return 0;
 }
 
-/*
- * Implementa un mecanismo de contención de sistema de archivos (Filesystem Sandboxing).
- * Funcionalidad:
- * 1. Resolución Canónica: Utiliza 'realpath' para resolver enlaces simbólicos y referencias relativas 
- * (como '..' o '.'), convirtiendo la entrada en una ruta absoluta pura. Esto mitiga ataques de 
- * "Directory Traversal" (ej. intentar acceder a /etc/passwd desde home usando ../../../).
- * 2. Verificación de Prefijo: Compara la ruta resuelta con la variable de entorno 'HOME'. Si la ruta 
- * no comienza con el prefijo de HOME, se deniega el acceso.
- * 3. Manejo de Archivos Inexistentes (Look-ahead): Si el archivo destino no existe (errno == ENOENT), 
- * el sistema extrae y valida el directorio padre. Esto es crucial para comandos de creación (mkdir, cp) 
- * donde el destino final aún no está en el disco, pero debemos asegurar que se creará en una ubicación permitida.
- */
-int validar_ruta_en_home(char *ruta_input) {
-    char *home = getenv("HOME");
-    if (home == NULL) return 0; // Sin HOME definido, bloqueamos por seguridad (Fail-closed)
+// Fuerza a disco lo escrito desde la última sincronización (msync exige inicio alineado a página)
+static void segmento_sincronizar(segmento_binlog_t *s) {
+    if (s->mapa == NULL || s->sincronizado == s->usado) return;
+    size_t pagina = (size_t)sysconf(_SC_PAGESIZE);
+    size_t inicio = s->sincronizado & ~(pagina - 1);
+    msync(s->mapa + inicio, s->usado - inicio, MS_SYNC);
+    s->sincronizado = s->usado;
+}
 
-    char ruta_resuelta[PATH_MAX];
-    char *res = realpath(ruta_input, ruta_resuelta);
+// Sella el segmento: tamaño definitivo en la cabecera y archivo truncado a lo usado
+static void segmento_cerrar(segmento_binlog_t *s) {
+    if (s->mapa == NULL) return;
+    cabecera_segmento_t *c = (cabecera_segmento_t *)s->mapa;
+    c->usado = s->usado;
+    c->cerrado = 1;
+    if (logger.politica_fsync != FSYNC_NUNCA) msync(s->mapa, s->usado, MS_SYNC);
+    munmap(s->mapa, s->tam);
+    if (ftruncate(s->fd, (off_t)s->usado) != 0) { /* queda con su tamaño reservado: sigue siendo legible */ }
+    close(s->fd);
+    s->mapa = NULL;
+    s->fd = -1;
+}
 
-    // Caso 1: El archivo/directorio ya existe
-    if (res != NULL) {
-        // Verificamos si ruta_resuelta empieza con la ruta de home
-        if (strncmp(ruta_resuelta, home, strlen(home)) == 0) return 1;
-        return 0;
-    }
-    
-    // Caso 2: El archivo no existe (ej. creando nuevo dir), validamos el padre
-    if (errno == ENOENT) {
-        char *copia = strdup(ruta_input); // Duplicamos porque dirname puede modificar el string
-        char *padre = dirname(copia);
-        char padre_resuelta[PATH_MAX];
-        int es_seguro = 0;
-        
-        // Resolvemos la ruta absoluta del directorio padre
-        if (realpath(padre, padre_resuelta) != NULL) {
-             // Validamos que el padre esté dentro del HOME
-             if (strncmp(padre_resuelta, home, strlen(home)) == 0) es_seguro = 1;
-        }
-        free(copia); // Liberamos memoria dinámica
-        return es_seguro;
-    }
-    
-    return 0;
+// Elimina un segmento preparado que nunca recibió registros
+static void segmento_descartar(segmento_binlog_t *s) {
+    if (s->mapa == NULL) return;
+    char ruta[PATH_MAX + 32];
+    ruta_segmento(ruta, sizeof(ruta), s->secuencia);
+    munmap(s->mapa, s->tam);
+    close(s->fd);
+    unlink(ruta);
+    s->mapa = NULL;
+    s->fd = -1;
 }
 
-// --- Wrapper de Seguridad: Validación y Reporte ---
+static int comparar_secuencias(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
 
 /*
- * Actúa como "Middleware" de seguridad, encapsulando la lógica de validación del Sandbox
- * con el sistema de reporte y auditoría.
- * Funcionalidad:
- * 1. Verificación: Invoca a 'validar_ruta_en_home' para determinar si la operación es lícita.
- * 2. Auditoría de Seguridad: Si la validación falla, genera automáticamente una entrada de log
- * con nivel "WARNING", documentando el intento de violación del perímetro de seguridad.
- * 3. Feedback al Usuario: Informa inmediatamente a la salida estándar de error (stderr) que
- * la acción fue bloqueada por el módulo [flsh_sec], garantizando transparencia.
- * Retorno: 1 si es seguro proceder, 0 si la acción fue bloqueada.
+ * Retención: si el directorio tiene más de 'max_segmentos' segmentos borra los más antiguos, salvo los
+ * que siguen abiertos por un proceso vivo (otra sesión, o este mismo shell). El segmento siguiente que
+ * preparó este shell todavía no tiene eventos: no cuenta (si no, se conservaría uno menos).
  */
-int validar_entorno_seguro(char *ruta, const char *contexto) {
-    // Delegamos la verificación matemática/lógica a la función de Sandbox
-    if (validar_ruta_en_home(ruta)) {
-        return 1; // Acceso concedido
-    } else {
-        // --- Bloque de Gestión de Incidentes ---
-        char msg[256];
-        // Construimos el mensaje forense con la ruta infractora
-        snprintf(msg, sizeof(msg), "Intento de acceso fuera de HOME: %s", ruta);
-        
-        // Registramos el incidente en los logs persistentes (Nivel WARNING, no ERROR de sistema)
-        log_shell((char*)contexto, msg, "WARNING"); 
-        
-        // Notificamos al usuario final sobre el bloqueo
-        fprintf(stderr, "[flsh_sec]: Acceso denegado (SandBox).\n");
-        
-        return 0; // Acceso denegado
+static void binlog_purgar(void) {
+    if (binlog.max_segmentos <= 0) return;
+    pthread_mutex_lock(&binlog.mutex);
+    uint32_t preparado = binlog.siguiente.mapa != NULL ? binlog.siguiente.secuencia : 0;
+    pthread_mutex_unlock(&binlog.mutex);
+    DIR *d = opendir(binlog.directorio);
+    if (d == NULL) return;
+    uint32_t *secuencias = NULL;
+    size_t n = 0, cap = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        uint32_t secuencia = secuencia_de_segmento(e->d_name);
+        if (secuencia == 0 || secuencia == preparado) continue;
+        if (n == cap) {
+            size_t nueva = cap ? cap * 2 : 32;
+            uint32_t *v = realloc(secuencias, nueva * sizeof(*v));
+            if (v == NULL) break;
+            secuencias = v;
+            cap = nueva;
+        }
+        secuencias[n++] = secuencia;
+    }
+    closedir(d);
+
+    if (n > (size_t)binlog.max_segmentos) {
+        qsort(secuencias, n, sizeof(*secuencias), comparar_secuencias);
+        for (size_t i = 0; i < n - (size_t)binlog.max_segmentos; i++) {
+            char ruta[PATH_MAX + 32];
+            ruta_segmento(ruta, sizeof(ruta), secuencias[i]);
+            int fd = open(ruta, O_RDONLY | O_CLOEXEC);
+            if (fd < 0) continue;
+            cabecera_segmento_t c;
+            int borrar = pread(fd, &c, sizeof(c), 0) == (ssize_t)sizeof(c) &&
+                         (c.cerrado || (kill((pid_t)c.pid, 0) < 0 && errno == ESRCH));
+            close(fd);
+            if (borrar) unlink(ruta);
+        }
     }
+    free(secuencias);
 }
- 
+
 /*
- * Renderiza el indicador de línea de comandos (Prompt) para la interacción usuario-sistema.
- * Funcionalidad:
- * 1. Contexto Espacial: Utiliza la llamada al sistema 'getcwd' (Get Current Working Directory)
- * para obtener la ruta absoluta actual y mostrarla al usuario. Esto es vital para la orientación
- * dentro del árbol de directorios.
- * 2. Manejo de Buffers (Crucial): Dado que 'printf' suele usar "line-buffering" (espera un '\n'
- * para imprimir en pantalla) y el prompt NO termina en nueva línea (para que el usuario escriba
- * al lado), es obligatorio llamar a 'fflush(stdout)'. Esto fuerza el vaciado del buffer y garantiza
- * que el prompt aparezca inmediatamente antes de la espera de entrada (input).
- * 3. Robustez: Si 'getcwd' falla (ej. permisos o ruta eliminada), muestra un prompt genérico "> "
- * para mantener la operatividad.
+ * Hilo escritor: adelanta la reserva del segmento actual cuando lo usado se acerca a lo reservado, y
+ * deja listo el segmento siguiente cuando el actual pasa 3/4 de su tamaño. La creación del siguiente
+ * (open + fallocate + mmap) ocurre fuera del mutex; solo la instalación lo toma.
  */
-void imprimir_prompt() {
-    char cwd[1024];
-    // Intentamos recuperar el directorio de trabajo actual
-    if (getcwd(cwd, sizeof(cwd)) != NULL) {
-        // Personalización del prompt (Requisito de "Tema/Enfoque propio")
-        printf("[Úsame: %s]> ", cwd); 
-    } else {
-        // Fallback en caso de error de sistema al leer la ruta
-        printf("> ");
+static void binlog_preparar_siguiente(void) {
+    pthread_mutex_lock(&binlog.mutex);
+    segmento_binlog_t *s = &binlog.actual;
+    if (s->mapa != NULL && s->reservado < s->tam && s->usado + BINLOG_TRAMO / 2 > s->reservado) {
+        size_t tramo = s->tam - s->reservado < BINLOG_TRAMO ? s->tam - s->reservado : BINLOG_TRAMO;
+        if (posix_fallocate(s->fd, (off_t)s->reservado, (off_t)tramo) == 0) s->reservado += tramo;
     }
-    // Forzamos la salida a pantalla porque printf no tiene '\n' al final
-    fflush(stdout);
-}
+    int falta = binlog.actual.mapa != NULL && binlog.siguiente.mapa == NULL &&
+                binlog.actual.usado > (binlog.actual.tam / 4) * 3;
+    pthread_mutex_unlock(&binlog.mutex);
+    if (!falta) return;
 
-int parsear_comando(char *input, char **args) {
-    int i = 0;
-    char *token = strtok(input, DELIMITADORES);
-    while (token != NULL && i < MAX_ARGS - 1) {
-        args[i] = token;
-        i++;
-        token = strtok(NULL, DELIMITADORES);
+    segmento_binlog_t nuevo;
+    if (segmento_crear(&nuevo) != 0) return;
+    pthread_mutex_lock(&binlog.mutex);
+    if (binlog.siguiente.mapa == NULL) {
+        binlog.siguiente = nuevo;
+        nuevo.mapa = NULL;
     }
-    args[i] = NULL;
-    return i;
+    pthread_mutex_unlock(&binlog.mutex);
+    segmento_descartar(&nuevo);
+    binlog_purgar();
 }
 
-// --- Comandos Internos ---
-
-// --- Comando Built-in: ls (Listar Directorio) ---
+// Rota al segmento preparado; si el escritor no llegó a prepararlo (o es un hijo de fork) lo crea aquí
+static int binlog_rotar(void) {
+    segmento_cerrar(&binlog.actual);
+    if (binlog.siguiente.mapa != NULL) {
+        binlog.actual = binlog.siguiente;
+        binlog.siguiente = (segmento_binlog_t){ .fd = -1 };
+        return 0;
+    }
+    return segmento_crear(&binlog.actual);
+}
 
-/*
- * Implementación nativa de listado de archivos mediante API POSIX (dirent.h), sin dependencias externas.
- * Funcionalidad:
- * 1. Validación de Seguridad: Si se especifica una ruta, verifica que esté dentro del Sandbox permitido
- * antes de intentar abrirla.
- * 2. Acceso al Sistema de Archivos: Utiliza 'opendir' y 'readdir' para obtener el flujo de entradas
- * del directorio, manejando punteros de estructura 'DIR' y 'struct dirent'.
- * 3. Filtrado Visual: Implementa lógica para omitir archivos ocultos (que inician con '.'), 
- * emulando el comportamiento estándar de una shell.
- * 4. Gestión de Errores: Captura fallos de apertura (ej. permisos, ruta inexistente) y los reporta.
- */
-void ejecutar_ls(char *ruta) {
-    // Si hay argumento, verificamos que sea seguro (Sandbox)
-    if (ruta != NULL && !validar_entorno_seguro(ruta, "ls")) return;
-
-    // Si ruta es NULL, listamos el directorio actual (".")
-    char *target = (ruta == NULL) ? "." : ruta;
-
-    DIR *d = opendir(target);
-    if (!d) { 
-        reportar_error_sistema("ls");
-        return; 
-    }
-
-    struct dirent *dir;
-    // Iteramos sobre cada entrada del directorio
-    while ((dir = readdir(d)) != NULL) {
-        // Filtramos archivos ocultos (los que empiezan con punto)
-        if (dir->d_name[0] != '.') printf("%s  ", dir->d_name);
-    }
-    printf("\n");
-    
-    closedir(d); // Es vital cerrar el stream del directorio
-    log_shell("ls", "Listado exitoso", "INFO");
+static uint8_t nivel_binlog(const char *nivel) {
+    for (uint8_t i = BINLOG_INFO; i <= BINLOG_CRITICAL; i++)
+        if (strcmp(nivel, nombres_nivel_binlog[i]) == 0) return i;
+    return BINLOG_INFO;
 }
- 
-// --- Comando Built-in: cd (Change Directory) ---
 
 /*
- * Gestiona el cambio del directorio de trabajo del proceso actual (Shell).
- * Funcionalidad:
- * 1. Resolución de Destino: Si no se provee argumento, redirige al usuario a su 'HOME' (comportamiento estándar).
- * 2. Validación de Seguridad: Intercepta la operación con el Sandbox ('validar_entorno_seguro') antes de llamar al kernel.
- * 3. Cambio de Contexto: Ejecuta la llamada al sistema 'chdir' para modificar el estado del proceso.
- * 4. Actualización de Entorno (Requisito Crítico): Tras un cambio exitoso, actualiza la variable de entorno 'PWD'
- * mediante 'putenv'. Esto asegura que las futuras llamadas a 'getcwd' y los procesos hijos hereden la ruta correcta.
+ * Copia un evento al segmento actual. El campo 'largo' se publica al final (store release): un lector
+ * del segmento abierto nunca ve un registro a medio escribir. 'durable' fuerza el rango a disco.
+ * Retorna -1 si no hay segmento disponible (el llamador usa el registro de texto de respaldo).
  */
-void ejecutar_cd(char *ruta) {
-    char *home = getenv("HOME");
-    char *objetivo = (ruta == NULL) ? home : ruta;
-    
-    // Verificamos permisos antes de intentar movernos
-    if (!validar_entorno_seguro(objetivo, "cd")) return;
-    
-    // Intentamos cambiar el directorio
-    if (chdir(objetivo) != 0) {
-        reportar_error_sistema("cd");
-    } else {
-        // Actualizamos la variable PWD para mantener consistencia
-        char cwd[PATH_MAX];
-        getcwd(cwd, sizeof(cwd));
-        char env_var[PATH_MAX + 5]; 
-        sprintf(env_var, "PWD=%s", cwd);
-        putenv(env_var); // Modifica el entorno del proceso actual
-        log_shell("cd", cwd, "INFO");
+static int binlog_escribir(const evento_log_t *ev, int durable) {
+    size_t largo_cmd = strnlen(ev->cmd, sizeof(ev->cmd)), largo_msg = strnlen(ev->msg, sizeof(ev->msg));
+    size_t largo_perf = ev->perf.presente ? sizeof(perf_evento_t) : 0;
+    size_t largo = sizeof(registro_binlog_t) + largo_perf + largo_cmd + largo_msg;
+    largo = (largo + BINLOG_ALINEACION - 1) & ~(size_t)(BINLOG_ALINEACION - 1);
+
+    pthread_mutex_lock(&binlog.mutex);
+    segmento_binlog_t *s = &binlog.actual;
+    if ((s->mapa == NULL || s->usado + largo > s->tam) && binlog_rotar() != 0) {
+        pthread_mutex_unlock(&binlog.mutex);
+        return -1;
     }
+    char *p = s->mapa + s->usado;
+    registro_binlog_t r = {
+        .nivel = nivel_binlog(ev->nivel), .banderas = largo_perf ? BINLOG_CON_PERF : 0,
+        .largo_cmd = (uint16_t)largo_cmd, .largo_msg = (uint16_t)largo_msg, .uid = ev->uid, .ip = ev->ip,
+        .instante_ns = (uint64_t)ev->instante.tv_sec * 1000000000ULL + (uint64_t)ev->instante.tv_nsec,
+    };
+    memcpy(p, &r, sizeof(r));
+    size_t k = sizeof(r);
+    if (largo_perf) { memcpy(p + k, &ev->perf, largo_perf); k += largo_perf; }
+    memcpy(p + k, ev->cmd, largo_cmd);
+    memcpy(p + k + largo_cmd, ev->msg, largo_msg);
+    __atomic_store_n((uint32_t *)p, (uint32_t)largo, __ATOMIC_RELEASE);
+    s->usado += largo;
+    if (durable) segmento_sincronizar(s);
+    pthread_mutex_unlock(&binlog.mutex);
+    return 0;
+}
+
+static void binlog_sincronizar(void) {
+    pthread_mutex_lock(&binlog.mutex);
+    segmento_sincronizar(&binlog.actual);
+    pthread_mutex_unlock(&binlog.mutex);
+}
+
+static size_t tamano_con_sufijo(const char *texto) {
+    char *fin;
+    unsigned long long v = strtoull(texto, &fin, 10);
+    switch (*fin) {
+        case 'k': case 'K': v <<= 10; break;
+        case 'm': case 'M': v <<= 20; break;
+        case 'g': case 'G': v <<= 30; break;
+    }
+    return (size_t)v;
 }
- 
-// --- Comando Built-in: mkdir (Make Directory) ---
 
 /*
- * Crea un nuevo directorio en el sistema de archivos.
- * Funcionalidad:
- * 1. Validación de Argumentos: Verifica la existencia del nombre del directorio antes de proceder.
- * 2. Seguridad (Sandbox): Confirma mediante 'validar_entorno_seguro' que el nuevo directorio
- * se creará dentro de los límites permitidos ($HOME), evitando escrituras en zonas de sistema.
- * 3. Llamada al Sistema: Invoca 'mkdir' con modo octal 0755 (rwxr-xr-x), otorgando permisos completos
- * al usuario y de lectura/ejecución al grupo y otros.
- * 4. Gestión de Resultados: Reporta errores de sistema (ej. "File exists") o registra el éxito en el log.
+ * Activa el formato binario en 'directorio':
+ * - FLSH_LOG_SEGMENTO: tamaño de cada segmento (sufijos K/M/G; 16M por defecto, mínimo 64K).
+ * - FLSH_LOG_SEGMENTOS: segmentos a conservar en el directorio (16 por defecto, 0 = todos).
+ * Retorna -1 si no puede crear el primer segmento (el logger sigue en texto).
  */
-void ejecutar_mkdir(char *ruta) {
-    if (!ruta) { fprintf(stderr, "mkdir: falta argumento\n"); return; }
-    
-    // Verificamos que sea seguro crear aquí
-    if (!validar_entorno_seguro(ruta, "mkdir")) return;
-    
-    // 0755 = rwx (Dueño) | r-x (Grupo) | r-x (Otros)
-    if (mkdir(ruta, 0755) != 0) reportar_error_sistema("mkdir");
-    else log_shell("mkdir", "Directorio creado", "INFO");
+static int binlog_iniciar(const char *directorio) {
+    snprintf(binlog.directorio, sizeof(binlog.directorio), "%s", directorio);
+    char *tam = getenv("FLSH_LOG_SEGMENTO");
+    binlog.tam_segmento = tam ? tamano_con_sufijo(tam) : BINLOG_SEGMENTO_DEFECTO;
+    if (binlog.tam_segmento < BINLOG_SEGMENTO_MINIMO) binlog.tam_segmento = BINLOG_SEGMENTO_MINIMO;
+    binlog.tam_segmento &= ~(size_t)(BINLOG_ALINEACION - 1);
+    char *max = getenv("FLSH_LOG_SEGMENTOS");
+    binlog.max_segmentos = max ? atoi(max) : BINLOG_SEGMENTOS_DEFECTO;
+
+    DIR *d = opendir(directorio);
+    if (d == NULL) return -1;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        uint32_t secuencia = secuencia_de_segmento(e->d_name);
+        if (secuencia > binlog.secuencia) binlog.secuencia = secuencia;
+    }
+    closedir(d);
+    return segmento_crear(&binlog.actual); // La retención la aplica el hilo escritor al arrancar
 }
- 
-// --- Comando Built-in: rm (Remove File) ---
+
+
+// --- Índice Disperso de Auditoría ---
 
 /*
- * Elimina un archivo del sistema de archivos de forma segura y auditada.
- * Funcionalidad:
- * 1. Validación de Seguridad (Sandbox): Verifica mediante 'validar_entorno_seguro' que el archivo
- * objetivo se encuentre dentro del espacio de usuario permitido, previniendo el borrado de archivos del sistema.
- * 2. Confirmación Interactiva (Fail-Safe): Implementa una barrera de seguridad lógica ('confirmar_accion')
- * que detiene la ejecución hasta obtener consentimiento explícito del usuario. Esto mitiga el error humano.
- * 3. Ejecución Atómica: Utiliza la llamada al sistema 'unlink' (estándar POSIX) para eliminar la referencia
- * del archivo en el inodo correspondiente.
- * 4. Auditoría Crítica: Registra el evento con nivel "WARNING" (si fue exitoso) o "INFO" (si fue cancelado),
- * permitiendo trazar quién borró qué y cuándo.
+ * Índice lateral de 'shell.log' y 'sistema_error.log' ('<log>.idx') para el built-in 'audit'.
+ * Una entrada por bloque de ~AUDIT_BLOQUE bytes de log, cortado en fin de línea, con el offset del
+ * bloque, el rango de fechas de sus líneas, un mapa de bits de niveles y filtros de Bloom de 256 bits
+ * de usuario, IP de origen y comando. Una consulta recorre las entradas (136 bytes cada 64 KB de log)
+ * y lee por mmap solo los bloques que pueden tener coincidencias.
+ * - El hilo escritor extiende el índice cada vez que el log acumula un bloque completo sin indexar;
+ *   'audit' recorre directamente la cola que todavía no llega a un bloque.
+ * - Las sesiones concurrentes comparten el índice: la extensión se serializa con flock.
+ * - Si el log fue rotado o truncado (otro inodo, o más corto que lo indexado) se reconstruye.
  */
-void ejecutar_rm(char *archivo) {
-    if (!archivo) { fprintf(stderr, "rm: falta argumento\n"); return; }
-    
-    // Capa 1: Validación de Entorno (Sandbox)
-    if (!validar_entorno_seguro(archivo, "rm")) return;
-    
-    // Capa 2: Confirmación de Usuario (Requisito de Seguridad)
-    char msg[512];
-    snprintf(msg, sizeof(msg), "ALERTA: Vas a eliminar '%s'. ¿Estás seguro?", archivo);
-    
-    if (!confirmar_accion(msg)) {
-        // Registro de la cancelación (Auditoría positiva)
-        log_shell("rm", "Cancelado por usuario", "INFO");
-        return;
-    }
+#define AUDIT_BLOQUE (64 * 1024)
+#define AUDIT_MAGICO "FLSHIDX1"
+#define AUDIT_VERSION 1
+
+typedef struct {
+    char magico[8];
+    uint32_t version, bloque;
+    uint64_t dispositivo, inodo;   // Log al que corresponde el índice
+    uint64_t indexado;             // Bytes del log cubiertos por las entradas
+    uint64_t entradas;
+} cabecera_indice_t;
+
+typedef struct {
+    uint64_t desde;
+    uint32_t largo, lineas;
+    uint64_t fecha_min, fecha_max; // AAAAMMDDhhmmss como entero: ordena igual que la fecha del log
+    uint32_t niveles;              // Bit i = nombres_nivel_binlog[i]
+    uint32_t relleno;
+    uint64_t usuarios[4], origenes[4], comandos[4];
+} entrada_indice_t;
 
-    // Capa 3: Ejecución (Syscall unlink)
-    if (unlink(archivo) != 0) reportar_error_sistema("rm");
-    else log_shell("rm", "Archivo eliminado", "WARNING"); // Warning porque es destructivo
+// Campos de una línea '[FECHA] [NIVEL] SRC:ip | USER:u | CMD:c | MSG:...'
+typedef struct {
+    uint64_t fecha;
+    int nivel;
+    const char *origen, *usuario, *comando;
+    size_t largo_origen, largo_usuario, largo_comando;
+} linea_auditoria_t;
+
+static uint64_t hash_campo(const char *s, size_t n) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < n; i++) { h ^= (unsigned char)s[i]; h *= 1099511628211ULL; }
+    return h ^ (h >> 29);
+}
+
+// Dos bits por valor, tomados del mismo hash
+static void bloom_agregar(uint64_t *filtro, uint64_t h) {
+    filtro[(h >> 6) & 3] |= 1ULL << (h & 63);
+    filtro[(h >> 14) & 3] |= 1ULL << ((h >> 8) & 63);
+}
+static int bloom_contiene(const uint64_t *filtro, uint64_t h) {
+    return (filtro[(h >> 6) & 3] >> (h & 63) & 1) && (filtro[(h >> 14) & 3] >> ((h >> 8) & 63) & 1);
+}
+
+static int nivel_de_texto(const char *s, size_t n) {
+    for (int i = BINLOG_INFO; i <= BINLOG_CRITICAL; i++)
+        if (strlen(nombres_nivel_binlog[i]) == n && memcmp(s, nombres_nivel_binlog[i], n) == 0) return i;
+    return BINLOG_INFO;
 }
- 
-// --- Comando Built-in: cp (Copy File) ---
+
+// Extrae el valor entre 'clave' y el separador siguiente; retorna el puntero posterior o NULL
+static const char *campo_linea(const char *p, const char *fin, const char *clave, const char *sep,
+                               const char **valor, size_t *largo) {
+    size_t lc = strlen(clave), ls = strlen(sep);
+    if ((size_t)(fin - p) < lc || memcmp(p, clave, lc) != 0) return NULL;
+    p += lc;
+    const char *s = memmem(p, (size_t)(fin - p), sep, ls);
+    if (s == NULL) return NULL;
+    *valor = p;
+    *largo = (size_t)(s - p);
+    return s + ls;
+}
+
+// Retorna 0 si la línea (sin '\n') tiene el formato del logger
+static int parsear_linea_auditoria(const char *p, size_t n, linea_auditoria_t *l) {
+    static const int digitos[14] = { 1, 2, 3, 4, 6, 7, 9, 10, 12, 13, 15, 16, 18, 19 };
+    if (n < 24 || p[0] != '[' || p[20] != ']' || p[21] != ' ' || p[22] != '[') return -1;
+    uint64_t fecha = 0;
+    for (int i = 0; i < 14; i++) {
+        char c = p[digitos[i]];
+        if (c < '0' || c > '9') return -1;
+        fecha = fecha * 10 + (uint64_t)(c - '0');
+    }
+    const char *fin = p + n, *q = p + 23;
+    const char *cierre = memchr(q, ']', (size_t)(fin - q));
+    if (cierre == NULL) return -1;
+    l->fecha = fecha;
+    l->nivel = nivel_de_texto(q, (size_t)(cierre - q));
+    q = cierre + 2;
+    if (q > fin) return -1;
+    q = campo_linea(q, fin, "SRC:", " | ", &l->origen, &l->largo_origen);
+    if (q) q = campo_linea(q, fin, "USER:", " | ", &l->usuario, &l->largo_usuario);
+    if (q) q = campo_linea(q, fin, "CMD:", " | MSG:", &l->comando, &l->largo_comando);
+    return q ? 0 : -1;
+}
+
+static void ruta_indice(char *destino, size_t tam, const char *ruta_log) { snprintf(destino, tam, "%s.idx", ruta_log); }
 
 /*
- * Realiza la copia de archivos binarios o de texto mediante gestión de buffers de bajo nivel.
- * Funcionalidad:
- * 1. Validación Dual: Verifica que TANTO el origen COMO el destino estén dentro del entorno seguro
- * (Sandbox), previniendo exfiltración de datos o escritura en zonas prohibidas.
- * 2. Protección contra Sobrescritura: Utiliza 'stat' para detectar si el destino ya existe. 
- * Si es así, detiene el flujo y solicita confirmación explicita al usuario, cumpliendo con la 
- * política de seguridad para operaciones destructivas.
- * 3. Gestión de Archivos (Low-Level I/O):
- * - Origen: Se abre en modo Solo Lectura (O_RDONLY).
- * - Destino: Se abre con flags O_CREAT (crear si no existe) y O_TRUNC (vaciar si existe),
- * con permisos 0644 (rw-r--r--).
- * 4. Transferencia Bufferizada: Implementa un bucle de lectura/escritura usando un buffer de 1KB.
- * Esto asegura eficiencia en memoria, copiando chunks de datos en lugar de cargar todo el archivo en RAM.
+ * Extiende el índice de 'ruta_log' con los bloques completos que todavía no cubre.
+ * Retorna los bytes del log cubiertos por el índice (0 si no pudo abrirlo).
  */
-void ejecutar_cp(char *origen, char *destino) {
-    if (!origen || !destino) { fprintf(stderr, "cp: faltan argumentos\n"); return; }
-    
-    // Verificamos seguridad en ambos extremos: no leer de /etc, no escribir en /bin
-    if (!validar_entorno_seguro(origen, "cp in") || !validar_entorno_seguro(destino, "cp out")) return;
+static uint64_t indice_extender(const char *ruta_log) {
+    char ruta_idx[PATH_MAX + 40];
+    ruta_indice(ruta_idx, sizeof(ruta_idx), ruta_log);
+    int fd_log = open(ruta_log, O_RDONLY | O_CLOEXEC);
+    if (fd_log < 0) return 0;
+    int fd_idx = open(ruta_idx, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_idx < 0) { close(fd_log); return 0; }
+    flock(fd_idx, LOCK_EX);
 
-    int fd_in = open(origen, O_RDONLY);
-    if (fd_in < 0) { reportar_error_sistema("cp (origen)"); return; }
-    
-    // --- Bloque de Prevención de Accidentes ---
     struct stat st;
-    // Si stat devuelve 0, el archivo destino existe
-    if (stat(destino, &st) == 0) {
-        char msg[512];
-        snprintf(msg, sizeof(msg), "ALERTA: '%s' ya existe. ¿Sobrescribir?", destino);
-        // Solicitamos confirmación interactiva antes de truncar el archivo
-        if (!confirmar_accion(msg)) {
-            close(fd_in);
-            log_shell("cp", "Cancelado (sobrescritura)", "INFO");
-            return;
-        }
+    cabecera_indice_t c;
+    if (fstat(fd_log, &st) != 0) memset(&st, 0, sizeof(st));
+    if (pread(fd_idx, &c, sizeof(c), 0) != (ssize_t)sizeof(c) || memcmp(c.magico, AUDIT_MAGICO, 8) != 0 ||
+        c.version != AUDIT_VERSION || c.bloque != AUDIT_BLOQUE || c.dispositivo != (uint64_t)st.st_dev ||
+        c.inodo != (uint64_t)st.st_ino || c.indexado > (uint64_t)st.st_size) {
+        memset(&c, 0, sizeof(c));
+        memcpy(c.magico, AUDIT_MAGICO, 8);
+        c.version = AUDIT_VERSION;
+        c.bloque = AUDIT_BLOQUE;
+        c.dispositivo = (uint64_t)st.st_dev;
+        c.inodo = (uint64_t)st.st_ino;
+        if (ftruncate(fd_idx, sizeof(c)) != 0 || pwrite(fd_idx, &c, sizeof(c), 0) != (ssize_t)sizeof(c)) c.indexado = 0;
     }
 
-    // Abrimos destino: O_WRONLY (escribir), O_CREAT (crear), O_TRUNC (borrar contenido previo)
-    // Permisos 0644: Usuario(rw), Grupo(r), Otros(r)
-    int fd_out = open(destino, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd_out < 0) { reportar_error_sistema("cp (destino)"); close(fd_in); return; }
-
-    // --- Bucle de Copia (Core) ---
-    char buffer[1024];
-    ssize_t n;
-    // Leemos del origen al buffer y escribimos del buffer al destino
-    while ((n = read(fd_in, buffer, sizeof(buffer))) > 0) write(fd_out, buffer, n);
-
-    close(fd_in); close(fd_out);
-    log_shell("cp", "Copia exitosa", "INFO");
+    uint64_t tam = (uint64_t)st.st_size;
+    if (tam - c.indexado >= AUDIT_BLOQUE) {
+        // Se mapea desde la página que contiene el primer byte sin indexar
+        uint64_t base = c.indexado & ~(uint64_t)(sysconf(_SC_PAGESIZE) - 1);
+        char *mapa = mmap(NULL, tam - base, PROT_READ, MAP_SHARED, fd_log, (off_t)base);
+        if (mapa != MAP_FAILED) {
+            madvise(mapa, tam - base, MADV_SEQUENTIAL);
+            uint64_t desde = c.indexado;
+            while (tam - desde >= AUDIT_BLOQUE) {
+                const char *p = mapa + (desde - base), *limite = mapa + (tam - base);
+                const char *nl = memchr(p + AUDIT_BLOQUE - 1, '\n', (size_t)(limite - (p + AUDIT_BLOQUE - 1)));
+                if (nl == NULL) break;
+                entrada_indice_t e;
+                memset(&e, 0, sizeof(e));
+                e.desde = desde;
+                e.largo = (uint32_t)(nl + 1 - p);
+                e.fecha_min = UINT64_MAX;
+                for (const char *q = p; q <= nl;) {
+                    const char *fl = memchr(q, '\n', (size_t)(nl + 1 - q));
+                    linea_auditoria_t l;
+                    if (parsear_linea_auditoria(q, (size_t)(fl - q), &l) == 0) {
+                        if (l.fecha < e.fecha_min) e.fecha_min = l.fecha;
+                        if (l.fecha > e.fecha_max) e.fecha_max = l.fecha;
+                        e.niveles |= 1u << l.nivel;
+                        bloom_agregar(e.usuarios, hash_campo(l.usuario, l.largo_usuario));
+                        bloom_agregar(e.origenes, hash_campo(l.origen, l.largo_origen));
+                        bloom_agregar(e.comandos, hash_campo(l.comando, l.largo_comando));
+                    }
+                    e.lineas++;
+                    q = fl + 1;
+                }
+                if (e.fecha_min == UINT64_MAX) e.fecha_min = 0;
+                off_t pos = (off_t)(sizeof(c) + c.entradas * sizeof(e));
+                if (pwrite(fd_idx, &e, sizeof(e), pos) != (ssize_t)sizeof(e)) break;
+                c.entradas++;
+                desde += e.largo;
+            }
+            munmap(mapa, tam - base);
+            c.indexado = desde;
+            if (pwrite(fd_idx, &c, sizeof(c), 0) != (ssize_t)sizeof(c)) c.indexado = 0;
+        }
+    }
+    flock(fd_idx, LOCK_UN);
+    close(fd_idx);
+    close(fd_log);
+    return c.indexado;
 }
- 
-// --- Comando Built-in: cat (Concatenate/Display) ---
 
 /*
- * Visualiza el contenido de un archivo volcándolo directamente a la salida estándar.
- * Funcionalidad:
- * 1. Validación de Seguridad: Confirma mediante 'validar_entorno_seguro' que el archivo objetivo
- * reside dentro del perímetro permitido ($HOME), impidiendo la lectura no autorizada de archivos 
- * del sistema (como /etc/passwd).
- * 2. Acceso de Bajo Nivel: Abre el archivo utilizando la syscall 'open' en modo solo lectura (O_RDONLY).
- * 3. Transferencia Bufferizada: Implementa un ciclo de lectura/escritura ('read' -> 'write') usando 
- * un buffer de 1KB. Escribe directamente en STDOUT_FILENO (descriptor 1), lo cual es más eficiente 
- * y seguro para datos binarios que usar funciones de alto nivel como 'printf'.
- * 4. Gestión de Recursos: Garantiza el cierre del descriptor de archivo ('close') al finalizar, 
- * evitando fugas de recursos en el shell.
+ * Hilo escritor: tras cada lote, si 'shell.log' o 'sistema_error.log' (que escribe el hilo principal)
+ * acumularon un bloque desde lo último indexado, extiende su índice. Un lseek por archivo y por lote.
  */
-void ejecutar_cat(char *archivo) {
-    if (!archivo) { fprintf(stderr, "cat: falta argumento\n"); return; }
-    
-    // Verificamos permisos de lectura según políticas del Sandbox
-    if (!validar_entorno_seguro(archivo, "cat")) return;
-    
-    int fd = open(archivo, O_RDONLY);
-    if (fd < 0) { reportar_error_sistema("cat"); return; }
-    
-    char buffer[1024];
-    ssize_t n;
-    // Leemos del archivo y escribimos directamente a la salida estándar (pantalla)
-    while ((n = read(fd, buffer, sizeof(buffer))) > 0) write(STDOUT_FILENO, buffer, n);
-    
-    printf("\n"); // Salto de línea estético al final
-    close(fd);
-    log_shell("cat", "Lectura exitosa", "INFO");
+static void auditoria_indexar(void) {
+    static uint64_t indexado[2];
+    int fds[2] = { logger.fd_shell, logger.fd_error };
+    static const char *const nombres[2] = { "shell.log", "sistema_error.log" };
+    for (int i = 0; i < 2; i++) {
+        if (fds[i] < 0) continue;
+        off_t fin = lseek(fds[i], 0, SEEK_END);
+        if (fin < 0) continue;
+        if ((uint64_t)fin < indexado[i]) indexado[i] = 0; // Log rotado: el índice se reconstruye
+        if ((uint64_t)fin < indexado[i] + AUDIT_BLOQUE) continue;
+        char ruta[PATH_MAX + 32];
+        snprintf(ruta, sizeof(ruta), "%s/%s", logger.directorio, nombres[i]);
+        indexado[i] = indice_extender(ruta);
+    }
 }
 
-// --- Comando Built-in Opcional: grep (Global Regular Expression Print) ---
+// --- Hilo Escritor del Logger ---
 
 /*
- * Implementa una utilidad de búsqueda de patrones de texto simple dentro de archivos.
- * Funcionalidad:
- * 1. Objetivo (Valor Agregado): Cumple con el requerimiento opcional del TP de procesar texto 
- * y buscar cadenas específicas sin invocar utilitarios externos.
- * 2. Seguridad (Sandbox): Al igual que los comandos críticos, valida mediante 'validar_entorno_seguro' 
- * que el archivo a analizar resida en el espacio de usuario permitido ($HOME).
- * 3. Procesamiento de Texto: Utiliza I/O estándar (stdio.h) con 'fopen' y 'fgets'. Esto es ideal 
- * para lectura línea por línea, a diferencia de la lectura por bloques de bytes usada en 'cp'.
- * 4. Algoritmo de Búsqueda: Emplea 'strstr' (string.h) para verificar la existencia de la subcadena 
- * 'patron' dentro de cada línea leída.
- * 5. Auditoría Estadística: No solo registra el éxito de la operación, sino que contabiliza y loguea 
- * el número exacto de coincidencias encontradas, enriqueciendo la información de auditoría.
+ * Drena hasta el final del anillo en un único write() por lote (o copiando al segmento binario).
+ * Se llama con el mutex tomado; lo libera mientras formatea y escribe para no bloquear a los productores
+ * (el formateo solo lee las ranuras [cola, cabeza), que los productores no pisan hasta que avance 'cola').
  */
-void ejecutar_grep(char *patron, char *archivo) {
-    if (!patron || !archivo) { fprintf(stderr, "grep: faltan argumentos\n"); return; }
-    
-    // Verificamos permisos de lectura (Sandbox)
-    if (!validar_entorno_seguro(archivo, "grep")) return;
-    
-    FILE *fp = fopen(archivo, "r");
-    if (!fp) { reportar_error_sistema("grep"); return; }
-    
-    char linea[1024];
-    int count = 0;
-    // Leemos el archivo línea por línea hasta el final (EOF)
-    while (fgets(linea, sizeof(linea), fp)) {
-        // strstr devuelve un puntero si encuentra el patrón, o NULL si no
-        if (strstr(linea, patron)) { 
-            printf("%s", linea); // Imprimimos la línea completa que contiene el patrón
-            count++; 
+static void drenar_anillo(void) {
+    static char lote[LOG_BUFFER_LOTE];
+    while (logger.cola != logger.cabeza) {
+        unsigned long desde = logger.cola, hasta = logger.cabeza;
+        pthread_mutex_unlock(&logger.mutex);
+
+        if (logger.binario) {
+            for (unsigned long i = desde; i != hasta; i++) binlog_escribir(&logger.anillo[i % LOG_CAPACIDAD_ANILLO], 0);
+            if (logger.politica_fsync == FSYNC_POR_LOTE) binlog_sincronizar();
+            binlog_preparar_siguiente();
+            pthread_mutex_lock(&logger.mutex);
+            logger.cola = hasta;
+            pthread_cond_broadcast(&logger.hay_espacio);
+            continue;
+        }
+
+        size_t usado = 0;
+        unsigned long i = desde;
+        for (; i != hasta; i++) {
+            if (LOG_BUFFER_LOTE - usado < LOG_MAX_CMD + LOG_MAX_MSG + LOG_MAX_PERF + 256) break;
+            usado += formatear_evento(&logger.anillo[i % LOG_CAPACIDAD_ANILLO], lote + usado, LOG_BUFFER_LOTE - usado);
         }
+        if (logger.fd_shell >= 0) {
+            escribir_todo(logger.fd_shell, lote, usado);
+            if (logger.politica_fsync == FSYNC_POR_LOTE) fdatasync(logger.fd_shell);
+        }
+        auditoria_indexar();
+
+        pthread_mutex_lock(&logger.mutex);
+        logger.cola = i;
+        pthread_cond_broadcast(&logger.hay_espacio);
     }
-    fclose(fp);
-    
-    // Registro detallado con métricas
-    char msg[64]; snprintf(msg, 64, "Coincidencias: %d", count);
-    log_shell("grep", msg, "INFO");
 }
-// --- MAIN: Bucle Principal de Ejecución (REPL) ---
 
 /*
- * Punto de entrada y orquestador del Shell. Implementa el ciclo de vida "Read-Eval-Print Loop".
- * Arquitectura y Flujo:
- * 1. Inicialización: Valida variables de entorno críticas ($HOME) para garantizar la integridad del Sandbox.
- * 2. Captura de Entrada: Utiliza 'fgets' para leer la línea de comandos de manera segura.
- * 3. Procesamiento de Redirección (I/O Redirection):
- * - Detecta el operador '>'.
- * - Valida la seguridad del archivo destino (Sandbox).
- * - Manipula la tabla de descriptores de archivo (File Descriptors) usando 'dup' (backup de stdout) 
- * y 'dup2' (reemplazo de stdout por el archivo). Esto permite que la salida de CUALQUIER comando 
- * (printf o write) se escriba en el archivo de forma transparente.
- * 4. Despacho de Comandos (Dispatcher):
- * - Enrutamiento estático para comandos internos (built-ins): ls, cd, rm, echo, etc.
- * 5. Ejecución de Comandos Externos (Process Creation):
- * - Si no es interno, verifica violaciones de seguridad en los argumentos.
- * - Implementa el patrón estándar UNIX:
- * a. fork(): Clona el proceso actual.
- * b. Child: Llama a 'execvp' para reemplazar su imagen de memoria con el nuevo programa.
- * c. Parent: Usa 'wait' para bloquearse hasta que el hijo termine, recogiendo su estado de salida (exit code).
- * 6. Restauración: Al final del ciclo, recupera el stdout original para volver a mostrar el prompt en pantalla.
- */
-int main() {
-    char input[MAX_INPUT_SIZE];
-    char *args[MAX_ARGS];
-    char *home = getenv("HOME");
-    
-    if (!home) { fprintf(stderr, "ERROR FATAL: HOME no definido.\n"); return 1; }
+ * Hilo escritor: espera según la política de flush configurada y drena el anillo por lotes.
+ * Independientemente de la política, se fuerza el drenado cuando el anillo supera 3/4 de su capacidad.
+ * Con FLUSH_INTERVALO el plazo es absoluto y arranca con el primer evento pendiente tras el último drenado:
+ * los despertares por eventos nuevos no lo corren, así que un evento espera a lo sumo un intervalo.
+ */
+static void *hilo_escritor_logs(void *arg) {
+    (void)arg;
+    if (logger.binario) binlog_purgar(); // Borrar segmentos viejos (unlink de varios MB) no demora el arranque
+    struct timespec plazo;
+    int plazo_activo = 0;
+    pthread_mutex_lock(&logger.mutex);
+    while (1) {
+        unsigned long pendientes = logger.cabeza - logger.cola;
+        int lleno = pendientes >= (LOG_CAPACIDAD_ANILLO * 3) / 4;
+        int drenar = logger.terminar || lleno || logger.vaciar;
+
+        if (!drenar) {
+            switch (logger.politica_flush) {
+                case FLUSH_POR_EVENTO: drenar = pendientes > 0; break;
+                case FLUSH_CADA_N:     drenar = pendientes >= (unsigned long)logger.flush_n; break;
+                case FLUSH_INTERVALO:
+                    if (plazo_activo) {
+                        struct timespec ahora;
+                        clock_gettime(CLOCK_REALTIME, &ahora);
+                        drenar = ahora.tv_sec > plazo.tv_sec || (ahora.tv_sec == plazo.tv_sec && ahora.tv_nsec >= plazo.tv_nsec);
+                    }
+                    break;
+                case FLUSH_AL_SALIR:   break;
+            }
+        }
+
+        if (drenar) {
+            logger.vaciar = 0;
+            drenar_anillo();
+            plazo_activo = 0;
+            if (logger.terminar) break;
+            continue;
+        }
+
+        if (logger.politica_flush == FLUSH_INTERVALO && pendientes > 0) {
+            if (!plazo_activo) {
+                clock_gettime(CLOCK_REALTIME, &plazo);
+                plazo.tv_sec += logger.flush_intervalo_ms / 1000;
+                plazo.tv_nsec += (long)(logger.flush_intervalo_ms % 1000) * 1000000L;
+                if (plazo.tv_nsec >= 1000000000L) { plazo.tv_sec++; plazo.tv_nsec -= 1000000000L; }
+                plazo_activo = 1;
+            }
+            // El resultado no importa: al despertar (plazo, evento o terminar) se reevalúa arriba
+            pthread_cond_timedwait(&logger.hay_eventos, &logger.mutex, &plazo);
+        } else {
+            pthread_cond_wait(&logger.hay_eventos, &logger.mutex);
+        }
+    }
+    pthread_mutex_unlock(&logger.mutex);
+    return NULL;
+}
+
+/*
+ * Espera a que el hilo escritor vuelque todo lo encolado hasta ahora, sea cual sea la política de flush.
+ * Quien lee los logs desde el propio shell ('audit') ve así los registros de los comandos anteriores.
+ */
+static void logger_vaciar(void) {
+    pthread_mutex_lock(&logger.mutex);
+    unsigned long hasta = logger.cabeza;
+    while (logger.hilo_activo && (long)(hasta - logger.cola) > 0) {
+        logger.vaciar = 1;
+        pthread_cond_signal(&logger.hay_eventos);
+        pthread_cond_wait(&logger.hay_espacio, &logger.mutex);
+    }
+    pthread_mutex_unlock(&logger.mutex);
+}
+
+/*
+ * Interpreta las variables de entorno de configuración del logger:
+ * - FLSH_LOG_FLUSH: "evento" (por defecto), "n:<N>", "intervalo:<ms>" o "salida".
+ * - FLSH_LOG_FSYNC: "nunca" (por defecto), "lote" o "salida".
+ */
+static void configurar_politicas_log(int por_lotes) {
+    // En modo por lotes el volcado por evento costaría un write() por comando: se agrupa por intervalo
+    // (el plazo es absoluto, así que el log va a lo sumo un intervalo detrás aunque el script sea largo)
+    logger.politica_flush = por_lotes ? FLUSH_INTERVALO : FLUSH_POR_EVENTO;
+    logger.flush_n = 64;
+    logger.flush_intervalo_ms = 200;
+    logger.politica_fsync = FSYNC_NUNCA;
+
+    char *flush = getenv("FLSH_LOG_FLUSH");
+    if (flush != NULL) {
+        if (strncmp(flush, "n:", 2) == 0 && atoi(flush + 2) > 0) {
+            logger.politica_flush = FLUSH_CADA_N;
+            logger.flush_n = atoi(flush + 2);
+            if (logger.flush_n > (LOG_CAPACIDAD_ANILLO * 3) / 4) logger.flush_n = (LOG_CAPACIDAD_ANILLO * 3) / 4;
+        } else if (strncmp(flush, "intervalo:", 10) == 0 && atoi(flush + 10) > 0) {
+            logger.politica_flush = FLUSH_INTERVALO;
+            logger.flush_intervalo_ms = atoi(flush + 10);
+        } else if (strcmp(flush, "salida") == 0) {
+            logger.politica_flush = FLUSH_AL_SALIR;
+        }
+    }
+
+    char *fsync_env = getenv("FLSH_LOG_FSYNC");
+    if (fsync_env != NULL) {
+        if (strcmp(fsync_env, "lote") == 0) logger.politica_fsync = FSYNC_POR_LOTE;
+        else if (strcmp(fsync_env, "salida") == 0) logger.politica_fsync = FSYNC_AL_SALIR;
+    }
+}
+
+/*
+ * Manejadores de fork (pthread_atfork): el mutex se toma antes del fork para que el hijo no herede
+ * un lock en estado inconsistente. En el hijo no existe el hilo escritor, por lo que el logger pasa
+ * a modo síncrono y descarta los eventos pendientes (pertenecen al padre, que los escribirá).
+ */
+static void logger_antes_fork(void) {
+    pthread_mutex_lock(&logger.mutex);
+    pthread_mutex_lock(&binlog.mutex);
+}
+static void logger_despues_fork_padre(void) {
+    pthread_mutex_unlock(&binlog.mutex);
+    pthread_mutex_unlock(&logger.mutex);
+}
+static void logger_despues_fork_hijo(void) {
+    logger.hilo_activo = 0;
+    logger.cola = logger.cabeza;
+    logger.retener = logger.hay_retenido = logger.hubo_error = 0;
+    if (logger.binario) {
+        // Los segmentos heredados son del padre: el hijo abre uno propio y pequeño si llega a registrar algo
+        binlog.actual = binlog.siguiente = (segmento_binlog_t){ .fd = -1 };
+        binlog.tam_segmento = BINLOG_SEGMENTO_MINIMO;
+    }
+    pthread_mutex_unlock(&binlog.mutex);
+    pthread_mutex_unlock(&logger.mutex);
+}
+
+/*
+ * Cierre ordenado del logger (registrado con atexit): detiene el hilo escritor tras drenar el anillo
+ * y aplica la política de fsync de salida. Solo actúa en el proceso dueño del logger.
+ */
+void cerrar_logger(void) {
+    if (logger.pid_dueno != getpid()) return;
+    if (logger.hilo_activo) {
+        pthread_mutex_lock(&logger.mutex);
+        logger.terminar = 1;
+        pthread_cond_signal(&logger.hay_eventos);
+        pthread_mutex_unlock(&logger.mutex);
+        pthread_join(logger.hilo, NULL);
+        logger.hilo_activo = 0;
+    }
+    if (logger.politica_fsync != FSYNC_NUNCA && logger.fd_shell >= 0) fdatasync(logger.fd_shell);
+    if (logger.binario) {
+        pthread_mutex_lock(&binlog.mutex);
+        segmento_cerrar(&binlog.actual);
+        segmento_descartar(&binlog.siguiente);
+        pthread_mutex_unlock(&binlog.mutex);
+    }
+}
+
+/*
+ * Inicializa el subsistema de logging una única vez por sesión:
+ * 1. Resuelve el directorio de logs (obtener_ruta_logs) y lo crea si no existe.
+ * 2. Abre 'shell.log' y 'sistema_error.log' con O_APPEND (escrituras atómicas entre sesiones concurrentes).
+ * Con FLSH_LOG_FORMATO=binario los eventos van a segmentos mapeados (binlog_iniciar) y solo se abre
+ * 'sistema_error.log', como respaldo de los hijos que no pueden crear su segmento (Landlock).
+ * 3. Cachea usuario (getpwuid del uid real) e IP de origen (SSH_CONNECTION), que no cambian durante la sesión.
+ * 4. Lanza el hilo escritor. Si no puede crearse, el logger queda en modo síncrono.
+ * 'por_lotes' (modo no interactivo) cambia la política de volcado por defecto a 'intervalo:200'.
+ */
+void iniciar_logger(int por_lotes) {
+    char directorio_logs[PATH_MAX];
+    char ruta_archivo[PATH_MAX + 32];
+    obtener_ruta_logs(directorio_logs, sizeof(directorio_logs));
+    mkdir(directorio_logs, 0755);
+    snprintf(logger.directorio, sizeof(logger.directorio), "%s", directorio_logs);
+
+    // El usuario sale de la base de cuentas, no de $USER: audit filtra por este nombre y el entorno lo
+    // controla quien ejecuta el shell (igual que 'iniciar_sesion_servidor' con pw_name)
+    struct passwd *pw = getpwuid(getuid());
+    const char *usuario = pw ? pw->pw_name : NULL;
+
+    // --- OBTENCIÓN DE IP (Valor Agregado: Seguridad/Red) ---
+    char origen[sizeof(logger.ip_origen)] = "LOCAL/CONSOLE";
+    char *ssh_connection = getenv("SSH_CONNECTION");
+    // SSH_CONNECTION fmt: "IP_CLIENTE PUERTO IP_SERVER PUERTO"
+    if (ssh_connection != NULL) sscanf(ssh_connection, "%47s", origen);
+    identificar_sesion_log((uint32_t)getuid(), usuario ? usuario : "unknown", origen);
+
+    configurar_politicas_log(por_lotes);
+    char *formato = getenv("FLSH_LOG_FORMATO");
+    if (formato != NULL && strcmp(formato, "binario") == 0) {
+        if (binlog_iniciar(directorio_logs) == 0) logger.binario = 1;
+        else fprintf(stderr, "flsh: no se pudo crear un segmento de log en %s, se usa el formato de texto\n", directorio_logs);
+    }
+    if (!logger.binario) {
+        snprintf(ruta_archivo, sizeof(ruta_archivo), "%s/shell.log", directorio_logs);
+        logger.fd_shell = open(ruta_archivo, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    }
+    snprintf(ruta_archivo, sizeof(ruta_archivo), "%s/sistema_error.log", directorio_logs);
+    logger.fd_error = open(ruta_archivo, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+
+    logger.pid_dueno = getpid();
+    pthread_atfork(logger_antes_fork, logger_despues_fork_padre, logger_despues_fork_hijo);
+
+    if (pthread_create(&logger.hilo, NULL, hilo_escritor_logs, NULL) == 0) logger.hilo_activo = 1;
+    atexit(cerrar_logger);
+}
+
+static int es_nivel_error(const char *nivel) { return strcmp(nivel, "ERROR") == 0 || strcmp(nivel, "CRITICAL") == 0; }
+
+/*
+ * Respaldo del formato binario cuando no hay segmento (hijo bajo Landlock fuera del directorio de
+ * logs): el evento se escribe como texto en 'sistema_error.log', con la fecha actual.
+ */
+static void publicar_como_texto(const evento_log_t *ev) {
+    if (logger.fd_error < 0) return;
+    evento_log_t copia = *ev;
+    clock_gettime(CLOCK_REALTIME, &copia.instante);
+    char linea[LOG_MAX_CMD + LOG_MAX_MSG + LOG_MAX_PERF + 256];
+    size_t len = formatear_evento(&copia, linea, sizeof(linea));
+    escribir_todo(logger.fd_error, linea, len);
+}
+
+/*
+ * Sesión de 'flsh --servidor': el evento viaja al escritor del daemon por el canal de la sesión (un
+ * mensaje SEQPACKET por evento). Un error espera el acuse del daemon, que llega cuando ya está escrito
+ * y sincronizado: sigue siendo durable antes de que el comando retorne.
+ */
+static void publicar_en_servidor(const evento_log_t *ev) {
+    int errno_guardado = errno;
+    pthread_mutex_lock(&logger.mutex);
+    if (send(logger.fd_servidor, ev, sizeof(*ev), MSG_NOSIGNAL) == (ssize_t)sizeof(*ev) && es_nivel_error(ev->nivel)) {
+        char acuse;
+        while (recv(logger.fd_servidor, &acuse, 1, 0) < 0 && errno == EINTR) {}
+    }
+    pthread_mutex_unlock(&logger.mutex);
+    errno = errno_guardado;
+}
+
+// Escribe (errores) o encola (resto) un evento ya construido
+static void publicar_evento(const evento_log_t *ev) {
+    if (logger.fd_servidor >= 0) { publicar_en_servidor(ev); return; }
+    if (logger.binario && (es_nivel_error(ev->nivel) || !logger.hilo_activo)) {
+        // Síncrono: errores (durables) y procesos sin hilo escritor
+        if (binlog_escribir(ev, es_nivel_error(ev->nivel)) != 0) publicar_como_texto(ev);
+        return;
+    }
+    // Lógica para separar archivos según criticidad (Requisito TP)
+    if (es_nivel_error(ev->nivel)) {
+        if (logger.fd_error < 0) return;
+        char linea[LOG_MAX_CMD + LOG_MAX_MSG + LOG_MAX_PERF + 256];
+        size_t len = formatear_evento(ev, linea, sizeof(linea));
+        escribir_todo(logger.fd_error, linea, len);
+        fdatasync(logger.fd_error);
+        return;
+    }
+
+    if (logger.fd_shell < 0 && !logger.binario) return;
+
+    pthread_mutex_lock(&logger.mutex);
+    if (!logger.hilo_activo) {
+        // Modo síncrono (hijos de fork o sin hilo escritor): formateamos y escribimos directamente
+        pthread_mutex_unlock(&logger.mutex);
+        char linea[LOG_MAX_CMD + LOG_MAX_MSG + LOG_MAX_PERF + 256];
+        size_t len = formatear_evento(ev, linea, sizeof(linea));
+        escribir_todo(logger.fd_shell, linea, len);
+        return;
+    }
+    // Si el anillo está lleno esperamos a que el escritor libere espacio: nunca descartamos auditoría
+    while (logger.cabeza - logger.cola >= LOG_CAPACIDAD_ANILLO) {
+        pthread_cond_signal(&logger.hay_eventos);
+        pthread_cond_wait(&logger.hay_espacio, &logger.mutex);
+    }
+    logger.anillo[logger.cabeza % LOG_CAPACIDAD_ANILLO] = *ev;
+    logger.cabeza++;
+    // Por intervalo o al salir el escritor solo necesita enterarse del primer pendiente (arma el plazo)
+    // y del umbral de 3/4; despertarlo por cada evento sería un cambio de contexto por comando
+    unsigned long pendientes = logger.cabeza - logger.cola;
+    int diferible = logger.politica_flush == FLUSH_INTERVALO || logger.politica_flush == FLUSH_AL_SALIR;
+    if (!diferible || pendientes == 1 || pendientes >= (LOG_CAPACIDAD_ANILLO * 3) / 4) pthread_cond_signal(&logger.hay_eventos);
+    pthread_mutex_unlock(&logger.mutex);
+}
+
+/*
+ * Orquesta el sistema de auditoría y registro de eventos del Shell.
+ * Funcionalidad:
+ * 1. Clasificación de Criticidad: Implementa lógica de bifurcación para separar flujos:
+ * - Niveles 'ERROR'/'CRITICAL' -> se escriben en 'sistema_error.log' de forma síncrona y con
+ * fdatasync, garantizando que el registro sea durable antes de que el comando retorne.
+ * - Niveles informativos -> se encolan en el anillo en memoria y el hilo escritor los vuelca
+ * a 'shell.log' por lotes, según la política de flush configurada.
+ * 2. Enriquecimiento de Datos (Contexto de Seguridad): el usuario y el origen de la conexión
+ * (IP del cliente SSH o 'LOCAL/CONSOLE') se resuelven una vez al iniciar la sesión.
+ * 3. Persistencia: Cada entrada queda estructurada y temporalizada (timestamp) en modo 'append'.
+ * 4. Telemetría: Mientras un comando se mide, su último evento informativo queda retenido hasta que
+ * 'log_soltar_retenido' le agrega las métricas; los errores no se retienen (siguen siendo síncronos).
+ */
+void log_shell(char *cmd, char *detalles, char *nivel) {
+    evento_log_t ev;
+    clock_gettime(logger.binario ? CLOCK_MONOTONIC : CLOCK_REALTIME, &ev.instante);
+    identificar_evento(&ev);
+    snprintf(ev.nivel, sizeof(ev.nivel), "%s", nivel);
+    snprintf(ev.cmd, sizeof(ev.cmd), "%s", cmd);
+    snprintf(ev.msg, sizeof(ev.msg), "%s", detalles);
+    ev.perf.presente = 0;
+    if (logger.omitir_info && strcmp(nivel, "INFO") == 0) return;
+
+    if (logger.retener && es_nivel_error(nivel)) logger.hubo_error = 1;
+    else if (logger.retener) {
+        // El evento anterior del mismo comando ya no es el último: sale sin métricas
+        evento_log_t anterior;
+        pthread_mutex_lock(&logger.mutex);
+        int habia = logger.hay_retenido;
+        if (habia) anterior = logger.retenido;
+        logger.retenido = ev;
+        logger.hay_retenido = 1;
+        pthread_mutex_unlock(&logger.mutex);
+        if (habia) publicar_evento(&anterior);
+        return;
+    }
+    publicar_evento(&ev);
+}
+
+/*
+ * Cierra la retención de eventos del comando en curso: publica su último evento con 'perf' adjunto.
+ * Si el comando solo registró errores, publica uno propio "Metricas" para 'cmd' (el costo de los
+ * fallos también queda auditado); si no registró nada, tampoco se agrega nada.
+ */
+void log_soltar_retenido(const char *cmd, const perf_evento_t *perf) {
+    evento_log_t ev;
+    pthread_mutex_lock(&logger.mutex);
+    int habia = logger.hay_retenido, hubo_error = logger.hubo_error;
+    if (habia) ev = logger.retenido;
+    logger.retener = logger.hay_retenido = logger.hubo_error = 0;
+    pthread_mutex_unlock(&logger.mutex);
+    if (!habia && !hubo_error) return;
+    if (!habia) {
+        clock_gettime(logger.binario ? CLOCK_MONOTONIC : CLOCK_REALTIME, &ev.instante);
+        identificar_evento(&ev);
+        snprintf(ev.nivel, sizeof(ev.nivel), "INFO");
+        snprintf(ev.cmd, sizeof(ev.cmd), "%s", cmd);
+        snprintf(ev.msg, sizeof(ev.msg), "Metricas");
+        if (logger.omitir_info) return;
+    }
+    ev.perf = *perf;
+    publicar_evento(&ev);
+}
+
+
+/*
+ * Centraliza la gestión de errores del sistema (System Call Errors).
+ * Funcionalidad:
+ * 1. Traducción: Recupera la variable global 'errno' (establecida por la última llamada al sistema fallida)
+ * y la convierte en una descripción textual legible mediante 'strerror'.
+ * 2. Visualización: Imprime el error en el flujo estándar de error (stderr), separándolo del flujo 
+ * de salida normal (stdout) para mantener la limpieza en redirecciones y pipes.
+ * 3. Persistencia: Invoca a 'log_shell' con nivel "ERROR" para asegurar que el incidente quede 
+ * registrado en 'sistema_error.log', cumpliendo con los requisitos de auditoría.
+ */
+void reportar_error_sistema(char *cmd) {
+    char *error_msg = strerror(errno);
+    // fprintf a stderr asegura que el usuario vea el error incluso si redirige stdout
+    fprintf(stderr, "[flsh_error] %s: %s\n", cmd, error_msg);
+    log_shell(cmd, error_msg, "ERROR"); // Usamos nivel ERROR
+    estado_builtin = 1;
+}
+
+// Igual que 'reportar_error_sistema', nombrando el operando que falló (ej. 'ls d nada a.txt')
+void reportar_error_ruta(char *cmd, const char *ruta) {
+    char *error_msg = strerror(errno);
+    fprintf(stderr, "[flsh_error] %s: %s: %s\n", cmd, ruta, error_msg);
+    char msg[LOG_MAX_MSG];
+    snprintf(msg, sizeof(msg), "%s: %s", ruta, error_msg);
+    log_shell(cmd, msg, "ERROR");
+    estado_builtin = 1;
+}
+
+
+// --- Telemetría de Comandos ---
+
+/*
+ * Costo de cada comando de la sesión: tiempo real (CLOCK_MONOTONIC), CPU de usuario/sistema
+ * (getrusage del shell para los built-ins, wait4 para los hijos), RSS máximo de los hijos y bytes
+ * leídos/escritos por los built-ins.
+ * 1. Auditoría: 'telemetria_cerrar' adjunta las cifras al último evento del comando (campo PERF).
+ * 2. Histogramas: uno por nombre de comando, con cubetas log-lineales al estilo HDR: 16 cubetas
+ * exactas para 0-15 ns y luego 8 subcubetas por potencia de 2 (error relativo <= 12.5%) hasta
+ * 2^43 ns (~2.4 h), sin reservar memoria por muestra.
+ * 3. Exportación: con FLSH_METRICS_FILE, una instantánea en formato de texto de Prometheus que se
+ * escribe en un temporal y se renombra (atómica para el lector), como máximo una vez por segundo y al salir.
+ * Los built-ins de un pipeline corren en hijos: de ellos solo se ve la CPU y el RSS (wait4).
+ */
+#define TELEMETRIA_CUBETAS (16 + 39 * 8)
+#define TELEMETRIA_MAX_COMANDOS 64      // Potencia de 2; los nombres que no entran se agrupan en "(otros)"
+#define TELEMETRIA_EXPORTAR_NS 1000000000LL
+
+typedef struct {
+    char nombre[32];
+    uint64_t cuenta, suma_ns, max_ns;
+    uint64_t cpu_usuario_us, cpu_sistema_us;
+    uint64_t leidos, escritos;
+    long rss_max_kb;
+    uint32_t cubetas[TELEMETRIA_CUBETAS];
+} estadistica_comando_t;
+
+static struct {
+    // Comando en curso
+    int midiendo;
+    struct timespec inicio;
+    struct rusage propio;           // getrusage(RUSAGE_SELF) al iniciar: la muestra final del comando anterior
+    int hay_muestra;
+    uint64_t hijos_usuario_us, hijos_sistema_us;
+    long hijos_rss_kb;
+    int hubo_hijos;
+    long pico_base_kb;              // ru_maxrss propio tras el último reinicio del pico
+    uint64_t leidos, escritos;      // Atómicos: grep -r escribe desde sus hilos
+    // Sesión
+    estadistica_comando_t tabla[TELEMETRIA_MAX_COMANDOS];
+    int ocupadas;
+    const char *archivo;            // FLSH_METRICS_FILE
+    int64_t ultima_exportacion_ns;
+} telemetria;
+
+static int cubeta_latencia(uint64_t ns) {
+    if (ns < 16) return (int)ns;
+    int e = 63 - __builtin_clzll(ns);
+    int i = 16 + (e - 4) * 8 + (int)((ns >> (e - 3)) & 7);
+    return (i < TELEMETRIA_CUBETAS) ? i : TELEMETRIA_CUBETAS - 1;
+}
+
+// Límite superior (exclusivo) de la cubeta 'i', en ns
+static uint64_t limite_cubeta(int i) {
+    if (i < 16) return (uint64_t)i + 1;
+    int e = 4 + (i - 16) / 8;
+    return (uint64_t)(9 + (i - 16) % 8) << (e - 3);
+}
+
+static int64_t ns_monotonico(const struct timespec *t) { return (int64_t)t->tv_sec * 1000000000LL + t->tv_nsec; }
+static uint64_t us_timeval(const struct timeval *t) { return (uint64_t)t->tv_sec * 1000000ULL + (uint64_t)t->tv_usec; }
+
+// Bytes movidos por el built-in en curso (ignorado fuera de una medición)
+static void contar_io(uint64_t leidos, uint64_t escritos) {
+    if (!telemetria.midiendo) return;
+    if (leidos) __atomic_fetch_add(&telemetria.leidos, leidos, __ATOMIC_RELAXED);
+    if (escritos) __atomic_fetch_add(&telemetria.escritos, escritos, __ATOMIC_RELAXED);
+}
+
+// Acumula el consumo de un hijo recogido con wait4
+void telemetria_hijo(const struct rusage *ru) {
+    if (!telemetria.midiendo) return;
+    telemetria.hijos_usuario_us += us_timeval(&ru->ru_utime);
+    telemetria.hijos_sistema_us += us_timeval(&ru->ru_stime);
+    if (ru->ru_maxrss > telemetria.hijos_rss_kb) telemetria.hijos_rss_kb = ru->ru_maxrss;
+    telemetria.hubo_hijos = 1;
+}
+
+void telemetria_iniciar(void) {
+    telemetria.hijos_usuario_us = telemetria.hijos_sistema_us = 0;
+    telemetria.hijos_rss_kb = 0;
+    telemetria.hubo_hijos = 0;
+    telemetria.leidos = telemetria.escritos = 0;
+    // Un solo getrusage por comando: la CPU del shell entre comandos (leer y analizar la línea)
+    // se atribuye al comando siguiente
+    if (!telemetria.hay_muestra) getrusage(RUSAGE_SELF, &telemetria.propio);
+    telemetria.hay_muestra = 0;
+    // execve deja en el hijo el pico de RSS de quien lo lanza (con vfork, el del shell): si nuestro
+    // pico creció (ej. grep sobre un mmap grande) se reinicia al RSS actual para no atribuírselo al hijo
+    if (telemetria.propio.ru_maxrss > telemetria.pico_base_kb + 1024) {
+        int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+        if (fd >= 0) { if (write(fd, "5", 1) < 0) {} close(fd); }
+        getrusage(RUSAGE_SELF, &telemetria.propio);
+        telemetria.pico_base_kb = telemetria.propio.ru_maxrss;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &telemetria.inicio);
+    telemetria.midiendo = 1;
+    logger.retener = 1;
+}
+
+static estadistica_comando_t *estadistica_de(const char *nombre) {
+    uint32_t h = hash_builtin(nombre, 0);
+    for (int intento = 0; intento < 2; intento++) {
+        for (uint32_t k = 0; k < TELEMETRIA_MAX_COMANDOS; k++) {
+            estadistica_comando_t *e = &telemetria.tabla[(h + k) & (TELEMETRIA_MAX_COMANDOS - 1)];
+            if (e->cuenta && strncmp(e->nombre, nombre, sizeof(e->nombre) - 1) == 0) return e;
+            if (!e->cuenta) {
+                // La última ranura libre queda para "(otros)"
+                if (intento == 0 && telemetria.ocupadas >= TELEMETRIA_MAX_COMANDOS - 1) break;
+                snprintf(e->nombre, sizeof(e->nombre), "%s", nombre);
+                telemetria.ocupadas++;
+                return e;
+            }
+        }
+        nombre = "(otros)";
+        h = hash_builtin(nombre, 0);
+    }
+    return NULL;
+}
+
+static void exportar_metricas(void);
+
+/*
+ * Cierra la medición del comando 'nombre': actualiza su histograma, adjunta las cifras a su evento
+ * de auditoría y, si corresponde, refresca la exportación.
+ */
+void telemetria_cerrar(const char *nombre) {
+    if (!telemetria.midiendo) return;
+    struct timespec fin;
+    struct rusage ahora;
+    clock_gettime(CLOCK_MONOTONIC, &fin);
+    getrusage(RUSAGE_SELF, &ahora);
+    telemetria.midiendo = 0;
+
+    uint64_t ns = (uint64_t)(ns_monotonico(&fin) - ns_monotonico(&telemetria.inicio));
+    uint64_t usuario = us_timeval(&ahora.ru_utime) - us_timeval(&telemetria.propio.ru_utime) + telemetria.hijos_usuario_us;
+    uint64_t sistema = us_timeval(&ahora.ru_stime) - us_timeval(&telemetria.propio.ru_stime) + telemetria.hijos_sistema_us;
+    telemetria.propio = ahora;
+    telemetria.hay_muestra = 1;
+
+    estadistica_comando_t *e = estadistica_de(nombre);
+    if (e) {
+        e->cuenta++;
+        e->suma_ns += ns;
+        if (ns > e->max_ns) e->max_ns = ns;
+        e->cubetas[cubeta_latencia(ns)]++;
+        e->cpu_usuario_us += usuario;
+        e->cpu_sistema_us += sistema;
+        e->leidos += telemetria.leidos;
+        e->escritos += telemetria.escritos;
+        if (telemetria.hijos_rss_kb > e->rss_max_kb) e->rss_max_kb = telemetria.hijos_rss_kb;
+    }
+
+    perf_evento_t perf = { .presente = 1, .con_hijos = telemetria.hubo_hijos, .ns = ns, .usuario_us = usuario,
+                           .sistema_us = sistema, .leidos = telemetria.leidos, .escritos = telemetria.escritos,
+                           .rss_kb = telemetria.hijos_rss_kb };
+    log_soltar_retenido(nombre, &perf);
+
+    if (telemetria.archivo && ns_monotonico(&fin) - telemetria.ultima_exportacion_ns >= TELEMETRIA_EXPORTAR_NS) {
+        telemetria.ultima_exportacion_ns = ns_monotonico(&fin);
+        exportar_metricas();
+    }
+}
+
+// Valor de etiqueta de Prometheus: escapa '\', '"' y saltos de línea
+static void etiqueta_prometheus(char *destino, size_t tam, const char *valor) {
+    size_t j = 0;
+    for (; *valor && j + 2 < tam; valor++) {
+        if (*valor == '\\' || *valor == '"') destino[j++] = '\\';
+        else if (*valor == '\n') { destino[j++] = '\\'; destino[j++] = 'n'; continue; }
+        destino[j++] = *valor;
+    }
+    destino[j] = '\0';
+}
+
+/*
+ * Escribe la instantánea en '<archivo>.tmp.<pid>' y la renombra sobre FLSH_METRICS_FILE. Los
+ * histogramas se exportan con límites decimales fijos (100us ... 10s) sumando las cubetas HDR cuyo
+ * límite superior no los supera.
+ */
+static void exportar_metricas(void) {
+    static const double limites_s[] = { 0.0001, 0.001, 0.01, 0.1, 1, 10 };
+    enum { N_LIMITES = sizeof(limites_s) / sizeof(limites_s[0]) };
+    char temporal[PATH_MAX + 32];
+    snprintf(temporal, sizeof(temporal), "%s.tmp.%d", telemetria.archivo, (int)getpid());
+    int fd = open(temporal, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    FILE *f = fdopen(fd, "w");
+    if (!f) { close(fd); unlink(temporal); return; }
+
+    fprintf(f, "# HELP flsh_command_duration_seconds Tiempo real de los comandos de la sesion.\n"
+               "# TYPE flsh_command_duration_seconds histogram\n");
+    for (int i = 0; i < TELEMETRIA_MAX_COMANDOS; i++) {
+        const estadistica_comando_t *e = &telemetria.tabla[i];
+        if (!e->cuenta) continue;
+        char nombre[2 * sizeof(e->nombre)];
+        etiqueta_prometheus(nombre, sizeof(nombre), e->nombre);
+        uint64_t acumulado = 0;
+        int c = 0;
+        for (int l = 0; l < N_LIMITES; l++) {
+            uint64_t limite_ns = (uint64_t)(limites_s[l] * 1e9);
+            for (; c < TELEMETRIA_CUBETAS && limite_cubeta(c) <= limite_ns; c++) acumulado += e->cubetas[c];
+            fprintf(f, "flsh_command_duration_seconds_bucket{command=\"%s\",le=\"%g\"} %llu\n", nombre, limites_s[l], (unsigned long long)acumulado);
+        }
+        fprintf(f, "flsh_command_duration_seconds_bucket{command=\"%s\",le=\"+Inf\"} %llu\n", nombre, (unsigned long long)e->cuenta);
+        fprintf(f, "flsh_command_duration_seconds_sum{command=\"%s\"} %.9f\n", nombre, e->suma_ns / 1e9);
+        fprintf(f, "flsh_command_duration_seconds_count{command=\"%s\"} %llu\n", nombre, (unsigned long long)e->cuenta);
+    }
+    fprintf(f, "# HELP flsh_command_cpu_seconds_total CPU consumida por los comandos (shell e hijos).\n"
+               "# TYPE flsh_command_cpu_seconds_total counter\n");
+    for (int i = 0; i < TELEMETRIA_MAX_COMANDOS; i++) {
+        const estadistica_comando_t *e = &telemetria.tabla[i];
+        if (!e->cuenta) continue;
+        char nombre[2 * sizeof(e->nombre)];
+        etiqueta_prometheus(nombre, sizeof(nombre), e->nombre);
+        fprintf(f, "flsh_command_cpu_seconds_total{command=\"%s\",mode=\"user\"} %.6f\n", nombre, e->cpu_usuario_us / 1e6);
+        fprintf(f, "flsh_command_cpu_seconds_total{command=\"%s\",mode=\"system\"} %.6f\n", nombre, e->cpu_sistema_us / 1e6);
+    }
+    fprintf(f, "# HELP flsh_command_io_bytes_total Bytes leidos y escritos por los comandos internos.\n"
+               "# TYPE flsh_command_io_bytes_total counter\n");
+    for (int i = 0; i < TELEMETRIA_MAX_COMANDOS; i++) {
+        const estadistica_comando_t *e = &telemetria.tabla[i];
+        if (!e->cuenta || (!e->leidos && !e->escritos)) continue;
+        char nombre[2 * sizeof(e->nombre)];
+        etiqueta_prometheus(nombre, sizeof(nombre), e->nombre);
+        fprintf(f, "flsh_command_io_bytes_total{command=\"%s\",direction=\"read\"} %llu\n", nombre, (unsigned long long)e->leidos);
+        fprintf(f, "flsh_command_io_bytes_total{command=\"%s\",direction=\"write\"} %llu\n", nombre, (unsigned long long)e->escritos);
+    }
+    fprintf(f, "# HELP flsh_command_max_rss_bytes Maximo RSS observado en los procesos hijos del comando.\n"
+               "# TYPE flsh_command_max_rss_bytes gauge\n");
+    for (int i = 0; i < TELEMETRIA_MAX_COMANDOS; i++) {
+        const estadistica_comando_t *e = &telemetria.tabla[i];
+        if (!e->cuenta || !e->rss_max_kb) continue;
+        char nombre[2 * sizeof(e->nombre)];
+        etiqueta_prometheus(nombre, sizeof(nombre), e->nombre);
+        fprintf(f, "flsh_command_max_rss_bytes{command=\"%s\"} %ld\n", nombre, e->rss_max_kb * 1024);
+    }
+    int error = ferror(f);
+    if (fclose(f) != 0 || error || rename(temporal, telemetria.archivo) != 0) unlink(temporal);
+}
+
+// Exportación final (atexit): refleja también los comandos de la última fracción de segundo
+static void telemetria_al_salir(void) {
+    if (telemetria.archivo) exportar_metricas();
+}
+
+void iniciar_telemetria(void) {
+    const char *archivo = getenv("FLSH_METRICS_FILE");
+    if (archivo && *archivo) {
+        telemetria.archivo = archivo;
+        atexit(telemetria_al_salir);
+    }
+}
+
+
+// --- Capa de Salida Unificada ---
+
+/*
+ * Todo lo que los built-ins escriben en stdout pasa por un único buffer de proceso.
+ * Funcionalidad:
+ * 1. Vaciado: al terminar cada comando en una sesión interactiva o con redirección ('main'), al
+ * llenarse, y antes de ceder stdout a otro proceso o de esperar una respuesta del usuario.
+ * 2. Tamaño según el destino, detectado con fstat cada vez que stdout cambia (redirección, etapa
+ * de pipeline): terminal 4 KB vaciando por línea, pipe 64 KB (su capacidad), archivo 256 KB.
+ * 3. Si stdout y stderr son el mismo archivo (2>&1) también se vacía por línea, para que los
+ * mensajes de error queden intercalados igual que en la terminal.
+ * 4. Una escritura grande con datos pendientes sale en un único writev (buffer + datos) sin copiarse.
+ */
+#define SALIDA_TERMINAL (4 * 1024)
+#define SALIDA_PIPE (64 * 1024)
+#define SALIDA_ARCHIVO (256 * 1024)
+
+static struct {
+    char *buffer;       // SALIDA_ARCHIVO bytes, reservado una vez
+    size_t usado;
+    size_t limite;      // Capacidad efectiva según el destino
+    int por_linea;
+    int error;          // Escritura fallida: se descarta el resto de la salida del comando
+} salida;
+
+void salida_configurar(void) {
+    struct stat st_salida, st_error;
+    int es_terminal = isatty(STDOUT_FILENO);
+    int valido = fstat(STDOUT_FILENO, &st_salida) == 0;
+    if (!salida.buffer) salida.buffer = malloc(SALIDA_ARCHIVO);
+    salida.limite = !salida.buffer ? 0 : es_terminal ? SALIDA_TERMINAL
+                  : (valido && S_ISFIFO(st_salida.st_mode)) ? SALIDA_PIPE : SALIDA_ARCHIVO;
+    salida.por_linea = es_terminal || (valido && fstat(STDERR_FILENO, &st_error) == 0 &&
+                       st_salida.st_dev == st_error.st_dev && st_salida.st_ino == st_error.st_ino);
+    salida.error = 0;
+}
+
+// Escribe los segmentos completos, reintentando escrituras parciales
+static void salida_escribir_segmentos(struct iovec *iov, int n) {
+    while (n > 0 && !salida.error) {
+        ssize_t escritos = writev(STDOUT_FILENO, iov, n);
+        if (escritos < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EPIPE) reportar_error_sistema("stdout");
+            salida.error = 1;
+            return;
+        }
+        contar_io(0, (uint64_t)escritos);
+        while (n > 0 && (size_t)escritos >= iov->iov_len) { escritos -= iov->iov_len; iov++; n--; }
+        if (n > 0) { iov->iov_base = (char *)iov->iov_base + escritos; iov->iov_len -= escritos; }
+    }
+}
+
+// Retorna 1 si se perdió salida del comando (escritura fallida, ej. el lector del pipe terminó)
+int salida_volcar(void) {
+    if (salida.usado > 0) {
+        struct iovec iov = { salida.buffer, salida.usado };
+        salida_escribir_segmentos(&iov, 1);
+    }
+    int fallo = salida.error;
+    salida.usado = 0;
+    salida.error = 0; // El siguiente comando vuelve a intentarlo
+    return fallo;
+}
+
+void salida_escribir(const void *datos, size_t n) {
+    if (salida.error || n == 0) return;
+    if (salida.usado + n > salida.limite) {
+        if (n >= salida.limite / 2) {
+            struct iovec iov[2] = { { salida.buffer, salida.usado }, { (void *)datos, n } };
+            int inicio = salida.usado ? 0 : 1;
+            salida_escribir_segmentos(iov + inicio, 2 - inicio);
+            salida.usado = 0;
+            return;
+        }
+        salida_volcar();
+    }
+    memcpy(salida.buffer + salida.usado, datos, n);
+    salida.usado += n;
+    if (salida.por_linea && memchr(datos, '\n', n)) salida_volcar();
+}
+
+void salida_texto(const char *texto) { salida_escribir(texto, strlen(texto)); }
+
+void salida_printf(const char *formato, ...) {
+    if (salida.error) return;
+    va_list ap;
+    for (int intento = 0; intento < 2; intento++) {
+        size_t libre = salida.limite - salida.usado;
+        va_start(ap, formato);
+        int n = vsnprintf(salida.buffer + salida.usado, libre, formato, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if ((size_t)n < libre) {
+            const char *inicio = salida.buffer + salida.usado;
+            salida.usado += n;
+            if (salida.por_linea && memchr(inicio, '\n', n)) salida_volcar();
+            return;
+        }
+        if (intento == 0 && salida.usado > 0) { salida_volcar(); continue; }
+        // Más grande que el buffer entero: se formatea aparte
+        char *texto = NULL;
+        va_start(ap, formato);
+        n = vasprintf(&texto, formato, ap);
+        va_end(ap);
+        if (n >= 0) { salida_escribir(texto, n); free(texto); }
+        return;
+    }
+}
+
+
+// --- Lectura de Entrada por Lotes (Modo No Interactivo) ---
+
+/*
+ * Fuente de líneas para el modo no interactivo ('flsh -c', 'flsh script' o stdin que no es terminal):
+ * - Script regular: se mapea completo con mmap (sin read() por línea).
+ * - Pipes/stdin: se lee en bloques de LECTOR_BLOQUE bytes y se cortan las líneas en memoria.
+ * - 'flsh -c': la cadena del argumento se usa directamente como buffer.
+ * Cada línea se copia al buffer del REPL (el parser trabaja sobre memoria escribible).
+ */
+#define LECTOR_BLOQUE (64 * 1024)
+
+typedef struct {
+    int fd;                 // -1 si la fuente es un buffer fijo (mmap o -c)
+    char *datos;
+    size_t largo, pos;
+    size_t capacidad;       // Solo para lectura por bloques
+    int mapeado;
+} lector_t;
+
+// Lector activo cuando los comandos vienen por stdin: 'confirmar_accion' debe consumir de él
+static lector_t *lector_stdin = NULL;
+
+void lector_desde_cadena(lector_t *l, const char *texto) {
+    memset(l, 0, sizeof(*l));
+    l->fd = -1;
+    l->datos = (char *)texto;
+    l->largo = strlen(texto);
+}
+
+/*
+ * Script regular -> mmap; cualquier otra cosa -> bloques. stdin nunca se mapea: su offset debe
+ * avanzar con lo consumido. El lector se queda con 'fd'. Retorna 0 o -1 con errno.
+ */
+int lector_desde_fd(lector_t *l, int fd) {
+    memset(l, 0, sizeof(*l));
+    l->fd = fd;
+    struct stat st;
+    if (fd != STDIN_FILENO && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m != MAP_FAILED) {
+            madvise(m, (size_t)st.st_size, MADV_SEQUENTIAL);
+            l->datos = m; l->largo = (size_t)st.st_size; l->mapeado = 1; l->fd = -1;
+            close(fd); // El mapeo se mantiene sin el descriptor
+            return 0;
+        }
+    }
+    l->capacidad = LECTOR_BLOQUE;
+    l->datos = malloc(l->capacidad);
+    return l->datos ? 0 : -1;
+}
+
+void lector_cerrar(lector_t *l) {
+    if (l->mapeado) munmap(l->datos, l->largo);
+    else if (l->capacidad) free(l->datos);
+    l->datos = NULL;
+}
+
+/*
+ * Copia la próxima línea (sin '\n') en '*destino', que crece con realloc como en getline(3) y se
+ * reutiliza entre llamadas (sin límite de largo). Retorna su largo o -1 en EOF.
+ */
+ssize_t lector_linea(lector_t *l, char **destino, size_t *capacidad) {
+    for (;;) {
+        char *inicio = l->datos + l->pos;
+        char *nl = memchr(inicio, '\n', l->largo - l->pos);
+        if (nl || l->fd < 0) {
+            if (!nl && l->pos >= l->largo) return -1;
+            size_t n = nl ? (size_t)(nl - inicio) : l->largo - l->pos;
+            if (n + 1 > *capacidad) {
+                size_t nueva = *capacidad ? *capacidad : 128;
+                while (nueva < n + 1) nueva *= 2;
+                char *buffer = realloc(*destino, nueva);
+                if (!buffer) return -1;
+                *destino = buffer; *capacidad = nueva;
+            }
+            l->pos += n + (nl ? 1 : 0);
+            memcpy(*destino, inicio, n);
+            (*destino)[n] = '\0';
+            return (ssize_t)n;
+        }
+        // Bloques: compactamos lo pendiente y leemos más (el buffer crece si una línea no entra)
+        size_t pendiente = l->largo - l->pos;
+        memmove(l->datos, inicio, pendiente);
+        l->largo = pendiente; l->pos = 0;
+        if (l->largo == l->capacidad) {
+            char *nuevo = realloc(l->datos, l->capacidad * 2);
+            if (!nuevo) return -1;
+            l->datos = nuevo; l->capacidad *= 2;
+        }
+        // stdin puede ser conversacional (cliente de 'flsh --servidor'): lo ya producido sale antes de bloquear
+        if (l->fd == STDIN_FILENO) salida_volcar();
+        ssize_t leidos = read(l->fd, l->datos + l->largo, l->capacidad - l->largo);
+        if (leidos < 0 && errno == EINTR) continue;
+        if (leidos <= 0) {
+            // EOF: la última línea puede no terminar en '\n'
+            if (l->fd != STDIN_FILENO) close(l->fd);
+            l->fd = -1;
+            if (l->largo == 0) return -1;
+            continue;
+        }
+        l->largo += (size_t)leidos;
+    }
+}
+
+/*
+ * Implementa un mecanismo de seguridad interactivo (Fail-Safe) para validar operaciones críticas.
+ * Funcionalidad:
+ * 1. Interrupción de Flujo: Detiene la ejecución automática para solicitar consentimiento explícito 
+ * del usuario a través de la salida estándar (stdout).
+ * 2. Lectura Segura de Buffer: Utiliza 'fgets' en lugar de 'scanf' o 'gets' para leer de 'stdin'. 
+ * Esto previene vulnerabilidades de desbordamiento de búfer (buffer overflow) y maneja correctamente 
+ * los caracteres de nueva línea. En modo por lotes con comandos por stdin, la respuesta es la
+ * siguiente línea del lector de lotes (stdin ya fue leído en bloque); con el comando redirigido
+ * ('rm x < respuestas') se lee directamente del descriptor 0, sin el buffer de stdio.
+ * 3. Lógica de Decisión: Evalúa el primer carácter de la entrada. Retorna 1 (verdadero) solo si 
+ * la intención es afirmativa ('s' o 'S'); cualquier otra entrada resulta en un retorno 0 (falso), 
+ * abortando la operación destructiva por defecto (deny-by-default).
+ */
+int confirmar_accion(const char *mensaje) {
+    salida_printf("%s (s/n): ", mensaje);
+    salida_volcar();
+    char respuesta[10];
+    if (entrada_redirigida) {
+        char c = 0;
+        ssize_t leidos = read(STDIN_FILENO, &c, 1);
+        int afirmativa = (leidos == 1 && (c == 's' || c == 'S'));
+        while (leidos == 1 && c != '\n') leidos = read(STDIN_FILENO, &c, 1);
+        return afirmativa;
+    }
+    // Modo por lotes desde stdin: la respuesta es la próxima línea del lector (stdin ya está en su buffer)
+    if (lector_stdin) {
+        static char *linea = NULL;
+        static size_t capacidad = 0;
+        if (lector_linea(lector_stdin, &linea, &capacidad) > 0 && (linea[0] == 's' || linea[0] == 'S')) return 1;
+        return 0;
+    }
+    // fgets es seguro porque limitamos la lectura a sizeof(respuesta)
+    if (fgets(respuesta, sizeof(respuesta), stdin) != NULL) {
+        if (respuesta[0] == 's' || respuesta[0] == 'S') return 1;
+    }
+    return 0;
+}
+
+// --- Sandbox: Política Declarativa Compilada en un Trie de Rutas ---
+
+// Asegura espacio para 'n' elementos de 'tam' bytes en un vector que crece al doble
+static int reservar_vector(void **v, size_t *cap, size_t n, size_t tam) {
+    if (n <= *cap) return 0;
+    size_t nueva = *cap ? *cap : 1024;
+    while (nueva < n) nueva *= 2;
+    void *p = realloc(*v, nueva * tam);
+    if (!p) return -1;
+    *v = p; *cap = nueva;
+    return 0;
+}
+
+
+/*
+ * La política declara qué raíces son accesibles, con qué derecho y para qué comandos. Se lee de
+ * FLSH_POLITICA (o de /etc/flsh/politica si existe); sin archivo rige 'permitir ~ rw', que equivale
+ * al confinamiento histórico en HOME. Formato, una regla por línea ('#' comenta):
+ *   permitir RUTA r|rw [cmd,cmd,...]
+ *   denegar  RUTA [cmd,cmd,...]
+ * - RUTA es absoluta o empieza con '~' (HOME). La raíz de un 'permitir' debe ser un directorio existente.
+ * - Sin lista, la regla vale para todos los comandos; con lista, solo para esos y tiene prioridad sobre
+ * la regla general de la misma ruta. Además de los built-ins se aceptan 'externo' (argumentos de
+ * comandos externos), 'redireccion' (<, >, >>) y 'script' (archivo de 'flsh script').
+ * - Gana la regla de la ruta más larga que contiene al objeto: 'denegar ~/.ssh' recorta 'permitir ~ rw'.
+ * Compilación: cada regla se inserta en un trie de componentes de ruta; el nodo guarda el derecho por
+ * comando y, si un 'permitir' lo nombra, un descriptor O_PATH del directorio (ancla de openat2).
+ * Al terminar, los hijos de todos los nodos se indexan en una tabla hash (padre, componente), así
+ * que consultar es un acceso a la tabla por componente, sin syscalls, aunque un directorio tenga
+ * cientos de raíces debajo.
+ */
+#define POLITICA_MAX_COMANDOS 32
+#define POLITICA_MAX_ARCHIVO (1 << 20)
+
+// Derecho efectivo de una ruta para un comando (orden creciente: cada uno incluye al anterior)
+#define ACCESO_HEREDADO 0      // Sin regla en este nodo: vale la del ancestro
+#define ACCESO_NINGUNO 1
+#define ACCESO_LECTURA 2
+#define ACCESO_ESCRITURA 3
+#define ACCESO_MASCARA 0x03
+#define ACCESO_ESPECIFICO 0x80 // Fijado por una regla con lista de comandos
+
+// Comandos con regla propia: los built-ins en el orden del registro, más tres contextos del shell
+static const char *const comandos_politica[] = {
+#define BUILTIN(nombre, manejador, min_args, max_args, politica, nivel_log) nombre,
+#include "flsh_builtins.def"
+#undef BUILTIN
+    "externo", "redireccion", "script",
+};
+#define POLITICA_N_COMANDOS ((int)(sizeof(comandos_politica) / sizeof(comandos_politica[0])))
+#define COMANDO_EXTERNO (POLITICA_N_COMANDOS - 3)
+#define COMANDO_REDIRECCION (POLITICA_N_COMANDOS - 2)
+#define COMANDO_SCRIPT (POLITICA_N_COMANDOS - 1)
+_Static_assert(sizeof(comandos_politica) / sizeof(comandos_politica[0]) <= POLITICA_MAX_COMANDOS,
+               "POLITICA_MAX_COMANDOS es menor que la cantidad de built-ins");
+
+static int indice_builtin(const char *nombre);
+
+typedef struct {
+    uint32_t nombre;            // Desplazamiento del componente en 'nombres'
+    uint32_t largo;
+    uint32_t hash;              // hash_hijo(padre, componente)
+    int32_t padre, primer_hijo, hermano;
+    int fd;                     // O_PATH del directorio si un 'permitir' lo ancla, o -1
+    uint8_t excepciones;        // Algún descendiente tiene reglas propias
+    uint8_t acceso[POLITICA_MAX_COMANDOS];
+} nodo_politica_t;
+
+typedef struct {
+    nodo_politica_t *nodos;     // nodos[0] es '/'
+    size_t n_nodos, cap_nodos;
+    int32_t *tabla;             // Hash abierto de hijos (índice de nodo, -1 vacía); NULL mientras se compila
+    uint32_t mascara;
+    char *nombres;
+    size_t largo_nombres, cap_nombres;
+    int reglas;
+    int reglas_internas;        // Alguna raíz tiene reglas debajo (ej. 'denegar ~/.ssh')
+    int referencias;            // La publicada cuenta como una; protegido por 'politicas.mutex'
+} politica_t;
+
+typedef struct {
+    int acceso;                 // Derecho efectivo (ACCESO_*)
+    int ancla;                  // Nodo con descriptor más profundo sobre la ruta, o -1
+    const char *resto;          // Ruta relativa al ancla (apunta dentro de la ruta consultada)
+    int nodo;                   // Nodo exacto de la ruta, o -1 si la ruta sale del trie
+} consulta_politica_t;
+
+// FNV-1a del componente mezclado con el padre: clave de la tabla de hijos
+static uint32_t hash_hijo(int padre, const char *nombre, size_t largo) {
+    uint32_t h = 2166136261u ^ ((uint32_t)padre * 0x9E3779B1u);
+    for (size_t i = 0; i < largo; i++) h = (h ^ (unsigned char)nombre[i]) * 16777619u;
+    return h;
+}
+
+static int politica_hijo(const politica_t *p, int padre, const char *nombre, size_t largo) {
+    if (!p->tabla) {
+        // Compilando: lista de hermanos
+        int h = p->nodos[padre].primer_hijo;
+        while (h >= 0 && (p->nodos[h].largo != largo || memcmp(p->nombres + p->nodos[h].nombre, nombre, largo) != 0))
+            h = p->nodos[h].hermano;
+        return h;
+    }
+    uint32_t clave = hash_hijo(padre, nombre, largo);
+    for (uint32_t i = clave & p->mascara;; i = (i + 1) & p->mascara) {
+        int h = p->tabla[i];
+        if (h < 0) return -1;
+        const nodo_politica_t *n = &p->nodos[h];
+        if (n->hash == clave && n->padre == padre && n->largo == largo && memcmp(p->nombres + n->nombre, nombre, largo) == 0) return h;
+    }
+}
+
+/*
+ * Núcleo de la política: desciende por los componentes de 'abs' (absoluta y normalizada) acumulando
+ * el derecho del nodo más profundo con regla para 'comando' y el ancla más profunda. O(profundidad).
+ */
+static void consultar_politica(const politica_t *p, const char *abs, int comando, consulta_politica_t *c) {
+    const nodo_politica_t *v = p->nodos;
+    int i = 0;
+    const char *s = abs;
+    while (*s == '/') s++;
+    c->acceso = v[0].acceso[comando] & ACCESO_MASCARA;
+    c->ancla = (v[0].fd >= 0) ? 0 : -1;
+    c->resto = s;
+    while (*s) {
+        const char *fin = strchrnul(s, '/');
+        int h = politica_hijo(p, i, s, (size_t)(fin - s));
+        if (h < 0) { c->nodo = -1; return; }
+        while (*fin == '/') fin++;
+        i = h;
+        if (v[i].acceso[comando]) c->acceso = v[i].acceso[comando] & ACCESO_MASCARA;
+        if (v[i].fd >= 0) { c->ancla = i; c->resto = fin; }
+        s = fin;
+    }
+    c->nodo = i;
+}
+
+static int politica_agregar_nodo(politica_t *p, int padre, const char *nombre, size_t largo) {
+    if (reservar_vector((void **)&p->nodos, &p->cap_nodos, p->n_nodos + 1, sizeof(nodo_politica_t)) != 0 ||
+        reservar_vector((void **)&p->nombres, &p->cap_nombres, p->largo_nombres + largo + 1, 1) != 0) return -1;
+    nodo_politica_t *n = &p->nodos[p->n_nodos];
+    memset(n, 0, sizeof(*n));
+    n->nombre = (uint32_t)p->largo_nombres;
+    n->largo = (uint32_t)largo;
+    n->padre = padre;
+    n->hash = hash_hijo(padre, nombre, largo);
+    n->primer_hijo = n->hermano = -1;
+    n->fd = -1;
+    memcpy(p->nombres + p->largo_nombres, nombre, largo);
+    p->largo_nombres += largo;
+    if (padre >= 0) {
+        n->hermano = p->nodos[padre].primer_hijo;
+        p->nodos[padre].primer_hijo = (int32_t)p->n_nodos;
+    }
+    return (int)p->n_nodos++;
+}
+
+// Nodo de 'abs' (creando los que falten). Retorna el índice o -1 sin memoria.
+static int politica_insertar(politica_t *p, const char *abs) {
+    int i = 0;
+    for (const char *s = abs; *s;) {
+        while (*s == '/') s++;
+        if (!*s) break;
+        const char *fin = strchrnul(s, '/');
+        int h = politica_hijo(p, i, s, (size_t)(fin - s));
+        if (h < 0 && (h = politica_agregar_nodo(p, i, s, (size_t)(fin - s))) < 0) return -1;
+        i = h;
+        s = fin;
+    }
+    return i;
+}
+
+static void politica_liberar(politica_t *p) {
+    if (!p) return;
+    for (size_t i = 0; i < p->n_nodos; i++) if (p->nodos[i].fd >= 0) close(p->nodos[i].fd);
+    free(p->nodos);
+    free(p->nombres);
+    free(p->tabla);
+    free(p);
+}
+
+// Agrega a 'salida' (de largo '*largo_salida') los componentes de 'p', resolviendo '.', '..' y '//'
+static int agregar_componentes(const char *p, char *salida, size_t *largo_salida, size_t tam) {
+    size_t n = *largo_salida;
+    while (*p) {
+        while (*p == '/') p++;
+        if (!*p) break;
+        const char *fin = strchrnul(p, '/');
+        size_t largo = (size_t)(fin - p);
+        if (largo == 1 && p[0] == '.') {
+            // componente vacío
+        } else if (largo == 2 && p[0] == '.' && p[1] == '.') {
+            while (n > 0 && salida[n - 1] != '/') n--;
+            if (n > 0) n--;
+        } else {
+            if (n + largo + 2 > tam) return -1;
+            salida[n++] = '/';
+            memcpy(salida + n, p, largo);
+            n += largo;
+        }
+        p += largo;
+    }
+    *largo_salida = n;
+    return 0;
+}
+
+/*
+ * Normalización léxica de una ruta absoluta ('.', '..' y '/' repetidas). La resolución real la hace
+ * el kernel bajo RESOLVE_BENEATH desde el ancla, por lo que una normalización "optimista" nunca puede
+ * abrir algo fuera de ella. Retorna 0, o -1 si el resultado no entra en 'tam' (nunca se trunca: un
+ * prefijo de la ruta tendría otro derecho).
+ */
+static int normalizar_ruta_absoluta(const char *entrada, char *salida, size_t tam) {
+    size_t n = 0;
+    if (agregar_componentes(entrada, salida, &n, tam) != 0) return -1;
+    if (n == 0) salida[n++] = '/';
+    salida[n] = '\0';
+    return 0;
+}
+
+/*
+ * Estado del Sandbox, inicializado una vez por sesión en 'iniciar_sandbox':
+ * - HOME se resuelve una sola vez (los '~' de la política y el 'cd' sin argumentos lo usan).
+ * - 'cwd' se actualiza solo en 'cd', evitando getcwd/getenv por cada verificación.
+ */
+#define SANDBOX_DENEGADO (-2)
+
+static struct {
+    char home[PATH_MAX];        // $HOME tal como lo define el entorno
+    size_t home_len;
+    char home_real[PATH_MAX];   // $HOME canónico (realpath una sola vez)
+    size_t home_real_len;
+    char cwd[PATH_MAX];         // Directorio de trabajo absoluto
+    int openat2_disponible;
+} sandbox = { .openat2_disponible = 1 };
+
+// Ruta de usuario -> absoluta y normalizada (las relativas parten de 'cwd', sin concatenar antes)
+static int normalizar_ruta_usuario(const char *ruta, char *salida, size_t tam) {
+    size_t n = 0;
+    if (ruta[0] != '/' && agregar_componentes(sandbox.cwd, salida, &n, tam) != 0) return -1;
+    if (agregar_componentes(ruta, salida, &n, tam) != 0) return -1;
+    if (n == 0) salida[n++] = '/';
+    salida[n] = '\0';
+    return 0;
+}
+
+// Expande '~' y normaliza. Retorna 0, o -1 si la ruta no es absoluta ni empieza con '~'.
+static int expandir_ruta_politica(const char *ruta, const char *home, char *destino, size_t tam) {
+    char expandida[PATH_MAX * 2];
+    if (ruta[0] == '~' && (ruta[1] == '\0' || ruta[1] == '/')) snprintf(expandida, sizeof(expandida), "%s/%s", home, ruta + 1);
+    else if (ruta[0] == '/') snprintf(expandida, sizeof(expandida), "%s", ruta);
+    else return -1;
+    return normalizar_ruta_absoluta(expandida, destino, tam);
+}
+
+/*
+ * Aplica una regla al nodo de 'abs'. 'comandos' NULL = todos (sin pisar las reglas específicas del
+ * mismo nodo). Con 'anclar', el nodo recibe el descriptor de la raíz 'real'.
+ */
+static int politica_aplicar(politica_t *p, const char *abs, int acceso, const uint8_t *comandos, const char *real, int anclar) {
+    int i = politica_insertar(p, abs);
+    if (i < 0) return -1;
+    nodo_politica_t *n = &p->nodos[i];
+    for (int c = 0; c < POLITICA_N_COMANDOS; c++) {
+        if (!comandos && !(n->acceso[c] & ACCESO_ESPECIFICO)) n->acceso[c] = (uint8_t)acceso;
+        else if (comandos && comandos[c]) n->acceso[c] = (uint8_t)(acceso | ACCESO_ESPECIFICO);
+    }
+    if (anclar && n->fd < 0 && (n->fd = open(real, O_PATH | O_DIRECTORY | O_CLOEXEC)) < 0) return -1;
+    return 0;
+}
+
+// Interpreta una línea de la política. Retorna 0, o -1 con la causa en 'error'.
+static int compilar_regla(politica_t *p, char *linea, char *error, size_t tam_error) {
+    char *campos[5], *guardado = NULL;
+    int n = 0;
+    for (char *t = strtok_r(linea, " \t\r", &guardado); t && n < 5; t = strtok_r(NULL, " \t\r", &guardado)) campos[n++] = t;
+    if (n == 0) return 0;
+
+    int permitir = strcmp(campos[0], "permitir") == 0;
+    if (!permitir && strcmp(campos[0], "denegar") != 0) { snprintf(error, tam_error, "regla desconocida '%s'", campos[0]); return -1; }
+    int base = permitir ? 3 : 2;
+    if (n < base || n > base + 1) {
+        snprintf(error, tam_error, "uso: %s", permitir ? "permitir RUTA r|rw [cmd,...]" : "denegar RUTA [cmd,...]");
+        return -1;
+    }
+    int acceso = ACCESO_NINGUNO;
+    if (permitir) {
+        if (strcmp(campos[2], "r") == 0) acceso = ACCESO_LECTURA;
+        else if (strcmp(campos[2], "rw") == 0) acceso = ACCESO_ESCRITURA;
+        else { snprintf(error, tam_error, "acceso inválido '%s' (r o rw)", campos[2]); return -1; }
+    }
+    uint8_t lista[POLITICA_MAX_COMANDOS] = { 0 };
+    if (n == base + 1) {
+        char *guardado_cmd = NULL;
+        for (char *c = strtok_r(campos[base], ",", &guardado_cmd); c; c = strtok_r(NULL, ",", &guardado_cmd)) {
+            int k = 0;
+            while (k < POLITICA_N_COMANDOS && strcmp(comandos_politica[k], c) != 0) k++;
+            if (k == POLITICA_N_COMANDOS) { snprintf(error, tam_error, "comando desconocido '%s'", c); return -1; }
+            lista[k] = 1;
+        }
+    }
+
+    // La misma regla se inserta con HOME canónico, con HOME tal como está en el entorno y con la ruta
+    // real de la raíz: el trie compara componentes léxicos y el usuario puede escribir cualquiera de ellas
+    char formas[3][PATH_MAX];
+    if (expandir_ruta_politica(campos[1], sandbox.home_real, formas[0], PATH_MAX) != 0 ||
+        expandir_ruta_politica(campos[1], sandbox.home, formas[1], PATH_MAX) != 0) {
+        snprintf(error, tam_error, "ruta inválida '%s' (absoluta o con '~')", campos[1]);
+        return -1;
+    }
+    if (realpath(formas[0], formas[2]) == NULL) {
+        if (permitir) { snprintf(error, tam_error, "%s: %s", campos[1], strerror(errno)); return -1; }
+        snprintf(formas[2], PATH_MAX, "%s", formas[0]);
+    }
+    for (int f = 0; f < 3; f++) {
+        if ((f > 0 && strcmp(formas[f], formas[0]) == 0) || (f > 1 && strcmp(formas[f], formas[1]) == 0)) continue;
+        if (politica_aplicar(p, formas[f], acceso, n == base + 1 ? lista : NULL, formas[2], permitir) != 0) {
+            snprintf(error, tam_error, "%s: %s", campos[1], strerror(errno));
+            return -1;
+        }
+    }
+    p->reglas++;
+    return 0;
+}
+
+/*
+ * Compila 'archivo' ("" = política por defecto). Retorna la política con una referencia, o NULL con
+ * la causa en 'error' ("archivo:línea: motivo").
+ */
+static politica_t *compilar_politica(const char *archivo, char *error, size_t tam_error) {
+    char *texto = NULL;
+    if (archivo[0] == '\0') texto = strdup("permitir ~ rw\n");
+    else {
+        int fd = open(archivo, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            snprintf(error, tam_error, "%.200s: %s", archivo, strerror(errno));
+            if (fd >= 0) close(fd);
+            return NULL;
+        }
+        if (st.st_size > POLITICA_MAX_ARCHIVO) { snprintf(error, tam_error, "%.200s: demasiado grande", archivo); close(fd); return NULL; }
+        texto = malloc((size_t)st.st_size + 1);
+        ssize_t leidos = texto ? read(fd, texto, (size_t)st.st_size) : -1;
+        close(fd);
+        if (leidos < 0) { snprintf(error, tam_error, "%.200s: %s", archivo, strerror(errno)); free(texto); return NULL; }
+        texto[leidos] = '\0';
+    }
+    politica_t *p = calloc(1, sizeof(*p));
+    if (!texto || !p || politica_agregar_nodo(p, -1, "", 0) != 0) {
+        snprintf(error, tam_error, "sin memoria");
+        free(texto); politica_liberar(p);
+        return NULL;
+    }
+
+    int numero = 0, resultado = 0;
+    for (char *linea = texto; linea && resultado == 0; numero++) {
+        char *siguiente = strchr(linea, '\n');
+        if (siguiente) *siguiente++ = '\0';
+        char *comentario = strchr(linea, '#');
+        if (comentario) *comentario = '\0';
+        char motivo[200];
+        if ((resultado = compilar_regla(p, linea, motivo, sizeof(motivo))) != 0)
+            snprintf(error, tam_error, "%.200s:%d: %s", archivo[0] ? archivo : "(defecto)", numero + 1, motivo);
+        linea = siguiente;
+    }
+    free(texto);
+    if (resultado != 0) { politica_liberar(p); return NULL; }
+
+    // Los hijos se crean después que sus padres: un recorrido inverso propaga 'excepciones' hacia arriba
+    for (size_t i = p->n_nodos - 1; i > 0; i--) {
+        const nodo_politica_t *n = &p->nodos[i];
+        int con_reglas = n->excepciones || n->fd >= 0;
+        for (int c = 0; c < POLITICA_N_COMANDOS && !con_reglas; c++) con_reglas = n->acceso[c] != ACCESO_HEREDADO;
+        if (con_reglas) p->nodos[n->padre].excepciones = 1;
+    }
+    for (size_t i = 0; i < p->n_nodos; i++) if (p->nodos[i].fd >= 0 && p->nodos[i].excepciones) p->reglas_internas = 1;
+
+    // Tabla de hijos con factor de carga <= 1/2
+    size_t cap = 16;
+    while (cap < p->n_nodos * 2) cap *= 2;
+    p->tabla = malloc(cap * sizeof(int32_t));
+    if (!p->tabla) { snprintf(error, tam_error, "sin memoria"); politica_liberar(p); return NULL; }
+    memset(p->tabla, 0xff, cap * sizeof(int32_t));
+    p->mascara = (uint32_t)(cap - 1);
+    for (size_t i = 1; i < p->n_nodos; i++) {
+        uint32_t k = p->nodos[i].hash & p->mascara;
+        while (p->tabla[k] >= 0) k = (k + 1) & p->mascara;
+        p->tabla[k] = (int32_t)i;
+    }
+    p->referencias = 1;
+    return p;
+}
+
+// --- Publicación y Recarga de la Política (SIGHUP) ---
+
+/*
+ * La política publicada se reemplaza sin detener a nadie:
+ * - Cada verificación toma una referencia ('politica_adquirir') y la suelta al terminar; los recorridos
+ * (ls -R, grep -r) la conservan durante todo el árbol.
+ * - SIGHUP solo escribe en un self-pipe. Un hilo de recarga compila el archivo fuera del camino de los
+ * comandos y publica el resultado con un intercambio de puntero bajo el mutex; la política anterior se
+ * libera (y cierra sus anclas) con su última referencia, así que un comando en curso termina con la
+ * política con la que empezó.
+ * - Si el archivo nuevo es inválido se conserva la política vigente. El resultado lo anuncia y registra
+ * el REPL antes del próximo prompt, para no mezclarlo con los eventos del comando en curso.
+ * El ruleset Landlock se construye con la política de arranque (los hijos ya lanzados no pueden cambiarlo).
+ */
+static struct {
+    pthread_mutex_t mutex;
+    politica_t *actual;
+    char archivo[PATH_MAX];     // Origen de la política ("" = por defecto)
+    int aviso[2];               // Self-pipe de SIGHUP
+    char resultado[640];        // Resultado de la última recarga, pendiente de anunciar
+    int hay_resultado, fallida;
+} politicas = { .mutex = PTHREAD_MUTEX_INITIALIZER, .aviso = { -1, -1 } };
+
+static politica_t *politica_adquirir(void) {
+    pthread_mutex_lock(&politicas.mutex);
+    politica_t *p = politicas.actual;
+    if (p) p->referencias++;
+    pthread_mutex_unlock(&politicas.mutex);
+    return p;
+}
+
+static void politica_soltar(politica_t *p) {
+    if (!p) return;
+    pthread_mutex_lock(&politicas.mutex);
+    int quedan = --p->referencias;
+    pthread_mutex_unlock(&politicas.mutex);
+    if (quedan == 0) politica_liberar(p);
+}
+
+static void politica_publicar(politica_t *nueva) {
+    pthread_mutex_lock(&politicas.mutex);
+    politica_t *vieja = politicas.actual;
+    politicas.actual = nueva;
+    pthread_mutex_unlock(&politicas.mutex);
+    politica_soltar(vieja);
+}
+
+// Un hijo de fork no debe heredar el mutex tomado por el hilo de recarga
+static void politica_antes_fork(void) { pthread_mutex_lock(&politicas.mutex); }
+static void politica_despues_fork(void) { pthread_mutex_unlock(&politicas.mutex); }
+
+static void manejador_recarga(int senal) {
+    (void)senal;
+    int errno_guardado = errno;
+    char c = 0;
+    if (write(politicas.aviso[1], &c, 1) < 0) {} // Pipe lleno: ya hay una recarga pendiente
+    errno = errno_guardado;
+}
+
+static void *hilo_recarga_politica(void *arg) {
+    (void)arg;
+    char buf[64];
+    while (read(politicas.aviso[0], buf, sizeof(buf)) > 0 || errno == EINTR) {
+        char error[512];
+        politica_t *nueva = compilar_politica(politicas.archivo, error, sizeof(error));
+        int reglas = nueva ? nueva->reglas : 0;
+        if (nueva) politica_publicar(nueva);
+        pthread_mutex_lock(&politicas.mutex);
+        if (nueva) snprintf(politicas.resultado, sizeof(politicas.resultado), "Recargada: %d reglas (%.200s)", reglas,
+                            politicas.archivo[0] ? politicas.archivo : "por defecto");
+        else snprintf(politicas.resultado, sizeof(politicas.resultado), "Recarga rechazada, sigue la anterior: %s", error);
+        politicas.hay_resultado = 1;
+        politicas.fallida = !nueva;
+        pthread_mutex_unlock(&politicas.mutex);
+    }
+    return NULL;
+}
+
+/*
+ * Instala la señal de recarga y su hilo (solo el shell interactivo o por lotes, no los hijos): SIGHUP,
+ * o SIGUSR1 en las sesiones de 'flsh --servidor', donde SIGHUP es la desconexión del cliente.
+ * Sin hilo, la señal conserva su acción por defecto.
+ */
+void iniciar_recarga_politica(int senal) {
+    pthread_t hilo;
+    if (pipe2(politicas.aviso, O_CLOEXEC) != 0) return;
+    fcntl(politicas.aviso[1], F_SETFL, O_NONBLOCK);
+    if (pthread_create(&hilo, NULL, hilo_recarga_politica, NULL) != 0) return;
+    pthread_detach(hilo);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = manejador_recarga;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(senal, &sa, NULL);
+}
+
+// Anuncia y registra el resultado de una recarga terminada desde el último prompt
+void anunciar_recarga_politica(void) {
+    char msg[sizeof(politicas.resultado)];
+    pthread_mutex_lock(&politicas.mutex);
+    int hay = politicas.hay_resultado, fallida = politicas.fallida;
+    if (hay) snprintf(msg, sizeof(msg), "%s", politicas.resultado);
+    politicas.hay_resultado = 0;
+    pthread_mutex_unlock(&politicas.mutex);
+    if (!hay) return;
+    if (fallida) fprintf(stderr, "[flsh_sec]: %s\n", msg);
+    log_shell("politica", msg, fallida ? "WARNING" : "INFO");
+}
+
+// --- Sandbox: Resolución Anclada a las Raíces de la Política ---
+
+/*
+ * Toda ruta de usuario se verifica contra la política y se abre con
+ * openat2(ancla, resto, RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS), donde 'ancla' es el descriptor de la
+ * raíz permitida más profunda sobre la ruta: el kernel rechaza con EXDEV cualquier intento de salir de
+ * ella ('..', enlaces absolutos o hacia afuera). La validación y la apertura son la misma syscall.
+ * Si debajo del ancla hay reglas más estrictas (ej. 'denegar ~/.ssh'), la apertura agrega
+ * RESOLVE_NO_SYMLINKS: sin enlaces, la ruta léxica consultada es la ruta real. Un enlace (ELOOP) o una
+ * salida del ancla (EXDEV) se reintentan con la ruta canónica, que se vuelve a consultar y se abre
+ * sin seguir enlaces, así que un cambio concurrente del enlace tampoco puede escapar.
+ */
+typedef struct {
+    int flags;
+    mode_t modo;
+    int comando;                // Índice en 'comandos_politica'
+    int requerido;              // ACCESO_LECTURA o ACCESO_ESCRITURA
+    int padre;                  // Abrir el directorio padre (O_PATH) de la ruta verificada
+} solicitud_sandbox_t;
+
+// Derecho que exige una apertura: cualquier modo de escritura, creación o truncado es escritura
+static int acceso_requerido(int flags) {
+    return ((flags & O_ACCMODE) != O_RDONLY || (flags & (O_CREAT | O_TRUNC))) ? ACCESO_ESCRITURA : ACCESO_LECTURA;
+}
+
+// Contexto de auditoría -> comando de la política ("cp in" -> cp, ">" -> redireccion, "flsh" -> script)
+static int comando_de_contexto(const char *contexto) {
+    if (contexto[0] == '<' || contexto[0] == '>') return COMANDO_REDIRECCION;
+    if (strcmp(contexto, "flsh") == 0) return COMANDO_SCRIPT;
+    char nombre[16];
+    size_t n = strcspn(contexto, " ");
+    if (n >= sizeof(nombre)) return COMANDO_EXTERNO;
+    memcpy(nombre, contexto, n);
+    nombre[n] = '\0';
+    int i = indice_builtin(nombre);
+    return i >= 0 ? i : COMANDO_EXTERNO;
+}
+
+// openat2 relativo al ancla con RESOLVE_BENEATH (o openat si el kernel no tiene openat2).
+static int abrir_bajo_ancla(int ancla_fd, const char *rel, int flags, mode_t modo, uint64_t resolver) {
+    if (sandbox.openat2_disponible) {
+        struct open_how how = { .flags = (uint64_t)(flags | O_CLOEXEC), .mode = (flags & (O_CREAT | O_TMPFILE)) ? modo : 0,
+                                .resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS | resolver };
+        int fd = (int)syscall(SYS_openat2, ancla_fd, rel, &how, sizeof(how));
+        if (fd >= 0 || errno != ENOSYS) return fd;
+        sandbox.openat2_disponible = 0;
+    }
+    return openat(ancla_fd, rel, flags | O_CLOEXEC, modo);
+}
+
+/*
+ * Resolución canónica (realpath) para los casos que la apertura léxica no resuelve (enlaces simbólicos)
+ * y para kernels sin openat2. Si el archivo no existe (creación), o 'sin_seguir_ultimo' pide no
+ * resolver el último componente (O_NOFOLLOW, padre de rm/mkdir), resuelve el padre y agrega el nombre.
+ */
+static int resolver_canonico(const char *ruta, char *destino, int sin_seguir_ultimo) {
+    if (!sin_seguir_ultimo) {
+        if (realpath(ruta, destino) != NULL) return 0;
+        if (errno != ENOENT) return -1;
+    }
+    char *copia_dir = strdup(ruta), *copia_base = strdup(ruta);
+    int resultado = -1;
+    if (copia_dir && copia_base) {
+        char padre[PATH_MAX];
+        if (realpath(dirname(copia_dir), padre) != NULL) {
+            int n = snprintf(destino, PATH_MAX, "%s/%s", strcmp(padre, "/") == 0 ? "" : padre, basename(copia_base));
+            resultado = (n > 0 && n < PATH_MAX) ? 0 : -1;
+        }
+    }
+    free(copia_dir); free(copia_base);
+    return resultado;
+}
+
+/*
+ * Verifica 'abs' (absoluta y normalizada) y la abre bajo su ancla. 'resolver' agrega banderas de
+ * RESOLVE_*; con 'nodo' devuelve el nodo exacto del trie (cursor de los recorridos).
+ * Retorna el fd, -1 (errno) o SANDBOX_DENEGADO.
+ */
+static int abrir_segun_politica(const politica_t *p, const char *abs, const solicitud_sandbox_t *s, uint64_t resolver, int *nodo) {
+    consulta_politica_t c;
+    consultar_politica(p, abs, s->comando, &c);
+    if (c.acceso < s->requerido || c.ancla < 0) return SANDBOX_DENEGADO;
+    if (nodo) *nodo = c.nodo;
+    if (p->nodos[c.ancla].excepciones) resolver |= RESOLVE_NO_SYMLINKS;
+    if (!s->padre) return abrir_bajo_ancla(p->nodos[c.ancla].fd, *c.resto ? c.resto : ".", s->flags, s->modo, resolver);
+
+    // rm/mkdir sobre la raíz misma: su padre está fuera del ancla
+    if (!*c.resto) return SANDBOX_DENEGADO;
+    char padre[PATH_MAX];
+    snprintf(padre, sizeof(padre), "%s", c.resto);
+    char *barra = strrchr(padre, '/');
+    if (barra) *barra = '\0';
+    else snprintf(padre, sizeof(padre), ".");
+    return abrir_bajo_ancla(p->nodos[c.ancla].fd, padre, O_PATH | O_DIRECTORY, 0, resolver);
+}
+
+/*
+ * Núcleo del Sandbox: abre 'ruta' garantizando que el objeto abierto está bajo una raíz de la política
+ * con el derecho requerido. Retorna el fd, -1 (error de sistema en errno) o SANDBOX_DENEGADO.
+ */
+static int resolver_en_sandbox(const politica_t *p, const char *ruta, const solicitud_sandbox_t *s, int *nodo) {
+    char normal[PATH_MAX];
+    if (normalizar_ruta_usuario(ruta, normal, sizeof(normal)) != 0) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (sandbox.openat2_disponible) {
+        int fd = abrir_segun_politica(p, normal, s, 0, nodo);
+        if (fd != -1 || (errno != EXDEV && errno != ELOOP)) return fd;
+    }
+
+    // Enlace simbólico, salida del ancla o kernel sin openat2: se consulta la ruta canónica
+    // (sin openat2 queda la ventana de carrera de la verificación original)
+    int errno_lexico = errno;
+    char canonica[PATH_MAX];
+    if (resolver_canonico(ruta, canonica, s->padre || (s->flags & O_NOFOLLOW)) != 0)
+        return (sandbox.openat2_disponible && errno_lexico == EXDEV) ? SANDBOX_DENEGADO : -1;
+    int fd = abrir_segun_politica(p, canonica, s, RESOLVE_NO_SYMLINKS, nodo);
+    if (fd == -1 && sandbox.openat2_disponible && (errno == EXDEV || (errno == ELOOP && !(s->flags & O_NOFOLLOW))))
+        return SANDBOX_DENEGADO;
+    return fd;
+}
+
+/*
+ * Inicializa el Sandbox: resuelve HOME una única vez y compila la política de la sesión.
+ * Retorna 0, -1 si HOME no es accesible o -2 si la política es inválida (la causa ya se informó).
+ */
+static int fijar_home_sandbox(const char *home) {
+    snprintf(sandbox.home, sizeof(sandbox.home), "%s", home);
+    sandbox.home_len = strlen(sandbox.home);
+    while (sandbox.home_len > 1 && sandbox.home[sandbox.home_len - 1] == '/') sandbox.home[--sandbox.home_len] = '\0';
+    if (realpath(home, sandbox.home_real) == NULL) return -1;
+    sandbox.home_real_len = strlen(sandbox.home_real);
+    if (getcwd(sandbox.cwd, sizeof(sandbox.cwd)) == NULL) snprintf(sandbox.cwd, sizeof(sandbox.cwd), "%s", sandbox.home_real);
+    return 0;
+}
+
+// Origen de la política: FLSH_POLITICA, /etc/flsh/politica o la política por defecto (solo HOME)
+static void resolver_archivo_politica(void) {
+    const char *archivo = getenv("FLSH_POLITICA");
+    if (!archivo && access("/etc/flsh/politica", F_OK) == 0) archivo = "/etc/flsh/politica";
+    snprintf(politicas.archivo, sizeof(politicas.archivo), "%s", archivo ? archivo : "");
+}
+
+int iniciar_sandbox(const char *home) {
+    if (fijar_home_sandbox(home) != 0) return -1;
+    resolver_archivo_politica();
+    char error[512];
+    politica_t *p = compilar_politica(politicas.archivo, error, sizeof(error));
+    if (!p) { fprintf(stderr, "[flsh_sec]: Política inválida: %s\n", error); return -2; }
+    politica_publicar(p);
+    pthread_atfork(politica_antes_fork, politica_despues_fork, politica_despues_fork);
+    return 0;
+}
+
+/*
+ * Verificación sin abrir el archivo para el usuario (argumentos de comandos externos).
+ * Funcionalidad:
+ * 1. Resolución en el Kernel: Abre la ruta con O_PATH mediante 'resolver_en_sandbox' (una sola syscall
+ * openat2 con RESOLVE_BENEATH desde el ancla en lugar de un lstat/readlink por componente de 'realpath').
+ * Esto mitiga ataques de "Directory Traversal" (ej. ../../../etc/passwd desde home).
+ * 2. Política: Exige al menos lectura para 'comando'; el derecho de escritura de un programa externo
+ * solo lo puede hacer cumplir Landlock. Con 'solo_raices' (Landlock activo) las rutas fuera de toda
+ * raíz se aceptan: las decide el ruleset del kernel.
+ * 3. Manejo de Archivos Inexistentes (Look-ahead): Si el archivo destino no existe (errno == ENOENT),
+ * el sistema valida el directorio padre. Esto es crucial para comandos de creación
+ * donde el destino final aún no está en el disco, pero debemos asegurar que se creará en una ubicación permitida.
+ */
+int validar_ruta_en_politica(const char *ruta_input, int comando, int solo_raices) {
+    politica_t *p = politica_adquirir();
+    if (!p) return 0; // Sin política, bloqueamos por seguridad (Fail-closed)
+    if (solo_raices) {
+        char normal[PATH_MAX];
+        consulta_politica_t c;
+        if (normalizar_ruta_usuario(ruta_input, normal, sizeof(normal)) == 0) {
+            consultar_politica(p, normal, comando, &c);
+            if (c.ancla < 0) { politica_soltar(p); return 1; }
+        }
+    }
+
+    solicitud_sandbox_t s = { .flags = O_PATH, .comando = comando, .requerido = ACCESO_LECTURA };
+    int fd = resolver_en_sandbox(p, ruta_input, &s, NULL);
+    if (fd < 0 && fd != SANDBOX_DENEGADO && errno == ENOENT) {
+        // Caso 2: El archivo no existe (ej. creando nuevo dir), validamos el padre
+        s.padre = 1;
+        fd = resolver_en_sandbox(p, ruta_input, &s, NULL);
+    }
+    politica_soltar(p);
+    if (fd >= 0) { close(fd); return 1; }
+    return 0;
+}
+
+// --- Wrapper de Seguridad: Validación y Reporte ---
+
+/*
+ * Registra y notifica un intento de acceso fuera del perímetro del Sandbox.
+ * 1. Auditoría de Seguridad: genera una entrada de log con nivel "WARNING", documentando el intento
+ * de violación del perímetro de seguridad.
+ * 2. Feedback al Usuario: Informa inmediatamente a la salida estándar de error (stderr) que
+ * la acción fue bloqueada por el módulo [flsh_sec], garantizando transparencia.
+ */
+static void notificar_violacion_sandbox(const char *ruta, const char *contexto) {
+    // --- Bloque de Gestión de Incidentes ---
+    char msg[256];
+    // Construimos el mensaje forense con la ruta infractora
+    snprintf(msg, sizeof(msg), "Acceso denegado por la politica: %s", ruta);
+
+    // Registramos el incidente en los logs persistentes (Nivel WARNING, no ERROR de sistema)
+    log_shell((char*)contexto, msg, "WARNING");
+
+    // Notificamos al usuario final sobre el bloqueo
+    fprintf(stderr, "[flsh_sec]: Acceso denegado (SandBox).\n");
+    estado_builtin = 1;
+}
+
+/*
+ * Actúa como "Middleware" de seguridad, encapsulando la lógica de validación del Sandbox
+ * con el sistema de reporte y auditoría.
+ * Retorno: 1 si es seguro proceder, 0 si la acción fue bloqueada.
+ */
+int validar_entorno_seguro(char *ruta, const char *contexto) {
+    // Delegamos la verificación a la función de Sandbox
+    if (validar_ruta_en_politica(ruta, comando_de_contexto(contexto), 0)) return 1; // Acceso concedido
+    notificar_violacion_sandbox(ruta, contexto);
+    return 0; // Acceso denegado
+}
+
+/*
+ * Recorridos (ls -R, grep -r, cp -r, rm -r): la raíz se abre por el Sandbox y los descensos son relativos
+ * a ella, sin seguir enlaces. Si debajo de la raíz hay reglas propias, el recorrido conserva la política y
+ * un cursor en el trie: cada subdirectorio o archivo con regla se consulta antes de entrar, sin syscalls.
+ * Sin reglas debajo, 'nodo' es -1 y descender no cuesta nada.
+ */
+typedef struct {
+    politica_t *politica;       // Referencia del recorrido (NULL si no hace falta)
+    int nodo;                   // Nodo del trie del directorio actual, o -1
+    int comando;
+    int requerido;
+} arbol_sandbox_t;
+
+/*
+ * Apertura común de los wrappers: toma una referencia de la política, resuelve y notifica la violación.
+ * Con 'a' deja además el cursor del recorrido sobre la ruta verificada (liberar con 'arbol_soltar').
+ */
+static int abrir_verificado(const char *ruta, const solicitud_sandbox_t *s, const char *contexto, arbol_sandbox_t *a) {
+    politica_t *p = politica_adquirir();
+    int nodo = -1;
+    int fd = p ? resolver_en_sandbox(p, ruta, s, a ? &nodo : NULL) : SANDBOX_DENEGADO;
+    int errno_guardado = errno;
+    if (a) {
+        *a = (arbol_sandbox_t){ .politica = NULL, .nodo = -1, .comando = s->comando, .requerido = s->requerido };
+        if (fd >= 0 && nodo >= 0 && p->nodos[nodo].excepciones) { a->politica = p; a->nodo = nodo; p = NULL; }
+    }
+    politica_soltar(p);
+    if (fd == SANDBOX_DENEGADO) notificar_violacion_sandbox(ruta, contexto);
+    errno = errno_guardado;
+    return fd;
+}
+
+/*
+ * Punto de entrada de los built-ins al Sandbox: valida y abre en una sola operación.
+ * El comando sale de 'contexto' y el derecho requerido de 'flags' (escritura si abre para escribir,
+ * crear o truncar). Retorna el fd abierto, -1 ante error de sistema (errno intacto para
+ * 'reportar_error_sistema') o SANDBOX_DENEGADO (el incidente ya quedó registrado y notificado).
+ */
+int abrir_en_sandbox(const char *ruta, int flags, mode_t modo, const char *contexto) {
+    solicitud_sandbox_t s = { .flags = flags, .modo = modo, .comando = comando_de_contexto(contexto), .requerido = acceso_requerido(flags) };
+    return abrir_verificado(ruta, &s, contexto, NULL);
+}
+
+/*
+ * Para operaciones sobre una entrada de directorio (unlink, mkdir): verifica el derecho de escritura
+ * sobre la ruta completa, abre su directorio padre dentro del Sandbox y deja en 'nombre' el último
+ * componente. Con 'a', el cursor de escritura para recorrer la entrada (rm -r, destino de cp -r).
+ * Retorna el fd del padre, -1 o SANDBOX_DENEGADO.
+ */
+int abrir_padre_en_sandbox(const char *ruta, char *nombre, size_t tam, const char *contexto, arbol_sandbox_t *a) {
+    char copia[PATH_MAX];
+    snprintf(copia, sizeof(copia), "%s", ruta);
+    size_t n = strlen(copia);
+    while (n > 1 && copia[n - 1] == '/') copia[--n] = '\0'; // "dir/" -> "dir"
+
+    char *barra = strrchr(copia, '/');
+    const char *base = barra ? barra + 1 : copia;
+    if (base[0] == '\0' || strcmp(base, ".") == 0 || strcmp(base, "..") == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    snprintf(nombre, tam, "%s", base);
+
+    solicitud_sandbox_t s = { .flags = O_PATH | O_DIRECTORY, .comando = comando_de_contexto(contexto), .requerido = ACCESO_ESCRITURA, .padre = 1 };
+    return abrir_verificado(copia, &s, contexto, a);
+}
+
+// Como 'abrir_en_sandbox', dejando en 'a' el cursor del recorrido (liberar con 'arbol_soltar')
+int abrir_arbol_en_sandbox(const char *ruta, int flags, const char *contexto, arbol_sandbox_t *a) {
+    solicitud_sandbox_t s = { .flags = flags, .comando = comando_de_contexto(contexto), .requerido = acceso_requerido(flags) };
+    return abrir_verificado(ruta, &s, contexto, a);
+}
+
+// Cursor de 'nombre' dentro del directorio de 'a'. Retorna 1 si se puede entrar, 0 si la política lo deniega.
+int arbol_descender(const arbol_sandbox_t *a, const char *nombre, arbol_sandbox_t *hijo) {
+    *hijo = *a;
+    if (a->nodo < 0) return 1;
+    const politica_t *p = a->politica;
+    int h = politica_hijo(p, a->nodo, nombre, strlen(nombre));
+    hijo->nodo = (h >= 0 && p->nodos[h].excepciones) ? h : -1;
+    if (h < 0) return 1;
+    int acceso = p->nodos[h].acceso[a->comando];
+    return acceso == ACCESO_HEREDADO || (acceso & ACCESO_MASCARA) >= a->requerido;
+}
+
+void arbol_soltar(arbol_sandbox_t *a) {
+    politica_soltar(a->politica);
+    a->politica = NULL;
+    a->nodo = -1;
+}
+
+
+// --- Landlock: Sandbox del Kernel para Comandos Externos ---
+
+/*
+ * Con FLSH_LANDLOCK=1, los comandos externos se ejecutan bajo un ruleset Landlock en lugar de
+ * revisar sus argumentos en espacio de usuario:
+ * - Raíces de la política (por defecto HOME): con 'rw', lectura, escritura, creación, borrado y
+ * ejecución; con 'r', lectura y ejecución.
+ * - Rutas del sistema necesarias para ejecutar (/usr, /bin, /sbin, /lib, /lib64, /opt, /etc): solo lectura
+ * y ejecución. '/dev' admite lectura/escritura de archivos (terminal, /dev/null) y '/proc' solo lectura.
+ * - Cualquier otra ruta (ej. /tmp, /var, HOME de otros usuarios) queda denegada por el kernel, incluso
+ * si el programa la abre internamente o la recibe escondida en un flag.
+ * FLSH_LANDLOCK_LECTURA agrega rutas de solo lectura adicionales, separadas por ':'.
+ * El ruleset se construye una vez por sesión; cada hijo solo paga 'landlock_restrict_self'.
+ */
+#ifndef LANDLOCK_ACCESS_FS_TRUNCATE
+#define LANDLOCK_ACCESS_FS_TRUNCATE (1ULL << 14)
+#endif
+#ifndef LANDLOCK_ACCESS_FS_IOCTL_DEV
+#define LANDLOCK_ACCESS_FS_IOCTL_DEV (1ULL << 15)
+#endif
+#ifndef LANDLOCK_RESTRICT_SELF_LOG_NEW_EXEC_ON
+#define LANDLOCK_RESTRICT_SELF_LOG_NEW_EXEC_ON (1U << 1)
+#endif
+
+#define LANDLOCK_LECTURA (LANDLOCK_ACCESS_FS_READ_FILE | LANDLOCK_ACCESS_FS_READ_DIR)
+#define LANDLOCK_LECTURA_EJECUCION (LANDLOCK_LECTURA | LANDLOCK_ACCESS_FS_EXECUTE)
+#define LANDLOCK_DISPOSITIVOS (LANDLOCK_LECTURA | LANDLOCK_ACCESS_FS_WRITE_FILE | LANDLOCK_ACCESS_FS_TRUNCATE | LANDLOCK_ACCESS_FS_IOCTL_DEV)
+
+static struct {
+    int ruleset_fd;             // -1 si Landlock no está activo
+    int abi;
+    uint32_t flags_restriccion; // LOG_NEW_EXEC_ON en ABI >= 7: el kernel audita las denegaciones tras execve
+} landlock = { .ruleset_fd = -1 };
+
+// Agrega una regla 'path_beneath' para el directorio abierto en 'fd'
+static int landlock_agregar_fd(int ruleset_fd, int fd, uint64_t acceso, uint64_t manejados) {
+    struct landlock_path_beneath_attr regla = { .allowed_access = acceso & manejados, .parent_fd = fd };
+    return (int)syscall(SYS_landlock_add_rule, ruleset_fd, LANDLOCK_RULE_PATH_BENEATH, &regla, 0);
+}
+
+// Agrega una regla 'path_beneath' para 'ruta'. Las rutas inexistentes (ej. /lib64) se omiten.
+static int landlock_agregar_ruta(int ruleset_fd, const char *ruta, uint64_t acceso, uint64_t manejados) {
+    int fd = open(ruta, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return (errno == ENOENT || errno == ENOTDIR) ? 0 : -1;
+    int resultado = landlock_agregar_fd(ruleset_fd, fd, acceso, manejados);
+    close(fd);
+    return resultado;
+}
+
+/*
+ * Raíces de la política para los comandos externos: cada ancla con derecho para 'externo' entra con
+ * todos los derechos (rw) o con lectura y ejecución (r). Landlock solo suma permisos, así que los
+ * 'denegar' dentro de una raíz no tienen equivalente en el kernel: esos los sigue verificando
+ * 'validar_argumentos_externos' (ver 'reglas_internas').
+ */
+static int landlock_agregar_politica(int ruleset_fd, uint64_t manejados) {
+    politica_t *p = politica_adquirir();
+    int error = p ? 0 : -1;
+    for (size_t i = 0; p && i < p->n_nodos && error == 0; i++) {
+        const nodo_politica_t *n = &p->nodos[i];
+        if (n->fd < 0) continue;
+        // El derecho efectivo del ancla puede venir de un ancestro
+        int acceso = ACCESO_HEREDADO;
+        for (int k = (int)i; k >= 0 && acceso == ACCESO_HEREDADO; k = p->nodos[k].padre) acceso = p->nodos[k].acceso[COMANDO_EXTERNO] & ACCESO_MASCARA;
+        if (acceso == ACCESO_ESCRITURA) error = landlock_agregar_fd(ruleset_fd, n->fd, manejados, manejados);
+        else if (acceso == ACCESO_LECTURA) error = landlock_agregar_fd(ruleset_fd, n->fd, LANDLOCK_LECTURA_EJECUCION, manejados);
+    }
+    politica_soltar(p);
+    return error;
+}
+
+/*
+ * Construye el ruleset de la sesión (requiere 'iniciar_sandbox' previo). Retorna 0 si Landlock quedó
+ * activo, o -1 si no fue solicitado o el kernel no lo soporta (se mantiene la verificación de argumentos).
+ */
+int iniciar_landlock(void) {
+    const char *opcion = getenv("FLSH_LANDLOCK");
+    if (!opcion || strcmp(opcion, "1") != 0) return -1;
+
+    int abi = (int)syscall(SYS_landlock_create_ruleset, NULL, 0, LANDLOCK_CREATE_RULESET_VERSION);
+    if (abi < 1) {
+        fprintf(stderr, "[flsh_sec]: Landlock no disponible en este kernel; se usa la verificación de argumentos.\n");
+        log_shell("landlock", "No disponible, verificacion de argumentos", "WARNING");
+        return -1;
+    }
+
+    // Derechos que el kernel sabe manejar según la versión del ABI
+    uint64_t manejados = (LANDLOCK_ACCESS_FS_MAKE_SYM << 1) - 1;
+    if (abi >= 2) manejados |= LANDLOCK_ACCESS_FS_REFER;
+    if (abi >= 3) manejados |= LANDLOCK_ACCESS_FS_TRUNCATE;
+    if (abi >= 5) manejados |= LANDLOCK_ACCESS_FS_IOCTL_DEV;
+
+    struct landlock_ruleset_attr atributos = { .handled_access_fs = manejados };
+    int ruleset_fd = (int)syscall(SYS_landlock_create_ruleset, &atributos, sizeof(atributos), 0);
+    if (ruleset_fd < 0) { reportar_error_sistema("landlock"); return -1; }
+
+    static const struct { const char *ruta; uint64_t acceso; } sistema[] = {
+        { "/usr", LANDLOCK_LECTURA_EJECUCION }, { "/bin", LANDLOCK_LECTURA_EJECUCION },
+        { "/sbin", LANDLOCK_LECTURA_EJECUCION }, { "/lib", LANDLOCK_LECTURA_EJECUCION },
+        { "/lib64", LANDLOCK_LECTURA_EJECUCION }, { "/opt", LANDLOCK_LECTURA_EJECUCION },
+        { "/etc", LANDLOCK_LECTURA }, { "/proc", LANDLOCK_LECTURA }, { "/dev", LANDLOCK_DISPOSITIVOS },
+    };
+    int error = landlock_agregar_politica(ruleset_fd, manejados);
+    for (size_t i = 0; i < sizeof(sistema) / sizeof(sistema[0]) && error == 0; i++)
+        error = landlock_agregar_ruta(ruleset_fd, sistema[i].ruta, sistema[i].acceso, manejados);
+
+    const char *extra = getenv("FLSH_LANDLOCK_LECTURA");
+    if (extra && error == 0) {
+        char *copia = strdup(extra), *guardado = NULL;
+        for (char *r = copia ? strtok_r(copia, ":", &guardado) : NULL; r && error == 0; r = strtok_r(NULL, ":", &guardado))
+            error = landlock_agregar_ruta(ruleset_fd, r, LANDLOCK_LECTURA_EJECUCION, manejados);
+        free(copia);
+    }
+    if (error != 0) { reportar_error_sistema("landlock"); close(ruleset_fd); return -1; }
+
+    landlock.ruleset_fd = ruleset_fd;
+    landlock.abi = abi;
+    if (abi >= 7) landlock.flags_restriccion = LANDLOCK_RESTRICT_SELF_LOG_NEW_EXEC_ON;
+    char msg[64];
+    snprintf(msg, sizeof(msg), "Ruleset activo (ABI %d)", abi);
+    log_shell("landlock", msg, "INFO");
+    return 0;
+}
+
+/*
+ * Se ejecuta en el hijo entre fork() y execvp(): aplica el ruleset de la sesión.
+ * NO_NEW_PRIVS es obligatorio para un proceso sin CAP_SYS_ADMIN (y evita que un binario setuid
+ * recupere privilegios fuera del Sandbox). Retorna 0 o -1 con errno; el llamador debe abortar (fail-closed).
+ */
+static int aplicar_landlock_en_hijo(void) {
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0) return -1;
+    if (syscall(SYS_landlock_restrict_self, landlock.ruleset_fd, landlock.flags_restriccion) == 0) return 0;
+    // Kernels previos a ABI 7 rechazan los flags de auditoría
+    if (errno == EINVAL && landlock.flags_restriccion) return (int)syscall(SYS_landlock_restrict_self, landlock.ruleset_fd, 0);
+    return -1;
+}
+
+
+// --- Tabla de Rutas de Comandos (hash de PATH) ---
+
+/*
+ * Cache de comandos resueltos en $PATH: evita recorrer PATH con 'execve' fallidos en cada comando.
+ * Invalidación:
+ * - Si el valor de PATH cambia (comparación con la copia cacheada, sin syscalls).
+ * - Si cambia el mtime de algún directorio de PATH (se instaló o borró un programa). Esta verificación
+ * cuesta un 'stat' por directorio, por lo que se hace como máximo una vez por segundo.
+ * - Si una ruta cacheada ya no existe al lanzar, se descarta y se vuelve a buscar.
+ */
+#define RUTAS_CAPACIDAD 512        // Potencia de 2 (máscara de índice)
+#define RUTAS_MAX_DIRECTORIOS 64
+#define RUTAS_INTERVALO_MTIME_NS 1000000000LL
+
+typedef struct {
+    char *nombre;
+    char *ruta;
+    unsigned long usos;
+} entrada_ruta_t;
+
+static struct {
+    entrada_ruta_t tabla[RUTAS_CAPACIDAD];
+    int ocupadas;
+    char *path;                                 // Copia del PATH con el que se llenó la tabla
+    char *directorios[RUTAS_MAX_DIRECTORIOS];   // Apuntan dentro de 'path_dividido'
+    struct timespec mtimes[RUTAS_MAX_DIRECTORIOS];
+    int n_directorios;
+    char *path_dividido;
+    long long ultima_verificacion_ns;
+} rutas;
+
+static long long reloj_monotonico_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static uint32_t hash_nombre(const char *s) {
+    uint32_t h = 2166136261u; // FNV-1a
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+// Vacía la tabla conservando la lista de directorios
+void vaciar_tabla_rutas(void) {
+    for (int i = 0; i < RUTAS_CAPACIDAD; i++) {
+        free(rutas.tabla[i].nombre); free(rutas.tabla[i].ruta);
+        rutas.tabla[i] = (entrada_ruta_t){ 0 };
+    }
+    rutas.ocupadas = 0;
+}
+
+// Toma una nueva instantánea de PATH y de los mtime de sus directorios
+static void cargar_path(const char *path) {
+    vaciar_tabla_rutas();
+    free(rutas.path); free(rutas.path_dividido);
+    rutas.path = strdup(path);
+    rutas.path_dividido = strdup(path);
+    rutas.n_directorios = 0;
+    char *guardado = NULL;
+    for (char *d = rutas.path_dividido ? strtok_r(rutas.path_dividido, ":", &guardado) : NULL;
+         d && rutas.n_directorios < RUTAS_MAX_DIRECTORIOS; d = strtok_r(NULL, ":", &guardado)) {
+        struct stat st;
+        int i = rutas.n_directorios++;
+        rutas.directorios[i] = d;
+        rutas.mtimes[i] = (stat(d, &st) == 0) ? st.st_mtim : (struct timespec){ 0 };
+    }
+    rutas.ultima_verificacion_ns = reloj_monotonico_ns();
+}
+
+// Aplica las reglas de invalidación antes de cada búsqueda
+static void verificar_vigencia_rutas(void) {
+    const char *path = getenv("PATH");
+    if (!path) path = "/usr/local/bin:/usr/bin:/bin";
+    if (!rutas.path || strcmp(rutas.path, path) != 0) { cargar_path(path); return; }
+
+    long long ahora = reloj_monotonico_ns();
+    if (ahora - rutas.ultima_verificacion_ns < RUTAS_INTERVALO_MTIME_NS) return;
+    rutas.ultima_verificacion_ns = ahora;
+    for (int i = 0; i < rutas.n_directorios; i++) {
+        struct stat st;
+        struct timespec m = (stat(rutas.directorios[i], &st) == 0) ? st.st_mtim : (struct timespec){ 0 };
+        if (m.tv_sec != rutas.mtimes[i].tv_sec || m.tv_nsec != rutas.mtimes[i].tv_nsec) { cargar_path(path); return; }
+    }
+}
+
+static entrada_ruta_t *buscar_entrada_ruta(const char *nombre, int crear) {
+    uint32_t i = hash_nombre(nombre) & (RUTAS_CAPACIDAD - 1);
+    for (;;) {
+        entrada_ruta_t *e = &rutas.tabla[i];
+        if (!e->nombre) return crear ? e : NULL;
+        if (strcmp(e->nombre, nombre) == 0) return e;
+        i = (i + 1) & (RUTAS_CAPACIDAD - 1);
+    }
+}
+
+/*
+ * Resuelve 'nombre' a una ruta ejecutable. Los nombres con '/' se usan tal cual.
+ * Retorna la ruta (válida hasta la próxima invalidación) o NULL con errno (ENOENT/EACCES).
+ */
+const char *resolver_comando(const char *nombre) {
+    if (strchr(nombre, '/')) return nombre;
+    verificar_vigencia_rutas();
+    entrada_ruta_t *e = buscar_entrada_ruta(nombre, 0);
+    if (e) { e->usos++; return e->ruta; }
+
+    int error = ENOENT;
+    char candidato[PATH_MAX];
+    for (int i = 0; i < rutas.n_directorios; i++) {
+        int n = snprintf(candidato, sizeof(candidato), "%s/%s", rutas.directorios[i], nombre);
+        if (n <= 0 || (size_t)n >= sizeof(candidato)) continue;
+        struct stat st;
+        if (stat(candidato, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        if (access(candidato, X_OK) != 0) { error = EACCES; continue; } // Igual que execvp: seguimos buscando
+
+        if (rutas.ocupadas >= RUTAS_CAPACIDAD / 2) vaciar_tabla_rutas(); // Mantiene el sondeo lineal corto
+        e = buscar_entrada_ruta(nombre, 1);
+        e->nombre = strdup(nombre);
+        e->ruta = strdup(candidato);
+        if (!e->nombre || !e->ruta) { free(e->nombre); free(e->ruta); *e = (entrada_ruta_t){ 0 }; return NULL; }
+        e->usos = 1;
+        rutas.ocupadas++;
+        return e->ruta;
+    }
+    errno = error;
+    return NULL;
+}
+
+// Descarta una entrada cuya ruta ya no es válida (ej. el binario se borró dentro del intervalo de mtime)
+static void olvidar_comando(const char *nombre) {
+    entrada_ruta_t *e = buscar_entrada_ruta(nombre, 0);
+    if (e) { free(e->nombre); free(e->ruta); *e = (entrada_ruta_t){ 0 }; rutas.ocupadas--; }
+    // Reinsertamos las entradas siguientes del mismo grupo para no cortar el sondeo lineal
+    entrada_ruta_t copia[RUTAS_CAPACIDAD];
+    int n = 0;
+    for (int i = 0; i < RUTAS_CAPACIDAD; i++) if (rutas.tabla[i].nombre) { copia[n++] = rutas.tabla[i]; rutas.tabla[i] = (entrada_ruta_t){ 0 }; }
+    for (int i = 0; i < n; i++) *buscar_entrada_ruta(copia[i].nombre, 1) = copia[i];
+}
+
+// --- Comando Built-in: hash (Tabla de Rutas) ---
+
+/*
+ * Inspecciona o limpia la tabla de rutas de comandos.
+ * Funcionalidad:
+ * 1. Sin argumentos: lista cada comando cacheado con su cantidad de usos y ruta resuelta.
+ * 2. 'hash -r': vacía la tabla (la próxima ejecución vuelve a recorrer PATH).
+ * 3. 'hash NOMBRE...': resuelve y cachea los comandos indicados sin ejecutarlos.
+ */
+void ejecutar_hash(char **args) {
+    if (args[1] && strcmp(args[1], "-r") == 0) {
+        vaciar_tabla_rutas();
+        log_shell("hash", "Tabla de rutas vaciada", "INFO");
+        return;
+    }
+    if (args[1]) {
+        for (int i = 1; args[i]; i++) {
+            if (!resolver_comando(args[i])) fprintf(stderr, "hash: %s: no encontrado\n", args[i]);
+        }
+        return;
+    }
+    verificar_vigencia_rutas();
+    if (rutas.ocupadas == 0) { salida_texto("hash: tabla vacía\n"); return; }
+    salida_texto("usos\tcomando\n");
+    for (int i = 0; i < RUTAS_CAPACIDAD; i++) {
+        if (rutas.tabla[i].nombre) salida_printf("%4lu\t%s\n", rutas.tabla[i].usos, rutas.tabla[i].ruta);
+    }
+    log_shell("hash", "Exito", "INFO");
+}
+
+// --- Lanzador de Procesos (posix_spawn / vfork) ---
+
+/*
+ * Crea los procesos de los comandos externos sin copiar el espacio de direcciones del shell:
+ * - Sin Landlock: 'posix_spawn' (glibc usa clone(CLONE_VM|CLONE_VFORK) y devuelve el errno real de exec).
+ * - Con Landlock: clone(CLONE_VM|CLONE_VFORK) propio, porque el hijo debe aplicar el ruleset antes de exec.
+ * El hijo comparte la memoria del padre (suspendido hasta el exec), así que solo ejecuta syscalls y
+ * comunica el error en 'resultado_hijo_t'; el registro en logs lo hace el padre.
+ * Las redirecciones de un comando simple ya están aplicadas por 'main' y se heredan tal cual; las de
+ * las etapas de un pipeline llegan como la terna 'fds' que el hijo instala con dup2.
+ * Los trabajos en segundo plano se lanzan en su propio grupo de procesos ('grupo'), para que 'fg',
+ * 'bg' y 'kill %N' puedan señalizar el trabajo completo.
+ * FLSH_SPAWN=fork fuerza el camino clásico fork()+execv() (comparación/diagnóstico).
+ */
+#define LANZADOR_PILA (64 * 1024)
+
+typedef struct {
+    const char *ruta;
+    char **args;
+    const int *fds;     // Descriptores a instalar como stdin/stdout/stderr del hijo
+    pid_t grupo;        // -1: grupo del shell, 0: nuevo grupo liderado por el hijo, >0: unirse a ese grupo
+    int error;          // errno del hijo si no llegó a ejecutar
+    int en_landlock;    // 1 si falló la restricción, 0 si falló exec
+} resultado_hijo_t;
+
+static const int descriptores_estandar[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+
+// 1 si algún descriptor estándar debe recibir otro descriptor estándar (ej. '2>&1 >archivo')
+static int cruza_descriptores(const int fds[3]) {
+    for (int k = 0; k < 3; k++) if (fds[k] <= STDERR_FILENO && fds[k] != k) return 1;
+    return 0;
+}
+
+/*
+ * Instala 'fds' como 0/1/2 del proceso actual (hijo). Una fuente que es a su vez un descriptor
+ * estándar se copia antes por encima de 2, para que un dup2 anterior no la pise.
+ */
+static int instalar_descriptores(const int fds[3]) {
+    int origen[3] = { fds[0], fds[1], fds[2] };
+    for (int k = 0; k < 3; k++)
+        if (origen[k] <= STDERR_FILENO && origen[k] != k && (origen[k] = fcntl(fds[k], F_DUPFD_CLOEXEC, 3)) < 0) return -1;
+    for (int k = 0; k < 3; k++)
+        if (origen[k] != k && dup2(origen[k], k) < 0) return -1;
+    return 0;
+}
+
+/*
+ * Prepara el hijo antes de exec: instala stdin/stdout/stderr (los extremos de pipe y archivos
+ * redirigidos son O_CLOEXEC: solo sobreviven las copias de dup2), entra en su grupo de procesos
+ * y restaura SIGTTOU (ignorada por el shell).
+ */
+static int preparar_hijo(const resultado_hijo_t *r) {
+    if (instalar_descriptores(r->fds) != 0) return -1;
+    if (r->grupo >= 0 && setpgid(0, r->grupo) != 0) return -1;
+    signal(SIGTTOU, SIG_DFL);
+    return 0;
+}
+
+static int hijo_vfork(void *arg) {
+    resultado_hijo_t *r = arg;
+    if (preparar_hijo(r) != 0) { r->error = errno; _exit(127); }
+    if (landlock.ruleset_fd >= 0 && aplicar_landlock_en_hijo() != 0) { r->error = errno; r->en_landlock = 1; _exit(126); }
+    execve(r->ruta, r->args, environ);
+    r->error = errno;
+    _exit(errno == EACCES ? 126 : 127);
+}
+
+static int usar_fork_clasico(void) {
+    static int modo = -1;
+    if (modo < 0) { const char *v = getenv("FLSH_SPAWN"); modo = (v && strcmp(v, "fork") == 0); }
+    return modo;
+}
+
+/*
+ * Lanza 'ruta' con 'args'. Retorna el pid, o -1 con 'resultado->error' / 'en_landlock' indicando el motivo.
+ */
+static pid_t lanzar_con_ruta(resultado_hijo_t *r) {
+    r->error = 0; r->en_landlock = 0;
+    pid_t pid;
+    if (usar_fork_clasico()) {
+        // Camino clásico: el hijo escribe el errno en memoria propia, así que usamos un pipe CLOEXEC
+        int canal[2];
+        if (pipe2(canal, O_CLOEXEC) != 0) { r->error = errno; return -1; }
+        pid = fork();
+        if (pid == 0) {
+            close(canal[0]);
+            resultado_hijo_t fallo = { .error = 0 };
+            if (preparar_hijo(r) != 0) {}
+            else if (landlock.ruleset_fd >= 0 && aplicar_landlock_en_hijo() != 0) fallo.en_landlock = 1;
+            else execve(r->ruta, r->args, environ);
+            fallo.error = errno;
+            if (write(canal[1], &fallo, sizeof(fallo)) < 0) {}
+            _exit(fallo.error == EACCES ? 126 : 127);
+        }
+        close(canal[1]);
+        resultado_hijo_t fallo;
+        if (pid > 0 && read(canal[0], &fallo, sizeof(fallo)) == (ssize_t)sizeof(fallo)) { r->error = fallo.error; r->en_landlock = fallo.en_landlock; }
+        else if (pid < 0) r->error = errno;
+        close(canal[0]);
+    } else if (landlock.ruleset_fd < 0 && !cruza_descriptores(r->fds)) {
+        // Las ternas que cruzan descriptores estándar necesitan copias intermedias: van por clone
+        posix_spawn_file_actions_t acciones, *p_acciones = NULL;
+        for (int k = 0; k < 3; k++) {
+            if (r->fds[k] == k) continue;
+            if (!p_acciones) { posix_spawn_file_actions_init(&acciones); p_acciones = &acciones; }
+            posix_spawn_file_actions_adddup2(&acciones, r->fds[k], k);
+        }
+        posix_spawnattr_t atributos;
+        sigset_t por_defecto;
+        sigemptyset(&por_defecto);
+        sigaddset(&por_defecto, SIGTTOU);
+        posix_spawnattr_init(&atributos);
+        posix_spawnattr_setsigdefault(&atributos, &por_defecto);
+        short flags = POSIX_SPAWN_SETSIGDEF;
+        if (r->grupo >= 0) { flags |= POSIX_SPAWN_SETPGROUP; posix_spawnattr_setpgroup(&atributos, r->grupo); }
+        posix_spawnattr_setflags(&atributos, flags);
+        int error = posix_spawn(&pid, r->ruta, p_acciones, &atributos, r->args, environ);
+        posix_spawnattr_destroy(&atributos);
+        if (p_acciones) posix_spawn_file_actions_destroy(p_acciones);
+        if (error != 0) { r->error = error; return -1; }
+        return pid;
+    } else {
+        static char *pila = NULL;
+        if (!pila && !(pila = malloc(LANZADOR_PILA))) { r->error = ENOMEM; return -1; }
+        // CLONE_VFORK: el padre queda suspendido hasta el exec/_exit del hijo, por eso 'r' es seguro de compartir
+        pid = clone(hijo_vfork, pila + LANZADOR_PILA, CLONE_VM | CLONE_VFORK | SIGCHLD, r);
+        if (pid < 0) { r->error = errno; return -1; }
+    }
+    if (r->error != 0 && pid > 0) { waitpid(pid, NULL, 0); return -1; } // El hijo no llegó a ejecutar: lo recogemos aquí
+    // También desde el padre: evita la carrera entre el setpgid del hijo y un 'kill %N' inmediato
+    if (pid > 0 && r->grupo >= 0) setpgid(pid, r->grupo ? r->grupo : pid);
+    return pid;
+}
+
+/*
+ * Punto de entrada del lanzador: resuelve el comando con la tabla de rutas y lo lanza con
+ * 'fds' como stdin/stdout/stderr ('descriptores_estandar' para heredar los del shell)
+ * en el grupo de procesos 'grupo' (-1 para quedarse en el del shell).
+ * Retorna el pid, o -1 habiendo informado el error al usuario y al log.
+ */
+pid_t lanzar_proceso(char **args, const int fds[3], pid_t grupo) {
+    resultado_hijo_t r = { .args = args, .fds = fds, .grupo = grupo };
+    salida_volcar(); // La salida pendiente de built-ins previos debe salir antes que la del hijo
+    r.ruta = resolver_comando(args[0]);
+    if (r.ruta == NULL) {
+        r.error = errno;
+    } else {
+        pid_t pid = lanzar_con_ruta(&r);
+        // Ruta cacheada obsoleta (el binario se borró o movió): se busca de nuevo una vez
+        if (pid < 0 && r.error == ENOENT && !strchr(args[0], '/')) {
+            olvidar_comando(args[0]);
+            r.ruta = resolver_comando(args[0]);
+            if (r.ruta) pid = lanzar_con_ruta(&r);
+            else r.error = errno;
+        }
+        if (pid > 0) return pid;
+    }
+
+    char msg[96];
+    if (r.en_landlock) {
+        fprintf(stderr, "[flsh_sec]: %s\n", strerror(r.error));
+        log_shell(args[0], "Landlock: no se pudo restringir el proceso", "CRITICAL");
+    } else if (r.error == EACCES && landlock.ruleset_fd >= 0) {
+        fprintf(stderr, "[flsh_sec]: Ejecución denegada por Landlock.\n");
+        log_shell(args[0], "Landlock: ejecucion fuera de rutas permitidas", "WARNING");
+    } else {
+        fprintf(stderr, "[flsh_error]: %s\n", strerror(r.error));
+        snprintf(msg, sizeof(msg), "Fallo externo (Code: %d)", r.error == EACCES ? 126 : 127);
+        log_shell(args[0], msg, "ERROR");
+    }
+    return -1;
+}
+ 
+// Texto del prompt (también lo usa el editor de línea, que lo dibuja él mismo)
+static void componer_prompt(char *destino, size_t tam) {
+    char cwd[PATH_MAX];
+    // Intentamos recuperar el directorio de trabajo actual
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        // Personalización del prompt (Requisito de "Tema/Enfoque propio")
+        snprintf(destino, tam, "[Úsame: %s]> ", cwd);
+    } else {
+        // Fallback en caso de error de sistema al leer la ruta
+        snprintf(destino, tam, "> ");
+    }
+}
+
+/*
+ * Renderiza el indicador de línea de comandos (Prompt) para la interacción usuario-sistema.
+ * Funcionalidad:
+ * 1. Contexto Espacial: Utiliza la llamada al sistema 'getcwd' (Get Current Working Directory)
+ * para obtener la ruta absoluta actual y mostrarla al usuario. Esto es vital para la orientación
+ * dentro del árbol de directorios.
+ * 2. Manejo de Buffers (Crucial): Dado que 'printf' suele usar "line-buffering" (espera un '\n'
+ * para imprimir en pantalla) y el prompt NO termina en nueva línea (para que el usuario escriba
+ * al lado), es obligatorio llamar a 'fflush(stdout)'. Esto fuerza el vaciado del buffer y garantiza
+ * que el prompt aparezca inmediatamente antes de la espera de entrada (input).
+ * 3. Robustez: Si 'getcwd' falla (ej. permisos o ruta eliminada), muestra un prompt genérico "> "
+ * para mantener la operatividad.
+ */
+void imprimir_prompt() {
+    char prompt[PATH_MAX + 32];
+    componer_prompt(prompt, sizeof(prompt));
+    printf("%s", prompt);
+    // Forzamos la salida a pantalla porque printf no tiene '\n' al final
+    fflush(stdout);
+}
+
+// --- Analizador de Línea de Comandos (Arena + AST) ---
+
+/*
+ * Arena por comando: bloques encadenados con asignación por desplazamiento. 'arena_reiniciar' solo
+ * rebobina entre líneas (los bloques se conservan), así que en régimen estable el parser no llama
+ * a malloc. Todo lo que produce el análisis de una línea (argv, comandos, redirecciones) vive aquí.
+ */
+#define ARENA_BLOQUE (16 * 1024)
+#define ARENA_ALINEACION sizeof(void *)
+
+typedef struct arena_bloque {
+    struct arena_bloque *sig;
+    size_t capacidad, usado;
+    char datos[];
+} arena_bloque_t;
+
+typedef struct {
+    arena_bloque_t *primero, *actual;
+} arena_t;
+
+void *arena_reservar(arena_t *a, size_t n) {
+    n = (n + ARENA_ALINEACION - 1) & ~(ARENA_ALINEACION - 1);
+    arena_bloque_t *b = a->actual, *anterior = NULL;
+    // Los bloques posteriores a 'actual' quedaron libres en el último reinicio
+    while (b && b->usado + n > b->capacidad) {
+        anterior = b;
+        b = b->sig;
+        if (b) b->usado = 0;
+    }
+    if (!b) {
+        size_t capacidad = (n > ARENA_BLOQUE) ? n : ARENA_BLOQUE;
+        b = malloc(sizeof(*b) + capacidad);
+        if (!b) return NULL;
+        b->sig = NULL; b->capacidad = capacidad; b->usado = 0;
+        if (anterior) anterior->sig = b;
+        else a->primero = b;
+    }
+    a->actual = b;
+    void *p = b->datos + b->usado;
+    b->usado += n;
+    return p;
+}
+
+void arena_reiniciar(arena_t *a) {
+    a->actual = a->primero;
+    if (a->primero) a->primero->usado = 0;
+}
+
+// Duplica el arreglo 'viejo' (n elementos de 'tam' bytes) en uno de 'nueva' elementos dentro de la arena
+static void *arena_crecer(arena_t *a, void *viejo, size_t n, size_t nueva, size_t tam) {
+    void *nuevo = arena_reservar(a, nueva * tam);
+    if (nuevo && n) memcpy(nuevo, viejo, n * tam);
+    return nuevo;
+}
+
+/*
+ * Árbol de la línea: pipeline de comandos, cada uno con su argv y sus redirecciones, más el '&' final.
+ * Las palabras apuntan al buffer de la línea: el lexer quita comillas y escapes reescribiendo cada
+ * palabra en su lugar (el resultado nunca es más largo que el texto original) y la termina con '\0'.
+ */
+typedef enum {
+    REDIR_SALIDA,       // [n]>  archivo (crear/truncar)
+    REDIR_ANEXAR,       // [n]>> archivo
+    REDIR_ENTRADA,      // [n]<  archivo
+    REDIR_DUPLICAR      // [n]>&m / [n]<&m: 'fd' pasa a ser una copia de 'origen' (ej. 2>&1)
+} tipo_redireccion_t;
+
+typedef struct redireccion {
+    tipo_redireccion_t tipo;
+    int fd;             // Descriptor afectado (0, 1 o 2)
+    int origen;         // REDIR_DUPLICAR
+    char *destino;      // Archivo (o el texto de 'origen' en REDIR_DUPLICAR)
+    struct redireccion *sig;
+} redireccion_t;
+
+// Palabra con comodines sin comillas: se expande después del análisis ('expandir_comodines')
+typedef struct comodin {
+    int indice;         // Posición en argv
+    char *patron;       // La palabra con lo citado escapado con '\' (argv conserva el texto literal)
+    struct comodin *sig;
+} comodin_t;
+
+typedef struct {
+    char **argv;                      // Terminado en NULL
+    int argc;
+    redireccion_t *redirecciones;     // En orden de aparición
+    comodin_t *comodines;             // En orden de aparición (NULL = nada que expandir)
+} comando_t;
+
+typedef struct {
+    comando_t *comandos;
+    int n_comandos;                   // 0 = línea vacía o solo comentario
+    int segundo_plano;
+} linea_t;
+
+typedef enum { TOK_FIN, TOK_PALABRA, TOK_TUBERIA, TOK_REDIRECCION, TOK_AMPERSAND, TOK_ERROR } tipo_token_t;
+
+typedef struct {
+    char *p;            // Próximo carácter a examinar
+    char pendiente;     // Valor original de *p (el '\0' de la palabra anterior pudo pisarlo)
+    char *texto;        // TOK_PALABRA: palabra ya sin comillas ni escapes
+    char *patron;       // TOK_PALABRA con '*', '?' o '[' sin citar: patrón en la arena (si no, NULL)
+    arena_t *arena;     // NULL = no se buscan comodines (set -f)
+    tipo_redireccion_t redir;   // TOK_REDIRECCION: tipo y descriptor afectado
+    int redir_fd;
+    const char *error;  // TOK_ERROR: descripción
+} lexer_t;
+
+static int es_blanco(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\a'; }
+static int es_operador(char c) { return c == '|' || c == '>' || c == '<' || c == '&'; }
+static int es_comodin(char c) { return c == '*' || c == '?' || c == '['; }
+
+/*
+ * Prepaso de solo lectura sobre la palabra que empieza en 'r', con las mismas reglas de comillas que el
+ * lexer: retorna 1 si tiene un comodín sin citar y deja en '*largo' su largo en el texto original.
+ */
+static int palabra_con_comodines(const char *r, size_t *largo) {
+    const char *inicio = r;
+    int hay = 0;
+    for (char c; (c = *r) != '\0' && !es_blanco(c) && !es_operador(c);) {
+        if (c == '\\') r += r[1] ? 2 : 1;
+        else if (c == '\'' || c == '"') {
+            for (r++; *r && *r != c; r++) if (c == '"' && *r == '\\' && r[1]) r++;
+            if (*r) r++;
+        } else {
+            hay |= es_comodin(c);
+            r++;
+        }
+    }
+    *largo = (size_t)(r - inicio);
+    return hay;
+}
+
+// Carácter citado o escapado: literal en la palabra y, si se arma un patrón, escapado en él
+static void copiar_citado(char **w, char **q, char c) {
+    if (*q) {
+        if (es_comodin(c) || c == ']' || c == '\\') *(*q)++ = '\\';
+        *(*q)++ = c;
+    }
+    *(*w)++ = c;
+}
+
+/*
+ * Próximo token de la línea. Reglas (subconjunto de sh):
+ * 1. Blancos separan palabras; '|', '&', '>', '>>', '<' y '>&' sin comillas son operadores aunque
+ * vayan pegados. Un número justo antes de '>' o '<' es el descriptor a redirigir (ej. '2>').
+ * 2. '\' escapa el carácter siguiente. Entre comillas simples todo es literal; entre dobles, '\'
+ * solo escapa '"', '\', '$' y '`'.
+ * 3. '#' al inicio de una palabra comienza un comentario (incluye el shebang de los scripts).
+ * 4. '*', '?' o '[' sin citar hacen de la palabra un patrón, que se expande después del análisis.
+ */
+static tipo_token_t siguiente_token(lexer_t *lx) {
+    char c = lx->pendiente ? lx->pendiente : *lx->p;
+    lx->pendiente = 0;
+    while (es_blanco(c)) c = *++lx->p;
+    if (c == '\0' || c == '#') return TOK_FIN;
+
+    int fd = -1;
+    if (c >= '0' && c <= '9') {
+        char *q = lx->p;
+        while (*q >= '0' && *q <= '9') q++;
+        if ((*q == '>' || *q == '<') && q - lx->p <= 4) { fd = atoi(lx->p); lx->p = q; c = *q; }
+    }
+    if (c == '>' || c == '<') {
+        // Si 'c' vino de 'pendiente', *p quedó pisado por un '\0' pero p[1] sigue intacto
+        char *q = lx->p + 1;
+        if (c == '>' && *q == '>') { lx->redir = REDIR_ANEXAR; q++; }
+        else if (*q == '&') { lx->redir = REDIR_DUPLICAR; q++; }
+        else lx->redir = (c == '>') ? REDIR_SALIDA : REDIR_ENTRADA;
+        lx->redir_fd = (fd >= 0) ? fd : (c == '>') ? STDOUT_FILENO : STDIN_FILENO;
+        lx->p = q;
+        return TOK_REDIRECCION;
+    }
+    if (es_operador(c)) {
+        lx->p++;
+        return (c == '|') ? TOK_TUBERIA : TOK_AMPERSAND;
+    }
+
+    char *r = lx->p, *w = lx->p;
+    lx->texto = w;
+    // Con comodines sin citar, el patrón se arma en paralelo: lo citado que el matcher trataría como
+    // especial ('*', '?', '[', ']', '\\') va escapado, así "'*'.txt" sigue siendo un nombre literal
+    size_t largo;
+    char *patron = NULL, *q = NULL;
+    if (lx->arena && palabra_con_comodines(r, &largo)) patron = q = arena_reservar(lx->arena, 2 * largo + 1);
+    for (;;) {
+        c = *r;
+        if (c == '\0' || es_blanco(c) || es_operador(c)) break;
+        if (c == '\\') {
+            if (r[1] == '\0') { copiar_citado(&w, &q, *r); r++; continue; } // '\' final sin continuación: literal
+            copiar_citado(&w, &q, r[1]); r += 2;
+        } else if (c == '\'') {
+            for (r++; *r && *r != '\''; r++) copiar_citado(&w, &q, *r);
+            if (!*r) { lx->error = "comilla simple sin cerrar"; return TOK_ERROR; }
+            r++;
+        } else if (c == '"') {
+            for (r++; *r && *r != '"'; r++) {
+                if (*r == '\\' && (r[1] == '"' || r[1] == '\\' || r[1] == '$' || r[1] == '`')) r++;
+                copiar_citado(&w, &q, *r);
+            }
+            if (!*r) { lx->error = "comilla doble sin cerrar"; return TOK_ERROR; }
+            r++;
+        } else {
+            if (q) *q++ = c;
+            *w++ = *r++;
+        }
+    }
+    if (q) *q = '\0';
+    lx->patron = patron;
+    // Si la palabra no se acortó, el '\0' cae sobre el separador: lo guardamos para la próxima llamada
+    lx->p = r;
+    lx->pendiente = *r;
+    *w = '\0';
+    return TOK_PALABRA;
+}
+
+static int error_sintaxis(const char *cerca) {
+    fprintf(stderr, "flsh: error de sintaxis cerca de '%s'\n", cerca);
+    return -1;
+}
+
+/*
+ * Analiza 'texto' (se modifica en su lugar) y construye el árbol en la arena 'a'.
+ * Gramática: linea := comando ('|' comando)* ['&'];  comando := (palabra | redirección palabra)+
+ * Redirecciones: [n]> [n]>> [n]< [n]>&m [n]<&m, con n y m entre 0 y 2.
+ * No hay límites fijos: argv y la lista de comandos crecen dentro de la arena.
+ * Retorna 0, o -1 ante un error de sintaxis (ya informado).
+ */
+int parsear_linea(arena_t *a, char *texto, linea_t *linea) {
+    lexer_t lx = { .p = texto, .arena = opciones_shell.sin_comodines ? NULL : a };
+    memset(linea, 0, sizeof(*linea));
+    comando_t *actual = NULL;
+    redireccion_t **cola = NULL;
+    comodin_t **cola_comodines = NULL;
+    int cap_comandos = 0, cap_args = 0;
+
+    for (;;) {
+        tipo_token_t t = siguiente_token(&lx);
+        if (t == TOK_ERROR) { fprintf(stderr, "flsh: error de sintaxis: %s\n", lx.error); return -1; }
+
+        if (t == TOK_PALABRA || t == TOK_REDIRECCION) {
+            if (!actual) {
+                if (linea->n_comandos == cap_comandos) {
+                    cap_comandos = cap_comandos ? cap_comandos * 2 : 4;
+                    linea->comandos = arena_crecer(a, linea->comandos, linea->n_comandos, cap_comandos, sizeof(comando_t));
+                    if (!linea->comandos) goto sin_memoria;
+                }
+                actual = &linea->comandos[linea->n_comandos++];
+                memset(actual, 0, sizeof(*actual));
+                cola = &actual->redirecciones;
+                cola_comodines = &actual->comodines;
+                cap_args = 0;
+            }
+            if (t == TOK_REDIRECCION) {
+                tipo_redireccion_t tipo = lx.redir;
+                int fd = lx.redir_fd;
+                const char *simbolo = (tipo == REDIR_ANEXAR) ? ">>" : (tipo == REDIR_ENTRADA) ? "<" : (tipo == REDIR_DUPLICAR) ? ">&" : ">";
+                if (siguiente_token(&lx) != TOK_PALABRA) return error_sintaxis(simbolo);
+                if (fd > STDERR_FILENO) { fprintf(stderr, "flsh: descriptor no soportado: %d (solo 0, 1 y 2)\n", fd); return -1; }
+                redireccion_t *r = arena_reservar(a, sizeof(*r));
+                if (!r) goto sin_memoria;
+                r->tipo = tipo; r->fd = fd; r->origen = -1; r->destino = lx.texto; r->sig = NULL;
+                if (tipo == REDIR_DUPLICAR) {
+                    if (lx.texto[0] < '0' || lx.texto[0] > '2' || lx.texto[1]) return error_sintaxis(lx.texto);
+                    r->origen = lx.texto[0] - '0';
+                }
+                *cola = r;
+                cola = &r->sig;
+                continue;
+            }
+            if (actual->argc + 1 >= cap_args) {
+                cap_args = cap_args ? cap_args * 2 : 8;
+                actual->argv = arena_crecer(a, actual->argv, actual->argc, cap_args, sizeof(char *));
+                if (!actual->argv) goto sin_memoria;
+            }
+            if (lx.patron) {
+                comodin_t *c = arena_reservar(a, sizeof(*c));
+                if (!c) goto sin_memoria;
+                c->indice = actual->argc; c->patron = lx.patron; c->sig = NULL;
+                *cola_comodines = c;
+                cola_comodines = &c->sig;
+            }
+            actual->argv[actual->argc++] = lx.texto;
+            actual->argv[actual->argc] = NULL;
+            continue;
+        }
+
+        // Fin de comando ('|', '&' o fin de línea): debe tener al menos una palabra
+        const char *operador = (t == TOK_TUBERIA) ? "|" : (t == TOK_AMPERSAND) ? "&" : NULL;
+        if (actual && actual->argc == 0) return error_sintaxis(operador ? operador : ">");
+        if (t == TOK_TUBERIA) {
+            if (!actual) return error_sintaxis("|");
+            actual = NULL;
+            continue;
+        }
+        if (t == TOK_AMPERSAND) {
+            // Solo al final de la línea
+            if (!actual || siguiente_token(&lx) != TOK_FIN) return error_sintaxis("&");
+            linea->segundo_plano = 1;
+        } else if (!actual && linea->n_comandos > 0) {
+            return error_sintaxis("|");
+        }
+        return 0;
+    }
+
+sin_memoria:
+    fprintf(stderr, "flsh: memoria insuficiente para analizar la línea\n");
+    return -1;
+}
+
+/*
+ * Indica si la línea lógica acumulada sigue en la próxima línea física:
+ * - LINEA_CONTINUA_BARRA: termina en '\' fuera de comillas simples (se quitan la barra y el salto).
+ * - LINEA_CONTINUA_COMILLA: hay una comilla abierta (el salto de línea es parte de la palabra).
+ */
+enum { LINEA_COMPLETA, LINEA_CONTINUA_BARRA, LINEA_CONTINUA_COMILLA };
+
+static int estado_continuacion(const char *s, size_t n) {
+    char comilla = 0;
+    int inicio_palabra = 1;
+    for (size_t i = 0; i < n; i++) {
+        char c = s[i];
+        if (comilla == '\'') { if (c == '\'') comilla = 0; continue; }
+        if (c == '\\') {
+            if (i + 1 == n) return LINEA_CONTINUA_BARRA;
+            i++; inicio_palabra = 0;
+            continue;
+        }
+        if (comilla == '"') { if (c == '"') comilla = 0; continue; }
+        if (c == '#' && inicio_palabra) return LINEA_COMPLETA; // Comentario hasta el final
+        if (c == '\'' || c == '"') comilla = c;
+        inicio_palabra = es_blanco(c) || es_operador(c);
+    }
+    return comilla ? LINEA_CONTINUA_COMILLA : LINEA_COMPLETA;
+}
+
+/*
+ * Lee una línea lógica en '*linea' (crece como en getline y se reutiliza entre comandos, sin límite
+ * de largo). 'lector' NULL = stdin: con el editor de línea activo lee con él (Ctrl-C devuelve una
+ * línea vacía y la línea completa va al historial); si no, con getline. Las continuaciones muestran "> ".
+ * Retorna el largo, -1 en EOF, o -2 si la entrada terminó con una comilla o '\' pendiente.
+ */
+ssize_t leer_linea_logica(lector_t *lector, char **linea, size_t *capacidad) {
+    static char *fisica = NULL;
+    static size_t cap_fisica = 0;
+    size_t largo = 0;
+    for (;;) {
+        ssize_t n;
+        if (lector) n = lector_linea(lector, &fisica, &cap_fisica);
+        else if (editor_activo) {
+            n = editor_leer_linea(largo ? "> " : NULL, &fisica, &cap_fisica);
+            if (n == -3) { largo = 0; n = 0; } // Ctrl-C: se descarta todo, también las líneas de continuación
+        } else {
+            n = getline(&fisica, &cap_fisica, stdin);
+            if (n > 0 && fisica[n - 1] == '\n') fisica[--n] = '\0';
+        }
+        if (n < 0) return largo ? -2 : -1;
+
+        if (largo + (size_t)n + 2 > *capacidad) {
+            size_t nueva = *capacidad ? *capacidad : 256;
+            while (nueva < largo + (size_t)n + 2) nueva *= 2;
+            char *buffer = realloc(*linea, nueva);
+            if (!buffer) return -1;
+            *linea = buffer; *capacidad = nueva;
+        }
+        memcpy(*linea + largo, fisica, (size_t)n + 1);
+        largo += (size_t)n;
+
+        int estado = estado_continuacion(*linea, largo);
+        if (estado == LINEA_COMPLETA) {
+            if (!lector && editor_activo) historial_agregar(*linea, largo);
+            return (ssize_t)largo;
+        }
+        if (estado == LINEA_CONTINUA_BARRA) (*linea)[--largo] = '\0';
+        else { (*linea)[largo++] = '\n'; (*linea)[largo] = '\0'; }
+        if (!lector && !editor_activo) { printf("> "); fflush(stdout); }
+    }
+}
+
+// --- Comandos Internos ---
+
+// --- Comando Built-in: ls (Listar Directorio) ---
+
+/*
+ * Motor de listado nativo, pensado para directorios enormes sin recurrir a /bin/ls:
+ * - Lectura: getdents64 en lotes de LS_LOTE bytes directamente sobre un buffer contiguo que crece;
+ * los nombres se quedan dentro de los registros dirent (sin copias ni un malloc por entrada).
+ * - Metadatos: solo si el formato o el orden los necesitan (-l, -t, -S), con statx pidiendo
+ * únicamente esos campos. Con más de LS_UMBRAL_PARALELO entradas se reparten entre hilos.
+ * - Orden: radix sobre un arreglo compacto de claves {64 bits, índice} (8 bytes del nombre tras el
+ * prefijo común, mtime o tamaño); el nombre completo solo se compara en los empates.
+ * - Salida: writev con iovecs que apuntan a los nombres en el buffer de lectura; solo el texto de
+ * formato (permisos, fechas, relleno) se escribe en un buffer propio.
+ * - -R: cada directorio se lista y se vuelca antes de descender, así la memoria depende del
+ * directorio más grande y no del árbol completo.
+ */
+#define LS_LOTE (256 * 1024)
+#define LS_UMBRAL_PARALELO 2048
+#define LS_MAX_HILOS 8
+#define LS_TRAMO 512                 // Entradas que toma un hilo de statx por vez
+#define LS_IOV 1024                  // IOV_MAX en Linux
+#define LS_TEXTO (64 * 1024)
+#define LS_SEIS_MESES (182L * 24 * 3600)
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/*
+ * Abre 'ruta' relativa a 'dirfd' sin permitir que la resolución salga de dirfd ni atraviese enlaces
+ * simbólicos. Usa openat2 (Linux 5.6+) y, si no está disponible, openat con O_NOFOLLOW.
+ */
+static int abrir_debajo_sin_enlaces(int dirfd, const char *ruta, int flags) {
+#ifdef SYS_openat2
+    struct open_how how = { .flags = (uint64_t)(flags | O_CLOEXEC), .mode = 0,
+                            .resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS | RESOLVE_NO_MAGICLINKS };
+    int fd = (int)syscall(SYS_openat2, dirfd, ruta, &how, sizeof(how));
+    if (fd >= 0 || errno != ENOSYS) return fd;
+#endif
+    return openat(dirfd, ruta, flags | O_CLOEXEC | O_NOFOLLOW);
+}
+
+typedef enum { ORDEN_NOMBRE, ORDEN_TIEMPO, ORDEN_TAMANO } orden_ls_t;
+
+typedef struct {
+    int largo, todos, recursivo;
+    orden_ls_t orden;
+    int columnas;                    // stdout es una terminal: columnas en lugar de una entrada por línea
+    int ancho;                       // Ancho de la terminal
+    time_t ahora;
+} opciones_ls_t;
+
+typedef struct {
+    uint64_t tam, bloques;
+    int64_t mtime;
+    uint32_t mtime_ns, modo, nlink, uid, gid;
+    int error;                       // errno de statx (0 = ok)
+} meta_ls_t;
+
+typedef struct {
+    uint64_t clave;
+    uint32_t indice;
+} clave_ls_t;
+
+typedef struct {
+    char *datos;                     // Registros dirent tal como los entrega getdents64
+    size_t usado, capacidad;
+    size_t *entradas;                // Desplazamiento de cada registro visible dentro de 'datos'
+    size_t n, cap_entradas;
+    meta_ls_t *meta;                 // Paralelo a 'entradas' (solo si hacen falta metadatos)
+    size_t cap_meta;
+    clave_ls_t *orden;
+    size_t cap_orden;
+} listado_t;
+
+typedef struct {
+    struct iovec iov[LS_IOV];
+    int n;
+    char texto[LS_TEXTO];            // Formato (permisos, fechas...); los nombres no se copian
+    size_t usado;
+    int error;
+} salida_ls_t;
+
+static struct linux_dirent64 *registro_ls(const listado_t *l, size_t i) {
+    return (struct linux_dirent64 *)(l->datos + l->entradas[i]);
+}
+
+static void liberar_listado(listado_t *l) {
+    free(l->datos); free(l->entradas); free(l->meta); free(l->orden);
+}
+
+// Lee todas las entradas de 'fd' con getdents64 (filtra las ocultas salvo '-a'). Retorna 0 o -1 con errno.
+static int leer_directorio_ls(int fd, listado_t *l, int todos) {
+    l->usado = 0; l->n = 0;
+    for (;;) {
+        if (l->capacidad - l->usado < LS_LOTE) {
+            size_t nueva = l->capacidad ? l->capacidad * 2 : LS_LOTE;
+            while (nueva - l->usado < LS_LOTE) nueva *= 2;
+            char *p = realloc(l->datos, nueva);
+            if (!p) return -1;
+            l->datos = p; l->capacidad = nueva;
+        }
+        long leidos = syscall(SYS_getdents64, fd, l->datos + l->usado, l->capacidad - l->usado);
+        if (leidos < 0 && errno == EINTR) continue;
+        if (leidos < 0) return -1;
+        if (leidos == 0) return 0;
+        for (size_t off = l->usado; off < l->usado + (size_t)leidos; ) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(l->datos + off);
+            if (todos || d->d_name[0] != '.') {
+                if (reservar_vector((void **)&l->entradas, &l->cap_entradas, l->n + 1, sizeof(size_t)) != 0) return -1;
+                l->entradas[l->n++] = off;
+            }
+            off += d->d_reclen;
+        }
+        l->usado += (size_t)leidos;
+    }
+}
+
+// --- Metadatos (statx en paralelo) ---
+
+typedef struct {
+    listado_t *l;
+    int dirfd;
+    unsigned mascara;
+    size_t siguiente;                // Próximo tramo libre (atómico)
+} tarea_statx_t;
+
+// Nombre vacío = el propio 'dirfd' (AT_EMPTY_PATH), para rutas sueltas abiertas con O_PATH
+static void statx_entrada(int dirfd, const char *nombre, unsigned mascara, meta_ls_t *m) {
+    struct statx stx;
+    memset(m, 0, sizeof(*m));
+    int flags = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT | (*nombre ? 0 : AT_EMPTY_PATH);
+    if (statx(dirfd, nombre, flags, mascara, &stx) != 0) { m->error = errno; return; }
+    m->modo = stx.stx_mode; m->nlink = stx.stx_nlink;
+    m->uid = stx.stx_uid; m->gid = stx.stx_gid;
+    m->tam = stx.stx_size; m->bloques = stx.stx_blocks;
+    m->mtime = stx.stx_mtime.tv_sec; m->mtime_ns = stx.stx_mtime.tv_nsec;
+}
+
+static void *hilo_statx(void *arg) {
+    tarea_statx_t *t = arg;
+    for (;;) {
+        size_t desde = __atomic_fetch_add(&t->siguiente, LS_TRAMO, __ATOMIC_RELAXED);
+        if (desde >= t->l->n) break;
+        size_t hasta = (desde + LS_TRAMO < t->l->n) ? desde + LS_TRAMO : t->l->n;
+        for (size_t i = desde; i < hasta; i++) statx_entrada(t->dirfd, registro_ls(t->l, i)->d_name, t->mascara, &t->l->meta[i]);
+    }
+    return NULL;
+}
+
+static int obtener_metadatos_ls(int dirfd, listado_t *l, unsigned mascara) {
+    if (reservar_vector((void **)&l->meta, &l->cap_meta, l->n, sizeof(meta_ls_t)) != 0) return -1;
+    tarea_statx_t t = { .l = l, .dirfd = dirfd, .mascara = mascara, .siguiente = 0 };
+    pthread_t hilos[LS_MAX_HILOS];
+    int creados = 0;
+    if (l->n > LS_UMBRAL_PARALELO) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        long n_hilos = (long)(l->n / LS_TRAMO);
+        if (n_hilos > cpus) n_hilos = cpus;
+        if (n_hilos > LS_MAX_HILOS) n_hilos = LS_MAX_HILOS;
+        for (long k = 1; k < n_hilos; k++) if (pthread_create(&hilos[creados], NULL, hilo_statx, &t) == 0) creados++;
+    }
+    hilo_statx(&t); // El hilo que invoca también trabaja
+    for (int k = 0; k < creados; k++) pthread_join(hilos[k], NULL);
+    return 0;
+}
+
+// --- Orden por arreglo de claves ---
+
+// 8 bytes del nombre desde 'desde' en big-endian: comparar claves equivale a strcmp sobre ese tramo
+static uint64_t clave_nombre(const char *s, size_t desde) {
+    uint64_t k = 0;
+    s += desde;
+    for (int i = 0; i < 8; i++) { k <<= 8; if (*s) k |= (unsigned char)*s++; }
+    return k;
+}
+
+static int comparar_claves_ls(const void *a, const void *b, void *contexto) {
+    const clave_ls_t *x = a, *y = b;
+    if (x->clave != y->clave) return (x->clave < y->clave) ? -1 : 1;
+    return strcmp(registro_ls(contexto, x->indice)->d_name, registro_ls(contexto, y->indice)->d_name);
+}
+
+/*
+ * Radix LSD de 8 bits sobre la clave (estable). Los 8 histogramas salen de una sola pasada y se
+ * omiten los bytes que todas las claves comparten. 'aux' tiene lugar para 'n' claves.
+ */
+static void radix_claves(clave_ls_t *v, clave_ls_t *aux, size_t n) {
+    static size_t cuenta[8][256];
+    memset(cuenta, 0, sizeof(cuenta));
+    for (size_t i = 0; i < n; i++) {
+        for (int b = 0; b < 8; b++) cuenta[b][(v[i].clave >> (8 * b)) & 0xff]++;
+    }
+    clave_ls_t *origen = v, *destino = aux;
+    for (int b = 0; b < 8; b++) {
+        if (cuenta[b][(v[0].clave >> (8 * b)) & 0xff] == n) continue;
+        size_t pos = 0;
+        for (int d = 0; d < 256; d++) { size_t c = cuenta[b][d]; cuenta[b][d] = pos; pos += c; }
+        for (size_t i = 0; i < n; i++) destino[cuenta[b][(origen[i].clave >> (8 * b)) & 0xff]++] = origen[i];
+        clave_ls_t *t = origen; origen = destino; destino = t;
+    }
+    if (origen != v) memcpy(v, origen, n * sizeof(*v));
+}
+
+/*
+ * Ordena 'l->orden'. La clave de nombre toma los 8 bytes que siguen al prefijo común de todo el
+ * directorio (ej. "IMG_0001.jpg", "IMG_0002.jpg" se distinguen en la clave y no en un strcmp);
+ * -t y -S ordenan de mayor a menor invirtiendo la clave. Los empates de clave se resuelven por nombre.
+ */
+static int ordenar_listado(listado_t *l, orden_ls_t orden) {
+    if (l->n == 0) return 0;
+    // El doble: la segunda mitad es el buffer auxiliar del radix
+    if (reservar_vector((void **)&l->orden, &l->cap_orden, 2 * l->n, sizeof(clave_ls_t)) != 0) return -1;
+    size_t comun = 0;
+    if (orden == ORDEN_NOMBRE) {
+        const char *primero = registro_ls(l, 0)->d_name;
+        comun = strlen(primero);
+        for (size_t i = 1; i < l->n && comun > 0; i++) {
+            const char *nombre = registro_ls(l, i)->d_name;
+            size_t k = 0;
+            while (k < comun && nombre[k] == primero[k]) k++;
+            comun = k;
+        }
+    }
+    for (size_t i = 0; i < l->n; i++) {
+        uint64_t clave;
+        if (orden == ORDEN_NOMBRE) clave = clave_nombre(registro_ls(l, i)->d_name, comun);
+        else if (l->meta[i].error) clave = UINT64_MAX;
+        else if (orden == ORDEN_TAMANO) clave = UINT64_MAX - l->meta[i].tam;
+        else {
+            // Nanosegundos con signo llevados a orden sin signo invirtiendo el bit alto
+            int64_t ns = l->meta[i].mtime * 1000000000LL + l->meta[i].mtime_ns;
+            clave = UINT64_MAX - ((uint64_t)ns ^ (1ULL << 63));
+        }
+        l->orden[i].clave = clave;
+        l->orden[i].indice = (uint32_t)i;
+    }
+    radix_claves(l->orden, l->orden + l->n, l->n);
+    for (size_t i = 0; i < l->n; ) {
+        size_t j = i + 1;
+        while (j < l->n && l->orden[j].clave == l->orden[i].clave) j++;
+        if (j - i > 1) qsort_r(l->orden + i, j - i, sizeof(clave_ls_t), comparar_claves_ls, l);
+        i = j;
+    }
+    return 0;
+}
+
+// --- Salida por writev ---
+
+static void volcar_ls(salida_ls_t *s) {
+    struct iovec *iov = s->iov;
+    int n = s->n;
+    while (n > 0 && !s->error) {
+        ssize_t escritos = writev(STDOUT_FILENO, iov, n);
+        if (escritos < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EPIPE) reportar_error_sistema("ls");
+            s->error = 1;
+            break;
+        }
+        contar_io(0, (uint64_t)escritos);
+        // Escritura parcial: avanzamos sobre los iovecs ya enviados
+        while (n > 0 && (size_t)escritos >= iov->iov_len) { escritos -= (ssize_t)iov->iov_len; iov++; n--; }
+        if (n > 0) { iov->iov_base = (char *)iov->iov_base + escritos; iov->iov_len -= (size_t)escritos; }
+    }
+    s->n = 0; s->usado = 0;
+}
+
+// Referencia 'largo' bytes que deben seguir vivos hasta el próximo volcado (nombres o constantes)
+static void emitir_ls(salida_ls_t *s, const char *p, size_t largo) {
+    if (largo == 0) return;
+    if (s->n > 0) {
+        struct iovec *ultimo = &s->iov[s->n - 1];
+        if ((char *)ultimo->iov_base + ultimo->iov_len == p) { ultimo->iov_len += largo; return; }
+    }
+    if (s->n == LS_IOV) volcar_ls(s);
+    s->iov[s->n].iov_base = (void *)p;
+    s->iov[s->n].iov_len = largo;
+    s->n++;
+}
+
+// Texto con formato: se copia al buffer propio (los trozos consecutivos comparten un solo iovec)
+__attribute__((format(printf, 2, 3)))
+static void emitir_texto_ls(salida_ls_t *s, const char *formato, ...) {
+    for (int intento = 0; intento < 2; intento++) {
+        va_list ap;
+        va_start(ap, formato);
+        int n = vsnprintf(s->texto + s->usado, LS_TEXTO - s->usado, formato, ap);
+        va_end(ap);
+        if (n < 0) return;
+        if ((size_t)n < LS_TEXTO - s->usado) {
+            emitir_ls(s, s->texto + s->usado, (size_t)n);
+            s->usado += (size_t)n;
+            return;
+        }
+        volcar_ls(s); // Sin espacio: se vacía y se reintenta con el buffer completo
+    }
+}
+
+static void emitir_relleno_ls(salida_ls_t *s, int n) {
+    static const char espacios[] = "                                                                ";
+    while (n > 0) {
+        int k = (n < (int)sizeof(espacios) - 1) ? n : (int)sizeof(espacios) - 1;
+        emitir_ls(s, espacios, (size_t)k);
+        n -= k;
+    }
+}
+
+// Ancho en pantalla (puntos de código UTF-8, no bytes)
+static int ancho_nombre(const char *s) {
+    int n = 0;
+    for (; *s; s++) if (((unsigned char)*s & 0xC0) != 0x80) n++;
+    return n;
+}
+
+// --- Formatos ---
+
+static void emitir_columnas_ls(salida_ls_t *s, const listado_t *l, const opciones_ls_t *o) {
+    if (!o->columnas) {
+        for (size_t k = 0; k < l->n; k++) {
+            const char *nombre = registro_ls(l, l->orden[k].indice)->d_name;
+            emitir_ls(s, nombre, strlen(nombre));
+            emitir_ls(s, "\n", 1);
+        }
+        return;
+    }
+    int max = 0;
+    for (size_t k = 0; k < l->n; k++) {
+        int w = ancho_nombre(registro_ls(l, k)->d_name);
+        if (w > max) max = w;
+    }
+    size_t columnas = (size_t)(o->ancho / (max + 2));
+    if (columnas == 0) columnas = 1;
+    size_t filas = (l->n + columnas - 1) / columnas;
+    // Orden por columnas (como ls): la entrada k va en la fila k % filas
+    for (size_t f = 0; f < filas; f++) {
+        for (size_t c = 0; c < columnas; c++) {
+            size_t k = c * filas + f;
+            if (k >= l->n) break;
+            const char *nombre = registro_ls(l, l->orden[k].indice)->d_name;
+            emitir_ls(s, nombre, strlen(nombre));
+            if (k + filas < l->n) emitir_relleno_ls(s, max + 2 - ancho_nombre(nombre));
+        }
+        emitir_ls(s, "\n", 1);
+    }
+}
+
+// Nombres de usuario/grupo con una pequeña cache de mapeo directo (getpwuid por entrada es caro)
+#define LS_CACHE_NOMBRES 64
+typedef struct { uint32_t id; int valido; char nombre[33]; } cache_nombre_t;
+
+static const char *nombre_de_id(uint32_t id, int es_grupo) {
+    static cache_nombre_t cache[2][LS_CACHE_NOMBRES];
+    cache_nombre_t *c = &cache[es_grupo][id % LS_CACHE_NOMBRES];
+    if (!c->valido || c->id != id) {
+        const char *nombre = NULL;
+        if (es_grupo) { struct group *g = getgrgid(id); if (g) nombre = g->gr_name; }
+        else { struct passwd *p = getpwuid(id); if (p) nombre = p->pw_name; }
+        if (nombre) snprintf(c->nombre, sizeof(c->nombre), "%s", nombre);
+        else snprintf(c->nombre, sizeof(c->nombre), "%u", id);
+        c->id = id; c->valido = 1;
+    }
+    return c->nombre;
+}
+
+static void texto_permisos(uint32_t modo, char *p) {
+    p[0] = S_ISDIR(modo) ? 'd' : S_ISLNK(modo) ? 'l' : S_ISCHR(modo) ? 'c' : S_ISBLK(modo) ? 'b' :
+           S_ISFIFO(modo) ? 'p' : S_ISSOCK(modo) ? 's' : '-';
+    const char *rwx = "rwxrwxrwx";
+    for (int i = 0; i < 9; i++) p[i + 1] = (modo & (1u << (8 - i))) ? rwx[i] : '-';
+    if (modo & S_ISUID) p[3] = (modo & S_IXUSR) ? 's' : 'S';
+    if (modo & S_ISGID) p[6] = (modo & S_IXGRP) ? 's' : 'S';
+    if (modo & S_ISVTX) p[9] = (modo & S_IXOTH) ? 't' : 'T';
+    p[10] = '\0';
+}
+
+static int digitos(uint64_t v) {
+    int n = 1;
+    while (v >= 10) { v /= 10; n++; }
+    return n;
+}
+
+/*
+ * Una línea de 'ls -l': permisos, enlaces, dueño, grupo, tamaño, fecha y nombre (y destino si es
+ * un enlace simbólico). 'anchos' = {enlaces, dueño, grupo, tamaño}. 'dirfd'/'nombre' sirven para readlinkat.
+ */
+static void emitir_linea_larga(salida_ls_t *s, const opciones_ls_t *o, const meta_ls_t *m, const int *anchos,
+                               int dirfd, const char *nombre, const char *mostrado) {
+    if (m->error) {
+        emitir_texto_ls(s, "?????????? %*s %-*s %-*s %*s %12s ", anchos[0], "?", anchos[1], "?", anchos[2], "?", anchos[3], "?", "");
+    } else {
+        char permisos[11], fecha[32];
+        texto_permisos(m->modo, permisos);
+        struct tm tm;
+        time_t t = (time_t)m->mtime;
+        localtime_r(&t, &tm);
+        // Fechas de más de seis meses (o futuras) muestran el año en lugar de la hora
+        int reciente = (o->ahora - t) < LS_SEIS_MESES && (t - o->ahora) < 3600;
+        strftime(fecha, sizeof(fecha), reciente ? "%b %e %H:%M" : "%b %e  %Y", &tm);
+        emitir_texto_ls(s, "%s %*u %-*s %-*s %*llu %s ", permisos, anchos[0], m->nlink, anchos[1], nombre_de_id(m->uid, 0),
+                        anchos[2], nombre_de_id(m->gid, 1), anchos[3], (unsigned long long)m->tam, fecha);
+    }
+    emitir_ls(s, mostrado, strlen(mostrado));
+    if (!m->error && S_ISLNK(m->modo)) {
+        char destino[PATH_MAX];
+        ssize_t n = readlinkat(dirfd, nombre, destino, sizeof(destino) - 1);
+        if (n >= 0) { destino[n] = '\0'; emitir_texto_ls(s, " -> %s", destino); }
+    }
+    emitir_texto_ls(s, "\n");
+}
+
+static void calcular_anchos(const meta_ls_t *m, int *anchos) {
+    if (m->error) return;
+    int w[4] = { digitos(m->nlink), (int)strlen(nombre_de_id(m->uid, 0)), (int)strlen(nombre_de_id(m->gid, 1)), digitos(m->tam) };
+    for (int i = 0; i < 4; i++) if (w[i] > anchos[i]) anchos[i] = w[i];
+}
+
+static void emitir_largo_ls(salida_ls_t *s, const listado_t *l, const opciones_ls_t *o, int dirfd) {
+    int anchos[4] = { 1, 1, 1, 1 };
+    unsigned long long bloques = 0;
+    for (size_t i = 0; i < l->n; i++) {
+        calcular_anchos(&l->meta[i], anchos);
+        bloques += l->meta[i].bloques;
+    }
+    emitir_texto_ls(s, "total %llu\n", bloques / 2); // Bloques de 512 bytes -> KiB
+    for (size_t k = 0; k < l->n; k++) {
+        uint32_t i = l->orden[k].indice;
+        const char *nombre = registro_ls(l, i)->d_name;
+        emitir_linea_larga(s, o, &l->meta[i], anchos, dirfd, nombre, nombre);
+    }
+}
+
+// --- Recorrido ---
+
+static int es_directorio_ls(const listado_t *l, size_t i, int dirfd) {
+    unsigned char tipo = registro_ls(l, i)->d_type;
+    if (tipo != DT_UNKNOWN) return tipo == DT_DIR;
+    struct stat st; // Sistemas de archivos sin d_type
+    return fstatat(dirfd, registro_ls(l, i)->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+}
+
+/*
+ * Lista el directorio abierto en 'fd'. 'ruta' solo se usa en cabeceras y mensajes. Con -R desciende
+ * a los subdirectorios (sin seguir enlaces) después de volcar la salida de este nivel, salteando los
+ * que la política deniega ('arbol' es el cursor del Sandbox para este directorio).
+ */
+static void listar_directorio_ls(int fd, const char *ruta, const arbol_sandbox_t *arbol, const opciones_ls_t *o,
+                                 listado_t *l, salida_ls_t *s, int cabecera) {
+    if (cabecera) emitir_texto_ls(s, "%s:\n", ruta);
+    if (leer_directorio_ls(fd, l, o->todos) != 0) { volcar_ls(s); reportar_error_ruta("ls", ruta); return; }
+
+    unsigned mascara = 0;
+    if (o->largo) mascara |= STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | STATX_SIZE | STATX_MTIME | STATX_BLOCKS;
+    if (o->orden == ORDEN_TIEMPO) mascara |= STATX_MTIME;
+    if (o->orden == ORDEN_TAMANO) mascara |= STATX_SIZE;
+    if ((mascara && obtener_metadatos_ls(fd, l, mascara) != 0) || ordenar_listado(l, o->orden) != 0) {
+        volcar_ls(s); reportar_error_ruta("ls", ruta); return;
+    }
+    if (o->largo) emitir_largo_ls(s, l, o, fd);
+    else emitir_columnas_ls(s, l, o);
+
+    // Los iovecs apuntan a 'l': se vuelca antes de reutilizarlo en el descenso
+    volcar_ls(s);
+    if (!o->recursivo || s->error) return;
+
+    // Subdirectorios en el orden del listado, copiados porque 'l' se reutiliza en cada nivel
+    char *subdirs = NULL;
+    size_t largo = 0, capacidad = 0;
+    for (size_t k = 0; k < l->n; k++) {
+        uint32_t i = l->orden[k].indice;
+        const char *nombre = registro_ls(l, i)->d_name;
+        if (strcmp(nombre, ".") == 0 || strcmp(nombre, "..") == 0) continue;
+        int es_dir = o->largo ? (!l->meta[i].error && S_ISDIR(l->meta[i].modo)) : es_directorio_ls(l, i, fd);
+        if (!es_dir) continue;
+        size_t n = strlen(nombre) + 1;
+        if (reservar_vector((void **)&subdirs, &capacidad, largo + n, 1) != 0) break;
+        memcpy(subdirs + largo, nombre, n);
+        largo += n;
+    }
+    for (size_t off = 0; off < largo && !s->error; off += strlen(subdirs + off) + 1) {
+        const char *nombre = subdirs + off;
+        arbol_sandbox_t sub;
+        if (!arbol_descender(arbol, nombre, &sub)) continue;
+        char ruta_hijo[PATH_MAX];
+        snprintf(ruta_hijo, sizeof(ruta_hijo), "%s/%s", ruta, nombre);
+        emitir_ls(s, "\n", 1);
+        int hijo = abrir_debajo_sin_enlaces(fd, nombre, O_RDONLY | O_DIRECTORY);
+        if (hijo < 0) { emitir_texto_ls(s, "%s:\n", ruta_hijo); volcar_ls(s); reportar_error_ruta("ls", ruta_hijo); continue; }
+        listar_directorio_ls(hijo, ruta_hijo, &sub, o, l, s, 1);
+        close(hijo);
+    }
+    free(subdirs);
+}
+
+/*
+ * Built-in 'ls [-latSR] [ruta...]'.
+ * Funcionalidad:
+ * 1. Validación de Seguridad: Cada ruta se abre a través del Sandbox ('abrir_arbol_en_sandbox'), que
+ * valida y abre en una sola syscall; los descensos de -R no siguen enlaces, no salen del árbol y no
+ * entran en los subárboles que la política deniega a 'ls'.
+ * 2. Opciones: -l formato largo, -a incluye ocultos, -t por fecha de modificación, -S por tamaño,
+ * -R recursivo. Sin -l, en una terminal se usan columnas y en un pipe una entrada por línea.
+ * 3. Gestión de Errores: Los fallos de apertura (ej. permisos, ruta inexistente) se reportan y el
+ * listado continúa con la siguiente ruta.
+ */
+void ejecutar_ls(char **args) {
+    opciones_ls_t o = { .orden = ORDEN_NOMBRE, .ancho = 80 };
+    int i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        for (const char *p = args[i] + 1; *p; p++) {
+            switch (*p) {
+                case 'l': o.largo = 1; break;
+                case 'a': o.todos = 1; break;
+                case 'R': o.recursivo = 1; break;
+                case 't': o.orden = ORDEN_TIEMPO; break;
+                case 'S': o.orden = ORDEN_TAMANO; break;
+                default:
+                    fprintf(stderr, "ls: opción inválida: -%c (uso: ls [-latSR] [ruta...])\n", *p);
+                    estado_builtin = 2;
+                    return;
+            }
+        }
+    }
+    o.columnas = isatty(STDOUT_FILENO);
+    struct winsize ws;
+    if (o.columnas && ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) o.ancho = ws.ws_col;
+    o.ahora = time(NULL);
+
+    salida_ls_t *s = malloc(sizeof(*s));
+    if (!s) { reportar_error_sistema("ls"); return; }
+    s->n = 0; s->usado = 0; s->error = 0;
+    listado_t l = { 0 };
+    salida_volcar(); // ls escribe directo al descriptor: lo pendiente en la capa de salida debe salir antes
+
+    char *actual[] = { ".", NULL };
+    char **rutas = args[i] ? &args[i] : actual;
+    int varias = rutas[0] && rutas[1];
+    for (int k = 0; rutas[k] && !s->error; k++) {
+        const char *ruta = rutas[k];
+        arbol_sandbox_t arbol = { .politica = NULL, .nodo = -1 };
+        // Sin argumentos se lista el directorio actual; con -R también pasa por la política (subárboles denegados)
+        int fd = (rutas == actual && !o.recursivo) ? open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+                                                   : abrir_arbol_en_sandbox(ruta, O_RDONLY | O_DIRECTORY, "ls", &arbol);
+        if (fd == SANDBOX_DENEGADO) continue;
+        if (fd < 0 && errno == ENOTDIR) {
+            // Archivo suelto: se muestra su propio nombre (con -l, sus metadatos)
+            int f = abrir_en_sandbox(ruta, O_PATH | O_NOFOLLOW, 0, "ls");
+            if (f < 0) { if (f != SANDBOX_DENEGADO) reportar_error_ruta("ls", ruta); continue; }
+            if (o.largo) {
+                meta_ls_t m;
+                int anchos[4] = { 1, 1, 1, 1 };
+                statx_entrada(f, "", STATX_BASIC_STATS, &m);
+                calcular_anchos(&m, anchos);
+                emitir_linea_larga(s, &o, &m, anchos, f, "", ruta);
+            } else {
+                emitir_ls(s, ruta, strlen(ruta));
+                emitir_ls(s, "\n", 1);
+            }
+            volcar_ls(s);
+            close(f);
+            continue;
+        }
+        if (fd < 0) { reportar_error_ruta("ls", ruta); continue; }
+        if (k > 0) emitir_ls(s, "\n", 1);
+        listar_directorio_ls(fd, ruta, &arbol, &o, &l, s, varias || o.recursivo);
+        arbol_soltar(&arbol);
+        close(fd);
+    }
+    volcar_ls(s);
+    liberar_listado(&l);
+    free(s);
+    if (estado_builtin == 0) log_shell("ls", "Listado exitoso", "INFO");
+}
+ 
+// --- Expansión de Comodines (Globbing) ---
+
+/*
+ * Expande '*', '?', '[...]' y '**' en los argumentos de cada comando, entre el análisis de la línea y
+ * la ejecución ('expandir_comodines').
+ * Funcionalidad:
+ * 1. Compilación: Cada patrón se compila una vez. Se parte en componentes por '/' y cada componente se
+ * traduce a piezas: literal, '?', clase (mapa de 256 bits) o '*'. Un componente sin comodines es un
+ * nombre y no obliga a listar su directorio. La coincidencia descarta por largo mínimo, prefijo y
+ * sufijo literales, y resuelve el resto sin recursión (solo retrocede hasta la última '*').
+ * 2. Listados: Cada directorio se abre por el Sandbox y se lee completo con getdents64 (el lector de
+ * ls). El listado queda en una cache de la línea, así varios patrones sobre el mismo directorio
+ * (ej. 'cp *.c *.h dir') cuestan una sola lectura.
+ * 3. Sandbox: Solo se listan los directorios a los que la política da lectura al comando. Cada
+ * coincidencia pasa además por el cursor del trie ('arbol_descender') y los enlaces simbólicos se
+ * resuelven por el Sandbox. Lo omitido se informa una vez por comando ([flsh_sec]) y se registra.
+ * 4. Semántica de sh: '*', '?' y las clases no coinciden con un '.' inicial salvo que el patrón lo
+ * escriba, y nunca con '.' ni '..'. '**' como componente completo baja por todos los subdirectorios
+ * (sin seguir enlaces). Los resultados de cada patrón se ordenan; sin coincidencias la palabra queda
+ * literal, como en sh.
+ */
+#define GLOB_MAX_RESULTADOS (1 << 20)
+#define GLOB_MAX_ABIERTOS 64      // Descriptores de la cache abiertos a la vez
+
+typedef enum { PIEZA_LITERAL, PIEZA_UNO, PIEZA_CLASE, PIEZA_ESTRELLA } tipo_pieza_t;
+
+typedef struct {
+    tipo_pieza_t tipo;
+    const char *texto;          // PIEZA_LITERAL, sin escapes
+    size_t largo;
+    uint64_t clase[4];          // PIEZA_CLASE: bytes aceptados (con la negación ya aplicada)
+} pieza_glob_t;
+
+typedef struct {
+    pieza_glob_t *piezas;
+    int n_piezas;
+    int literal;                // Sin comodines: 'nombre' es el componente sin escapes
+    int recursivo;              // '**'
+    int ocultos;                // Empieza con un '.' literal: puede coincidir con nombres ocultos
+    const char *nombre;
+    size_t minimo;              // Largo mínimo de un nombre que coincide
+    const pieza_glob_t *prefijo, *sufijo;  // Literales de los extremos, para descartar con memcmp
+} componente_glob_t;
+
+typedef struct {
+    componente_glob_t *componentes;
+    int n;
+    int absoluto;               // Empieza con '/'
+    int solo_directorios;       // Termina con '/': solo coinciden directorios (y se conserva la '/')
+} patron_glob_t;
+
+static void marcar_clase(uint64_t clase[4], unsigned desde, unsigned hasta) {
+    for (unsigned v = desde; v <= hasta; v++) clase[v >> 6] |= 1ULL << (v & 63);
+}
+
+// '[...]' que empieza en 'p': retorna lo que sigue al ']' o NULL si no cierra (el '[' es literal)
+static const char *compilar_clase(const char *p, const char *fin, uint64_t clase[4]) {
+    static const struct { const char *nombre; int (*es)(int); } nombradas[] = {
+        { "alpha", isalpha }, { "digit", isdigit }, { "alnum", isalnum }, { "upper", isupper },
+        { "lower", islower }, { "space", isspace }, { "xdigit", isxdigit }, { "punct", ispunct },
+    };
+    const char *q = p + 1;
+    int negada = (q < fin && (*q == '!' || *q == '^'));
+    if (negada) q++;
+    memset(clase, 0, 4 * sizeof(uint64_t));
+    for (int primero = 1; q < fin && (*q != ']' || primero); primero = 0) {
+        if (*q == '[' && q + 1 < fin && q[1] == ':') {
+            const char *cierre = strstr(q + 2, ":]");
+            size_t i = 0, n = sizeof(nombradas) / sizeof(nombradas[0]);
+            while (cierre && cierre < fin && i < n && (strlen(nombradas[i].nombre) != (size_t)(cierre - q - 2) ||
+                   strncmp(nombradas[i].nombre, q + 2, (size_t)(cierre - q - 2)) != 0)) i++;
+            if (cierre && cierre < fin && i < n) {
+                for (unsigned v = 0; v < 256; v++) if (nombradas[i].es((int)v)) marcar_clase(clase, v, v);
+                q = cierre + 2;
+                continue;
+            }
+        }
+        unsigned char desde = (unsigned char)*q;
+        if (*q == '\\' && q + 1 < fin) desde = (unsigned char)*++q;
+        q++;
+        unsigned char hasta = desde;
+        if (q + 1 < fin && *q == '-' && q[1] != ']') {
+            q++;
+            if (*q == '\\' && q + 1 < fin) q++;
+            hasta = (unsigned char)*q++;
+        }
+        if (desde <= hasta) marcar_clase(clase, desde, hasta);
+    }
+    if (q >= fin) return NULL;
+    if (negada) for (int i = 0; i < 4; i++) clase[i] = ~clase[i];
+    return q + 1;
+}
+
+// Compila el componente [ini, fin) del patrón (escapes con '\'). Retorna 0 o -1 sin memoria.
+static int compilar_componente(arena_t *a, const char *ini, const char *fin, componente_glob_t *c) {
+    size_t n = (size_t)(fin - ini);
+    memset(c, 0, sizeof(*c));
+    if (n == 2 && ini[0] == '*' && ini[1] == '*') { c->recursivo = 1; return 0; }
+    c->piezas = arena_reservar(a, (n + 1) * sizeof(pieza_glob_t));
+    char *texto = arena_reservar(a, n + 1);  // Literales sin escapes; las piezas apuntan aquí
+    if (!c->piezas || !texto) return -1;
+    size_t t = 0;
+    for (const char *p = ini; p < fin;) {
+        pieza_glob_t *pz = &c->piezas[c->n_piezas];
+        if (*p == '*') {
+            while (p < fin && *p == '*') p++;
+            pz->tipo = PIEZA_ESTRELLA;
+            c->n_piezas++;
+            continue;
+        }
+        if (*p == '?') { pz->tipo = PIEZA_UNO; c->n_piezas++; c->minimo++; p++; continue; }
+        if (*p == '[') {
+            const char *sig = compilar_clase(p, fin, pz->clase);
+            if (sig) { pz->tipo = PIEZA_CLASE; c->n_piezas++; c->minimo++; p = sig; continue; }
+        }
+        if (*p == '\\' && p + 1 < fin) p++;
+        // Literal: se extiende la pieza anterior si también lo es
+        pieza_glob_t *ultima = c->n_piezas ? &c->piezas[c->n_piezas - 1] : NULL;
+        if (!ultima || ultima->tipo != PIEZA_LITERAL) {
+            ultima = &c->piezas[c->n_piezas++];
+            ultima->tipo = PIEZA_LITERAL;
+            ultima->texto = texto + t;
+            ultima->largo = 0;
+        }
+        texto[t++] = *p++;
+        ultima->largo++;
+        c->minimo++;
+    }
+    texto[t] = '\0';
+    c->literal = c->n_piezas == 0 || (c->n_piezas == 1 && c->piezas[0].tipo == PIEZA_LITERAL);
+    c->nombre = texto;
+    c->ocultos = c->n_piezas > 0 && c->piezas[0].tipo == PIEZA_LITERAL && c->piezas[0].texto[0] == '.';
+    if (c->n_piezas > 1 && c->piezas[0].tipo == PIEZA_LITERAL) c->prefijo = &c->piezas[0];
+    if (c->n_piezas > 1 && c->piezas[c->n_piezas - 1].tipo == PIEZA_LITERAL) c->sufijo = &c->piezas[c->n_piezas - 1];
+    return 0;
+}
+
+static int compilar_patron(arena_t *a, const char *texto, patron_glob_t *g) {
+    memset(g, 0, sizeof(*g));
+    size_t n = strlen(texto), maximo = 1;
+    for (size_t i = 0; i < n; i++) maximo += (texto[i] == '/');
+    g->componentes = arena_reservar(a, maximo * sizeof(componente_glob_t));
+    if (!g->componentes) return -1;
+    g->absoluto = texto[0] == '/';
+    g->solo_directorios = n > 1 && texto[n - 1] == '/';
+    for (const char *p = texto; *p;) {
+        const char *fin = strchr(p, '/');
+        if (!fin) fin = p + strlen(p);
+        if (fin > p && compilar_componente(a, p, fin, &g->componentes[g->n++]) != 0) return -1;
+        p = *fin ? fin + 1 : fin;
+    }
+    return 0;
+}
+
+static int pieza_acepta(const pieza_glob_t *p, unsigned char c) {
+    return p->tipo == PIEZA_UNO || ((p->clase[c >> 6] >> (c & 63)) & 1);
+}
+
+static int coincide_componente(const componente_glob_t *c, const char *s, size_t n) {
+    if (n < c->minimo || (s[0] == '.' && !c->ocultos)) return 0;
+    if (c->prefijo && memcmp(s, c->prefijo->texto, c->prefijo->largo) != 0) return 0;
+    if (c->sufijo && memcmp(s + n - c->sufijo->largo, c->sufijo->texto, c->sufijo->largo) != 0) return 0;
+    int i = 0, estrella = -1;
+    size_t j = 0, reintento = 0;
+    for (;;) {
+        if (i < c->n_piezas) {
+            const pieza_glob_t *p = &c->piezas[i];
+            if (p->tipo == PIEZA_ESTRELLA) { estrella = i++; reintento = j; continue; }
+            if (p->tipo == PIEZA_LITERAL ? (n - j >= p->largo && memcmp(s + j, p->texto, p->largo) == 0)
+                                         : (j < n && pieza_acepta(p, (unsigned char)s[j]))) {
+                j += (p->tipo == PIEZA_LITERAL) ? p->largo : 1;
+                i++;
+                continue;
+            }
+        } else if (j == n || estrella == c->n_piezas - 1) {
+            return 1;
+        }
+        // Falló: la última '*' absorbe un carácter más
+        if (estrella < 0 || reintento >= n) return 0;
+        i = estrella + 1;
+        j = ++reintento;
+    }
+}
+
+// Directorio listado durante la expansión de una línea (clave: comando de la política + ruta escrita)
+typedef struct {
+    char *ruta;                 // "" = directorio actual; si no, termina en '/'
+    int comando;
+    int fd;                     // -1 si no está abierto
+    int inaccesible;            // La política lo deniega o no se pudo abrir
+    int nodo;                   // Cursor del trie si debajo hay reglas propias, o -1
+    int leido;
+    listado_t listado;
+} directorio_glob_t;
+
+typedef struct {
+    arena_t *arena;
+    politica_t *politica;
+    int comando;
+    directorio_glob_t **tabla;  // Direccionamiento abierto
+    size_t cap_tabla, n_tabla;
+    int abiertos;               // Descriptores de la cache; pasado GLOB_MAX_ABIERTOS se cierran al terminar cada nivel
+    listado_t lectura;          // Buffer de getdents64 compartido por todos los directorios
+    char **resultados;          // Argumentos del comando en construcción (textos en la arena)
+    size_t n_resultados, cap_resultados;
+    int denegados, desbordado;
+} expansion_t;
+
+static uint64_t hash_directorio_glob(const char *ruta, int comando) {
+    uint64_t h = 1469598103934665603ULL ^ (uint64_t)comando;
+    for (const unsigned char *p = (const unsigned char *)ruta; *p; p++) h = (h ^ *p) * 1099511628211ULL;
+    return h;
+}
+
+// Entrada de la cache para 'ruta' (NULL sin memoria)
+static directorio_glob_t *directorio_glob(expansion_t *x, const char *ruta) {
+    if (x->n_tabla * 2 >= x->cap_tabla) {
+        size_t cap = x->cap_tabla ? x->cap_tabla * 2 : 64;
+        directorio_glob_t **tabla = calloc(cap, sizeof(*tabla));
+        if (!tabla) return NULL;
+        for (size_t i = 0; i < x->cap_tabla; i++) {
+            directorio_glob_t *d = x->tabla[i];
+            if (!d) continue;
+            size_t k = hash_directorio_glob(d->ruta, d->comando) & (cap - 1);
+            while (tabla[k]) k = (k + 1) & (cap - 1);
+            tabla[k] = d;
+        }
+        free(x->tabla);
+        x->tabla = tabla;
+        x->cap_tabla = cap;
+    }
+    size_t k = hash_directorio_glob(ruta, x->comando) & (x->cap_tabla - 1);
+    for (; x->tabla[k]; k = (k + 1) & (x->cap_tabla - 1))
+        if (x->tabla[k]->comando == x->comando && strcmp(x->tabla[k]->ruta, ruta) == 0) return x->tabla[k];
+
+    directorio_glob_t *d = calloc(1, sizeof(*d));
+    if (!d || !(d->ruta = strdup(ruta))) { free(d); return NULL; }
+    d->comando = x->comando;
+    d->fd = -1;
+    d->nodo = -1;
+    x->tabla[k] = d;
+    x->n_tabla++;
+    return d;
+}
+
+// Descriptor del directorio, abierto por el Sandbox (se reabre si se cerró por el límite de descriptores)
+static int descriptor_glob(expansion_t *x, directorio_glob_t *d) {
+    if (d->fd >= 0 || d->inaccesible) return d->fd;
+    solicitud_sandbox_t s = { .flags = O_RDONLY | O_DIRECTORY, .comando = x->comando, .requerido = ACCESO_LECTURA };
+    int nodo = -1;
+    int fd = x->politica ? resolver_en_sandbox(x->politica, *d->ruta ? d->ruta : ".", &s, &nodo) : SANDBOX_DENEGADO;
+    if (fd < 0) {
+        if (fd == SANDBOX_DENEGADO) x->denegados++;
+        d->inaccesible = 1;
+        return -1;
+    }
+    if (nodo >= 0 && x->politica->nodos[nodo].excepciones) d->nodo = nodo;
+    x->abiertos++;
+    return d->fd = fd;
+}
+
+static void cerrar_directorio_glob(expansion_t *x, directorio_glob_t *d) {
+    if (d->fd < 0) return;
+    close(d->fd);
+    d->fd = -1;
+    x->abiertos--;
+}
+
+/*
+ * Lee el directorio en el buffer de lectura compartido 't' (getdents64 pide de a LS_LOTE) y deja en 'l'
+ * (vacío) una copia a medida: con '**' hay muchos directorios chicos. Un listado grande se queda con el
+ * buffer entero. Retorna 0 o -1.
+ */
+static int leer_listado_compacto(int fd, listado_t *t, listado_t *l) {
+    if (leer_directorio_ls(fd, t, 1) != 0) return -1;
+    if (t->n == 0) return 0;
+    if (t->usado > LS_LOTE / 2) {
+        *l = *t;
+        memset(t, 0, sizeof(*t));
+        return 0;
+    }
+    l->datos = malloc(t->usado);
+    l->entradas = malloc(t->n * sizeof(size_t));
+    if (!l->datos || !l->entradas) { liberar_listado(l); memset(l, 0, sizeof(*l)); return -1; }
+    memcpy(l->datos, t->datos, t->usado);
+    memcpy(l->entradas, t->entradas, t->n * sizeof(size_t));
+    l->usado = l->capacidad = t->usado;
+    l->n = l->cap_entradas = t->n;
+    return 0;
+}
+
+static const listado_t *listado_glob(expansion_t *x, directorio_glob_t *d) {
+    if (!d->leido) {
+        d->leido = 1;
+        leer_listado_compacto(d->fd, &x->lectura, &d->listado);
+    }
+    return &d->listado;
+}
+
+static void liberar_expansion(expansion_t *x) {
+    for (size_t i = 0; i < x->cap_tabla; i++) {
+        directorio_glob_t *d = x->tabla[i];
+        if (!d) continue;
+        cerrar_directorio_glob(x, d);
+        liberar_listado(&d->listado);
+        free(d->ruta);
+        free(d);
+    }
+    liberar_listado(&x->lectura);
+    free(x->tabla);
+    free(x->resultados);
+    if (x->politica) politica_soltar(x->politica);
+}
+
+static void agregar_argumento(expansion_t *x, char *texto) {
+    if (x->desbordado) return;
+    if (x->n_resultados >= GLOB_MAX_RESULTADOS ||
+        reservar_vector((void **)&x->resultados, &x->cap_resultados, x->n_resultados + 1, sizeof(char *)) != 0) {
+        x->desbordado = 1;
+        return;
+    }
+    x->resultados[x->n_resultados++] = texto;
+}
+
+static void agregar_ruta_glob(expansion_t *x, const char *ruta, size_t largo) {
+    char *copia = arena_reservar(x->arena, largo + 1);
+    if (!copia) { x->desbordado = 1; return; }
+    memcpy(copia, ruta, largo);
+    copia[largo] = '\0';
+    agregar_argumento(x, copia);
+}
+
+static unsigned char tipo_stat_glob(const struct stat *st) {
+    return S_ISDIR(st->st_mode) ? DT_DIR : S_ISLNK(st->st_mode) ? DT_LNK : DT_REG;
+}
+
+// Tipo de la entrada 'i' (DT_UNKNOWN se resuelve con fstatat, sin seguir enlaces)
+static unsigned char tipo_entrada_glob(const directorio_glob_t *d, size_t i) {
+    const struct linux_dirent64 *e = registro_ls(&d->listado, i);
+    struct stat st;
+    if (e->d_type != DT_UNKNOWN) return e->d_type;
+    return fstatat(d->fd, e->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 ? tipo_stat_glob(&st) : DT_UNKNOWN;
+}
+
+// Un enlace se sigue para saber si lleva a un directorio (componentes intermedios, como sh)
+static int lleva_a_directorio(const directorio_glob_t *d, const char *nombre, unsigned char tipo) {
+    struct stat st;
+    if (tipo == DT_DIR) return 1;
+    return tipo == DT_LNK && fstatat(d->fd, nombre, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+/*
+ * Filtro del Sandbox para una coincidencia: las reglas propias debajo del directorio se consultan en el
+ * trie, sin syscalls; un enlace simbólico se resuelve por el Sandbox ('ruta' es su ruta completa).
+ * 'nodo' recibe el cursor del trie de la coincidencia.
+ */
+static int coincidencia_permitida(expansion_t *x, const directorio_glob_t *d, const char *nombre, unsigned char tipo, const char *ruta, int *nodo) {
+    *nodo = -1;
+    if (d->nodo >= 0) {
+        arbol_sandbox_t a = { .politica = x->politica, .nodo = d->nodo, .comando = x->comando, .requerido = ACCESO_LECTURA }, hijo;
+        if (!arbol_descender(&a, nombre, &hijo)) { x->denegados++; return 0; }
+        *nodo = hijo.nodo;
+    }
+    if (tipo == DT_LNK) {
+        solicitud_sandbox_t s = { .flags = O_PATH, .comando = x->comando, .requerido = ACCESO_LECTURA };
+        int fd = resolver_en_sandbox(x->politica, ruta, &s, NULL);
+        if (fd == SANDBOX_DENEGADO) { x->denegados++; return 0; }
+        if (fd >= 0) close(fd); // Un enlace roto se conserva, como en sh
+    }
+    return 1;
+}
+
+/*
+ * Un subdirectorio real (no un enlace) se abre relativo al padre ya abierto, sin seguir enlaces, como en
+ * los recorridos de ls -R o grep -r: la política ya se consultó en el trie ('nodo' es su cursor).
+ * 'ruta' es la del subdirectorio, con '/' final.
+ */
+static void abrir_subdirectorio_glob(expansion_t *x, const directorio_glob_t *padre, const char *nombre, const char *ruta, int nodo) {
+    directorio_glob_t *d = directorio_glob(x, ruta);
+    if (!d || d->fd >= 0 || d->inaccesible) return;
+    int fd = openat(padre->fd, nombre, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return; // 'descriptor_glob' lo intentará por el Sandbox
+    d->fd = fd;
+    d->nodo = nodo;
+    x->abiertos++;
+}
+
+/*
+ * Sigue el patrón desde el componente 'k' dentro del directorio 'ruta' ('largo' bytes: vacío o con '/'
+ * final). 'ruta' es un buffer de PATH_MAX que cada nivel extiende a partir de 'largo'.
+ */
+static void expandir_nivel(expansion_t *x, const patron_glob_t *g, int k, char *ruta, size_t largo) {
+    const componente_glob_t *c = &g->componentes[k];
+    int ultimo = (k == g->n - 1);
+    struct stat st;
+    if (x->desbordado) return;
+    if (c->literal && !ultimo) {
+        // Nombre intermedio: no hace falta listar, el nivel siguiente abre la ruta por el Sandbox
+        size_t n = strlen(c->nombre);
+        if (largo + n + 2 > PATH_MAX) return;
+        memcpy(ruta + largo, c->nombre, n);
+        ruta[largo + n] = '/';
+        expandir_nivel(x, g, k + 1, ruta, largo + n + 1);
+        return;
+    }
+    ruta[largo] = '\0';
+    directorio_glob_t *d = directorio_glob(x, ruta);
+    if (!d) { x->desbordado = 1; return; }
+    if (descriptor_glob(x, d) < 0) return;
+
+    if (c->literal) {
+        // Último componente literal (ej. '*/Makefile'): basta con confirmar que existe
+        size_t n = strlen(c->nombre);
+        if (largo + n + 2 <= PATH_MAX && fstatat(d->fd, c->nombre, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+            unsigned char tipo = tipo_stat_glob(&st);
+            memcpy(ruta + largo, c->nombre, n + 1);
+            int nodo;
+            if ((!g->solo_directorios || lleva_a_directorio(d, c->nombre, tipo)) && coincidencia_permitida(x, d, c->nombre, tipo, ruta, &nodo)) {
+                ruta[largo + n] = '/';
+                agregar_ruta_glob(x, ruta, largo + n + (g->solo_directorios ? 1 : 0));
+            }
+        }
+    } else {
+        const listado_t *l = listado_glob(x, d);
+        for (size_t i = 0; i < l->n && !x->desbordado; i++) {
+            const char *nombre = registro_ls(l, i)->d_name;
+            if (nombre[0] == '.' && (nombre[1] == '\0' || (nombre[1] == '.' && nombre[2] == '\0'))) continue;
+            size_t n = strlen(nombre);
+            if (largo + n + 2 > PATH_MAX) continue;
+            if (c->recursivo ? nombre[0] == '.' : !coincide_componente(c, nombre, n)) continue;
+            unsigned char tipo = tipo_entrada_glob(d, i);
+            // '**' no sigue enlaces (evita ciclos); los demás componentes sí, como sh
+            int es_directorio = c->recursivo ? tipo == DT_DIR : lleva_a_directorio(d, nombre, tipo);
+            if (!es_directorio && (!ultimo || g->solo_directorios)) continue;
+            memcpy(ruta + largo, nombre, n + 1);
+            int nodo;
+            if (!coincidencia_permitida(x, d, nombre, tipo, ruta, &nodo)) continue;
+            ruta[largo + n] = '/';
+            if (ultimo) agregar_ruta_glob(x, ruta, largo + n + (g->solo_directorios ? 1 : 0));
+            if (tipo == DT_DIR && (c->recursivo || !ultimo)) {
+                ruta[largo + n + 1] = '\0';
+                abrir_subdirectorio_glob(x, d, nombre, ruta, nodo);
+            }
+            // '**' sigue bajando con el mismo componente; un directorio intermedio pasa al siguiente
+            if (c->recursivo && es_directorio) expandir_nivel(x, g, k, ruta, largo + n + 1);
+            else if (!ultimo) expandir_nivel(x, g, k + 1, ruta, largo + n + 1);
+        }
+        // '**' también coincide con cero directorios: el resto del patrón se prueba aquí mismo
+        if (c->recursivo && !ultimo) expandir_nivel(x, g, k + 1, ruta, largo);
+    }
+    if (x->abiertos > GLOB_MAX_ABIERTOS) cerrar_directorio_glob(x, d);
+}
+
+static int comparar_argumentos(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Reemplaza en cada comando de la línea las palabras con comodines por sus coincidencias. La cache
+ * de listados vive lo que dura la línea. Retorna 0, o -1 si una expansión superó GLOB_MAX_RESULTADOS
+ * o faltó memoria (ya informado: la línea no se ejecuta).
+ */
+int expandir_comodines(arena_t *a, linea_t *linea) {
+    expansion_t x = { .arena = a };
+    int resultado = 0;
+    char *ruta = NULL;
+    for (int i = 0; i < linea->n_comandos && resultado == 0; i++) {
+        comando_t *cmd = &linea->comandos[i];
+        if (!cmd->comodines) continue;
+        if (!ruta && !(ruta = malloc(PATH_MAX))) { resultado = -1; break; }
+        if (!x.politica) x.politica = politica_adquirir();
+        int b = indice_builtin(cmd->argv[0]);
+        x.comando = b >= 0 ? b : COMANDO_EXTERNO;
+        x.n_resultados = 0;
+        x.denegados = 0;
+
+        const comodin_t *c = cmd->comodines;
+        for (int j = 0; j < cmd->argc && !x.desbordado; j++) {
+            if (!c || c->indice != j) { agregar_argumento(&x, cmd->argv[j]); continue; }
+            patron_glob_t g;
+            size_t inicio = x.n_resultados;
+            if (compilar_patron(a, c->patron, &g) != 0) x.desbordado = 1;
+            else if (g.n > 0) {
+                if (g.absoluto) ruta[0] = '/';
+                expandir_nivel(&x, &g, 0, ruta, g.absoluto ? 1 : 0);
+            }
+            if (x.n_resultados == inicio) agregar_argumento(&x, cmd->argv[j]); // Sin coincidencias: literal
+            else qsort(x.resultados + inicio, x.n_resultados - inicio, sizeof(char *), comparar_argumentos);
+            c = c->sig;
+        }
+        if (x.desbordado) {
+            fprintf(stderr, "flsh: %s: demasiadas coincidencias (máx. %d argumentos)\n", cmd->argv[0], GLOB_MAX_RESULTADOS);
+            resultado = -1;
+            break;
+        }
+        if (x.denegados) {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "Expansion de comodines: %d rutas omitidas por la politica", x.denegados);
+            log_shell(cmd->argv[0], msg, "WARNING");
+            fprintf(stderr, "[flsh_sec]: %d ruta(s) omitidas de la expansión de comodines (SandBox).\n", x.denegados);
+        }
+        char **argv = arena_reservar(a, (x.n_resultados + 1) * sizeof(char *));
+        if (!argv) { fprintf(stderr, "flsh: memoria insuficiente para expandir comodines\n"); resultado = -1; break; }
+        memcpy(argv, x.resultados, x.n_resultados * sizeof(char *));
+        argv[x.n_resultados] = NULL;
+        cmd->argv = argv;
+        cmd->argc = (int)x.n_resultados;
+        cmd->comodines = NULL;
+    }
+    free(ruta);
+    liberar_expansion(&x);
+    return resultado;
+}
+
+// --- Comando Built-in: cd (Change Directory) ---
+
+/*
+ * Gestiona el cambio del directorio de trabajo del proceso actual (Shell).
+ * Funcionalidad:
+ * 1. Resolución de Destino: Si no se provee argumento, redirige al usuario a su 'HOME' (comportamiento estándar).
+ * 2. Validación de Seguridad: Abre el destino a través del Sandbox ('abrir_en_sandbox') como descriptor O_PATH.
+ * 3. Cambio de Contexto: Ejecuta 'fchdir' sobre el descriptor ya validado (sin ventana entre verificar y entrar).
+ * 4. Actualización de Entorno (Requisito Crítico): Tras un cambio exitoso, actualiza la variable de entorno 'PWD'
+ * y el cwd cacheado del Sandbox. Esto asegura que los procesos hijos hereden la ruta correcta.
+ */
+void ejecutar_cd(char *ruta) {
+    const char *objetivo = (ruta == NULL) ? sandbox.home_real : ruta;
+    
+    // Validamos y abrimos el destino en una sola operación
+    int fd = abrir_en_sandbox(objetivo, O_PATH | O_DIRECTORY, 0, "cd");
+    if (fd == SANDBOX_DENEGADO) return;
+    
+    // Intentamos cambiar el directorio
+    if (fd < 0 || fchdir(fd) != 0) {
+        reportar_error_sistema("cd");
+    } else {
+        // Actualizamos el cwd del Sandbox y la variable PWD para mantener consistencia
+        if (getcwd(sandbox.cwd, sizeof(sandbox.cwd)) == NULL) snprintf(sandbox.cwd, sizeof(sandbox.cwd), "%s", objetivo);
+        setenv("PWD", sandbox.cwd, 1); // Modifica el entorno del proceso actual
+        log_shell("cd", sandbox.cwd, "INFO");
+    }
+    if (fd >= 0) close(fd);
+}
+ 
+// --- Backend de I/O Asíncrono (io_uring) ---
+
+/*
+ * Con FLSH_IO=uring, las transferencias de datos de cat, cp y grep mantienen varias lecturas en vuelo
+ * sobre un anillo io_uring de la sesión (syscalls directas, sin liburing) en lugar de un read por vez.
+ * Es opcional: con read-ahead del kernel y page cache, el camino sincrónico (por defecto, FLSH_IO=sync)
+ * rinde igual o mejor; el anillo apunta a volúmenes donde una sola lectura pendiente deja ancho de banda
+ * sin usar (NVMe, homes en red). Ver 'bench/bench_io.c'.
+ * - FLSH_IO_QD: operaciones en vuelo (8 por defecto, máximo 64). FLSH_IO_BUF: tamaño de cada buffer
+ * (sufijos K/M/G; 1M por defecto, mínimo 64K).
+ * - Los buffers se reservan y registran una vez por sesión (IORING_REGISTER_BUFFERS): el kernel no
+ * fija las páginas en cada operación. Si el registro falla (RLIMIT_MEMLOCK) se usan lecturas comunes.
+ * - El anillo solo recibe descriptores ya abiertos a través del Sandbox: nunca abre rutas.
+ * - Un usuario a la vez: los hilos de grep -r y de cp -r que lo encuentran ocupado siguen por el camino
+ * sincrónico. Un hijo de fork (etapa de pipeline) no comparte el anillo del padre: crea el suyo.
+ * Si io_uring no está disponible (ENOSYS, o EPERM por kernel.io_uring_disabled) se detecta en el primer
+ * uso y la sesión sigue con el camino sincrónico.
+ */
+#define IO_QD_DEFECTO 8
+#define IO_QD_MAXIMO 64
+#define IO_BUF_DEFECTO (1 << 20)
+#define IO_BUF_MINIMO (64 * 1024)
+
+typedef enum { SLOT_LIBRE, SLOT_LEYENDO, SLOT_LISTO, SLOT_ESCRIBIENDO } fase_slot_t;
+
+// Un buffer registrado y la operación que lo ocupa (una por vez; user_data = índice del slot)
+typedef struct {
+    off_t offset;
+    size_t largo;               // Bytes pedidos
+    size_t hechos;              // Bytes ya transferidos (las operaciones cortas se reenvían por el resto)
+    int eof;
+    fase_slot_t fase;
+} slot_io_t;
+
+static struct {
+    int fd;
+    int estado;                 // 0 sin iniciar, 1 activo, -1 no disponible en esta sesión
+    pid_t pid_dueno;
+    unsigned profundidad;
+    size_t tam_buffer;
+    int registrados;
+    char *buffers;              // profundidad * tam_buffer, alineado a página
+    void *mapa_sq, *mapa_cq;
+    size_t tam_sq, tam_cq, tam_sqes;
+    unsigned *sq_cola, *sq_mascara, *sq_indices;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_cabeza, *cq_cola, *cq_mascara;
+    struct io_uring_cqe *cqes;
+    unsigned a_enviar;          // SQEs preparados que el kernel todavía no recibió
+    unsigned en_vuelo;
+    slot_io_t slots[IO_QD_MAXIMO];
+    pthread_mutex_t uso;
+} anillo_io = { .fd = -1, .uso = PTHREAD_MUTEX_INITIALIZER };
+
+static int io_uring_preferido(void) {
+    const char *modo = getenv("FLSH_IO");
+    return modo && strcmp(modo, "uring") == 0;
+}
+
+static void anillo_io_desmapear(void) {
+    if (anillo_io.sqes) munmap(anillo_io.sqes, anillo_io.tam_sqes);
+    if (anillo_io.mapa_cq && anillo_io.mapa_cq != anillo_io.mapa_sq) munmap(anillo_io.mapa_cq, anillo_io.tam_cq);
+    if (anillo_io.mapa_sq) munmap(anillo_io.mapa_sq, anillo_io.tam_sq);
+    if (anillo_io.fd >= 0) close(anillo_io.fd);
+    anillo_io.sqes = NULL; anillo_io.mapa_sq = anillo_io.mapa_cq = NULL;
+    anillo_io.fd = -1;
+}
+
+/*
+ * Crea el anillo y registra los buffers (que se reservan la primera vez y se conservan tras un fork).
+ * Retorna 0, o -1 con errno si el kernel no ofrece io_uring.
+ */
+static int anillo_io_crear(void) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int)syscall(__NR_io_uring_setup, anillo_io.profundidad, &p);
+    if (fd < 0) return -1;
+    anillo_io.fd = fd;
+    anillo_io.tam_sq = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    anillo_io.tam_cq = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP && anillo_io.tam_cq > anillo_io.tam_sq) anillo_io.tam_sq = anillo_io.tam_cq;
+    anillo_io.mapa_sq = mmap(NULL, anillo_io.tam_sq, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (anillo_io.mapa_sq == MAP_FAILED) { anillo_io.mapa_sq = NULL; goto error; }
+    anillo_io.mapa_cq = (p.features & IORING_FEAT_SINGLE_MMAP) ? anillo_io.mapa_sq
+                      : mmap(NULL, anillo_io.tam_cq, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (anillo_io.mapa_cq == MAP_FAILED) { anillo_io.mapa_cq = NULL; goto error; }
+    anillo_io.tam_sqes = p.sq_entries * sizeof(struct io_uring_sqe);
+    anillo_io.sqes = mmap(NULL, anillo_io.tam_sqes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (anillo_io.sqes == MAP_FAILED) { anillo_io.sqes = NULL; goto error; }
+
+    char *sq = anillo_io.mapa_sq, *cq = anillo_io.mapa_cq;
+    anillo_io.sq_cola = (unsigned *)(sq + p.sq_off.tail);
+    anillo_io.sq_mascara = (unsigned *)(sq + p.sq_off.ring_mask);
+    anillo_io.sq_indices = (unsigned *)(sq + p.sq_off.array);
+    anillo_io.cq_cabeza = (unsigned *)(cq + p.cq_off.head);
+    anillo_io.cq_cola = (unsigned *)(cq + p.cq_off.tail);
+    anillo_io.cq_mascara = (unsigned *)(cq + p.cq_off.ring_mask);
+    anillo_io.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    anillo_io.a_enviar = anillo_io.en_vuelo = 0;
+
+    size_t total = (size_t)anillo_io.profundidad * anillo_io.tam_buffer;
+    if (!anillo_io.buffers) {
+        anillo_io.buffers = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (anillo_io.buffers == MAP_FAILED) { anillo_io.buffers = NULL; errno = ENOMEM; goto error; }
+    }
+    struct iovec iov[IO_QD_MAXIMO];
+    for (unsigned i = 0; i < anillo_io.profundidad; i++) {
+        iov[i].iov_base = anillo_io.buffers + (size_t)i * anillo_io.tam_buffer;
+        iov[i].iov_len = anillo_io.tam_buffer;
+    }
+    anillo_io.registrados = syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov, anillo_io.profundidad) == 0;
+    return 0;
+
+error:;
+    int err = errno;
+    anillo_io_desmapear();
+    errno = err;
+    return -1;
+}
+
+// Lee la configuración y crea el anillo la primera vez (o en un hijo de fork). Con 'uso' tomado.
+static void anillo_io_iniciar(void) {
+    if (anillo_io.estado == 1 && anillo_io.pid_dueno == getpid()) return;
+    if (anillo_io.estado == 1) {
+        // Hijo de fork: las páginas del anillo son compartidas con el padre
+        anillo_io_desmapear();
+        anillo_io.estado = 0;
+    }
+    if (anillo_io.estado != 0) return;
+    anillo_io.pid_dueno = getpid();
+
+    if (!io_uring_preferido()) { anillo_io.estado = -1; return; }
+    if (!anillo_io.buffers) {
+        const char *qd = getenv("FLSH_IO_QD"), *buf = getenv("FLSH_IO_BUF");
+        int q = qd ? atoi(qd) : IO_QD_DEFECTO;
+        anillo_io.profundidad = q < 1 ? 1 : q > IO_QD_MAXIMO ? IO_QD_MAXIMO : (unsigned)q;
+        anillo_io.tam_buffer = buf ? tamano_con_sufijo(buf) : IO_BUF_DEFECTO;
+        if (anillo_io.tam_buffer < IO_BUF_MINIMO) anillo_io.tam_buffer = IO_BUF_MINIMO;
+        anillo_io.tam_buffer &= ~(size_t)4095; // Múltiplo de página
+    }
+
+    char msg[160];
+    if (anillo_io_crear() != 0) {
+        snprintf(msg, sizeof(msg), "io_uring no disponible (%s): lecturas sincronicas", strerror(errno));
+        log_shell("io", msg, "INFO");
+        anillo_io.estado = -1;
+        return;
+    }
+    snprintf(msg, sizeof(msg), "io_uring activo: %u en vuelo, buffers de %zu KB%s", anillo_io.profundidad,
+             anillo_io.tam_buffer / 1024, anillo_io.registrados ? " (registrados)" : "");
+    log_shell("io", msg, "INFO");
+    anillo_io.estado = 1;
+}
+
+/*
+ * Decide si una transferencia de 'tam' bytes va por io_uring. Retorna 1 con el anillo tomado
+ * (liberar con 'anillo_io_soltar'), o 0 si se debe usar el camino sincrónico.
+ */
+static int anillo_io_tomar(off_t tam) {
+    if (anillo_io.estado < 0 && anillo_io.pid_dueno == getpid()) return 0;
+    if (tam <= 0 || pthread_mutex_trylock(&anillo_io.uso) != 0) return 0;
+    anillo_io_iniciar();
+    if (anillo_io.estado == 1) return 1;
+    pthread_mutex_unlock(&anillo_io.uso);
+    return 0;
+}
+
+static void anillo_io_soltar(void) { pthread_mutex_unlock(&anillo_io.uso); }
+
+static char *buffer_slot(unsigned slot) { return anillo_io.buffers + (size_t)slot * anillo_io.tam_buffer; }
+
+// Prepara la lectura o escritura de la parte pendiente del slot (se envía en 'anillo_io_esperar')
+static void anillo_io_preparar(unsigned slot, int fd, int escribir) {
+    slot_io_t *s = &anillo_io.slots[slot];
+    unsigned cola = *anillo_io.sq_cola, i = cola & *anillo_io.sq_mascara;
+    struct io_uring_sqe *sqe = &anillo_io.sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    if (anillo_io.registrados) {
+        sqe->opcode = escribir ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = (uint16_t)slot;
+    } else {
+        sqe->opcode = escribir ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+    sqe->fd = fd;
+    sqe->off = (uint64_t)(s->offset + (off_t)s->hechos);
+    sqe->addr = (uint64_t)(uintptr_t)(buffer_slot(slot) + s->hechos);
+    sqe->len = (uint32_t)(s->largo - s->hechos);
+    sqe->user_data = slot;
+    anillo_io.sq_indices[i] = i;
+    __atomic_store_n(anillo_io.sq_cola, cola + 1, __ATOMIC_RELEASE);
+    anillo_io.a_enviar++;
+    anillo_io.en_vuelo++;
+}
+
+// Envía lo preparado y espera una finalización. Retorna 0 con el slot y el resultado (bytes o -errno).
+static int anillo_io_esperar(unsigned *slot, int *resultado) {
+    while (1) {
+        unsigned cabeza = *anillo_io.cq_cabeza;
+        if (cabeza != __atomic_load_n(anillo_io.cq_cola, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &anillo_io.cqes[cabeza & *anillo_io.cq_mascara];
+            *slot = (unsigned)cqe->user_data;
+            *resultado = cqe->res;
+            __atomic_store_n(anillo_io.cq_cabeza, cabeza + 1, __ATOMIC_RELEASE);
+            anillo_io.en_vuelo--;
+            return 0;
+        }
+        int n = (int)syscall(__NR_io_uring_enter, anillo_io.fd, anillo_io.a_enviar, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n < 0) { if (errno == EINTR) continue; return -1; }
+        anillo_io.a_enviar -= (unsigned)n;
+    }
+}
+
+// Espera las operaciones pendientes antes de devolver los buffers (tras un error o un corte del consumidor)
+static void anillo_io_drenar(void) {
+    unsigned slot;
+    int resultado;
+    while (anillo_io.en_vuelo > 0 && anillo_io_esperar(&slot, &resultado) == 0) {}
+}
+
+// Ocupa el slot con la lectura del siguiente bloque de [*siguiente, hasta)
+static void anillo_io_leer_siguiente(unsigned slot, int fd, off_t *siguiente, off_t hasta) {
+    slot_io_t *s = &anillo_io.slots[slot];
+    s->offset = *siguiente;
+    s->largo = (hasta - *siguiente < (off_t)anillo_io.tam_buffer) ? (size_t)(hasta - *siguiente) : anillo_io.tam_buffer;
+    s->hechos = 0;
+    s->eof = 0;
+    s->fase = SLOT_LEYENDO;
+    *siguiente += (off_t)s->largo;
+    anillo_io_preparar(slot, fd, 0);
+}
+
+/*
+ * Aplica el resultado de una operación al slot. Retorna 0 si el slot terminó su fase, 1 si se
+ * reenvió por el resto (operación corta o EINTR/EAGAIN), o -1 con errno ante un error de I/O.
+ */
+static int anillo_io_completar(unsigned slot, int fd, int resultado) {
+    slot_io_t *s = &anillo_io.slots[slot];
+    int escribir = s->fase == SLOT_ESCRIBIENDO;
+    if (resultado == -EINTR || resultado == -EAGAIN) { anillo_io_preparar(slot, fd, escribir); return 1; }
+    if (resultado < 0) { errno = -resultado; return -1; }
+    if (resultado == 0 && !escribir) { s->eof = 1; return 0; }
+    if (resultado == 0) { errno = EIO; return -1; }
+    s->hechos += (size_t)resultado;
+    if (s->hechos < s->largo) { anillo_io_preparar(slot, fd, escribir); return 1; }
+    return 0;
+}
+
+/*
+ * Lee [desde, hasta) de 'fd' con hasta FLSH_IO_QD lecturas en vuelo y entrega los bloques en orden a
+ * 'consumir' (que retorna distinto de 0 para cortar): mientras se consume un bloque, el kernel ya está
+ * leyendo los siguientes. Acumula en '*leidos' lo entregado (menos de lo pedido si el archivo se achicó).
+ * Retorna 0, -1 con errno ante un error de lectura, o 1 si la transferencia va por el camino sincrónico.
+ */
+int io_leer_secuencial(int fd, off_t desde, off_t hasta, int (*consumir)(void *, const char *, size_t), void *ctx, off_t *leidos) {
+    *leidos = 0;
+    if (!anillo_io_tomar(hasta - desde)) return 1;
+    off_t siguiente = desde;
+    unsigned q = anillo_io.profundidad, turno = 0, lanzados = 0;
+    for (; lanzados < q && siguiente < hasta; lanzados++) anillo_io_leer_siguiente(lanzados, fd, &siguiente, hasta);
+
+    int resultado = 0;
+    while (lanzados > 0) {
+        slot_io_t *s = &anillo_io.slots[turno];
+        if (s->fase == SLOT_LISTO) {
+            // Los bloques se entregan en el orden del archivo aunque las lecturas terminen desordenadas
+            *leidos += (off_t)s->hechos;
+            if ((s->hechos > 0 && consumir(ctx, buffer_slot(turno), s->hechos) != 0) || s->eof) break;
+            s->fase = SLOT_LIBRE;
+            lanzados--;
+            if (siguiente < hasta) { anillo_io_leer_siguiente(turno, fd, &siguiente, hasta); lanzados++; }
+            turno = (turno + 1) % q;
+            continue;
+        }
+        unsigned slot;
+        int r;
+        if (anillo_io_esperar(&slot, &r) != 0) { resultado = -1; break; }
+        int estado = anillo_io_completar(slot, fd, r);
+        if (estado < 0) { resultado = -1; break; }
+        if (estado == 0) anillo_io.slots[slot].fase = SLOT_LISTO;
+    }
+    int err = errno;
+    anillo_io_drenar();
+    anillo_io_soltar();
+    errno = err;
+    return resultado;
+}
+
+/*
+ * Copia [offset, offset + longitud) de fd_in a la misma posición de fd_out: cada slot lee un bloque y
+ * al terminar escribe ese mismo buffer, así que lecturas y escrituras de distintos bloques se solapan.
+ * Acumula lo copiado en '*copiados'. Retorna 0, -1 con errno, o 1 si va por el camino sincrónico.
+ */
+int io_copiar_rango(int fd_in, int fd_out, off_t offset, off_t longitud, off_t *copiados) {
+    if (!anillo_io_tomar(longitud)) return 1;
+    off_t siguiente = offset, hasta = offset + longitud;
+    unsigned q = anillo_io.profundidad, activos = 0;
+    for (; activos < q && siguiente < hasta; activos++) anillo_io_leer_siguiente(activos, fd_in, &siguiente, hasta);
+
+    int resultado = 0;
+    while (activos > 0) {
+        unsigned slot;
+        int r;
+        if (anillo_io_esperar(&slot, &r) != 0) { resultado = -1; break; }
+        slot_io_t *s = &anillo_io.slots[slot];
+        int fd = s->fase == SLOT_ESCRIBIENDO ? fd_out : fd_in;
+        int estado = anillo_io_completar(slot, fd, r);
+        if (estado < 0) { resultado = -1; break; }
+        if (estado > 0) continue;
+        if (s->fase == SLOT_LEYENDO) {
+            if (s->eof) hasta = s->offset + (off_t)s->hechos; // El origen se achicó: no hay más que leer
+            if (s->hechos > 0) {
+                s->largo = s->hechos;
+                s->hechos = 0;
+                s->fase = SLOT_ESCRIBIENDO;
+                anillo_io_preparar(slot, fd_out, 1);
+                continue;
+            }
+        } else {
+            *copiados += (off_t)s->hechos;
+        }
+        s->fase = SLOT_LIBRE;
+        activos--;
+        if (siguiente < hasta) { anillo_io_leer_siguiente(slot, fd_in, &siguiente, hasta); activos++; }
+    }
+    int err = errno;
+    anillo_io_drenar();
+    anillo_io_soltar();
+    errno = err;
+    return resultado;
+}
+
+// --- Motor de Copia por Niveles ---
+
+/*
+ * Estrategias de transferencia ordenadas de más a menos eficiente. El motor intenta cada nivel
+ * y, si el kernel o el sistema de archivos no lo soporta, desciende al siguiente:
+ * 1. reflink (ioctl FICLONE): el destino comparte los extents del origen (copy-on-write), sin mover datos.
+ * 2. copy_file_range: copia dentro del kernel (y offload al almacenamiento si el FS lo soporta).
+ * 3. sendfile: transferencia kernel->kernel sin pasar por espacio de usuario.
+ * 4. io_uring (solo con FLSH_IO=uring, y en ese caso directamente después de reflink): varias lecturas
+ * en vuelo que se solapan con las escrituras de los bloques ya leídos (ver 'io_copiar_rango').
+ * 5. buffer: bucle pread/pwrite con un buffer grande alineado a página.
+ */
+#define CP_TAMANO_BLOQUE (1 << 20)
+#define CP_ALINEACION 4096
+
+typedef enum { COPIA_REFLINK, COPIA_COPY_FILE_RANGE, COPIA_SENDFILE, COPIA_URING, COPIA_BUFFER } metodo_copia_t;
+static const char *nombres_metodo_copia[] = { "reflink", "copy_file_range", "sendfile", "io_uring", "buffer" };
+
+// Errores que indican "nivel no soportado" (se desciende de nivel) en lugar de un fallo real de I/O.
+static int es_error_no_soportado(int err) {
+    return err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP || err == ENOTSUP || err == EBADF;
+}
+
+// Escribe 'len' bytes en 'offset', reintentando ante escrituras parciales. Retorna 0 o -1 (errno).
+static int escribir_completo_en(int fd, const char *buf, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, offset);
+        if (n < 0) { if (errno == EINTR) continue; return -1; }
+        buf += n; len -= (size_t)n; offset += n;
+    }
+    return 0;
+}
+
+/*
+ * Copia el rango [offset, offset + longitud) de fd_in a la misma posición de fd_out.
+ * Con longitud < 0 copia hasta EOF (orígenes de tamaño desconocido). 'metodo' indica el nivel
+ * actual y se degrada in-situ si el kernel rechaza el nivel. Acumula lo copiado en '*copiados'.
+ * Retorna 0 en éxito o -1 con errno ante un error real de lectura/escritura.
+ */
+static int copiar_rango(int fd_in, int fd_out, off_t offset, off_t longitud, metodo_copia_t *metodo, off_t *copiados) {
+    off_t restante = longitud;
+
+    while (*metodo == COPIA_COPY_FILE_RANGE && (longitud < 0 || restante > 0)) {
+        off_t off_in = offset, off_out = offset;
+        size_t pedido = (longitud < 0 || restante > (off_t)0x40000000) ? 0x40000000 : (size_t)restante;
+        ssize_t n = copy_file_range(fd_in, &off_in, fd_out, &off_out, pedido, 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (es_error_no_soportado(errno)) { *metodo = COPIA_SENDFILE; break; }
+            return -1;
+        }
+        if (n == 0) return 0; // EOF
+        offset += n; restante -= n; *copiados += n;
+    }
+
+    while (*metodo == COPIA_SENDFILE && (longitud < 0 || restante > 0)) {
+        off_t off_in = offset;
+        size_t pedido = (longitud < 0 || restante > (off_t)0x40000000) ? 0x40000000 : (size_t)restante;
+        // sendfile escribe en la posición actual de fd_out: la alineamos con el offset del rango
+        if (lseek(fd_out, offset, SEEK_SET) < 0) return -1;
+        ssize_t n = sendfile(fd_out, fd_in, &off_in, pedido);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (es_error_no_soportado(errno)) { *metodo = COPIA_URING; break; }
+            return -1;
+        }
+        if (n == 0) return 0;
+        offset += n; restante -= n; *copiados += n;
+    }
+
+    if (*metodo == COPIA_URING && longitud >= 0 && restante > 0) {
+        int r = io_copiar_rango(fd_in, fd_out, offset, restante, copiados);
+        if (r <= 0) return r;
+        *metodo = COPIA_BUFFER; // Anillo desactivado, ocupado (otro hilo) o no disponible
+    }
+    if (*metodo < COPIA_URING || (longitud >= 0 && restante <= 0)) return 0;
+
+    // Último nivel: buffer grande alineado (reduce syscalls y permite I/O eficiente del page cache)
+    char *buffer;
+    if (posix_memalign((void **)&buffer, CP_ALINEACION, CP_TAMANO_BLOQUE) != 0) { errno = ENOMEM; return -1; }
+    int resultado = 0;
+    while (longitud < 0 || restante > 0) {
+        size_t pedido = (longitud < 0 || restante > CP_TAMANO_BLOQUE) ? CP_TAMANO_BLOQUE : (size_t)restante;
+        ssize_t n = pread(fd_in, buffer, pedido, offset);
+        if (n < 0) { if (errno == EINTR) continue; resultado = -1; break; }
+        if (n == 0) break;
+        if (escribir_completo_en(fd_out, buffer, (size_t)n, offset) != 0) { resultado = -1; break; }
+        offset += n; restante -= n; *copiados += n;
+    }
+    free(buffer);
+    return resultado;
+}
+
+/*
+ * Copia el contenido completo de fd_in a fd_out (ya truncado) eligiendo el nivel más rápido disponible.
+ * Funcionalidad:
+ * 1. Reflink: si FICLONE funciona la copia termina en O(1), sin mover datos.
+ * 2. Archivos dispersos: si el origen ocupa menos bloques que su tamaño, recorre solo los segmentos
+ * con datos (SEEK_DATA/SEEK_HOLE) y deja los huecos sin escribir; un ftruncate final fija el tamaño.
+ * 3. Resto: copia secuencial con copy_file_range -> sendfile -> io_uring -> buffer.
+ * Retorna 0 en éxito o -1 con errno; informa bytes copiados y el nivel utilizado.
+ */
+int copiar_contenido(int fd_in, int fd_out, const struct stat *st_in, off_t *copiados, metodo_copia_t *metodo) {
+    *copiados = 0;
+
+    if (S_ISREG(st_in->st_mode) && ioctl(fd_out, FICLONE, fd_in) == 0) {
+        *metodo = COPIA_REFLINK;
+        *copiados = st_in->st_size;
+        return 0;
+    }
+    *metodo = io_uring_preferido() ? COPIA_URING : COPIA_COPY_FILE_RANGE;
+    if (!S_ISREG(st_in->st_mode)) return copiar_rango(fd_in, fd_out, 0, -1, metodo, copiados);
+
+    int disperso = (off_t)st_in->st_blocks * 512 < st_in->st_size;
+    if (disperso) {
+        off_t datos = lseek(fd_in, 0, SEEK_DATA);
+        if (datos >= 0 || errno == ENXIO) {
+            // ENXIO: no hay más datos (archivo compuesto solo por huecos)
+            while (datos >= 0) {
+                off_t hueco = lseek(fd_in, datos, SEEK_HOLE);
+                if (hueco < 0) return -1;
+                if (copiar_rango(fd_in, fd_out, datos, hueco - datos, metodo, copiados) != 0) return -1;
+                datos = lseek(fd_in, hueco, SEEK_DATA);
+            }
+            if (errno != ENXIO) return -1;
+            return ftruncate(fd_out, st_in->st_size);
+        }
+        // SEEK_DATA no soportado por el FS: caemos a la copia secuencial
+    }
+
+    if (copiar_rango(fd_in, fd_out, 0, st_in->st_size, metodo, copiados) != 0) return -1;
+    // El archivo pudo crecer durante la copia: continuamos hasta EOF
+    return copiar_rango(fd_in, fd_out, st_in->st_size, -1, metodo, copiados);
+}
+
+// --- Operaciones de Árbol en Paralelo (cp -r, rm -r) ---
+
+/*
+ * cp -r y rm -r recorren el árbol en el hilo que invoca y reparten el trabajo por archivo entre un pool
+ * acotado de hilos:
+ * - Recorrido: cada directorio se lee completo con getdents64 (el lector de ls) antes de tocarlo, así
+ * crear o borrar entradas no altera el listado en curso. Los archivos y enlaces se encolan y después
+ * se desciende a los subdirectorios, en profundidad.
+ * - Todo es relativo a descriptores de directorio: los trabajadores usan openat/unlinkat/symlinkat
+ * sobre el fd del directorio de la tarea, sin resolver rutas de nuevo y sin seguir enlaces (O_NOFOLLOW).
+ * - Cada directorio es un nodo con contador de referencias (el recorrido, sus tareas pendientes y sus
+ * subdirectorios). Quien suelta la última referencia lo cierra: rm -r lo elimina con
+ * unlinkat(AT_REMOVEDIR) desde el padre y cp -r -p le aplica permisos y tiempos del origen, recién
+ * cuando todo su contenido terminó.
+ * - La cola es un anillo de ARBOL_COLA tareas: si los trabajadores no dan abasto el recorrido espera,
+ * lo que acota la memoria y los descriptores abiertos (solo directorios con tareas en vuelo). Se
+ * despierta un trabajador cada ARBOL_LOTE tareas (y al recorrido, con la cola llena, cuando se libera
+ * un lote) y no por cada una: sin eso, con archivos chicos el recorrido y los hilos se alternan en
+ * cada tarea y los cambios de contexto cuestan más que la copia.
+ * Los datos pasan por 'copiar_contenido' (reflink -> copy_file_range -> sendfile -> buffer). El recorrido
+ * lleva los cursores de la política: lo que deniega se saltea, se informa al final y en rm -r conserva
+ * los directorios que lo contienen.
+ */
+#define ARBOL_MAX_HILOS 32
+#define ARBOL_COLA 256
+#define ARBOL_LOTE 32               // Tareas acumuladas por cada despertar de un trabajador
+
+typedef enum { ARBOL_COPIAR, ARBOL_BORRAR } tipo_operacion_arbol_t;
+
+typedef struct nodo_arbol {
+    struct nodo_arbol *padre;
+    int fd;                     // Directorio recorrido (cp -r: el origen)
+    int fd_destino;             // cp -r: el directorio creado en el destino (-1 en rm -r)
+    int refs;
+    int conservar;              // rm -r: quedó contenido (denegado o con error), no se elimina
+    mode_t modo;                // cp -r -p: permisos y tiempos del origen, aplicados al soltar
+    struct timespec tiempos[2];
+    char nombre[];              // Nombre dentro del padre
+} nodo_arbol_t;
+
+typedef struct {
+    nodo_arbol_t *dir;
+    unsigned char tipo;         // DT_REG, DT_LNK... (rm -r encola cualquier tipo salvo directorios)
+    char nombre[NAME_MAX + 1];
+} tarea_arbol_t;
+
+typedef struct {
+    tipo_operacion_arbol_t tipo;
+    int preservar;              // cp -p
+    int fusion;                 // cp: el destino ya existía (confirmado): se sobrescriben los archivos
+    const char *raiz;           // Ruta del usuario, para los mensajes
+    nodo_arbol_t *nodo_raiz;
+    listado_t listado;          // Buffer del recorrido, reutilizado en cada directorio
+    pthread_mutex_t mutex;
+    pthread_cond_t hay_tarea, hay_lugar;
+    tarea_arbol_t cola[ARBOL_COLA];
+    size_t ini, n;
+    int recorrido_terminado;
+    int n_hilos;
+    long archivos, directorios, enlaces, omitidos, denegados, errores; // Atómicos
+    long long bytes;
+    unsigned metodos;           // Niveles de copia usados (bit por metodo_copia_t)
+    int primer_errno;           // Primer error (bajo 'mutex')
+    char primer_error[PATH_MAX];
+} operacion_arbol_t;
+
+static nodo_arbol_t *nuevo_nodo_arbol(nodo_arbol_t *padre, const char *nombre, int fd, int fd_destino) {
+    size_t n = strlen(nombre) + 1;
+    nodo_arbol_t *d = malloc(sizeof(*d) + n);
+    if (!d) return NULL;
+    memset(d, 0, sizeof(*d));
+    d->padre = padre;
+    d->fd = fd;
+    d->fd_destino = fd_destino;
+    d->refs = 1;
+    memcpy(d->nombre, nombre, n);
+    if (padre) __atomic_add_fetch(&padre->refs, 1, __ATOMIC_RELAXED);
+    return d;
+}
+
+// Ruta de 'nombre' dentro de 'dir' (o de 'dir' mismo) para los mensajes: la raíz del usuario y los nodos
+static void ruta_en_arbol(const operacion_arbol_t *op, const nodo_arbol_t *dir, const char *nombre, char *destino, size_t tam) {
+    const char *partes[128];
+    int n = 0;
+    for (const nodo_arbol_t *d = dir; d && d != op->nodo_raiz && n < 128; d = d->padre) partes[n++] = d->nombre;
+    size_t largo = (size_t)snprintf(destino, tam, "%s", op->raiz);
+    while (n > 0 && largo < tam) largo += (size_t)snprintf(destino + largo, tam - largo, "/%s", partes[--n]);
+    if (nombre && largo < tam) snprintf(destino + largo, tam - largo, "/%s", nombre);
+}
+
+static void registrar_error_arbol(operacion_arbol_t *op, const nodo_arbol_t *dir, const char *nombre, int err) {
+    __atomic_add_fetch(&op->errores, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&op->mutex);
+    if (op->primer_errno == 0) {
+        op->primer_errno = err;
+        ruta_en_arbol(op, dir, nombre, op->primer_error, sizeof(op->primer_error));
+    }
+    pthread_mutex_unlock(&op->mutex);
+}
+
+// rm -r: lo que quedó en 'dir' (denegado o con error) impide eliminar 'dir' y sus ancestros
+static void conservar_ancestros(nodo_arbol_t *dir) {
+    for (; dir; dir = dir->padre) __atomic_store_n(&dir->conservar, 1, __ATOMIC_RELAXED);
+}
+
+// Suelta una referencia; el último en soltar cierra el directorio y sigue con el padre.
+static void soltar_nodo_arbol(operacion_arbol_t *op, nodo_arbol_t *d) {
+    while (d && __atomic_sub_fetch(&d->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        nodo_arbol_t *padre = d->padre;
+        if (op->preservar && d->fd_destino >= 0 && (fchmod(d->fd_destino, d->modo) != 0 || futimens(d->fd_destino, d->tiempos) != 0))
+            registrar_error_arbol(op, d, NULL, errno);
+        if (d->fd >= 0) close(d->fd);
+        if (d->fd_destino >= 0) close(d->fd_destino);
+        if (op->tipo == ARBOL_BORRAR && padre && !__atomic_load_n(&d->conservar, __ATOMIC_RELAXED)) {
+            if (unlinkat(padre->fd, d->nombre, AT_REMOVEDIR) == 0) __atomic_add_fetch(&op->directorios, 1, __ATOMIC_RELAXED);
+            else { registrar_error_arbol(op, d, NULL, errno); conservar_ancestros(padre); }
+        }
+        free(d);
+        d = padre;
+    }
+}
+
+// cp -r: un archivo regular o un enlace simbólico (se copia el enlace, nunca su destino)
+static void copiar_entrada_arbol(operacion_arbol_t *op, const tarea_arbol_t *t) {
+    nodo_arbol_t *d = t->dir;
+    if (t->tipo == DT_LNK) {
+        char objetivo[PATH_MAX];
+        ssize_t n = readlinkat(d->fd, t->nombre, objetivo, sizeof(objetivo) - 1);
+        int r = -1;
+        if (n >= 0) {
+            objetivo[n] = '\0';
+            r = symlinkat(objetivo, d->fd_destino, t->nombre);
+            if (r != 0 && errno == EEXIST && op->fusion && unlinkat(d->fd_destino, t->nombre, 0) == 0)
+                r = symlinkat(objetivo, d->fd_destino, t->nombre);
+        }
+        if (r != 0) registrar_error_arbol(op, d, t->nombre, errno);
+        else __atomic_add_fetch(&op->enlaces, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    struct stat st;
+    int fd_in = openat(d->fd, t->nombre, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd_in < 0 || fstat(fd_in, &st) != 0) {
+        registrar_error_arbol(op, d, t->nombre, errno);
+        if (fd_in >= 0) close(fd_in);
+        return;
+    }
+    // Destino recién creado: O_EXCL. Al fusionar se abre sin truncar para no destruir un mismo inodo.
+    int flags = O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC | (op->fusion ? 0 : O_EXCL);
+    int fd_out = openat(d->fd_destino, t->nombre, flags, 0644);
+    int r = (fd_out >= 0) ? 0 : -1;
+    if (r == 0 && op->fusion) {
+        struct stat st_out;
+        if (fstat(fd_out, &st_out) == 0 && st_out.st_dev == st.st_dev && st_out.st_ino == st.st_ino) {
+            // Enlace duro al mismo archivo: ya es idéntico
+            __atomic_add_fetch(&op->omitidos, 1, __ATOMIC_RELAXED);
+            close(fd_out); close(fd_in);
+            return;
+        }
+        r = ftruncate(fd_out, 0);
+    }
+    off_t copiados = 0;
+    metodo_copia_t metodo = COPIA_BUFFER;
+    if (r == 0) r = copiar_contenido(fd_in, fd_out, &st, &copiados, &metodo);
+    if (r == 0 && op->preservar) {
+        struct timespec tiempos[2] = { st.st_atim, st.st_mtim };
+        if (fchmod(fd_out, st.st_mode & 07777) != 0 || futimens(fd_out, tiempos) != 0) r = -1;
+    }
+    int err = errno;
+    if (fd_out >= 0 && close(fd_out) != 0 && r == 0) { r = -1; err = errno; }
+    close(fd_in);
+    if (r != 0) { registrar_error_arbol(op, d, t->nombre, err); return; }
+    __atomic_add_fetch(&op->archivos, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&op->bytes, (long long)copiados, __ATOMIC_RELAXED);
+    __atomic_or_fetch(&op->metodos, 1u << metodo, __ATOMIC_RELAXED);
+}
+
+// rm -r: cualquier entrada que no sea directorio (el tamaño se suma a los bytes liberados)
+static void borrar_entrada_arbol(operacion_arbol_t *op, const tarea_arbol_t *t) {
+    nodo_arbol_t *d = t->dir;
+    struct stat st;
+    long long tam = (t->tipo == DT_REG && fstatat(d->fd, t->nombre, &st, AT_SYMLINK_NOFOLLOW) == 0) ? (long long)st.st_size : 0;
+    if (unlinkat(d->fd, t->nombre, 0) != 0) {
+        if (errno == ENOENT) return; // Ya no estaba
+        registrar_error_arbol(op, d, t->nombre, errno);
+        conservar_ancestros(d);
+        return;
+    }
+    __atomic_add_fetch(t->tipo == DT_LNK ? &op->enlaces : &op->archivos, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&op->bytes, tam, __ATOMIC_RELAXED);
+}
+
+static void procesar_tarea_arbol(operacion_arbol_t *op, const tarea_arbol_t *t) {
+    if (op->tipo == ARBOL_COPIAR) copiar_entrada_arbol(op, t);
+    else borrar_entrada_arbol(op, t);
+    soltar_nodo_arbol(op, t->dir);
+}
+
+// Encola una entrada de 'dir' (la tarea retiene el directorio); espera si el anillo está lleno
+static void encolar_arbol(operacion_arbol_t *op, nodo_arbol_t *dir, unsigned char tipo, const char *nombre) {
+    __atomic_add_fetch(&dir->refs, 1, __ATOMIC_RELAXED);
+    if (op->n_hilos == 0) {
+        // Sin trabajadores (pthread_create falló): se procesa en el mismo hilo
+        tarea_arbol_t t = { .dir = dir, .tipo = tipo };
+        snprintf(t.nombre, sizeof(t.nombre), "%s", nombre);
+        procesar_tarea_arbol(op, &t);
+        return;
+    }
+    pthread_mutex_lock(&op->mutex);
+    while (op->n == ARBOL_COLA) pthread_cond_wait(&op->hay_lugar, &op->mutex);
+    tarea_arbol_t *t = &op->cola[(op->ini + op->n) % ARBOL_COLA];
+    t->dir = dir;
+    t->tipo = tipo;
+    snprintf(t->nombre, sizeof(t->nombre), "%s", nombre);
+    if (++op->n % ARBOL_LOTE == 0) pthread_cond_signal(&op->hay_tarea);
+    pthread_mutex_unlock(&op->mutex);
+}
+
+static void *hilo_trabajador_arbol(void *arg) {
+    operacion_arbol_t *op = arg;
+    for (;;) {
+        pthread_mutex_lock(&op->mutex);
+        while (op->n == 0 && !op->recorrido_terminado) pthread_cond_wait(&op->hay_tarea, &op->mutex);
+        if (op->n == 0) { pthread_mutex_unlock(&op->mutex); break; }
+        tarea_arbol_t t = op->cola[op->ini];
+        op->ini = (op->ini + 1) % ARBOL_COLA;
+        // El recorrido (si esperaba con la cola llena) sigue cuando hay lugar para un lote entero
+        if (--op->n == ARBOL_COLA - ARBOL_LOTE) pthread_cond_signal(&op->hay_lugar);
+        pthread_mutex_unlock(&op->mutex);
+        procesar_tarea_arbol(op, &t);
+    }
+    return NULL;
+}
+
+// Abre el subdirectorio 'nombre' de 'dir' (y en cp -r lo crea en el destino). NULL ante error (ya registrado).
+static nodo_arbol_t *abrir_subdirectorio_arbol(operacion_arbol_t *op, nodo_arbol_t *dir, const char *nombre) {
+    struct stat st;
+    int fd = openat(dir->fd, nombre, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    int fd_destino = -1, copiar = op->tipo == ARBOL_COPIAR;
+    if (fd >= 0 && copiar && (!op->preservar || fstat(fd, &st) == 0) &&
+        (mkdirat(dir->fd_destino, nombre, 0755) == 0 || (errno == EEXIST && op->fusion)))
+        fd_destino = openat(dir->fd_destino, nombre, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    nodo_arbol_t *sub = NULL;
+    if (fd >= 0 && (!copiar || fd_destino >= 0)) sub = nuevo_nodo_arbol(dir, nombre, fd, fd_destino);
+    if (!sub) {
+        registrar_error_arbol(op, dir, nombre, errno);
+        conservar_ancestros(dir);
+        if (fd >= 0) close(fd);
+        if (fd_destino >= 0) close(fd_destino);
+        return NULL;
+    }
+    if (copiar) __atomic_add_fetch(&op->directorios, 1, __ATOMIC_RELAXED);
+    if (copiar && op->preservar) {
+        sub->modo = st.st_mode & 07777;
+        sub->tiempos[0] = st.st_atim;
+        sub->tiempos[1] = st.st_mtim;
+    }
+    return sub;
+}
+
+/*
+ * Recorre el directorio del nodo 'dir' con los cursores de la política del origen y (cp -r) del destino:
+ * encola archivos y enlaces, y después desciende a los subdirectorios.
+ */
+static void recorrer_arbol(operacion_arbol_t *op, nodo_arbol_t *dir, const arbol_sandbox_t *origen, const arbol_sandbox_t *destino) {
+    listado_t *l = &op->listado;
+    if (leer_directorio_ls(dir->fd, l, 1) != 0) {
+        registrar_error_arbol(op, dir, NULL, errno);
+        conservar_ancestros(dir);
+        return;
+    }
+    // Los subdirectorios se copian aparte: el listado se reutiliza en cada nivel
+    char *subdirs = NULL;
+    size_t largo = 0, capacidad = 0;
+    for (size_t i = 0; i < l->n; i++) {
+        const struct linux_dirent64 *e = registro_ls(l, i);
+        const char *nombre = e->d_name;
+        if (nombre[0] == '.' && (nombre[1] == '\0' || (nombre[1] == '.' && nombre[2] == '\0'))) continue;
+        unsigned char tipo = e->d_type;
+        if (tipo == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(dir->fd, nombre, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+            tipo = IFTODT(st.st_mode);
+        }
+        if (tipo == DT_DIR) {
+            size_t n = strlen(nombre) + 1;
+            if (reservar_vector((void **)&subdirs, &capacidad, largo + n, 1) != 0) {
+                registrar_error_arbol(op, dir, nombre, errno);
+                conservar_ancestros(dir);
+                continue;
+            }
+            memcpy(subdirs + largo, nombre, n);
+            largo += n;
+            continue;
+        }
+        arbol_sandbox_t so, sd;
+        if (!arbol_descender(origen, nombre, &so) || (destino && !arbol_descender(destino, nombre, &sd))) {
+            __atomic_add_fetch(&op->denegados, 1, __ATOMIC_RELAXED);
+            conservar_ancestros(dir);
+            continue;
+        }
+        // cp -r no copia FIFOs, sockets ni dispositivos
+        if (op->tipo == ARBOL_COPIAR && tipo != DT_REG && tipo != DT_LNK) {
+            __atomic_add_fetch(&op->omitidos, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        encolar_arbol(op, dir, tipo, nombre);
+    }
+
+    for (size_t off = 0; off < largo; off += strlen(subdirs + off) + 1) {
+        const char *nombre = subdirs + off;
+        arbol_sandbox_t so, sd;
+        if (!arbol_descender(origen, nombre, &so) || (destino && !arbol_descender(destino, nombre, &sd))) {
+            __atomic_add_fetch(&op->denegados, 1, __ATOMIC_RELAXED);
+            conservar_ancestros(dir);
+            continue;
+        }
+        nodo_arbol_t *sub = abrir_subdirectorio_arbol(op, dir, nombre);
+        if (!sub) continue;
+        recorrer_arbol(op, sub, &so, destino ? &sd : NULL);
+        soltar_nodo_arbol(op, sub);
+    }
+    free(subdirs);
+}
+
+// Cantidad de hilos: FLSH_ARBOL_HILOS o el doble de núcleos en línea (las operaciones de metadatos se
+// bloquean en el kernel más de lo que calculan), acotado a [1, ARBOL_MAX_HILOS].
+static int hilos_arbol(void) {
+    long n = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    char *env = getenv("FLSH_ARBOL_HILOS");
+    if (env && atoi(env) > 0) n = atoi(env);
+    if (n < 1) n = 1;
+    if (n > ARBOL_MAX_HILOS) n = ARBOL_MAX_HILOS;
+    return (int)n;
+}
+
+/*
+ * Ejecuta la operación desde el nodo 'raiz' (consume su referencia): lanza el pool, recorre y espera a
+ * que los trabajadores vacíen la cola. Al volver, todos los nodos bajo la raíz ya se soltaron.
+ */
+static void ejecutar_operacion_arbol(operacion_arbol_t *op, nodo_arbol_t *raiz, const arbol_sandbox_t *origen,
+                                     const arbol_sandbox_t *destino) {
+    op->nodo_raiz = raiz;
+    pthread_mutex_init(&op->mutex, NULL);
+    pthread_cond_init(&op->hay_tarea, NULL);
+    pthread_cond_init(&op->hay_lugar, NULL);
+
+    pthread_t hilos[ARBOL_MAX_HILOS];
+    int pedidos = hilos_arbol(), lanzados = 0;
+    for (; lanzados < pedidos; lanzados++)
+        if (pthread_create(&hilos[lanzados], NULL, hilo_trabajador_arbol, op) != 0) break;
+    op->n_hilos = lanzados;
+
+    recorrer_arbol(op, raiz, origen, destino);
+    soltar_nodo_arbol(op, raiz);
+
+    pthread_mutex_lock(&op->mutex);
+    op->recorrido_terminado = 1;
+    pthread_cond_broadcast(&op->hay_tarea);
+    pthread_mutex_unlock(&op->mutex);
+    for (int i = 0; i < lanzados; i++) pthread_join(hilos[i], NULL);
+
+    liberar_listado(&op->listado);
+    pthread_mutex_destroy(&op->mutex);
+    pthread_cond_destroy(&op->hay_tarea);
+    pthread_cond_destroy(&op->hay_lugar);
+}
+
+// Errores y entradas denegadas de una operación de árbol: a stderr y al log, con estado 1
+static void informar_operacion_arbol(const operacion_arbol_t *op, const char *cmd) {
+    char msg[PATH_MAX + 256];
+    if (op->errores > 0) {
+        fprintf(stderr, "[flsh_error] %s: '%s': %s", cmd, op->primer_error, strerror(op->primer_errno));
+        if (op->errores > 1) fprintf(stderr, " (y %ld errores más)", op->errores - 1);
+        fputc('\n', stderr);
+        snprintf(msg, sizeof(msg), "%ld errores, el primero en '%s': %s", op->errores, op->primer_error, strerror(op->primer_errno));
+        log_shell((char *)cmd, msg, "ERROR");
+        estado_builtin = 1;
+    }
+    if (op->denegados > 0) {
+        fprintf(stderr, "[flsh_sec]: %ld entradas omitidas por la política del Sandbox.\n", op->denegados);
+        snprintf(msg, sizeof(msg), "Entradas denegadas por la politica: %ld", op->denegados);
+        log_shell((char *)cmd, msg, "WARNING");
+        estado_builtin = 1;
+    }
+}
+
+// cp -r: 'dir' (un descriptor de directorio) es 'st' o uno de sus descendientes (se sube por '..')
+static int directorio_dentro_de(int dir, const struct stat *st) {
+    int fd = openat(dir, ".", O_PATH | O_DIRECTORY | O_CLOEXEC), dentro = 0;
+    struct stat actual, anterior = { 0 };
+    for (int primero = 1; fd >= 0 && fstat(fd, &actual) == 0; primero = 0) {
+        if (actual.st_dev == st->st_dev && actual.st_ino == st->st_ino) { dentro = 1; break; }
+        if (!primero && actual.st_dev == anterior.st_dev && actual.st_ino == anterior.st_ino) break; // '/'
+        anterior = actual;
+        int arriba = openat(fd, "..", O_PATH | O_DIRECTORY | O_CLOEXEC);
+        close(fd);
+        fd = arriba;
+    }
+    if (fd >= 0) close(fd);
+    return dentro;
+}
+
+/*
+ * cp -r: copia el directorio 'fd_in' ('origen', abierto por el Sandbox con el cursor 'arbol') a 'destino',
+ * o a 'destino/<nombre del origen>' si 'destino' es un directorio existente (como cp de coreutils).
+ * Si el directorio final ya existe se pide una sola confirmación antes de copiar encima.
+ */
+static void copiar_arbol(int fd_in, const struct stat *st_in, const arbol_sandbox_t *arbol, const char *origen,
+                         const char *destino, int preservar) {
+    char objetivo[PATH_MAX];
+    snprintf(objetivo, sizeof(objetivo), "%s", destino);
+    int fd_dir = abrir_en_sandbox(destino, O_PATH | O_DIRECTORY, 0, "cp out");
+    if (fd_dir == SANDBOX_DENEGADO) { close(fd_in); return; }
+    if (fd_dir >= 0) {
+        char base[PATH_MAX];
+        snprintf(base, sizeof(base), "%s", origen);
+        size_t n = strlen(base);
+        while (n > 1 && base[n - 1] == '/') base[--n] = '\0';
+        const char *barra = strrchr(base, '/');
+        if ((size_t)snprintf(objetivo, sizeof(objetivo), "%s/%s", destino, barra ? barra + 1 : base) >= sizeof(objetivo)) {
+            errno = ENAMETOOLONG;
+            reportar_error_sistema("cp (destino)");
+            close(fd_dir); close(fd_in);
+            return;
+        }
+        close(fd_dir);
+    }
+
+    char nombre[NAME_MAX + 1];
+    arbol_sandbox_t arbol_destino;
+    int padre = abrir_padre_en_sandbox(objetivo, nombre, sizeof(nombre), "cp out", &arbol_destino);
+    if (padre == SANDBOX_DENEGADO) { close(fd_in); return; }
+    if (padre < 0) { reportar_error_sistema("cp (destino)"); close(fd_in); return; }
+
+    struct stat st;
+    int fusion = fstatat(padre, nombre, &st, AT_SYMLINK_NOFOLLOW) == 0;
+    int fd_out = -1;
+    if (fusion && !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "cp: '%s' ya existe y no es un directorio\n", objetivo);
+        estado_builtin = 1;
+    } else if (fusion && st.st_dev == st_in->st_dev && st.st_ino == st_in->st_ino) {
+        fprintf(stderr, "cp: '%s' y '%s' son el mismo directorio\n", origen, objetivo);
+        estado_builtin = 1;
+    } else if (directorio_dentro_de(padre, st_in)) {
+        fprintf(stderr, "cp: no se puede copiar '%s' dentro de sí mismo ('%s')\n", origen, objetivo);
+        estado_builtin = 1;
+    } else {
+        char msg[PATH_MAX + 96];
+        snprintf(msg, sizeof(msg), "ALERTA: '%s' ya existe. ¿Copiar dentro y sobrescribir lo que coincida?", objetivo);
+        if (fusion && !confirmar_accion(msg)) log_shell("cp", "Cancelado (sobrescritura)", "INFO");
+        else if (!fusion && mkdirat(padre, nombre, 0755) != 0) reportar_error_sistema("cp (destino)");
+        else if ((fd_out = openat(padre, nombre, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) < 0) reportar_error_sistema("cp (destino)");
+    }
+    close(padre);
+    operacion_arbol_t *op = (fd_out >= 0) ? calloc(1, sizeof(*op)) : NULL;
+    nodo_arbol_t *raiz = op ? nuevo_nodo_arbol(NULL, "", fd_in, fd_out) : NULL;
+    if (!raiz) {
+        if (fd_out >= 0) { errno = ENOMEM; reportar_error_sistema("cp"); close(fd_out); }
+        free(op);
+        close(fd_in);
+        arbol_soltar(&arbol_destino);
+        return;
+    }
+    op->tipo = ARBOL_COPIAR;
+    op->preservar = preservar;
+    op->fusion = fusion;
+    op->raiz = origen;
+    op->directorios = 1;
+    raiz->modo = st_in->st_mode & 07777;
+    raiz->tiempos[0] = st_in->st_atim;
+    raiz->tiempos[1] = st_in->st_mtim;
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    ejecutar_operacion_arbol(op, raiz, arbol, &arbol_destino);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    arbol_soltar(&arbol_destino);
+    contar_io((uint64_t)op->bytes, (uint64_t)op->bytes);
+    informar_operacion_arbol(op, "cp");
+    if (op->omitidos > 0) fprintf(stderr, "cp: %ld entradas omitidas (archivos especiales o ya idénticos)\n", op->omitidos);
+
+    char metodos[64] = "";
+    for (int m = COPIA_REFLINK; m <= COPIA_BUFFER; m++) {
+        if (!(op->metodos & (1u << m))) continue;
+        size_t n = strlen(metodos);
+        snprintf(metodos + n, sizeof(metodos) - n, "%s%s", n ? "+" : "", nombres_metodo_copia[m]);
+    }
+    double ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+    double s = ms > 0 ? ms / 1e3 : 1e-9;
+    char msg[384];
+    snprintf(msg, sizeof(msg), "Copia recursiva: %ld archivos, %ld directorios, %ld enlaces, %lld bytes en %.3f ms "
+             "(%.1f MB/s, %.0f archivos/s) via %s, %d hilos%s%s",
+             op->archivos, op->directorios, op->enlaces, op->bytes, ms, op->bytes / (1024.0 * 1024.0) / s,
+             op->archivos / s, metodos[0] ? metodos : "-", op->n_hilos, preservar ? " [-p]" : "", fusion ? " [sobre existente]" : "");
+    log_shell("cp", msg, "INFO");
+    free(op);
+}
+
+/*
+ * rm -r: elimina el directorio 'nombre' de 'padre' (el descriptor pasa a la operación) con todo su
+ * contenido. 'ruta' es la del usuario y 'arbol' el cursor de escritura de la política.
+ */
+static void borrar_arbol(int padre, const char *nombre, const char *ruta, const arbol_sandbox_t *arbol) {
+    int fd = openat(padre, nombre, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    operacion_arbol_t *op = (fd >= 0) ? calloc(1, sizeof(*op)) : NULL;
+    nodo_arbol_t *base = op ? nuevo_nodo_arbol(NULL, "", padre, -1) : NULL;
+    nodo_arbol_t *raiz = base ? nuevo_nodo_arbol(base, nombre, fd, -1) : NULL;
+    if (!raiz) {
+        if (fd >= 0) errno = ENOMEM;
+        reportar_error_sistema("rm");
+        if (fd >= 0) close(fd);
+        close(padre);
+        free(base);
+        free(op);
+        return;
+    }
+    op->tipo = ARBOL_BORRAR;
+    op->raiz = ruta;
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    ejecutar_operacion_arbol(op, raiz, arbol, NULL);
+    soltar_nodo_arbol(op, base); // Cierra el padre
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    informar_operacion_arbol(op, "rm");
+
+    double ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+    double s = ms > 0 ? ms / 1e3 : 1e-9;
+    char msg[320];
+    snprintf(msg, sizeof(msg), "Arbol eliminado: %ld archivos, %ld directorios, %ld enlaces, %lld bytes en %.3f ms "
+             "(%.0f entradas/s), %d hilos",
+             op->archivos, op->directorios, op->enlaces, op->bytes, ms,
+             (op->archivos + op->directorios + op->enlaces) / s, op->n_hilos);
+    log_shell("rm", msg, "WARNING"); // Warning porque es destructivo
+    free(op);
+}
+
+// --- Comando Built-in: mkdir (Make Directory) ---
+
+/*
+ * mkdir -p: crea 'ruta' y los padres que falten. Solo se verifican con la política los componentes que
+ * se crean (los existentes se atraviesan); cada uno se crea con 'mkdirat' sobre su padre abierto por el
+ * Sandbox. Suma en 'creados' los directorios nuevos. Retorna 0, -1 (errno) o SANDBOX_DENEGADO.
+ */
+static int crear_con_padres(const char *ruta, int *creados) {
+    char nombre[NAME_MAX + 1];
+    int padre = abrir_padre_en_sandbox(ruta, nombre, sizeof(nombre), "mkdir", NULL);
+    if (padre == -1 && errno == ENOENT) {
+        // Falta el padre: se crea primero y se reintenta
+        char copia[PATH_MAX];
+        snprintf(copia, sizeof(copia), "%s", ruta);
+        size_t n = strlen(copia);
+        while (n > 1 && copia[n - 1] == '/') copia[--n] = '\0';
+        char *barra = strrchr(copia, '/');
+        if (!barra || barra == copia) return -1;
+        *barra = '\0';
+        int r = crear_con_padres(copia, creados);
+        if (r != 0) return r;
+        padre = abrir_padre_en_sandbox(ruta, nombre, sizeof(nombre), "mkdir", NULL);
+    }
+    if (padre < 0) return padre;
+
+    int r = mkdirat(padre, nombre, 0755);
+    if (r == 0) (*creados)++;
+    else if (errno == EEXIST) {
+        // Ya existe: es éxito si es un directorio (o un enlace a uno)
+        struct stat st;
+        r = (fstatat(padre, nombre, &st, 0) == 0 && S_ISDIR(st.st_mode)) ? 0 : -1;
+        errno = EEXIST;
+    }
+    int errno_guardado = errno;
+    close(padre);
+    errno = errno_guardado;
+    return r;
+}
+
+/*
+ * Crea un nuevo directorio en el sistema de archivos.
+ * Uso: mkdir [-p] ruta
+ * Funcionalidad:
+ * 1. Validación de Argumentos: Verifica la existencia del nombre del directorio antes de proceder.
+ * 2. Seguridad (Sandbox): Abre el directorio padre a través del Sandbox ('abrir_padre_en_sandbox'), de modo
+ * que el nuevo directorio se creará donde la política da escritura, evitando escrituras en zonas de sistema.
+ * 3. Llamada al Sistema: Invoca 'mkdirat' relativo al padre ya validado con modo octal 0755 (rwxr-xr-x), otorgando permisos completos
+ * al usuario y de lectura/ejecución al grupo y otros.
+ * 4. -p: crea también los padres que falten ('crear_con_padres') y no falla si el directorio ya existe.
+ * 5. Gestión de Resultados: Reporta errores de sistema (ej. "File exists") o registra el éxito en el log.
+ */
+void ejecutar_mkdir(char **args) {
+    int padres = 0, i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        for (const char *p = args[i] + 1; *p; p++) {
+            if (*p == 'p') { padres = 1; continue; }
+            fprintf(stderr, "mkdir: opción inválida: -%c (uso: mkdir [-p] ruta)\n", *p);
+            estado_builtin = 2;
+            return;
+        }
+    }
+    char *ruta = args[i];
+    if (!ruta) { fprintf(stderr, "mkdir: falta argumento\n"); estado_builtin = 2; return; }
+    if (args[i + 1]) { fprintf(stderr, "mkdir: demasiados argumentos\n"); estado_builtin = 2; return; }
+
+    if (padres) {
+        int creados = 0;
+        int r = crear_con_padres(ruta, &creados);
+        if (r == SANDBOX_DENEGADO) return;
+        if (r != 0) { reportar_error_sistema("mkdir"); return; }
+        char msg[64];
+        snprintf(msg, sizeof(msg), "Directorios creados: %d [-p]", creados);
+        log_shell("mkdir", msg, "INFO");
+        return;
+    }
+
+    // Abrimos el padre dentro del Sandbox: solo se puede crear aquí si es seguro
+    char nombre[NAME_MAX + 1];
+    int padre = abrir_padre_en_sandbox(ruta, nombre, sizeof(nombre), "mkdir", NULL);
+    if (padre == SANDBOX_DENEGADO) return;
+    if (padre < 0) { reportar_error_sistema("mkdir"); return; }
+    
+    // 0755 = rwx (Dueño) | r-x (Grupo) | r-x (Otros)
+    if (mkdirat(padre, nombre, 0755) != 0) reportar_error_sistema("mkdir");
+    else log_shell("mkdir", "Directorio creado", "INFO");
+    close(padre);
+}
+ 
+// --- Comando Built-in: rm (Remove File) ---
+
+#define RM_MAX_LISTADOS 100     // Operandos que se muestran antes de la confirmación única
+
+// Borra un operando de 'rm'; con 'confirmar' pregunta antes (ver 'ejecutar_rm')
+static void borrar_operando(const char *archivo, int recursivo, int confirmar) {
+    // Capa 1: Validación de Entorno (Sandbox)
+    char nombre[NAME_MAX + 1];
+    arbol_sandbox_t arbol;
+    int padre = abrir_padre_en_sandbox(archivo, nombre, sizeof(nombre), "rm", recursivo ? &arbol : NULL);
+    if (padre == SANDBOX_DENEGADO) return;
+    if (padre < 0) { reportar_error_sistema("rm"); return; }
+    struct stat st;
+    int es_arbol = recursivo && fstatat(padre, nombre, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+    
+    // Capa 2: Confirmación de Usuario (Requisito de Seguridad)
+    char msg[512];
+    if (es_arbol) snprintf(msg, sizeof(msg), "ALERTA: Vas a eliminar '%s' y todo su contenido. ¿Estás seguro?", archivo);
+    else snprintf(msg, sizeof(msg), "ALERTA: Vas a eliminar '%s'. ¿Estás seguro?", archivo);
+    
+    if (confirmar && !confirmar_accion(msg)) {
+        // Registro de la cancelación (Auditoría positiva)
+        log_shell("rm", "Cancelado por usuario", "INFO");
+        close(padre);
+    } else if (es_arbol) {
+        borrar_arbol(padre, nombre, archivo, &arbol);
+    } else {
+        // Capa 3: Ejecución (Syscall unlinkat)
+        if (unlinkat(padre, nombre, 0) != 0) reportar_error_sistema("rm");
+        else log_shell("rm", "Archivo eliminado", "WARNING"); // Warning porque es destructivo
+        close(padre);
+    }
+    if (recursivo) arbol_soltar(&arbol);
+}
+
+/*
+ * Elimina archivos (o con -r árboles completos) de forma segura y auditada.
+ * Uso: rm [-r] ruta...
+ * Funcionalidad:
+ * 1. Validación de Seguridad (Sandbox): Abre el directorio padre a través del Sandbox, garantizando que la
+ * entrada a borrar se encuentre dentro del espacio de usuario permitido, previniendo el borrado de archivos del sistema.
+ * 2. Confirmación Interactiva (Fail-Safe): Implementa una barrera de seguridad lógica ('confirmar_accion')
+ * que detiene la ejecución hasta obtener consentimiento explícito del usuario. Esto mitiga el error humano.
+ * Con -r sobre un directorio se confirma una sola vez para todo el árbol. Con varios operandos (ej. la
+ * expansión de 'rm *.tmp') se muestra la lista completa una vez y se confirma una sola vez para todos.
+ * 3. Ejecución Atómica: Utiliza 'unlinkat' relativo al padre ya validado para eliminar la referencia
+ * del archivo en el inodo correspondiente (un enlace simbólico se elimina a sí mismo, nunca su destino).
+ * Con -r el árbol se vacía con el pool de 'borrar_arbol', salteando lo que la política deniega.
+ * 4. Auditoría Crítica: Registra el evento con nivel "WARNING" (si fue exitoso) o "INFO" (si fue cancelado),
+ * permitiendo trazar quién borró qué y cuándo (con -r, cuántos archivos y bytes).
+ */
+void ejecutar_rm(char **args) {
+    int recursivo = 0, i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        for (const char *p = args[i] + 1; *p; p++) {
+            if (*p == 'r' || *p == 'R') { recursivo = 1; continue; }
+            fprintf(stderr, "rm: opción inválida: -%c (uso: rm [-r] ruta...)\n", *p);
+            estado_builtin = 2;
+            return;
+        }
+    }
+    if (!args[i]) { fprintf(stderr, "rm: falta argumento\n"); estado_builtin = 2; return; }
+    if (!args[i + 1]) { borrar_operando(args[i], recursivo, 1); return; }
+
+    int n = 0;
+    while (args[i + n]) n++;
+    salida_printf("rm: se eliminarán %d elementos%s:\n", n, recursivo ? " (los directorios con todo su contenido)" : "");
+    for (int k = 0; k < n && k < RM_MAX_LISTADOS; k++) salida_printf("  %s\n", args[i + k]);
+    if (n > RM_MAX_LISTADOS) salida_printf("  ... y %d más\n", n - RM_MAX_LISTADOS);
+    char msg[96];
+    snprintf(msg, sizeof(msg), "ALERTA: Vas a eliminar estos %d elementos. ¿Estás seguro?", n);
+    if (!confirmar_accion(msg)) { log_shell("rm", "Cancelado por usuario", "INFO"); return; }
+    for (int k = 0; k < n; k++) borrar_operando(args[i + k], recursivo, 0);
+    snprintf(msg, sizeof(msg), "Eliminacion multiple confirmada: %d operandos", n);
+    log_shell("rm", msg, "WARNING");
+}
+ 
+// --- Comando Built-in: cp (Copy File) ---
+
+/*
+ * Copia de un archivo ya abierto ('fd_in', con su 'st_in') a 'destino': sobrescritura confirmada,
+ * transferencia por niveles y auditoría (ver 'ejecutar_cp').
+ */
+static void copiar_archivo(int fd_in, const struct stat *st_in, const char *origen, const char *destino, int preservar) {
+    // --- Bloque de Prevención de Accidentes ---
+    // Si el destino se puede abrir sin O_CREAT, ya existe
+    int fd_out = abrir_en_sandbox(destino, O_WRONLY, 0, "cp out");
+    if (fd_out == SANDBOX_DENEGADO) { close(fd_in); return; }
+    if (fd_out >= 0) {
+        struct stat st;
+        if (fstat(fd_out, &st) == 0 && st.st_dev == st_in->st_dev && st.st_ino == st_in->st_ino) {
+            // Truncar el mismo inodo destruiría el origen
+            fprintf(stderr, "cp: '%s' y '%s' son el mismo archivo\n", origen, destino);
+            close(fd_in); close(fd_out);
+            return;
+        }
+        char msg[512];
+        snprintf(msg, sizeof(msg), "ALERTA: '%s' ya existe. ¿Sobrescribir?", destino);
+        // Solicitamos confirmación interactiva antes de truncar el archivo
+        if (!confirmar_accion(msg)) {
+            close(fd_in); close(fd_out);
+            log_shell("cp", "Cancelado (sobrescritura)", "INFO");
+            return;
+        }
+        if (ftruncate(fd_out, 0) != 0) { reportar_error_sistema("cp (destino)"); close(fd_in); close(fd_out); return; }
+    } else if (errno == ENOENT) {
+        // Creamos el destino: O_EXCL garantiza que es el archivo nuevo que acabamos de validar
+        // Permisos 0644: Usuario(rw), Grupo(r), Otros(r)
+        fd_out = abrir_en_sandbox(destino, O_WRONLY | O_CREAT | O_EXCL, 0644, "cp out");
+        if (fd_out == SANDBOX_DENEGADO) { close(fd_in); return; }
+    }
+    if (fd_out < 0) { reportar_error_sistema("cp (destino)"); close(fd_in); return; }
+
+    // --- Transferencia (Core) ---
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    off_t copiados = 0;
+    metodo_copia_t metodo;
+    int resultado = copiar_contenido(fd_in, fd_out, st_in, &copiados, &metodo);
+    contar_io((uint64_t)copiados, (uint64_t)copiados);
+
+    if (resultado == 0 && preservar) {
+        // Permisos del origen y tiempos de acceso/modificación (futimens sobre el fd ya escrito)
+        struct timespec tiempos[2] = { st_in->st_atim, st_in->st_mtim };
+        if (fchmod(fd_out, st_in->st_mode & 07777) != 0 || futimens(fd_out, tiempos) != 0) resultado = -1;
+    }
+    // close puede reportar errores diferidos de escritura (ej. NFS, disco lleno)
+    if (close(fd_out) != 0 && resultado == 0) resultado = -1;
+    close(fd_in);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if (resultado != 0) { reportar_error_sistema("cp"); return; }
+
+    double ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+    double mbs = (ms > 0) ? ((double)copiados / (1024.0 * 1024.0)) / (ms / 1e3) : 0.0;
+    char msg[256];
+    snprintf(msg, sizeof(msg), "Copia exitosa: %lld bytes en %.3f ms (%.1f MB/s) via %s%s",
+             (long long)copiados, ms, mbs, nombres_metodo_copia[metodo], preservar ? " [-p]" : "");
+    log_shell("cp", msg, "INFO");
+}
+ 
+/*
+ * Realiza la copia de archivos binarios o de texto delegando la transferencia al motor por niveles.
+ * Uso: cp [-p] [-r] origen destino
+ * Funcionalidad:
+ * 1. Validación Dual: Abre TANTO el origen COMO el destino a través del Sandbox ('abrir_en_sandbox'),
+ * previniendo exfiltración de datos o escritura en zonas prohibidas sin carrera entre verificar y abrir.
+ * 2. Protección contra Sobrescritura: Si el destino ya existe (se pudo abrir sin O_CREAT), 
+ * Si es así, detiene el flujo y solicita confirmación explicita al usuario, cumpliendo con la 
+ * política de seguridad para operaciones destructivas. Copiar un archivo sobre sí mismo se rechaza.
+ * 3. Gestión de Archivos (Low-Level I/O):
+ * - Origen: Se abre en modo Solo Lectura (O_RDONLY).
+ * - Destino: Si existe se trunca tras la confirmación; si no, se crea con O_CREAT | O_EXCL y
+ * permisos 0644 (rw-r--r--), o con los permisos y mtime del origen si se indica '-p'.
+ * 4. Transferencia: 'copiar_contenido' (reflink -> copy_file_range -> sendfile -> buffer de 1MB),
+ * preservando huecos de archivos dispersos y detectando escrituras parciales o fallidas.
+ * 5. Auditoría: el log registra bytes copiados, tiempo, throughput y el nivel de copia utilizado.
+ * 6. -r: si el origen es un directorio, 'copiar_arbol' lo copia completo con el pool de hilos
+ * (una sola confirmación si el destino ya existe; el log registra archivos, directorios y bytes).
+ */
+void ejecutar_cp(char **args) {
+    int preservar = 0, recursivo = 0, i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        for (const char *p = args[i] + 1; *p; p++) {
+            switch (*p) {
+                case 'p': preservar = 1; break;
+                case 'r': case 'R': recursivo = 1; break;
+                default:
+                    fprintf(stderr, "cp: opción inválida: -%c (uso: cp [-p] [-r] origen destino)\n", *p);
+                    estado_builtin = 2;
+                    return;
+            }
+        }
+    }
+    char *origen = args[i], *destino = origen ? args[i + 1] : NULL;
+    if (!origen || !destino) { fprintf(stderr, "cp: faltan argumentos\n"); estado_builtin = 2; return; }
+    if (args[i + 2]) { fprintf(stderr, "cp: demasiados argumentos\n"); estado_builtin = 2; return; }
+    
+    // Verificamos seguridad en ambos extremos: no leer de /etc, no escribir en /bin
+    arbol_sandbox_t arbol;
+    int fd_in = abrir_arbol_en_sandbox(origen, O_RDONLY, "cp in", &arbol);
+    if (fd_in == SANDBOX_DENEGADO) return;
+    if (fd_in < 0) { reportar_error_sistema("cp (origen)"); return; }
+
+    struct stat st_in;
+    if (fstat(fd_in, &st_in) != 0) { reportar_error_sistema("cp (origen)"); close(fd_in); arbol_soltar(&arbol); return; }
+    if (S_ISDIR(st_in.st_mode)) {
+        if (recursivo) copiar_arbol(fd_in, &st_in, &arbol, origen, destino, preservar);
+        else {
+            fprintf(stderr, "cp: '%s' es un directorio (use -r)\n", origen);
+            estado_builtin = 1;
+            close(fd_in);
+        }
+    } else {
+        copiar_archivo(fd_in, &st_in, origen, destino, preservar);
+    }
+    arbol_soltar(&arbol);
+}
+
+// --- Comando Built-in: cat (Concatenate/Display) ---
+
+/*
+ * Visualiza el contenido de uno o más archivos volcándolos directamente a la salida estándar.
+ * Funcionalidad:
+ * 1. Validación de Seguridad: Abre el archivo a través del Sandbox ('abrir_en_sandbox'), garantizando que
+ * reside dentro del perímetro permitido ($HOME), impidiendo la lectura no autorizada de archivos 
+ * del sistema (como /etc/passwd).
+ * 2. Acceso de Bajo Nivel: La apertura es en modo solo lectura (O_RDONLY) y en la misma syscall que la validación.
+ * 3. Transferencia Bufferizada: Implementa un ciclo de lectura/escritura ('read' -> 'salida_escribir')
+ * en bloques de 64KB sobre la capa de salida, segura para datos binarios (sin 'printf').
+ * Si stdout es un pipe (etapa de pipeline) usa 'splice': las páginas pasan del page cache al pipe
+ * sin copiarse a espacio de usuario. Sin archivo y con stdin redirigido, copia stdin.
+ * Si no, con FLSH_IO=uring un archivo regular se lee con varias lecturas en vuelo mientras se escribe
+ * el bloque anterior ('io_leer_secuencial'); lo que falte (o todo, sin io_uring) con el ciclo clásico.
+ * 4. Gestión de Recursos: Garantiza el cierre del descriptor de archivo ('close') al finalizar, 
+ * evitando fugas de recursos en el shell.
+ */
+static int volcar_bloque_cat(void *ctx, const char *datos, size_t n) {
+    (void)ctx;
+    contar_io((uint64_t)n, 0);
+    salida_escribir(datos, n);
+    return salida.error;
+}
+
+// Vuelca 'archivo' (o stdin si es NULL) sin el salto estético final. Retorna 0, o -1 si no se abrió o no se pudo leer (ya informado).
+static int volcar_cat(char *archivo) {
+    int fd = STDIN_FILENO;
+    if (!archivo) {
+        if (isatty(STDIN_FILENO)) { fprintf(stderr, "cat: falta argumento\n"); estado_builtin = 2; return -1; }
+    } else {
+        // Verificamos permisos de lectura según políticas del Sandbox y abrimos en la misma operación
+        fd = abrir_en_sandbox(archivo, O_RDONLY, 0, "cat");
+        if (fd == SANDBOX_DENEGADO) return -1;
+        if (fd < 0) { reportar_error_sistema("cat"); return -1; }
+    }
+    
+    struct stat st_salida;
+    int salida_es_pipe = (fstat(STDOUT_FILENO, &st_salida) == 0 && S_ISFIFO(st_salida.st_mode));
+    ssize_t n = 1;
+    // Pipeline: movemos páginas al pipe con splice (EINVAL si el origen no lo soporta -> ciclo clásico)
+    if (salida_es_pipe) salida_volcar();
+    while (salida_es_pipe && (n = splice(fd, NULL, STDOUT_FILENO, NULL, 1 << 20, SPLICE_F_MOVE | SPLICE_F_MORE)) > 0) contar_io((uint64_t)n, (uint64_t)n);
+    if (n < 0 && errno == EINVAL) n = 1;
+    if (n > 0) {
+        struct stat st;
+        off_t desde = lseek(fd, 0, SEEK_CUR), leidos;
+        if (desde >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > desde) {
+            n = io_leer_secuencial(fd, desde, st.st_size, volcar_bloque_cat, NULL, &leidos);
+            if (n == 0) lseek(fd, desde + leidos, SEEK_SET); // El archivo pudo crecer: sigue el ciclo clásico
+        }
+        char buffer[SALIDA_PIPE];
+        while (n >= 0 && !salida.error && (n = read(fd, buffer, sizeof(buffer))) > 0) { contar_io((uint64_t)n, 0); salida_escribir(buffer, (size_t)n); }
+    }
+    // Un read() fallido (ej. EISDIR al pasar un directorio) no es fin de archivo
+    if (n < 0) reportar_error_sistema("cat");
+    if (fd != STDIN_FILENO) close(fd);
+    return (n < 0) ? -1 : 0;
+}
+
+void ejecutar_cat(char *archivo) {
+    if (volcar_cat(archivo) != 0) return;
+    if (isatty(STDOUT_FILENO)) salida_escribir("\n", 1); // Salto de línea estético al final (no altera datos en pipes/archivos)
+    log_shell("cat", "Lectura exitosa", "INFO");
+}
+
+// Varios archivos (ej. 'cat *.txt'): se vuelcan en orden, uno que falla no detiene a los demás
+void ejecutar_cat_archivos(char **archivos) {
+    if (!archivos[0] || !archivos[1]) { ejecutar_cat(archivos[0]); return; }
+    int leidos = 0;
+    for (int i = 0; archivos[i] && !salida.error; i++) leidos += (volcar_cat(archivos[i]) == 0);
+    if (isatty(STDOUT_FILENO)) salida_escribir("\n", 1);
+    char msg[64];
+    snprintf(msg, sizeof(msg), "Lectura exitosa: %d archivos", leidos);
+    if (leidos) log_shell("cat", msg, "INFO");
+}
+
+// --- Motor de Expresiones Regulares (NFA de Thompson + DFA perezoso) ---
+
+/*
+ * Compila expresiones regulares extendidas (subconjunto ERE) a un NFA de Thompson y las ejecuta con un
+ * DFA construido de forma perezosa: cada estado del DFA (conjunto de estados del NFA) y cada transición
+ * se calculan la primera vez que se necesitan y quedan en una cache de tamaño acotado. Si la cache se
+ * llena se vacía por completo y se sigue desde el estado actual (estrategia de RE2), por lo que el
+ * consumo de memoria está acotado incluso con expresiones que explotan exponencialmente.
+ * Sintaxis: literales, '.', [clases] (rangos y negación), '*', '+', '?', '|', '()', '^', '$',
+ * escapes '\.' y las clases '\d', '\w', '\s'.
+ */
+#define REGEX_MAX_ESTADOS_DFA 1024
+
+typedef enum { NFA_CONJUNTO, NFA_DIVISION, NFA_EPSILON, NFA_INICIO_LINEA, NFA_FIN_LINEA, NFA_ACEPTA } tipo_nfa_t;
+
+typedef struct {
+    uint8_t tipo;
+    int sig, sig2;              // Sucesores (sig2 solo en NFA_DIVISION)
+    uint64_t conjunto[4];       // Bytes aceptados (solo NFA_CONJUNTO)
+} estado_nfa_t;
+
+typedef struct {
+    estado_nfa_t *estados;
+    int n_estados, capacidad;
+    int inicio;
+    int ignorar_mayus;
+    const char *error;
+} expresion_t;
+
+typedef struct { int inicio, fin; } fragmento_nfa_t;
+
+typedef struct {
+    int *nfa;                   // Estados del NFA (ordenados) que componen este estado del DFA
+    int n_nfa;
+    uint32_t hash;
+    int siguiente[256];         // -1: transición aún no calculada
+    uint8_t acepta;             // El NFA alcanzó ACEPTA: la línea ya coincide
+    uint8_t acepta_fin;         // ACEPTA alcanzable si aquí termina la línea (anclas '$')
+} estado_dfa_t;
+
+typedef struct {
+    const expresion_t *re;
+    estado_dfa_t *estados;
+    int n_estados;
+    int *pool;                  // Almacén contiguo de los conjuntos de estados NFA
+    size_t pool_usado, pool_cap;
+    int *tabla_hash, tam_hash;  // Direccionamiento abierto: índice de estado + 1 (0 = vacío)
+    int inicio;                 // Estado al comienzo de línea (con '^' satisfecho)
+    int *pila, *marca, *tmp, generacion;
+    int *inicio_sin_bol;        // Clausura del inicio sin '^': se une en cada paso (búsqueda no anclada)
+    int n_inicio_sin_bol;
+    unsigned long vaciados;     // Veces que se vació la cache (invalida índices de estado previos)
+} dfa_perezoso_t;
+
+static int nuevo_estado_nfa(expresion_t *re, int tipo) {
+    if (re->n_estados == re->capacidad) {
+        int cap = re->capacidad ? re->capacidad * 2 : 64;
+        estado_nfa_t *nuevo = realloc(re->estados, (size_t)cap * sizeof(estado_nfa_t));
+        if (!nuevo) { re->error = "sin memoria"; return -1; }
+        re->estados = nuevo; re->capacidad = cap;
+    }
+    estado_nfa_t *e = &re->estados[re->n_estados];
+    memset(e, 0, sizeof(*e));
+    e->tipo = (uint8_t)tipo; e->sig = e->sig2 = -1;
+    return re->n_estados++;
+}
+
+static inline void conjunto_agregar(uint64_t *c, unsigned char b) { c[b >> 6] |= 1ULL << (b & 63); }
+static inline int conjunto_contiene(const uint64_t *c, unsigned char b) { return (c[b >> 6] >> (b & 63)) & 1; }
+
+static void conjunto_agregar_mayus(expresion_t *re, uint64_t *c, unsigned char b) {
+    conjunto_agregar(c, b);
+    if (!re->ignorar_mayus) return;
+    if (b >= 'a' && b <= 'z') conjunto_agregar(c, (unsigned char)(b - 32));
+    else if (b >= 'A' && b <= 'Z') conjunto_agregar(c, (unsigned char)(b + 32));
+}
+
+// Clases abreviadas \d \w \s (y sus negaciones en mayúscula). Retorna 1 si 'c' era una clase.
+static int agregar_clase_escape(uint64_t *conj, char c) {
+    uint64_t tmp[4] = {0, 0, 0, 0};
+    char base = (char)(c | 0x20);
+    if (base != 'd' && base != 'w' && base != 's') return 0;
+    for (int b = 0; b < 256; b++) {
+        int dentro = (base == 'd') ? (b >= '0' && b <= '9')
+                   : (base == 's') ? (b == ' ' || b == '\t' || b == '\r' || b == '\f' || b == '\v')
+                   : ((b >= '0' && b <= '9') || (b >= 'a' && b <= 'z') || (b >= 'A' && b <= 'Z') || b == '_');
+        if (dentro) conjunto_agregar(tmp, (unsigned char)b);
+    }
+    if (c != base) { for (int i = 0; i < 4; i++) tmp[i] = ~tmp[i]; tmp[0] &= ~(1ULL << '\n'); }
+    for (int i = 0; i < 4; i++) conj[i] |= tmp[i];
+    return 1;
+}
+
+static fragmento_nfa_t fragmento_error(void) { fragmento_nfa_t f = { -1, -1 }; return f; }
+
+// Crea un fragmento "estado -> epsilon final"; el estado final queda pendiente de enlazar.
+static fragmento_nfa_t fragmento_simple(expresion_t *re, int tipo) {
+    int s = nuevo_estado_nfa(re, tipo), e = nuevo_estado_nfa(re, NFA_EPSILON);
+    if (s < 0 || e < 0) return fragmento_error();
+    re->estados[s].sig = e;
+    fragmento_nfa_t f = { s, e };
+    return f;
+}
+
+static fragmento_nfa_t parsear_alternativa(expresion_t *re, const char **p);
+
+static fragmento_nfa_t parsear_atomo(expresion_t *re, const char **p) {
+    const char *s = *p;
+    fragmento_nfa_t f;
+    if (*s == '(') {
+        *p = s + 1;
+        f = parsear_alternativa(re, p);
+        if (f.inicio < 0) return f;
+        if (**p != ')') { re->error = "paréntesis sin cerrar"; return fragmento_error(); }
+        (*p)++;
+        return f;
+    }
+    if (*s == '^' || *s == '$') {
+        *p = s + 1;
+        return fragmento_simple(re, *s == '^' ? NFA_INICIO_LINEA : NFA_FIN_LINEA);
+    }
+
+    f = fragmento_simple(re, NFA_CONJUNTO);
+    if (f.inicio < 0) return f;
+    uint64_t *conj = re->estados[f.inicio].conjunto;
+
+    if (*s == '.') {
+        for (int i = 0; i < 4; i++) conj[i] = ~0ULL;
+        conj[0] &= ~(1ULL << '\n');
+        *p = s + 1;
+    } else if (*s == '[') {
+        s++;
+        int negar = 0;
+        if (*s == '^') { negar = 1; s++; }
+        int primero = 1;
+        while (*s && (*s != ']' || primero)) {
+            primero = 0;
+            unsigned char desde = (unsigned char)*s;
+            if (*s == '\\' && s[1]) {
+                s++;
+                if (agregar_clase_escape(conj, *s)) { s++; continue; }
+                desde = (unsigned char)*s;
+            }
+            s++;
+            if (*s == '-' && s[1] && s[1] != ']') {
+                unsigned char hasta = (unsigned char)s[1];
+                s += 2;
+                for (int b = desde; b <= hasta; b++) conjunto_agregar_mayus(re, conj, (unsigned char)b);
+            } else {
+                conjunto_agregar_mayus(re, conj, desde);
+            }
+        }
+        if (*s != ']') { re->error = "clase [ sin cerrar"; return fragmento_error(); }
+        if (negar) { for (int i = 0; i < 4; i++) conj[i] = ~conj[i]; conj[0] &= ~(1ULL << '\n'); }
+        *p = s + 1;
+    } else if (*s == '\\') {
+        if (!s[1]) { re->error = "escape incompleto"; return fragmento_error(); }
+        if (!agregar_clase_escape(conj, s[1])) {
+            char c = s[1];
+            if (c == 't') c = '\t'; else if (c == 'n') c = '\n';
+            conjunto_agregar_mayus(re, conj, (unsigned char)c);
+        }
+        *p = s + 2;
+    } else {
+        conjunto_agregar_mayus(re, conj, (unsigned char)*s);
+        *p = s + 1;
+    }
+    return f;
+}
+
+static fragmento_nfa_t parsear_repeticion(expresion_t *re, const char **p) {
+    fragmento_nfa_t f = parsear_atomo(re, p);
+    while (f.inicio >= 0 && (**p == '*' || **p == '+' || **p == '?')) {
+        char op = *(*p)++;
+        int d = nuevo_estado_nfa(re, NFA_DIVISION), e = nuevo_estado_nfa(re, NFA_EPSILON);
+        if (d < 0 || e < 0) return fragmento_error();
+        re->estados[d].sig = f.inicio;
+        re->estados[d].sig2 = e;
+        if (op == '*') { re->estados[f.fin].sig = d; f.inicio = d; }
+        else if (op == '+') { re->estados[f.fin].sig = d; }
+        else { re->estados[f.fin].sig = e; f.inicio = d; }
+        f.fin = e;
+    }
+    return f;
+}
+
+static fragmento_nfa_t parsear_concatenacion(expresion_t *re, const char **p) {
+    int e = nuevo_estado_nfa(re, NFA_EPSILON);
+    if (e < 0) return fragmento_error();
+    fragmento_nfa_t f = { e, e };
+    while (**p && **p != '|' && **p != ')') {
+        if (**p == '*' || **p == '+' || **p == '?') { re->error = "repetición sin operando"; return fragmento_error(); }
+        fragmento_nfa_t g = parsear_repeticion(re, p);
+        if (g.inicio < 0) return g;
+        re->estados[f.fin].sig = g.inicio;
+        f.fin = g.fin;
+    }
+    return f;
+}
+
+static fragmento_nfa_t parsear_alternativa(expresion_t *re, const char **p) {
+    fragmento_nfa_t f = parsear_concatenacion(re, p);
+    while (f.inicio >= 0 && **p == '|') {
+        (*p)++;
+        fragmento_nfa_t g = parsear_concatenacion(re, p);
+        if (g.inicio < 0) return g;
+        int d = nuevo_estado_nfa(re, NFA_DIVISION), e = nuevo_estado_nfa(re, NFA_EPSILON);
+        if (d < 0 || e < 0) return fragmento_error();
+        re->estados[d].sig = f.inicio; re->estados[d].sig2 = g.inicio;
+        re->estados[f.fin].sig = e; re->estados[g.fin].sig = e;
+        f.inicio = d; f.fin = e;
+    }
+    return f;
+}
+
+/*
+ * Compila 'patron' a un NFA. Retorna 0 o -1 dejando en re->error la causa (para informar al usuario).
+ */
+int compilar_expresion(expresion_t *re, const char *patron, int ignorar_mayus) {
+    memset(re, 0, sizeof(*re));
+    re->ignorar_mayus = ignorar_mayus;
+    const char *p = patron;
+    fragmento_nfa_t f = parsear_alternativa(re, &p);
+    if (f.inicio >= 0 && *p == ')') re->error = "paréntesis ')' sin abrir";
+    if (f.inicio < 0 || re->error) { if (!re->error) re->error = "expresión inválida"; return -1; }
+    int a = nuevo_estado_nfa(re, NFA_ACEPTA);
+    if (a < 0) return -1;
+    re->estados[f.fin].sig = a;
+    re->inicio = f.inicio;
+    return 0;
+}
+
+void liberar_expresion(expresion_t *re) { free(re->estados); re->estados = NULL; }
+
+/*
+ * Clausura epsilon de 'semillas' (en dfa->tmp tras la llamada, ordenada). Solo conserva los estados
+ * "importantes" (CONJUNTO, ACEPTA, FIN_LINEA): dos conjuntos con los mismos estados importantes son
+ * el mismo estado del DFA. Con 'en_bol' se atraviesan las anclas '^'.
+ */
+static int clausura(dfa_perezoso_t *d, const int *semillas, int n_semillas, int en_bol) {
+    const estado_nfa_t *nfa = d->re->estados;
+    int tope = 0, n = 0;
+    d->generacion++;
+    for (int i = 0; i < n_semillas; i++) d->pila[tope++] = semillas[i];
+    while (tope > 0) {
+        int s = d->pila[--tope];
+        if (s < 0 || d->marca[s] == d->generacion) continue;
+        d->marca[s] = d->generacion;
+        switch (nfa[s].tipo) {
+            case NFA_EPSILON: d->pila[tope++] = nfa[s].sig; break;
+            case NFA_DIVISION: d->pila[tope++] = nfa[s].sig2; d->pila[tope++] = nfa[s].sig; break;
+            case NFA_INICIO_LINEA: if (en_bol) d->pila[tope++] = nfa[s].sig; break;
+            default: d->tmp[n++] = s; break;
+        }
+    }
+    // Orden por inserción: los conjuntos son pequeños y así la clave del estado es canónica
+    for (int i = 1; i < n; i++) {
+        int v = d->tmp[i], j = i - 1;
+        while (j >= 0 && d->tmp[j] > v) { d->tmp[j + 1] = d->tmp[j]; j--; }
+        d->tmp[j + 1] = v;
+    }
+    return n;
+}
+
+// ¿Alcanza ACEPTA el conjunto si la línea termina aquí? (atraviesa anclas '$' y epsilons)
+static int acepta_al_final(dfa_perezoso_t *d, const int *conj, int n) {
+    const estado_nfa_t *nfa = d->re->estados;
+    int tope = 0;
+    d->generacion++;
+    for (int i = 0; i < n; i++) d->pila[tope++] = conj[i];
+    while (tope > 0) {
+        int s = d->pila[--tope];
+        if (s < 0 || d->marca[s] == d->generacion) continue;
+        d->marca[s] = d->generacion;
+        switch (nfa[s].tipo) {
+            case NFA_ACEPTA: return 1;
+            case NFA_EPSILON: case NFA_FIN_LINEA: d->pila[tope++] = nfa[s].sig; break;
+            case NFA_DIVISION: d->pila[tope++] = nfa[s].sig; d->pila[tope++] = nfa[s].sig2; break;
+            default: break;
+        }
+    }
+    return 0;
+}
+
+static void vaciar_cache_dfa(dfa_perezoso_t *d) {
+    d->n_estados = 0;
+    d->pool_usado = 0;
+    memset(d->tabla_hash, 0, (size_t)d->tam_hash * sizeof(int));
+}
+
+/*
+ * Busca (o crea) el estado del DFA para el conjunto 'conj'. Si la cache está llena, la vacía y
+ * vuelve a registrar el estado de inicio: todos los índices previos quedan invalidados.
+ */
+static int obtener_estado_dfa(dfa_perezoso_t *d, const int *conj, int n) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < n; i++) h = (h ^ (uint32_t)conj[i]) * 16777619u;
+    int mascara = d->tam_hash - 1;
+    for (int pos = (int)(h & (uint32_t)mascara); d->tabla_hash[pos]; pos = (pos + 1) & mascara) {
+        estado_dfa_t *e = &d->estados[d->tabla_hash[pos] - 1];
+        if (e->hash == h && e->n_nfa == n && memcmp(e->nfa, conj, (size_t)n * sizeof(int)) == 0)
+            return d->tabla_hash[pos] - 1;
+    }
+
+    if (d->n_estados == REGEX_MAX_ESTADOS_DFA || d->pool_usado + (size_t)n > d->pool_cap) {
+        // Copiamos el conjunto antes de vaciar: puede apuntar al pool que vamos a reutilizar
+        int *copia = malloc((size_t)(n ? n : 1) * sizeof(int));
+        if (!copia) return -1;
+        memcpy(copia, conj, (size_t)n * sizeof(int));
+        vaciar_cache_dfa(d);
+        int inicio_nfa = d->re->inicio;
+        int n_ini = clausura(d, &inicio_nfa, 1, 1);
+        int *ini = malloc((size_t)(n_ini ? n_ini : 1) * sizeof(int));
+        if (!ini) { free(copia); return -1; }
+        memcpy(ini, d->tmp, (size_t)n_ini * sizeof(int));
+        d->vaciados++;
+        d->inicio = obtener_estado_dfa(d, ini, n_ini);
+        free(ini);
+        int id = obtener_estado_dfa(d, copia, n);
+        free(copia);
+        return id;
+    }
+
+    int id = d->n_estados++;
+    estado_dfa_t *e = &d->estados[id];
+    e->nfa = d->pool + d->pool_usado;
+    memcpy(e->nfa, conj, (size_t)n * sizeof(int));
+    d->pool_usado += (size_t)n;
+    e->n_nfa = n;
+    e->hash = h;
+    memset(e->siguiente, -1, sizeof(e->siguiente));
+    e->acepta = 0;
+    for (int i = 0; i < n; i++) if (d->re->estados[conj[i]].tipo == NFA_ACEPTA) e->acepta = 1;
+    e->acepta_fin = e->acepta || acepta_al_final(d, conj, n);
+    int pos = (int)(h & (uint32_t)mascara);
+    while (d->tabla_hash[pos]) pos = (pos + 1) & mascara;
+    d->tabla_hash[pos] = id + 1;
+    return id;
+}
+
+// Calcula la transición (estado, byte) y la memoriza en la cache.
+static int calcular_transicion(dfa_perezoso_t *d, int estado, unsigned char c) {
+    const estado_nfa_t *nfa = d->re->estados;
+    const estado_dfa_t *e = &d->estados[estado];
+    unsigned long vaciados = d->vaciados;
+    int n_semillas = 0;
+    int *semillas = d->pila + d->re->n_estados; // Segunda mitad de la pila como buffer temporal
+    for (int i = 0; i < e->n_nfa; i++) {
+        const estado_nfa_t *s = &nfa[e->nfa[i]];
+        if (s->tipo == NFA_CONJUNTO && conjunto_contiene(s->conjunto, c)) semillas[n_semillas++] = s->sig;
+    }
+    for (int i = 0; i < d->n_inicio_sin_bol; i++) semillas[n_semillas++] = d->inicio_sin_bol[i];
+    int n = clausura(d, semillas, n_semillas, 0);
+    int destino = obtener_estado_dfa(d, d->tmp, n);
+    if (destino < 0) return -1;
+    // Si hubo vaciado de cache, 'estado' ya no es válido: no memorizamos la transición
+    if (d->vaciados == vaciados) d->estados[estado].siguiente[c] = destino;
+    return destino;
+}
+
+static inline int paso_dfa(dfa_perezoso_t *d, int estado, unsigned char c) {
+    int s = d->estados[estado].siguiente[c];
+    return (s >= 0) ? s : calcular_transicion(d, estado, c);
+}
+
+/*
+ * Crea un DFA perezoso para una expresión compilada. Cada hilo de búsqueda debe tener el suyo
+ * (la cache se modifica durante la búsqueda); el NFA se comparte en solo lectura.
+ */
+dfa_perezoso_t *crear_dfa(const expresion_t *re) {
+    dfa_perezoso_t *d = calloc(1, sizeof(*d));
+    if (!d) return NULL;
+    d->re = re;
+    d->estados = malloc(REGEX_MAX_ESTADOS_DFA * sizeof(estado_dfa_t));
+    d->pool_cap = (size_t)REGEX_MAX_ESTADOS_DFA * 8 + (size_t)re->n_estados * 2;
+    d->pool = malloc(d->pool_cap * sizeof(int));
+    d->tam_hash = REGEX_MAX_ESTADOS_DFA * 2;
+    d->tabla_hash = calloc((size_t)d->tam_hash, sizeof(int));
+    d->pila = malloc((size_t)re->n_estados * 6 * sizeof(int));
+    d->marca = calloc((size_t)re->n_estados, sizeof(int));
+    d->tmp = malloc((size_t)re->n_estados * sizeof(int));
+    d->inicio_sin_bol = malloc((size_t)re->n_estados * sizeof(int));
+    if (!d->estados || !d->pool || !d->tabla_hash || !d->pila || !d->marca || !d->tmp || !d->inicio_sin_bol) {
+        free(d->estados); free(d->pool); free(d->tabla_hash); free(d->pila); free(d->marca); free(d->tmp);
+        free(d->inicio_sin_bol); free(d);
+        return NULL;
+    }
+    int inicio_nfa = re->inicio;
+    d->n_inicio_sin_bol = clausura(d, &inicio_nfa, 1, 0);
+    memcpy(d->inicio_sin_bol, d->tmp, (size_t)d->n_inicio_sin_bol * sizeof(int));
+    int n = clausura(d, &inicio_nfa, 1, 1);
+    d->inicio = obtener_estado_dfa(d, d->tmp, n);
+    return d;
+}
+
+void liberar_dfa(dfa_perezoso_t *d) {
+    if (!d) return;
+    free(d->estados); free(d->pool); free(d->tabla_hash); free(d->pila); free(d->marca); free(d->tmp);
+    free(d->inicio_sin_bol); free(d);
+}
+
+/*
+ * Busca la primera línea coincidente en [p, fin). Retorna un puntero dentro de esa línea (o a su '\n'
+ * final / 'fin' si la coincidencia se decide al terminar la línea), o NULL si ninguna línea coincide.
+ */
+const char *buscar_dfa(dfa_perezoso_t *d, const char *p, const char *fin) {
+    while (p < fin) {
+        int s = d->inicio;
+        if (d->estados[s].acepta) return p;
+        for (; p < fin && *p != '\n'; p++) {
+            s = paso_dfa(d, s, (unsigned char)*p);
+            if (s < 0) return NULL;
+            if (d->estados[s].acepta) return p;
+        }
+        if (d->estados[s].acepta_fin) return p;
+        p++;
+    }
+    return NULL;
+}
+
+// --- Motor de Búsqueda Literal (grep) ---
+
+/*
+ * Motor de búsqueda sobre bloques de memoria completos (archivo mapeado o chunks grandes de un pipe).
+ * En lugar de partir la entrada en líneas y buscar en cada una, se buscan candidatos sobre todo el
+ * bloque y solo alrededor de cada coincidencia se calculan los límites de línea (memrchr/memchr).
+ * - Un patrón: filtro vectorizado por primer y último byte (AVX2 o SSE2 elegido en tiempo de
+ * ejecución, con fallback escalar) y verificación completa solo de los candidatos.
+ * - Varios patrones (-e): autómata Aho-Corasick con tabla de transiciones completa.
+ */
+#define GREP_MAX_PATRONES 32
+#define GREP_BLOQUE_STREAM (1 << 20)
+
+typedef struct {
+    int n_estados;
+    int32_t *transiciones;      // n_estados * 256 (DFA completo: sin seguir enlaces de fallo al buscar)
+    unsigned char *es_final;
+    unsigned char arranques[8];  // Bytes con los que puede empezar una coincidencia (prefiltro SIMD)
+    int n_arranques;             // 0: demasiados bytes de arranque distintos, sin prefiltro
+} automata_ac_t;
+
+typedef struct {
+    const char *patrones[GREP_MAX_PATRONES];
+    size_t longitudes[GREP_MAX_PATRONES];
+    int n_patrones;
+    int ignorar_mayus, invertir, contar, numerar;
+    int patron_vacio;                   // Un patrón "" coincide con todas las líneas
+    int usar_ac;                        // Búsqueda por autómata (multi-patrón) en lugar del filtro SIMD
+    int usar_regex;                     // -E: los patrones son expresiones regulares (DFA perezoso)
+    expresion_t *regex;                 // NFA compartido (solo lectura)
+    dfa_perezoso_t *dfa;                // Cache DFA propia de cada hilo de búsqueda
+    unsigned char patron_min[256];      // Patrón único normalizado a minúsculas (para -i)
+    unsigned char primero[2], ultimo[2];// Variantes (mayúscula/minúscula) del primer y último byte
+    automata_ac_t ac;
+} busqueda_t;
+
+typedef struct {
+    long long num_linea;        // Número de la línea que comienza en la posición actual
+    long long coincidencias;    // Líneas seleccionadas (coincidentes, o no coincidentes con -v)
+    FILE *salida;               // NULL: no imprimir (modo -c o benchmark); stdout: capa de salida del shell
+    const char *prefijo;        // Nombre de archivo a anteponer en cada línea (grep -r)
+} estado_grep_t;
+
+static unsigned char tabla_minusculas[256];
+
+static void iniciar_tabla_minusculas(void) {
+    for (int c = 0; c < 256; c++) tabla_minusculas[c] = (c >= 'A' && c <= 'Z') ? (unsigned char)(c + 32) : (unsigned char)c;
+}
+
+// Verifica la coincidencia completa del patrón único a partir de 'p' (ya filtrado por primer/último byte).
+static inline int verificar_patron(const busqueda_t *b, const char *p) {
+    size_t m = b->longitudes[0];
+    if (!b->ignorar_mayus) return memcmp(p, b->patrones[0], m) == 0;
+    for (size_t i = 0; i < m; i++)
+        if (tabla_minusculas[(unsigned char)p[i]] != b->patron_min[i]) return 0;
+    return 1;
+}
+
+static const char *filtro_escalar(const busqueda_t *b, const char *p, const char *fin) {
+    size_t m = b->longitudes[0];
+    for (; p + m <= fin; p++) {
+        unsigned char c0 = (unsigned char)p[0], c1 = (unsigned char)p[m - 1];
+        if ((c0 == b->primero[0] || c0 == b->primero[1]) && (c1 == b->ultimo[0] || c1 == b->ultimo[1]) && verificar_patron(b, p))
+            return p;
+    }
+    return NULL;
+}
+
+#if defined(__x86_64__)
+/*
+ * Filtro SSE2 (disponible en todo x86_64): compara 16 posiciones candidatas a la vez contra el primer
+ * byte (en p) y el último byte (en p + m - 1) del patrón; solo los bits que pasan ambos filtros se verifican.
+ */
+static const char *filtro_sse2(const busqueda_t *b, const char *p, const char *fin) {
+    size_t m = b->longitudes[0];
+    const __m128i f0 = _mm_set1_epi8((char)b->primero[0]), f1 = _mm_set1_epi8((char)b->primero[1]);
+    const __m128i l0 = _mm_set1_epi8((char)b->ultimo[0]), l1 = _mm_set1_epi8((char)b->ultimo[1]);
+    for (; p + m - 1 + 16 <= fin; p += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)p);
+        __m128i z = _mm_loadu_si128((const __m128i *)(p + m - 1));
+        __m128i ca = _mm_or_si128(_mm_cmpeq_epi8(a, f0), _mm_cmpeq_epi8(a, f1));
+        __m128i cz = _mm_or_si128(_mm_cmpeq_epi8(z, l0), _mm_cmpeq_epi8(z, l1));
+        unsigned mascara = (unsigned)_mm_movemask_epi8(_mm_and_si128(ca, cz));
+        while (mascara) {
+            int i = __builtin_ctz(mascara);
+            if (verificar_patron(b, p + i)) return p + i;
+            mascara &= mascara - 1;
+        }
+    }
+    return filtro_escalar(b, p, fin);
+}
+
+// Variante AVX2: misma lógica con 32 candidatos por iteración.
+__attribute__((target("avx2")))
+static const char *filtro_avx2(const busqueda_t *b, const char *p, const char *fin) {
+    size_t m = b->longitudes[0];
+    const __m256i f0 = _mm256_set1_epi8((char)b->primero[0]), f1 = _mm256_set1_epi8((char)b->primero[1]);
+    const __m256i l0 = _mm256_set1_epi8((char)b->ultimo[0]), l1 = _mm256_set1_epi8((char)b->ultimo[1]);
+    for (; p + m - 1 + 32 <= fin; p += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)p);
+        __m256i z = _mm256_loadu_si256((const __m256i *)(p + m - 1));
+        __m256i ca = _mm256_or_si256(_mm256_cmpeq_epi8(a, f0), _mm256_cmpeq_epi8(a, f1));
+        __m256i cz = _mm256_or_si256(_mm256_cmpeq_epi8(z, l0), _mm256_cmpeq_epi8(z, l1));
+        unsigned mascara = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(ca, cz));
+        while (mascara) {
+            int i = __builtin_ctz(mascara);
+            if (verificar_patron(b, p + i)) return p + i;
+            mascara &= mascara - 1;
+        }
+    }
+    return filtro_sse2(b, p, fin);
+}
+#endif
+
+typedef const char *(*filtro_literal_fn)(const busqueda_t *, const char *, const char *);
+
+// Selección única en tiempo de ejecución del filtro más ancho que soporta la CPU.
+static filtro_literal_fn seleccionar_filtro(void) {
+    static filtro_literal_fn elegido = NULL;
+    if (elegido) return elegido;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    elegido = __builtin_cpu_supports("avx2") ? filtro_avx2 : filtro_sse2;
+    if (getenv("FLSH_GREP_ESCALAR")) elegido = filtro_escalar;
+#else
+    elegido = filtro_escalar;
+#endif
+    return elegido;
+}
+
+/*
+ * Construye el autómata Aho-Corasick para búsqueda multi-patrón:
+ * 1. Trie de patrones (en minúsculas si -i).
+ * 2. BFS que completa las transiciones faltantes con las del estado de fallo, obteniendo un DFA
+ * que consume exactamente un byte por paso.
+ * 3. Propaga la marca de estado final a través de los enlaces de fallo.
+ */
+static int construir_aho_corasick(busqueda_t *b) {
+    size_t total = 1;
+    for (int i = 0; i < b->n_patrones; i++) total += b->longitudes[i];
+
+    automata_ac_t *ac = &b->ac;
+    ac->transiciones = malloc(total * 256 * sizeof(int32_t));
+    ac->es_final = calloc(total, 1);
+    int32_t *fallo = calloc(total, sizeof(int32_t));
+    int32_t *cola = malloc(total * sizeof(int32_t));
+    if (!ac->transiciones || !ac->es_final || !fallo || !cola) { free(fallo); free(cola); return -1; }
+    memset(ac->transiciones, -1, total * 256 * sizeof(int32_t));
+    ac->n_estados = 1;
+
+    for (int i = 0; i < b->n_patrones; i++) {
+        int32_t estado = 0;
+        for (size_t j = 0; j < b->longitudes[i]; j++) {
+            unsigned char c = (unsigned char)b->patrones[i][j];
+            if (b->ignorar_mayus) c = tabla_minusculas[c];
+            int32_t *t = &ac->transiciones[estado * 256 + c];
+            if (*t < 0) *t = ac->n_estados++;
+            estado = *t;
+        }
+        ac->es_final[estado] = 1;
+    }
+
+    // Bytes de arranque: transiciones no triviales desde la raíz (hasta 8 para el prefiltro)
+    ac->n_arranques = 0;
+    for (int c = 0; c < 256; c++) {
+        if (ac->transiciones[c] < 0) continue;
+        if (ac->n_arranques == (int)sizeof(ac->arranques)) { ac->n_arranques = 0; break; }
+        ac->arranques[ac->n_arranques++] = (unsigned char)c;
+        if (b->ignorar_mayus && c >= 'a' && c <= 'z') {
+            if (ac->n_arranques == (int)sizeof(ac->arranques)) { ac->n_arranques = 0; break; }
+            ac->arranques[ac->n_arranques++] = (unsigned char)(c - 32);
+        }
+    }
+
+    int ini = 0, fin_cola = 0;
+    for (int c = 0; c < 256; c++) {
+        int32_t *t = &ac->transiciones[c];
+        if (*t < 0) *t = 0;
+        else { fallo[*t] = 0; cola[fin_cola++] = *t; }
+    }
+    while (ini < fin_cola) {
+        int32_t e = cola[ini++];
+        ac->es_final[e] |= ac->es_final[fallo[e]];
+        for (int c = 0; c < 256; c++) {
+            int32_t *t = &ac->transiciones[e * 256 + c];
+            if (*t < 0) *t = ac->transiciones[fallo[e] * 256 + c];
+            else { fallo[*t] = ac->transiciones[fallo[e] * 256 + c]; cola[fin_cola++] = *t; }
+        }
+    }
+    free(fallo); free(cola);
+    return 0;
+}
+
+/*
+ * Avanza hasta el próximo byte que puede iniciar una coincidencia. Mientras el autómata está en la raíz
+ * no hay coincidencia parcial en curso, por lo que saltar los bytes que no son de arranque es seguro.
+ */
+static const char *saltar_a_arranque(const automata_ac_t *ac, const char *p, const char *fin) {
+#if defined(__x86_64__)
+    __m128i objetivos[8];
+    for (int i = 0; i < ac->n_arranques; i++) objetivos[i] = _mm_set1_epi8((char)ac->arranques[i]);
+    for (; p + 16 <= fin; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i acumulado = _mm_setzero_si128();
+        for (int i = 0; i < ac->n_arranques; i++) acumulado = _mm_or_si128(acumulado, _mm_cmpeq_epi8(v, objetivos[i]));
+        unsigned mascara = (unsigned)_mm_movemask_epi8(acumulado);
+        if (mascara) return p + __builtin_ctz(mascara);
+    }
+#endif
+    for (; p < fin; p++)
+        for (int i = 0; i < ac->n_arranques; i++)
+            if ((unsigned char)*p == ac->arranques[i]) return p;
+    return fin;
+}
+
+// Recorre el DFA Aho-Corasick; retorna un puntero al último byte de la primera coincidencia.
+static const char *buscar_aho_corasick(const busqueda_t *b, const char *p, const char *fin) {
+    const automata_ac_t *ac = &b->ac;
+    const int32_t *t = ac->transiciones;
+    const unsigned char *mapa = b->ignorar_mayus ? tabla_minusculas : NULL;
+    int32_t estado = 0;
+    while (p < fin) {
+        if (estado == 0 && ac->n_arranques > 0) {
+            p = saltar_a_arranque(ac, p, fin);
+            if (p == fin) break;
+        }
+        unsigned char c = (unsigned char)*p;
+        estado = t[estado * 256 + (mapa ? mapa[c] : c)];
+        if (ac->es_final[estado]) return p;
+        p++;
+    }
+    return NULL;
+}
+
+/*
+ * Retorna un puntero a algún byte de la primera coincidencia en [p, fin), o NULL.
+ * Como ningún patrón contiene '\n', la línea que contiene ese byte es la línea coincidente.
+ */
+static const char *buscar_coincidencia(const busqueda_t *b, const char *p, const char *fin) {
+    if (b->usar_regex) return buscar_dfa(b->dfa, p, fin);
+    if (b->patron_vacio) return (p < fin) ? p : NULL;
+    if (b->usar_ac) return buscar_aho_corasick(b, p, fin);
+    return seleccionar_filtro()(b, p, fin);
+}
+
+/*
+ * Compila los patrones como expresión regular: varios -e se combinan como alternativas "(p1)|(p2)".
+ * Retorna 0 o -1 informando el error de sintaxis por stderr.
+ */
+static int preparar_regex(busqueda_t *b) {
+    size_t total = 1;
+    for (int i = 0; i < b->n_patrones; i++) total += strlen(b->patrones[i]) + 3;
+    char *combinado = malloc(total);
+    b->regex = malloc(sizeof(expresion_t));
+    if (!combinado || !b->regex) { free(combinado); free(b->regex); b->regex = NULL; errno = ENOMEM; return -1; }
+    size_t usado = 0;
+    for (int i = 0; i < b->n_patrones; i++)
+        usado += (size_t)sprintf(combinado + usado, (b->n_patrones > 1) ? "%s(%s)" : "%s%s", i ? "|" : "", b->patrones[i]);
+
+    int resultado = compilar_expresion(b->regex, combinado, b->ignorar_mayus);
+    free(combinado);
+    if (resultado != 0) {
+        fprintf(stderr, "grep: expresión regular inválida: %s\n", b->regex->error);
+        liberar_expresion(b->regex); free(b->regex); b->regex = NULL;
+        errno = EINVAL;
+        return -1;
+    }
+    b->dfa = crear_dfa(b->regex);
+    if (!b->dfa) { errno = ENOMEM; return -1; }
+    return 0;
+}
+
+/*
+ * Prepara una búsqueda a partir de los patrones y opciones. Retorna 0 o -1 (sin memoria o -E inválida).
+ */
+int preparar_busqueda(busqueda_t *b) {
+    if (tabla_minusculas['A'] != 'a') iniciar_tabla_minusculas();
+    if (b->usar_regex) return preparar_regex(b);
+    b->patron_vacio = 0;
+    for (int i = 0; i < b->n_patrones; i++) {
+        b->longitudes[i] = strlen(b->patrones[i]);
+        if (b->longitudes[i] == 0) b->patron_vacio = 1;
+    }
+    if (b->patron_vacio) return 0;
+
+    // Patrones largos con -i también usan el autómata (no dependen de un buffer de tamaño fijo)
+    size_t m = b->longitudes[0];
+    b->usar_ac = b->n_patrones > 1 || (b->ignorar_mayus && m > sizeof(b->patron_min));
+    if (b->usar_ac) return construir_aho_corasick(b);
+
+    // El filtro de primer/último byte compara contra ambas variantes de mayúscula si -i
+    unsigned char c0 = (unsigned char)b->patrones[0][0], c1 = (unsigned char)b->patrones[0][m - 1];
+    if (b->ignorar_mayus) {
+        for (size_t i = 0; i < m; i++) b->patron_min[i] = tabla_minusculas[(unsigned char)b->patrones[0][i]];
+        c0 = tabla_minusculas[c0]; c1 = tabla_minusculas[c1];
+        b->primero[0] = c0; b->primero[1] = (c0 >= 'a' && c0 <= 'z') ? (unsigned char)(c0 - 32) : c0;
+        b->ultimo[0] = c1;  b->ultimo[1] = (c1 >= 'a' && c1 <= 'z') ? (unsigned char)(c1 - 32) : c1;
+    } else {
+        b->primero[0] = b->primero[1] = c0;
+        b->ultimo[0] = b->ultimo[1] = c1;
+    }
+    return 0;
+}
+
+void liberar_busqueda(busqueda_t *b) {
+    free(b->ac.transiciones); free(b->ac.es_final);
+    b->ac.transiciones = NULL; b->ac.es_final = NULL;
+    liberar_dfa(b->dfa);
+    b->dfa = NULL;
+    if (b->regex) { liberar_expresion(b->regex); free(b->regex); b->regex = NULL; }
+}
+
+/*
+ * Cuenta los '\n' en [p, fin) (grep -n, head y tail). Cada comparación resta su máscara (0xFF = -1) de
+ * contadores de 8 bits; cada 255 vueltas 'psadbw' los suma de a 8 bytes, sin un movemask + popcount
+ * por bloque.
+ */
+static long long contar_saltos_escalar(const char *p, const char *fin) {
+    long long n = 0;
+    for (; p < fin; p++) n += (*p == '\n');
+    return n;
+}
+
+#if defined(__x86_64__)
+static long long contar_saltos_sse2(const char *p, const char *fin) {
+    long long n = 0;
+    const __m128i nl = _mm_set1_epi8('\n'), cero = _mm_setzero_si128();
+    while (fin - p >= 16) {
+        size_t vueltas = (size_t)(fin - p) / 16;
+        if (vueltas > 255) vueltas = 255;
+        __m128i contadores = cero;
+        for (size_t i = 0; i < vueltas; i++, p += 16)
+            contadores = _mm_sub_epi8(contadores, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), nl));
+        __m128i suma = _mm_sad_epu8(contadores, cero);
+        n += _mm_cvtsi128_si64(suma) + _mm_extract_epi16(suma, 4);
+    }
+    return n + contar_saltos_escalar(p, fin);
+}
+
+// Variante AVX2: 32 bytes por vuelta, cuatro sumas parciales por 'vpsadbw'.
+__attribute__((target("avx2")))
+static long long contar_saltos_avx2(const char *p, const char *fin) {
+    long long n = 0;
+    const __m256i nl = _mm256_set1_epi8('\n'), cero = _mm256_setzero_si256();
+    while (fin - p >= 32) {
+        size_t vueltas = (size_t)(fin - p) / 32;
+        if (vueltas > 255) vueltas = 255;
+        __m256i contadores = cero;
+        for (size_t i = 0; i < vueltas; i++, p += 32)
+            contadores = _mm256_sub_epi8(contadores, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), nl));
+        __m256i suma = _mm256_sad_epu8(contadores, cero);
+        n += _mm256_extract_epi64(suma, 0) + _mm256_extract_epi64(suma, 1) + _mm256_extract_epi64(suma, 2) + _mm256_extract_epi64(suma, 3);
+    }
+    return n + contar_saltos_sse2(p, fin);
+}
+#endif
+
+static long long contar_saltos(const char *p, const char *fin) {
+    static long long (*elegido)(const char *, const char *) = NULL;
+    if (!elegido) {
+#if defined(__x86_64__)
+        __builtin_cpu_init();
+        elegido = __builtin_cpu_supports("avx2") ? contar_saltos_avx2 : contar_saltos_sse2;
+#else
+        elegido = contar_saltos_escalar;
+#endif
+    }
+    return elegido(p, fin);
+}
+
+static void emitir_linea(const busqueda_t *b, estado_grep_t *e, const char *ini, const char *fin) {
+    e->coincidencias++;
+    if (!e->salida || b->contar) return;
+    if (e->salida == stdout) {
+        if (e->prefijo) salida_printf("%s:", e->prefijo);
+        if (b->numerar) salida_printf("%lld:", e->num_linea);
+        salida_escribir(ini, (size_t)(fin - ini));
+        salida_escribir("\n", 1);
+        return;
+    }
+    if (e->prefijo) fprintf(e->salida, "%s:", e->prefijo);
+    if (b->numerar) fprintf(e->salida, "%lld:", e->num_linea);
+    fwrite(ini, 1, (size_t)(fin - ini), e->salida);
+    fputc('\n', e->salida);
+}
+
+/*
+ * Procesa un bloque que contiene solo líneas completas (o la última línea del archivo sin '\n').
+ * Salta directamente de coincidencia en coincidencia; con -v emite las líneas intermedias.
+ */
+void procesar_bloque_grep(const busqueda_t *b, estado_grep_t *e, const char *p, const char *fin) {
+    while (p < fin) {
+        const char *hit = buscar_coincidencia(b, p, fin);
+        const char *ini_linea = fin, *fin_linea = fin;
+        if (hit) {
+            const char *nl = memrchr(p, '\n', (size_t)(hit - p));
+            ini_linea = nl ? nl + 1 : p;
+            fin_linea = memchr(hit, '\n', (size_t)(fin - hit));
+            if (!fin_linea) fin_linea = fin;
+        }
+
+        if (b->invertir) {
+            // Todas las líneas entre p y la línea coincidente son no coincidentes
+            while (p < ini_linea) {
+                const char *nl = memchr(p, '\n', (size_t)(ini_linea - p));
+                const char *fl = nl ? nl : ini_linea;
+                emitir_linea(b, e, p, fl);
+                e->num_linea++;
+                p = fl + 1;
+            }
+        } else if (hit) {
+            if (b->numerar) e->num_linea += contar_saltos(p, ini_linea);
+            emitir_linea(b, e, ini_linea, fin_linea);
+        }
+        if (!hit) {
+            // Las líneas restantes del bloque no coinciden: solo las contamos para los siguientes bloques
+            if (!b->invertir && b->numerar) e->num_linea += contar_saltos(p, fin);
+            return;
+        }
+        e->num_linea++;
+        p = fin_linea + 1;
+    }
+}
+
+// Arrastre de líneas partidas entre bloques leídos por io_uring
+typedef struct {
+    const busqueda_t *b;
+    estado_grep_t *e;
+    char *resto;
+    size_t usado, capacidad;
+    int sin_memoria;
+} lectura_grep_t;
+
+static int agregar_resto_grep(lectura_grep_t *l, const char *datos, size_t n) {
+    if (l->usado + n > l->capacidad) {
+        size_t capacidad = l->capacidad ? l->capacidad : 4096;
+        while (capacidad < l->usado + n) capacidad *= 2;
+        char *nuevo = realloc(l->resto, capacidad);
+        if (!nuevo) { l->sin_memoria = 1; return -1; }
+        l->resto = nuevo; l->capacidad = capacidad;
+    }
+    memcpy(l->resto + l->usado, datos, n);
+    l->usado += n;
+    return 0;
+}
+
+// Procesa las líneas completas del bloque; la línea que cruza al siguiente se completa en 'resto'
+static int consumir_bloque_grep(void *ctx, const char *datos, size_t n) {
+    lectura_grep_t *l = ctx;
+    const char *fin = datos + n;
+    contar_io((uint64_t)n, 0);
+    if (l->usado > 0) {
+        const char *nl = memchr(datos, '\n', n);
+        size_t parte = nl ? (size_t)(nl + 1 - datos) : n;
+        if (agregar_resto_grep(l, datos, parte) != 0) return -1;
+        if (!nl) return 0;
+        procesar_bloque_grep(l->b, l->e, l->resto, l->resto + l->usado);
+        l->usado = 0;
+        datos = nl + 1;
+    }
+    const char *ultimo_nl = memrchr(datos, '\n', (size_t)(fin - datos));
+    if (ultimo_nl) {
+        procesar_bloque_grep(l->b, l->e, datos, ultimo_nl + 1);
+        datos = ultimo_nl + 1;
+    }
+    return agregar_resto_grep(l, datos, (size_t)(fin - datos));
+}
+
+/*
+ * Ejecuta la búsqueda sobre un descriptor:
+ * - Archivo regular con FLSH_IO=uring: bloques leídos con varias lecturas en vuelo; la búsqueda
+ * sobre un bloque se solapa con la lectura de los siguientes ('io_leer_secuencial').
+ * - Otro archivo regular no vacío: mmap completo + MADV_SEQUENTIAL (cero copias).
+ * - Pipes, terminales o archivos especiales: lectura en chunks de 1MB; solo se procesan líneas completas
+ * y el resto se arrastra al siguiente chunk (las líneas largas hacen crecer el buffer, nunca se parten).
+ * Retorna 0 o -1 con errno ante error de lectura/memoria.
+ */
+int buscar_en_fd(const busqueda_t *b, estado_grep_t *e, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        lectura_grep_t l = { .b = b, .e = e };
+        off_t leidos;
+        int r = io_leer_secuencial(fd, 0, st.st_size, consumir_bloque_grep, &l, &leidos);
+        if (r == 0 && l.sin_memoria) { r = -1; errno = ENOMEM; }
+        if (r <= 0) {
+            if (r == 0 && l.usado > 0) procesar_bloque_grep(b, e, l.resto, l.resto + l.usado);
+            free(l.resto);
+            return r;
+        }
+        char *mapa = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapa != MAP_FAILED) {
+            madvise(mapa, (size_t)st.st_size, MADV_SEQUENTIAL);
+            contar_io((uint64_t)st.st_size, 0);
+            procesar_bloque_grep(b, e, mapa, mapa + st.st_size);
+            munmap(mapa, (size_t)st.st_size);
+            return 0;
+        }
+    }
+
+    size_t capacidad = GREP_BLOQUE_STREAM, usado = 0;
+    char *buf = malloc(capacidad);
+    if (!buf) return -1;
+    while (1) {
+        if (usado == capacidad) {
+            char *nuevo = realloc(buf, capacidad * 2);
+            if (!nuevo) { free(buf); errno = ENOMEM; return -1; }
+            buf = nuevo; capacidad *= 2;
+        }
+        ssize_t n = read(fd, buf + usado, capacidad - usado);
+        if (n < 0) { if (errno == EINTR) continue; free(buf); return -1; }
+        if (n == 0) break;
+        contar_io((uint64_t)n, 0);
+        char *ultimo_nl = memrchr(buf + usado, '\n', (size_t)n);
+        usado += (size_t)n;
+        if (!ultimo_nl) continue;
+        procesar_bloque_grep(b, e, buf, ultimo_nl + 1);
+        size_t resto = (size_t)(buf + usado - (ultimo_nl + 1));
+        memmove(buf, ultimo_nl + 1, resto);
+        usado = resto;
+    }
+    if (usado > 0) procesar_bloque_grep(b, e, buf, buf + usado);
+    free(buf);
+    return 0;
+}
+
+// --- Búsqueda Recursiva Paralela (grep -r) ---
+
+/*
+ * grep -r reparte los archivos de un árbol entre un pool de hilos con robo de trabajo (work stealing):
+ * - El hilo que invoca recorre los directorios con getdents64 (lotes grandes, sin readdir por entrada)
+ * y reparte rutas relativas en las colas de los trabajadores por turnos.
+ * - Cada trabajador toma tareas del final de su propia cola y, si está vacía, roba del comienzo de
+ * las colas ajenas, manteniendo a todos los núcleos ocupados aunque el reparto inicial sea desigual.
+ * - La salida de cada archivo se acumula en memoria y se vuelca completa bajo un mutex: las líneas de
+ * archivos distintos nunca se intercalan.
+ * Contención (misma política que 'abrir_en_sandbox' sin un realpath por archivo): la raíz se abre
+ * una vez a través del Sandbox; los directorios se abren con O_NOFOLLOW y los archivos con openat2(RESOLVE_BENEATH |
+ * RESOLVE_NO_SYMLINKS) relativo a la raíz, por lo que ningún enlace simbólico puede sacar la búsqueda del árbol.
+ * Las entradas con regla propia en la política (ej. 'denegar ~/.ssh') se consultan con el cursor del
+ * recorrido antes de entrar o encolar.
+ */
+#define GREP_MAX_HILOS 64
+
+typedef struct {
+    pthread_mutex_t mutex;
+    char **tareas;              // Rutas relativas a la raíz
+    size_t ini, fin, capacidad; // Deque: el dueño extrae de 'fin', los ladrones de 'ini'
+} cola_trabajo_t;
+
+typedef struct {
+    const busqueda_t *plantilla;
+    int raiz_fd;
+    const char *raiz_nombre;
+    int n_hilos;
+    cola_trabajo_t colas[GREP_MAX_HILOS];
+    pthread_mutex_t mutex_espera;
+    pthread_cond_t hay_trabajo;
+    long encoladas;             // Tareas en colas (protegido por mutex_espera)
+    int recorrido_terminado;
+    pthread_mutex_t mutex_salida;
+    long long coincidencias, archivos;
+} grep_recursivo_t;
+
+typedef struct {
+    grep_recursivo_t *g;
+    int id;
+} trabajador_grep_t;
+
+static void encolar_tarea(grep_recursivo_t *g, char *ruta, int destino) {
+    cola_trabajo_t *c = &g->colas[destino];
+    pthread_mutex_lock(&c->mutex);
+    if (c->fin == c->capacidad) {
+        // Compactamos o crecemos el arreglo de la deque
+        size_t vivos = c->fin - c->ini;
+        if (c->ini > 0 && vivos < c->capacidad / 2) {
+            memmove(c->tareas, c->tareas + c->ini, vivos * sizeof(char *));
+        } else {
+            size_t cap = c->capacidad ? c->capacidad * 2 : 256;
+            char **nuevo = realloc(c->tareas, cap * sizeof(char *));
+            if (!nuevo) { pthread_mutex_unlock(&c->mutex); free(ruta); return; }
+            c->tareas = nuevo; c->capacidad = cap;
+            if (c->ini > 0) memmove(c->tareas, c->tareas + c->ini, vivos * sizeof(char *));
+        }
+        c->ini = 0; c->fin = vivos;
+    }
+    c->tareas[c->fin++] = ruta;
+    pthread_mutex_unlock(&c->mutex);
+
+    pthread_mutex_lock(&g->mutex_espera);
+    g->encoladas++;
+    pthread_cond_signal(&g->hay_trabajo);
+    pthread_mutex_unlock(&g->mutex_espera);
+}
+
+// Extrae una tarea: primero de la propia cola (LIFO), luego robando de las demás (FIFO).
+static char *obtener_tarea(grep_recursivo_t *g, int id) {
+    for (int k = 0; k < g->n_hilos; k++) {
+        cola_trabajo_t *c = &g->colas[(id + k) % g->n_hilos];
+        char *ruta = NULL;
+        pthread_mutex_lock(&c->mutex);
+        if (c->fin > c->ini) ruta = (k == 0) ? c->tareas[--c->fin] : c->tareas[c->ini++];
+        pthread_mutex_unlock(&c->mutex);
+        if (ruta) {
+            pthread_mutex_lock(&g->mutex_espera);
+            g->encoladas--;
+            pthread_mutex_unlock(&g->mutex_espera);
+            return ruta;
+        }
+    }
+    return NULL;
+}
+
+// Busca en un archivo y vuelca su salida completa de una sola vez.
+static void buscar_archivo_recursivo(grep_recursivo_t *g, busqueda_t *b, const char *ruta) {
+    int fd = abrir_debajo_sin_enlaces(g->raiz_fd, ruta, O_RDONLY);
+    if (fd < 0) return;
+
+    // El operando tal como se escribió ('.' -> './a.txt', 'dir/' -> 'dir/a.txt'); sin operando, la ruta relativa
+    char nombre[PATH_MAX];
+    size_t largo_raiz = g->raiz_nombre ? strlen(g->raiz_nombre) : 0;
+    if (largo_raiz == 0) snprintf(nombre, sizeof(nombre), "%s", ruta);
+    else snprintf(nombre, sizeof(nombre), "%s%s%s", g->raiz_nombre, g->raiz_nombre[largo_raiz - 1] == '/' ? "" : "/", ruta);
+
+    // Archivos binarios (NUL en el primer bloque) se omiten para no volcar basura en la terminal
+    char muestra[4096];
+    ssize_t n = pread(fd, muestra, sizeof(muestra), 0);
+    if (n < 0 || memchr(muestra, '\0', (size_t)n)) { close(fd); return; }
+
+    char *texto = NULL;
+    size_t largo = 0;
+    FILE *salida = open_memstream(&texto, &largo);
+    if (!salida) { close(fd); return; }
+    estado_grep_t e = { .num_linea = 1, .coincidencias = 0, .salida = salida, .prefijo = nombre };
+    buscar_en_fd(b, &e, fd);
+    close(fd);
+    if (b->contar) fprintf(salida, "%s:%lld\n", nombre, e.coincidencias);
+    fclose(salida);
+
+    pthread_mutex_lock(&g->mutex_salida);
+    if (largo > 0) salida_escribir(texto, largo);
+    g->coincidencias += e.coincidencias;
+    g->archivos++;
+    pthread_mutex_unlock(&g->mutex_salida);
+    free(texto);
+}
+
+static void *hilo_trabajador_grep(void *arg) {
+    trabajador_grep_t *t = arg;
+    grep_recursivo_t *g = t->g;
+    // Copia propia de la búsqueda con su cache DFA: el NFA y las tablas se comparten en solo lectura
+    busqueda_t b = *g->plantilla;
+    if (b.usar_regex) b.dfa = crear_dfa(b.regex);
+
+    while (1) {
+        char *ruta = obtener_tarea(g, t->id);
+        if (ruta) {
+            if (!b.usar_regex || b.dfa) buscar_archivo_recursivo(g, &b, ruta);
+            free(ruta);
+            continue;
+        }
+        pthread_mutex_lock(&g->mutex_espera);
+        while (g->encoladas == 0 && !g->recorrido_terminado) pthread_cond_wait(&g->hay_trabajo, &g->mutex_espera);
+        int salir = g->encoladas == 0 && g->recorrido_terminado;
+        pthread_mutex_unlock(&g->mutex_espera);
+        if (salir) break;
+    }
+    if (b.usar_regex) liberar_dfa(b.dfa);
+    return NULL;
+}
+
+/*
+ * Recorre el directorio 'dirfd' (ruta relativa 'prefijo') con getdents64 y encola los archivos regulares.
+ * Los enlaces simbólicos se ignoran (nunca se siguen), los subdirectorios se abren con O_NOFOLLOW y lo
+ * que la política deniega ('arbol' es el cursor de este directorio) se saltea.
+ */
+static void recorrer_directorio(grep_recursivo_t *g, int dirfd, const char *prefijo, const arbol_sandbox_t *arbol, int *turno) {
+    char buf[65536] __attribute__((aligned(8)));
+    long leidos;
+    while ((leidos = syscall(SYS_getdents64, dirfd, buf, sizeof(buf))) > 0) {
+        for (long pos = 0; pos < leidos;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + pos);
+            pos += d->d_reclen;
+            const char *nombre = d->d_name;
+            if (nombre[0] == '.' && (nombre[1] == '\0' || (nombre[1] == '.' && nombre[2] == '\0'))) continue;
+
+            unsigned char tipo = d->d_type;
+            if (tipo == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(dirfd, nombre, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+                tipo = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+            }
+            if (tipo != DT_DIR && tipo != DT_REG) continue;
+            arbol_sandbox_t sub;
+            if (!arbol_descender(arbol, nombre, &sub)) continue;
+
+            size_t largo = strlen(prefijo) + strlen(nombre) + 2;
+            char *ruta = malloc(largo);
+            if (!ruta) continue;
+            if (prefijo[0]) snprintf(ruta, largo, "%s/%s", prefijo, nombre);
+            else snprintf(ruta, largo, "%s", nombre);
+
+            if (tipo == DT_REG) {
+                encolar_tarea(g, ruta, (*turno)++ % g->n_hilos);
+                continue;
+            }
+            int subfd = openat(dirfd, nombre, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (subfd >= 0) {
+                recorrer_directorio(g, subfd, ruta, &sub, turno);
+                close(subfd);
+            }
+            free(ruta);
+        }
+    }
+}
+
+// Cantidad de hilos: núcleos en línea (o FLSH_GREP_HILOS), acotado a [1, GREP_MAX_HILOS].
+static int hilos_busqueda(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    char *env = getenv("FLSH_GREP_HILOS");
+    if (env && atoi(env) > 0) n = atoi(env);
+    if (n < 1) n = 1;
+    if (n > GREP_MAX_HILOS) n = GREP_MAX_HILOS;
+    return (int)n;
+}
+
+/*
+ * Ejecuta grep -r sobre el directorio 'raiz_fd' (abierto por el Sandbox con el cursor 'arbol'; 'nombre'
+ * es el prefijo de salida, NULL = ninguno). El descriptor sigue siendo del llamador. Retorna 0 o -1 con errno.
+ */
+int grep_recursivo(const busqueda_t *b, int raiz_fd, const arbol_sandbox_t *arbol, const char *nombre,
+                   long long *coincidencias, long long *archivos) {
+    grep_recursivo_t g;
+    memset(&g, 0, sizeof(g));
+    g.plantilla = b;
+    g.raiz_nombre = nombre;
+    g.raiz_fd = raiz_fd;
+    g.n_hilos = hilos_busqueda();
+    pthread_mutex_init(&g.mutex_espera, NULL);
+    pthread_cond_init(&g.hay_trabajo, NULL);
+    pthread_mutex_init(&g.mutex_salida, NULL);
+    for (int i = 0; i < g.n_hilos; i++) pthread_mutex_init(&g.colas[i].mutex, NULL);
+
+    pthread_t hilos[GREP_MAX_HILOS];
+    trabajador_grep_t datos[GREP_MAX_HILOS];
+    int lanzados = 0;
+    for (; lanzados < g.n_hilos; lanzados++) {
+        datos[lanzados].g = &g; datos[lanzados].id = lanzados;
+        if (pthread_create(&hilos[lanzados], NULL, hilo_trabajador_grep, &datos[lanzados]) != 0) break;
+    }
+    if (lanzados == 0) { errno = EAGAIN; return -1; }
+    g.n_hilos = lanzados; // Si no se pudieron crear todos, repartimos solo entre los existentes
+
+    int turno = 0;
+    int dirfd = dup(g.raiz_fd);
+    if (dirfd >= 0) { recorrer_directorio(&g, dirfd, "", arbol, &turno); close(dirfd); }
+
+    pthread_mutex_lock(&g.mutex_espera);
+    g.recorrido_terminado = 1;
+    pthread_cond_broadcast(&g.hay_trabajo);
+    pthread_mutex_unlock(&g.mutex_espera);
+    for (int i = 0; i < lanzados; i++) pthread_join(hilos[i], NULL);
+
+    for (int i = 0; i < GREP_MAX_HILOS; i++) { free(g.colas[i].tareas); pthread_mutex_destroy(&g.colas[i].mutex); }
+    pthread_mutex_destroy(&g.mutex_espera);
+    pthread_cond_destroy(&g.hay_trabajo);
+    pthread_mutex_destroy(&g.mutex_salida);
+    *coincidencias = g.coincidencias;
+    *archivos = g.archivos;
+    return 0;
+}
+
+// --- Comando Built-in Opcional: grep (Global Regular Expression Print) ---
+
+// Operando de 'grep -r' sin directorio: se busca en '.' pero los nombres se muestran sin './' (como grep(1))
+static char operando_actual[] = ".";
+
+// Busca en un operando de grep ('archivo' NULL = stdin); con 'varios' cada línea lleva el nombre. Retorna 0 o -1 (ya informado).
+static int grep_operando(busqueda_t *b, const char *archivo, int recursivo, int varios, long long *coincidencias, long long *archivos) {
+    // Verificamos permisos de lectura (Sandbox) abriendo el objetivo en la misma operación
+    int fd = STDIN_FILENO;
+    arbol_sandbox_t arbol = { .politica = NULL, .nodo = -1 };
+    if (archivo) {
+        fd = abrir_arbol_en_sandbox(archivo, recursivo ? (O_RDONLY | O_DIRECTORY) : O_RDONLY, "grep", &arbol);
+        if (fd == SANDBOX_DENEGADO) return -1;
+        if (fd < 0) { reportar_error_sistema("grep"); return -1; }
+    }
+    if (recursivo) {
+        long long c = 0, a = 0;
+        int resultado = grep_recursivo(b, fd, &arbol, archivo == operando_actual ? NULL : archivo, &c, &a);
+        arbol_soltar(&arbol);
+        close(fd);
+        if (resultado != 0) { reportar_error_sistema("grep"); return -1; }
+        *coincidencias += c;
+        *archivos += a;
+        return 0;
+    }
+
+    estado_grep_t e = { .num_linea = 1, .coincidencias = 0, .salida = stdout, .prefijo = varios ? archivo : NULL };
+    arbol_soltar(&arbol);
+    int resultado = buscar_en_fd(b, &e, fd);
+    if (archivo) close(fd);
+    if (resultado != 0) { reportar_error_sistema("grep"); return -1; }
+    if (b->contar && varios) salida_printf("%s:%lld\n", archivo, e.coincidencias);
+    else if (b->contar) salida_printf("%lld\n", e.coincidencias);
+    *coincidencias += e.coincidencias;
+    (*archivos)++;
+    return 0;
+}
+
+/*
+ * Implementa una utilidad de búsqueda de patrones de texto dentro de archivos, árboles o stdin.
+ * Uso: grep [-c] [-n] [-i] [-v] [-E] [-r] [-e PATRON]... [PATRON] [ARCHIVO | DIRECTORIO]...
+ * Funcionalidad:
+ * 1. Objetivo (Valor Agregado): Cumple con el requerimiento opcional del TP de procesar texto 
+ * y buscar cadenas específicas sin invocar utilitarios externos.
+ * 2. Seguridad (Sandbox): Al igual que los comandos críticos, abre el archivo o directorio a través de
+ * 'abrir_arbol_en_sandbox', asegurando que la política le dé lectura a 'grep' (y, con -r, salteando los
+ * subárboles que le deniega).
+ * 3. Procesamiento de Texto: Delegado al motor de búsqueda por bloques ('buscar_en_fd'), sin límite
+ * de longitud de línea: una línea nunca se parte ni se imprime dos veces.
+ * 4. Opciones: -c (solo contar), -n (numerar líneas), -i (ignorar mayúsculas ASCII),
+ * -v (invertir selección), -e (varios patrones, búsqueda Aho-Corasick),
+ * -E (expresiones regulares con DFA perezoso), -r (árbol completo con el pool de hilos; por defecto '.').
+ * Con varios operandos (ej. 'grep x *.c') cada línea lleva el nombre del archivo, como en grep(1).
+ * 5. Auditoría Estadística: No solo registra el éxito de la operación, sino que contabiliza y loguea 
+ * el número exacto de coincidencias encontradas, enriqueciendo la información de auditoría.
+ */
+void ejecutar_grep(char **args) {
+    busqueda_t b;
+    memset(&b, 0, sizeof(b));
+    int recursivo = 0, i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+        if (strcmp(args[i], "-e") == 0) {
+            if (!args[i + 1]) { fprintf(stderr, "grep: -e requiere un patrón\n"); estado_builtin = 2; return; }
+            if (b.n_patrones == GREP_MAX_PATRONES) { fprintf(stderr, "grep: demasiados patrones\n"); estado_builtin = 2; return; }
+            b.patrones[b.n_patrones++] = args[++i];
+            continue;
+        }
+        for (char *f = args[i] + 1; *f; f++) {
+            if (*f == 'c') b.contar = 1;
+            else if (*f == 'n') b.numerar = 1;
+            else if (*f == 'i') b.ignorar_mayus = 1;
+            else if (*f == 'v') b.invertir = 1;
+            else if (*f == 'E') b.usar_regex = 1;
+            else if (*f == 'r') recursivo = 1;
+            else { fprintf(stderr, "grep: opción inválida -%c\n", *f); estado_builtin = 2; return; }
+        }
+    }
+    if (b.n_patrones == 0) {
+        if (!args[i]) { fprintf(stderr, "grep: faltan argumentos\n"); estado_builtin = 2; return; }
+        b.patrones[b.n_patrones++] = args[i++];
+    }
+    char **operandos = args + i;
+    int n = 0;
+    while (operandos[n]) n++;
+    char *actual[] = { operando_actual, NULL };
+    if (recursivo && n == 0) { operandos = actual; n = 1; }
+
+    if (preparar_busqueda(&b) != 0) {
+        // EINVAL: expresión inválida (ya informada), error de sintaxis como en grep(1)
+        if (errno != EINVAL) reportar_error_sistema("grep");
+        else estado_builtin = 2;
+        liberar_busqueda(&b);
+        return;
+    }
+    // Un operando que no se puede abrir se informa y no detiene a los demás (ej. 'grep x *.c')
+    long long coincidencias = 0, archivos = 0;
+    int errores = 0;
+    for (int k = 0; k < (n ? n : 1); k++) {
+        errores += grep_operando(&b, n ? operandos[k] : NULL, recursivo, n > 1, &coincidencias, &archivos) != 0;
+    }
+    liberar_busqueda(&b);
+    if (!errores) estado_builtin = (coincidencias == 0); // Como grep(1): 1 si no hubo coincidencias
+
+    // Registro detallado con métricas
+    char msg[128];
+    if (recursivo || n > 1) snprintf(msg, sizeof(msg), "%s%lld archivos, Coincidencias: %lld", recursivo ? "Recursivo: " : "", archivos, coincidencias);
+    else snprintf(msg, sizeof(msg), "Coincidencias: %lld", coincidencias);
+    log_shell("grep", msg, "INFO");
+}
+// --- Comandos Built-in: head y tail ---
+
+/*
+ * head [-n N | -c N] [ARCHIVO] y tail [-f] [-n [+]N | -c [+]N] [ARCHIVO] (por defecto 10 líneas).
+ * Funcionalidad:
+ * 1. Seguridad y Auditoría: Igual que cat, abren a través de 'abrir_en_sandbox' (lectura para 'head' o
+ * 'tail' en la política), escriben por la capa de salida y registran un evento por ejecución.
+ * Sin archivo y con stdin redirigido, leen stdin.
+ * 2. head: Lee hacia adelante y se detiene apenas completó las N líneas (o N bytes).
+ * 3. tail sobre un archivo regular: Lee hacia atrás desde el final en bloques de 256 KB ('pread') y cuenta
+ * los saltos de cada bloque con 'contar_saltos' (SIMD) hasta reunir N líneas. El costo depende de lo
+ * que se imprime, no del tamaño del archivo. Los últimos bloques leídos quedan en memoria y se imprimen
+ * desde ahí, sin volver a leerlos. Sobre un pipe conserva solo la ventana de las últimas N
+ * líneas. Con '+N' empieza en la línea (o byte) N contando desde el principio.
+ * 4. tail -f: Sigue el archivo con inotify, sin sondeo. Imprime lo que se agrega y, si el archivo se
+ * trunca, vuelve al principio. Si el nombre pasa a otro archivo (rotación), lo reabre por el Sandbox y
+ * sigue el nuevo; para eso vigila también el directorio, si la política le da lectura. Termina con
+ * Ctrl-C (estado 130) o cuando la salida deja de aceptar datos.
+ */
+#define TAIL_BLOQUE (256 * 1024)
+#define TAIL_RETENIDOS 16      // Bloques de la cola en memoria (4 MB); más atrás, lo cercano al final se relee
+
+typedef struct {
+    long long cantidad;        // Líneas, o bytes con -c
+    int bytes;
+    int desde_inicio;          // '+N' (solo tail)
+    int seguir;                // -f (solo tail)
+    const char *archivo;       // NULL = stdin
+} opciones_recorte_t;
+
+// Retorna 0, o -1 ante un error de uso (ya informado, estado 2)
+static int parsear_opciones_recorte(char **args, const char *comando, int es_tail, opciones_recorte_t *o) {
+    *o = (opciones_recorte_t){ .cantidad = 10 };
+    int i = 1;
+    for (; args[i] && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+        if (es_tail && strcmp(args[i], "-f") == 0) { o->seguir = 1; continue; }
+        if (args[i][1] != 'n' && args[i][1] != 'c') {
+            fprintf(stderr, "%s: opción inválida %s\n", comando, args[i]);
+            estado_builtin = 2;
+            return -1;
+        }
+        o->bytes = args[i][1] == 'c';
+        const char *valor = args[i][2] ? args[i] + 2 : args[++i];
+        if (!valor) { fprintf(stderr, "%s: -%c requiere un número\n", comando, o->bytes ? 'c' : 'n'); estado_builtin = 2; return -1; }
+        o->desde_inicio = es_tail && valor[0] == '+';
+        char *fin;
+        errno = 0;
+        o->cantidad = strtoll(valor + (valor[0] == '+'), &fin, 10);
+        if (errno || fin == valor + (valor[0] == '+') || *fin || o->cantidad < 0) {
+            fprintf(stderr, "%s: número inválido '%s'\n", comando, valor);
+            estado_builtin = 2;
+            return -1;
+        }
+    }
+    o->archivo = args[i];
+    if (o->archivo && args[i + 1]) { fprintf(stderr, "%s: demasiados argumentos\n", comando); estado_builtin = 2; return -1; }
+    return 0;
+}
+
+// Abre el archivo por el Sandbox, o stdin si no hay archivo. Retorna el fd o -1 (ya informado)
+static int abrir_recorte(const opciones_recorte_t *o, const char *comando) {
+    if (!o->archivo) {
+        if (isatty(STDIN_FILENO)) { fprintf(stderr, "%s: falta argumento\n", comando); estado_builtin = 2; return -1; }
+        return STDIN_FILENO;
+    }
+    int fd = abrir_en_sandbox(o->archivo, O_RDONLY, 0, comando);
+    if (fd == SANDBOX_DENEGADO) return -1;
+    if (fd < 0) { reportar_error_sistema((char *)comando); return -1; }
+    return fd;
+}
+
+// Posición del 'n'-ésimo '\n' de [p, fin) (n >= 1, el bloque tiene al menos n)
+static const char *enesimo_salto(const char *p, const char *fin, long long n) {
+    for (;; p++) {
+        p = memchr(p, '\n', (size_t)(fin - p));
+        if (--n == 0) return p;
+    }
+}
+
+// Desplazamiento en [p, p + largo) donde empiezan sus últimas 'n' líneas (el '\n' final cierra la última)
+static size_t inicio_ultimas_lineas_mem(const char *p, size_t largo, long long n) {
+    const char *q = p + largo;
+    if (n == 0) return largo;
+    if (q > p && q[-1] == '\n') q--;
+    while (n-- > 0) {
+        const char *s = memrchr(p, '\n', (size_t)(q - p));
+        if (!s) return 0;
+        q = s;
+    }
+    return (size_t)(q - p) + 1;
+}
+
+void ejecutar_head(char **args) {
+    opciones_recorte_t o;
+    if (parsear_opciones_recorte(args, "head", 0, &o) != 0) return;
+    int fd = abrir_recorte(&o, "head");
+    if (fd < 0) return;
+
+    char buffer[SALIDA_PIPE];
+    long long restante = o.cantidad, emitidos = 0;
+    ssize_t n = 0;
+    while (restante > 0 && !salida.error) {
+        size_t pedido = (o.bytes && restante < (long long)sizeof(buffer)) ? (size_t)restante : sizeof(buffer);
+        if ((n = read(fd, buffer, pedido)) <= 0) break;
+        contar_io((uint64_t)n, 0);
+        size_t usar = (size_t)n;
+        if (o.bytes) restante -= n;
+        else {
+            long long saltos = contar_saltos(buffer, buffer + n);
+            if (saltos >= restante) { usar = (size_t)(enesimo_salto(buffer, buffer + n, restante) - buffer) + 1; restante = 0; }
+            else restante -= saltos;
+        }
+        salida_escribir(buffer, usar);
+        emitidos += (long long)usar;
+    }
+    if (fd != STDIN_FILENO) close(fd);
+    if (n < 0) { reportar_error_sistema("head"); return; }
+
+    char msg[96];
+    snprintf(msg, sizeof(msg), "Lectura exitosa: %lld bytes", emitidos);
+    log_shell("head", msg, "INFO");
+}
+
+/*
+ * Bloques leídos hacia atrás desde 'fin': el k-ésimo cubre [fin - (k+1) * TAIL_BLOQUE, fin - k * TAIL_BLOQUE)
+ * recortado a 'base' y vive en buffers[k % TAIL_RETENIDOS]. Quedan en memoria los últimos TAIL_RETENIDOS
+ * leídos (los más cercanos al inicio de la salida). buffers[0] es el bloque del llamador; el resto se
+ * reserva solo si hace falta.
+ */
+typedef struct {
+    char *buffers[TAIL_RETENIDOS];
+    long n;                    // Bloques leídos (0 = nada en memoria)
+    off_t base, fin;
+} cola_tail_t;
+
+static void liberar_cola_tail(cola_tail_t *c) {
+    for (int i = 1; i < TAIL_RETENIDOS; i++) free(c->buffers[i]);
+}
+
+/*
+ * Inicio de las últimas 'n' líneas de [base, fin) en un archivo regular: bloques hacia atrás desde 'fin'.
+ * Los bloques con menos saltos de los que faltan solo se cuentan; en el último se ubica el salto exacto.
+ */
+static off_t inicio_ultimas_lineas(int fd, long long n, cola_tail_t *c, uint64_t *leidos) {
+    if (n == 0) return c->fin;
+    long long hallados = 0;
+    for (off_t limite = c->fin; limite > c->base;) {
+        off_t ini = (limite - c->base > TAIL_BLOQUE) ? limite - TAIL_BLOQUE : c->base;
+        char **bloque = &c->buffers[c->n % TAIL_RETENIDOS];
+        if (!*bloque && !(*bloque = malloc(TAIL_BLOQUE))) return -1;
+        ssize_t r = pread(fd, *bloque, (size_t)(limite - ini), ini);
+        if (r < 0) return -1;
+        if (r != limite - ini) { c->n = 0; return ini; } // El archivo se achicó mientras se leía: se relee
+        contar_io((uint64_t)r, 0);
+        *leidos += (uint64_t)r;
+        c->n++;
+        const char *p = *bloque, *q = p + r;
+        if (limite == c->fin && p[r - 1] == '\n') q--;
+        long long saltos = contar_saltos(p, q);
+        if (hallados + saltos >= n) {
+            for (long long k = n - hallados; k > 0; k--) q = memrchr(p, '\n', (size_t)(q - p));
+            return ini + (q - p) + 1;
+        }
+        hallados += saltos;
+        limite = ini;
+    }
+    return c->base;
+}
+
+// Copia [desde, hasta) del archivo a la salida
+static int volcar_rango(int fd, off_t desde, off_t hasta, char *bloque, uint64_t *leidos) {
+    while (desde < hasta && !salida.error) {
+        size_t pedido = (hasta - desde > TAIL_BLOQUE) ? TAIL_BLOQUE : (size_t)(hasta - desde);
+        ssize_t r = pread(fd, bloque, pedido, desde);
+        if (r < 0) return -1;
+        if (r == 0) break;
+        contar_io((uint64_t)r, 0);
+        *leidos += (uint64_t)r;
+        salida_escribir(bloque, (size_t)r);
+        desde += r;
+    }
+    return 0;
+}
+
+// Copia [desde, fin) a la salida: lo que sigue en la cola desde memoria y solo el resto con pread
+static int volcar_cola_tail(int fd, const cola_tail_t *c, off_t desde, uint64_t *leidos) {
+    long primero = c->n > TAIL_RETENIDOS ? c->n - TAIL_RETENIDOS : 0;
+    for (long k = c->n - 1; k >= primero && !salida.error; k--) {
+        off_t limite = c->fin - (off_t)k * TAIL_BLOQUE;
+        off_t ini = (limite - c->base > TAIL_BLOQUE) ? limite - TAIL_BLOQUE : c->base;
+        off_t d = desde > ini ? desde : ini;
+        if (d < limite) salida_escribir(c->buffers[k % TAIL_RETENIDOS] + (d - ini), (size_t)(limite - d));
+    }
+    // Sin bloques en memoria (tail -c, o el archivo se achicó) se lee todo el rango
+    off_t en_memoria = c->n ? c->fin - (off_t)primero * TAIL_BLOQUE : desde;
+    return volcar_rango(fd, desde > en_memoria ? desde : en_memoria, c->fin, c->buffers[0], leidos);
+}
+
+// tail +N: saltea las primeras N-1 líneas (o bytes) del flujo y copia el resto
+static int volcar_desde_inicio(int fd, const opciones_recorte_t *o, char *bloque, uint64_t *leidos) {
+    long long saltar = o->cantidad > 0 ? o->cantidad - 1 : 0;
+    ssize_t n = 0;
+    while (!salida.error && (n = read(fd, bloque, TAIL_BLOQUE)) > 0) {
+        contar_io((uint64_t)n, 0);
+        *leidos += (uint64_t)n;
+        const char *p = bloque, *fin = bloque + n;
+        if (saltar > 0 && o->bytes) {
+            long long k = saltar < n ? saltar : n;
+            p += k;
+            saltar -= k;
+        } else if (saltar > 0) {
+            long long saltos = contar_saltos(p, fin);
+            if (saltos < saltar) { saltar -= saltos; p = fin; }
+            else { p = enesimo_salto(p, fin, saltar) + 1; saltar = 0; }
+        }
+        salida_escribir(p, (size_t)(fin - p));
+    }
+    return salida.error ? 0 : (int)n;
+}
+
+/*
+ * tail sobre un pipe: acumula el flujo y, cada vez que duplica lo que hace falta conservar, descarta lo
+ * anterior a las últimas N líneas (una cota inferior: lo que falta leer solo puede correr el inicio).
+ */
+static int volcar_ventana_final(int fd, const opciones_recorte_t *o, uint64_t *leidos) {
+    size_t capacidad = TAIL_BLOQUE, usado = 0, umbral = TAIL_BLOQUE;
+    char *ventana = malloc(capacidad);
+    if (!ventana) return -1;
+    ssize_t n;
+    for (;;) {
+        if (capacidad - usado < SALIDA_PIPE) {
+            char *mayor = realloc(ventana, capacidad * 2);
+            if (!mayor) { free(ventana); return -1; }
+            ventana = mayor;
+            capacidad *= 2;
+        }
+        if ((n = read(fd, ventana + usado, capacidad - usado)) <= 0) break;
+        contar_io((uint64_t)n, 0);
+        *leidos += (uint64_t)n;
+        usado += (size_t)n;
+        if (usado > 2 * umbral) {
+            size_t ini = o->bytes ? ((unsigned long long)usado > (unsigned long long)o->cantidad ? usado - (size_t)o->cantidad : 0)
+                                  : inicio_ultimas_lineas_mem(ventana, usado, o->cantidad);
+            memmove(ventana, ventana + ini, usado - ini);
+            usado -= ini;
+            if (usado > umbral) umbral = usado;
+        }
+    }
+    if (n == 0) {
+        size_t ini = o->bytes ? ((unsigned long long)usado > (unsigned long long)o->cantidad ? usado - (size_t)o->cantidad : 0)
+                              : inicio_ultimas_lineas_mem(ventana, usado, o->cantidad);
+        salida_escribir(ventana + ini, usado - ini);
+    }
+    free(ventana);
+    return (int)n;
+}
+
+// --- Seguimiento (tail -f) ---
+
+#define TAIL_EVENTOS_ARCHIVO (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+#define TAIL_EVENTOS_DIRECTORIO (IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+
+typedef struct {
+    const char *archivo;
+    char nombre[NAME_MAX + 1];  // Último componente: filtra los eventos del directorio
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    int inotify, wd_archivo, wd_directorio;
+    int rotaciones, truncados;
+    uint64_t leidos;
+    char *bloque;
+} seguimiento_tail_t;
+
+static int aviso_interrupcion_tail = -1; // Extremo de escritura del pipe que despierta el ciclo con Ctrl-C
+
+static void manejador_interrupcion_tail(int senal) {
+    (void)senal;
+    int errno_guardado = errno;
+    char c = 0;
+    if (write(aviso_interrupcion_tail, &c, 1) < 0) {} // Pipe lleno: ya hay un aviso pendiente
+    errno = errno_guardado;
+}
+
+// Vigila el inodo ya abierto (no el nombre, que puede cambiar entre la apertura y la vigilancia)
+static int vigilar_descriptor(int inotify, int fd, uint32_t eventos) {
+    char ruta[32];
+    snprintf(ruta, sizeof(ruta), "/proc/self/fd/%d", fd);
+    return inotify_add_watch(inotify, ruta, eventos);
+}
+
+// Imprime lo agregado desde la última lectura (desde el principio si el archivo se truncó). 1 = falló la salida
+static int volcar_agregado(seguimiento_tail_t *s) {
+    struct stat st;
+    off_t pos = lseek(s->fd, 0, SEEK_CUR);
+    if (fstat(s->fd, &st) == 0 && st.st_size < pos) {
+        fprintf(stderr, "tail: %s: archivo truncado\n", s->archivo);
+        lseek(s->fd, 0, SEEK_SET);
+        s->truncados++;
+    }
+    ssize_t n;
+    while (!salida.error && (n = read(s->fd, s->bloque, TAIL_BLOQUE)) > 0) {
+        contar_io((uint64_t)n, 0);
+        s->leidos += (uint64_t)n;
+        salida_escribir(s->bloque, (size_t)n);
+    }
+    return salida_volcar();
+}
+
+/*
+ * El nombre pudo pasar a otro archivo: lo reabre por el Sandbox y, si es otro inodo, lo sigue desde el
+ * principio. Retorna 1 si cambió, 0 si sigue igual (o todavía no existe) y -1 si la política lo deniega.
+ */
+static int reabrir_rotado(seguimiento_tail_t *s) {
+    int fd = abrir_en_sandbox(s->archivo, O_RDONLY, 0, "tail");
+    if (fd == SANDBOX_DENEGADO) return -1;
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (st.st_dev == s->dev && st.st_ino == s->ino)) { close(fd); return 0; }
+
+    volcar_agregado(s); // Lo último escrito en el archivo anterior
+    fprintf(stderr, "tail: '%s' fue reemplazado; se sigue el archivo nuevo\n", s->archivo);
+    if (s->wd_archivo >= 0) inotify_rm_watch(s->inotify, s->wd_archivo);
+    close(s->fd);
+    s->fd = fd;
+    s->dev = st.st_dev;
+    s->ino = st.st_ino;
+    s->wd_archivo = vigilar_descriptor(s->inotify, fd, TAIL_EVENTOS_ARCHIVO);
+    s->rotaciones++;
+    return 1;
+}
+
+// Directorio del archivo, vigilado solo si la política le da lectura a 'tail' (sin notificar si no)
+static void vigilar_directorio(seguimiento_tail_t *s) {
+    char copia[PATH_MAX];
+    snprintf(copia, sizeof(copia), "%s", s->archivo);
+    size_t largo = strlen(copia);
+    while (largo > 1 && copia[largo - 1] == '/') copia[--largo] = '\0';
+    char *barra = strrchr(copia, '/');
+    snprintf(s->nombre, sizeof(s->nombre), "%.*s", NAME_MAX, barra ? barra + 1 : copia);
+    const char *directorio = !barra ? "." : (barra == copia ? "/" : (*barra = '\0', copia));
+    if (!validar_ruta_en_politica(directorio, comando_de_contexto("tail"), 0)) return;
+    int fd = abrir_en_sandbox(directorio, O_PATH | O_DIRECTORY, 0, "tail");
+    if (fd < 0) return;
+    s->wd_directorio = vigilar_descriptor(s->inotify, fd, TAIL_EVENTOS_DIRECTORIO);
+    close(fd);
+}
+
+/*
+ * Ciclo de tail -f: espera eventos de inotify y el aviso de Ctrl-C con 'poll'. Las escrituras y los
+ * cambios de atributos del archivo (un unlink baja su cantidad de enlaces) disparan la lectura de lo
+ * nuevo; los eventos del directorio sobre el nombre, y el movimiento o borrado del archivo, la
+ * comprobación de rotación. Retorna 130 si se interrumpió, 1 ante un error y 0 si se cerró la salida.
+ */
+static int seguir_archivo(seguimiento_tail_t *s) {
+    s->inotify = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    int aviso[2];
+    if (s->inotify < 0 || pipe2(aviso, O_CLOEXEC | O_NONBLOCK) != 0) {
+        reportar_error_sistema("tail");
+        if (s->inotify >= 0) close(s->inotify);
+        return 1;
+    }
+    s->wd_archivo = vigilar_descriptor(s->inotify, s->fd, TAIL_EVENTOS_ARCHIVO);
+    s->wd_directorio = -1;
+    if (s->wd_archivo >= 0) vigilar_directorio(s);
+
+    struct sigaction sa, anterior;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = manejador_interrupcion_tail;
+    sigemptyset(&sa.sa_mask);
+    aviso_interrupcion_tail = aviso[1];
+    sigaction(SIGINT, &sa, &anterior);
+
+    int resultado = s->wd_archivo < 0 ? (reportar_error_sistema("tail"), 1) : 0;
+    // Lo escrito entre la lectura inicial y la vigilancia
+    if (resultado == 0 && volcar_agregado(s)) resultado = -1;
+    char eventos[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd p[2] = { { .fd = s->inotify, .events = POLLIN }, { .fd = aviso[0], .events = POLLIN } };
+    while (resultado == 0) {
+        if (poll(p, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            reportar_error_sistema("tail");
+            resultado = 1;
+            break;
+        }
+        if (p[1].revents) { resultado = 130; break; }
+        ssize_t n = read(s->inotify, eventos, sizeof(eventos));
+        if (n <= 0) continue;
+        int datos = 0, nombre = 0;
+        for (char *e = eventos; e < eventos + n;) {
+            struct inotify_event *ev = (struct inotify_event *)e;
+            if (ev->mask & IN_Q_OVERFLOW) datos = nombre = 1;
+            else if (ev->wd == s->wd_archivo) {
+                if (ev->mask & IN_MODIFY) datos = 1;
+                if (ev->mask & (IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)) nombre = 1;
+            } else if (ev->wd == s->wd_directorio && ev->len && strcmp(ev->name, s->nombre) == 0) nombre = 1;
+            e += sizeof(*ev) + ev->len;
+        }
+        if (datos && volcar_agregado(s)) resultado = -1;
+        if (nombre && resultado == 0) {
+            int r = reabrir_rotado(s);
+            if (r < 0) resultado = 1;
+            else if (r > 0 && volcar_agregado(s)) resultado = -1;
+        }
+    }
+
+    sigaction(SIGINT, &anterior, NULL);
+    aviso_interrupcion_tail = -1;
+    close(aviso[0]);
+    close(aviso[1]);
+    close(s->inotify);
+    return resultado < 0 ? 0 : resultado;
+}
+
+void ejecutar_tail(char **args) {
+    opciones_recorte_t o;
+    if (parsear_opciones_recorte(args, "tail", 1, &o) != 0) return;
+    int fd = abrir_recorte(&o, "tail");
+    if (fd < 0) return;
+    char *bloque = malloc(TAIL_BLOQUE);
+    if (!bloque) { reportar_error_sistema("tail"); if (fd != STDIN_FILENO) close(fd); return; }
+
+    struct stat st;
+    int regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    off_t base = regular ? lseek(fd, 0, SEEK_CUR) : -1, desde = -1, fin = 0;
+    uint64_t leidos = 0;
+    int resultado;
+    if (o.desde_inicio) {
+        resultado = volcar_desde_inicio(fd, &o, bloque, &leidos);
+    } else if (base >= 0) {
+        // Archivo regular: solo se lee la cola, y -f sigue desde el final
+        fin = st.st_size > base ? st.st_size : base;
+        cola_tail_t cola = { .buffers = { bloque }, .base = base, .fin = fin };
+        if (o.bytes) desde = (fin - base > o.cantidad) ? fin - (off_t)o.cantidad : base;
+        else desde = inicio_ultimas_lineas(fd, o.cantidad, &cola, &leidos);
+        resultado = desde < 0 ? -1 : volcar_cola_tail(fd, &cola, desde, &leidos);
+        liberar_cola_tail(&cola);
+        lseek(fd, fin, SEEK_SET);
+    } else {
+        resultado = volcar_ventana_final(fd, &o, &leidos);
+    }
+    if (resultado < 0) {
+        reportar_error_sistema("tail");
+        free(bloque);
+        if (fd != STDIN_FILENO) close(fd);
+        return;
+    }
+
+    char msg[192];
+    int largo = (desde >= 0) ? snprintf(msg, sizeof(msg), "Lectura exitosa: %llu bytes leidos, desde el byte %lld de %lld",
+                                        (unsigned long long)leidos, (long long)desde, (long long)fin)
+                             : snprintf(msg, sizeof(msg), "Lectura exitosa: %llu bytes leidos", (unsigned long long)leidos);
+    // -f solo tiene sentido sobre un archivo con nombre (como tail(1), se ignora sobre stdin y pipes)
+    if (o.seguir && o.archivo && regular) {
+        seguimiento_tail_t s = { .archivo = o.archivo, .fd = fd, .dev = st.st_dev, .ino = st.st_ino, .bloque = bloque };
+        estado_builtin = seguir_archivo(&s);
+        fd = s.fd;
+        snprintf(msg + largo, sizeof(msg) - (size_t)largo, "; seguimiento: %llu bytes, %d rotaciones, %d truncados",
+                 (unsigned long long)s.leidos, s.rotaciones, s.truncados);
+    }
+    free(bloque);
+    if (fd != STDIN_FILENO) close(fd);
+    log_shell("tail", msg, "INFO");
+}
+
+// --- Comando Built-in: set (Opciones de la Sesión) ---
+
+/*
+ * Activa o desactiva opciones de la sesión.
+ * - 'set -e': a partir de aquí, el shell termina ante el primer comando con estado distinto de 0
+ * (fail-fast para scripts y modo por lotes), saliendo con ese mismo estado.
+ * - 'set +e': desactiva el comportamiento anterior.
+ * - 'set -f' / 'set +f': desactiva / reactiva la expansión de comodines.
+ * - Sin argumentos: muestra el estado de las opciones.
+ */
+void ejecutar_set(char **args) {
+    if (!args[1]) {
+        salida_printf("errexit\t%s\n", opciones_shell.salir_en_error ? "on" : "off");
+        salida_printf("noglob\t%s\n", opciones_shell.sin_comodines ? "on" : "off");
+        return;
+    }
+    for (int i = 1; args[i]; i++) {
+        if (strcmp(args[i], "-e") == 0) opciones_shell.salir_en_error = 1;
+        else if (strcmp(args[i], "+e") == 0) opciones_shell.salir_en_error = 0;
+        else if (strcmp(args[i], "-f") == 0) opciones_shell.sin_comodines = 1;
+        else if (strcmp(args[i], "+f") == 0) opciones_shell.sin_comodines = 0;
+        else { fprintf(stderr, "set: opción inválida: %s\n", args[i]); estado_builtin = 2; return; }
+    }
+    char msg[64];
+    snprintf(msg, sizeof(msg), "errexit %s, noglob %s", opciones_shell.salir_en_error ? "on" : "off", opciones_shell.sin_comodines ? "on" : "off");
+    log_shell("set", msg, "INFO");
+}
+
+// --- Comando Built-in: stats (Telemetría de la Sesión) ---
+
+static void formatear_duracion(uint64_t ns, char *destino, size_t tam) {
+    if (ns < 1000) snprintf(destino, tam, "%lluns", (unsigned long long)ns);
+    else if (ns < 1000000) snprintf(destino, tam, "%.1fus", ns / 1e3);
+    else if (ns < 1000000000) snprintf(destino, tam, "%.2fms", ns / 1e6);
+    else snprintf(destino, tam, "%.2fs", ns / 1e9);
+}
+
+// Valor bajo el cual cae la fracción 'q' de las muestras (límite de su cubeta, acotado por el máximo)
+static uint64_t percentil(const estadistica_comando_t *e, double q) {
+    uint64_t objetivo = (uint64_t)(q * (double)e->cuenta + 0.999999), acumulado = 0;
+    if (objetivo == 0) objetivo = 1;
+    for (int i = 0; i < TELEMETRIA_CUBETAS; i++) {
+        acumulado += e->cubetas[i];
+        if (acumulado >= objetivo) return (limite_cubeta(i) - 1 < e->max_ns) ? limite_cubeta(i) - 1 : e->max_ns;
+    }
+    return e->max_ns;
+}
+
+/*
+ * Muestra la telemetría de la sesión.
+ * - Sin argumentos: por comando, cantidad, media, percentiles 50/90/99, máximo y CPU acumulada.
+ * - 'stats COMANDO': su histograma de latencia (solo las cubetas con muestras).
+ * - 'stats -r': reinicia las estadísticas.
+ */
+void ejecutar_stats(char **args) {
+    char t[5][16];
+    if (args[1] && strcmp(args[1], "-r") == 0) {
+        memset(telemetria.tabla, 0, sizeof(telemetria.tabla));
+        telemetria.ocupadas = 0;
+        log_shell("stats", "Estadisticas reiniciadas", "INFO");
+        return;
+    }
+    if (args[1]) {
+        const estadistica_comando_t *e = NULL;
+        for (int i = 0; i < TELEMETRIA_MAX_COMANDOS && !e; i++)
+            if (telemetria.tabla[i].cuenta && strcmp(telemetria.tabla[i].nombre, args[1]) == 0) e = &telemetria.tabla[i];
+        if (!e) { fprintf(stderr, "stats: sin muestras para '%s'\n", args[1]); estado_builtin = 1; return; }
+        uint32_t mayor = 0;
+        for (int i = 0; i < TELEMETRIA_CUBETAS; i++) if (e->cubetas[i] > mayor) mayor = e->cubetas[i];
+        for (int i = 0; i < TELEMETRIA_CUBETAS; i++) {
+            if (!e->cubetas[i]) continue;
+            formatear_duracion(i ? limite_cubeta(i - 1) : 0, t[0], sizeof(t[0]));
+            formatear_duracion(limite_cubeta(i), t[1], sizeof(t[1]));
+            char barra[41];
+            int largo = (int)((uint64_t)e->cubetas[i] * 40 / mayor);
+            memset(barra, '#', (size_t)largo);
+            barra[largo] = '\0';
+            salida_printf("%10s - %-10s %8u %s\n", t[0], t[1], e->cubetas[i], barra);
+        }
+        return;
+    }
+    salida_printf("%-16s %8s %10s %10s %10s %10s %10s %10s %10s\n", "comando", "n", "media", "p50", "p90", "p99", "max", "usr", "sys");
+    for (int i = 0; i < TELEMETRIA_MAX_COMANDOS; i++) {
+        const estadistica_comando_t *e = &telemetria.tabla[i];
+        if (!e->cuenta) continue;
+        formatear_duracion(e->suma_ns / e->cuenta, t[0], sizeof(t[0]));
+        formatear_duracion(percentil(e, 0.50), t[1], sizeof(t[1]));
+        formatear_duracion(percentil(e, 0.90), t[2], sizeof(t[2]));
+        formatear_duracion(percentil(e, 0.99), t[3], sizeof(t[3]));
+        formatear_duracion(e->max_ns, t[4], sizeof(t[4]));
+        salida_printf("%-16s %8llu %10s %10s %10s %10s %10s %9.3fs %9.3fs\n", e->nombre, (unsigned long long)e->cuenta,
+                      t[0], t[1], t[2], t[3], t[4], e->cpu_usuario_us / 1e6, e->cpu_sistema_us / 1e6);
+    }
+}
+
+// --- Comando Built-in: audit (Consulta de la Auditoría) ---
+
+typedef struct {
+    uint64_t desde, hasta;             // AAAAMMDDhhmmss, como las entradas del índice
+    time_t desde_epoch, hasta_epoch;   // Los mismos límites para los segmentos binarios
+    uint32_t niveles;                  // 0 = todos
+    const char *usuario, *origen, *comando;
+    uint64_t h_usuario, h_origen, h_comando;
+} consulta_auditoria_t;
+
+typedef struct {
+    uint64_t fecha;
+    size_t orden;                      // Desempate estable entre líneas del mismo segundo
+    const char *texto;                 // Línea en un log mapeado, o NULL si está en 'formateadas'
+    size_t desplazamiento, largo;      // 'largo' incluye el '\n'
+} coincidencia_audit_t;
+
+typedef struct {
+    coincidencia_audit_t *v;
+    size_t n, cap;
+    char *formateadas;                 // Líneas reconstruidas desde segmentos binarios
+    size_t usado_f, cap_f;
+    long bloques_leidos, bloques_totales;
+    struct { char *mapa; size_t tam; } logs[2];
+} resultados_audit_t;
+
+static uint64_t empaquetar_fecha(const struct tm *tm) {
+    return ((((((uint64_t)tm->tm_year + 1900) * 100 + (uint64_t)tm->tm_mon + 1) * 100 + (uint64_t)tm->tm_mday) * 100 +
+             (uint64_t)tm->tm_hour) * 100 + (uint64_t)tm->tm_min) * 100 + (uint64_t)tm->tm_sec;
+}
+
+static time_t fecha_a_epoch(uint64_t fecha) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_sec = (int)(fecha % 100); fecha /= 100;
+    tm.tm_min = (int)(fecha % 100); fecha /= 100;
+    tm.tm_hour = (int)(fecha % 100); fecha /= 100;
+    tm.tm_mday = (int)(fecha % 100); fecha /= 100;
+    tm.tm_mon = (int)(fecha % 100) - 1; fecha /= 100;
+    tm.tm_year = (int)fecha - 1900;
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+/*
+ * Fecha de consulta: 'AAAA-MM-DD[ hh:mm[:ss]]' o relativa al momento actual ('-30m', '-12h', '-7d').
+ * Los campos omitidos toman el inicio del período, o su final si 'fin' es 1 (límite 'hasta').
+ */
+static int parsear_fecha_audit(const char *s, int fin, uint64_t *fecha) {
+    if (s[0] == '-') {
+        char *unidad;
+        long n = strtol(s + 1, &unidad, 10);
+        long segundos = *unidad == 'm' ? 60 : *unidad == 'h' ? 3600 : *unidad == 'd' ? 86400 : 0;
+        if (n <= 0 || segundos == 0 || unidad[1] != '\0') return -1;
+        time_t t = time(NULL) - (time_t)(n * segundos);
+        struct tm tm;
+        localtime_r(&t, &tm);
+        *fecha = empaquetar_fecha(&tm);
+        return 0;
+    }
+    long v[6] = { 0, 1, 1, fin ? 23 : 0, fin ? 59 : 0, fin ? 59 : 0 };
+    static const long maximo[6] = { 9999, 12, 31, 23, 59, 59 };
+    int k = 0;
+    char *p = (char *)s;
+    while (*p && k < 6) {
+        if (*p < '0' || *p > '9') return -1;
+        v[k] = strtol(p, &p, 10);
+        if (v[k] > maximo[k]) return -1;
+        k++;
+        if (*p == '-' || *p == ' ' || *p == ':' || *p == 'T') p++;
+        else if (*p) return -1;
+    }
+    if (k < 3) return -1;
+    *fecha = 0;
+    for (int i = 0; i < 6; i++) *fecha = *fecha * (i ? 100 : 1) + (uint64_t)v[i];
+    return 0;
+}
+
+static int campo_igual(const char *valor, const char *campo, size_t largo) {
+    return strlen(valor) == largo && memcmp(valor, campo, largo) == 0;
+}
+
+static int linea_coincide(const consulta_auditoria_t *q, const linea_auditoria_t *l) {
+    if (l->fecha < q->desde || l->fecha > q->hasta) return 0;
+    if (q->niveles && !(q->niveles >> l->nivel & 1)) return 0;
+    if (q->usuario && !campo_igual(q->usuario, l->usuario, l->largo_usuario)) return 0;
+    if (q->origen && !campo_igual(q->origen, l->origen, l->largo_origen)) return 0;
+    if (q->comando && !campo_igual(q->comando, l->comando, l->largo_comando)) return 0;
+    return 1;
+}
+
+// Descarta bloques por rango de fechas, niveles presentes y filtros de Bloom (falsos positivos posibles)
+static int bloque_puede_coincidir(const consulta_auditoria_t *q, const entrada_indice_t *e) {
+    if (e->fecha_max < q->desde || e->fecha_min > q->hasta) return 0;
+    if (q->niveles && !(e->niveles & q->niveles)) return 0;
+    if (q->usuario && !bloom_contiene(e->usuarios, q->h_usuario)) return 0;
+    if (q->origen && !bloom_contiene(e->origenes, q->h_origen)) return 0;
+    if (q->comando && !bloom_contiene(e->comandos, q->h_comando)) return 0;
+    return 1;
+}
+
+static int agregar_coincidencia(resultados_audit_t *r, uint64_t fecha, const char *texto, size_t desplazamiento, size_t largo) {
+    if (reservar_vector((void **)&r->v, &r->cap, r->n + 1, sizeof(*r->v)) != 0) return -1;
+    r->v[r->n] = (coincidencia_audit_t){ fecha, r->n, texto, desplazamiento, largo };
+    r->n++;
+    return 0;
+}
+
+// Recorre las líneas completas de una región del log
+static int buscar_en_region(const consulta_auditoria_t *q, const char *p, size_t n, resultados_audit_t *r) {
+    const char *fin = p + n;
+    while (p < fin) {
+        const char *nl = memchr(p, '\n', (size_t)(fin - p));
+        if (nl == NULL) break; // Línea a medio escribir por otra sesión
+        linea_auditoria_t l;
+        if (parsear_linea_auditoria(p, (size_t)(nl - p), &l) == 0 && linea_coincide(q, &l) &&
+            agregar_coincidencia(r, l.fecha, p, 0, (size_t)(nl + 1 - p)) != 0) return -1;
+        p = nl + 1;
+    }
+    return 0;
+}
+
+/*
+ * Consulta un log de texto: pone al día su índice, lee las entradas con un lock compartido y recorre
+ * por mmap solo los bloques candidatos y la cola sin indexar. El mapa queda abierto hasta imprimir.
+ */
+static int auditar_log(const char *ruta, const consulta_auditoria_t *q, resultados_audit_t *r, int slot) {
+    indice_extender(ruta);
+    int fd = open(ruta, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return errno == ENOENT ? 0 : -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) { close(fd); return -1; }
+    size_t tam = (size_t)st.st_size;
+    if (tam == 0) { close(fd); return 0; }
+    char *mapa = mmap(NULL, tam, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapa == MAP_FAILED) return -1;
+    r->logs[slot].mapa = mapa;
+    r->logs[slot].tam = tam;
+
+    // Entradas del índice (pread y no mmap: una reconstrucción concurrente puede truncar el archivo)
+    char ruta_idx[PATH_MAX + 40];
+    ruta_indice(ruta_idx, sizeof(ruta_idx), ruta);
+    cabecera_indice_t c;
+    entrada_indice_t *entradas = NULL;
+    uint64_t indexado = 0;
+    int fd_idx = open(ruta_idx, O_RDONLY | O_CLOEXEC);
+    if (fd_idx >= 0) {
+        flock(fd_idx, LOCK_SH);
+        if (pread(fd_idx, &c, sizeof(c), 0) == (ssize_t)sizeof(c) && memcmp(c.magico, AUDIT_MAGICO, 8) == 0 &&
+            c.version == AUDIT_VERSION && c.dispositivo == (uint64_t)st.st_dev && c.inodo == (uint64_t)st.st_ino &&
+            c.indexado <= tam && (entradas = malloc(c.entradas * sizeof(*entradas) + 1)) != NULL) {
+            size_t bytes = c.entradas * sizeof(*entradas);
+            if (pread(fd_idx, entradas, bytes, sizeof(c)) == (ssize_t)bytes) indexado = c.indexado;
+            else c.entradas = 0;
+        }
+        flock(fd_idx, LOCK_UN);
+        close(fd_idx);
+    }
+
+    int resultado = 0;
+    for (uint64_t i = 0; indexado && i < c.entradas && resultado == 0; i++) {
+        r->bloques_totales++;
+        if (!bloque_puede_coincidir(q, &entradas[i])) continue;
+        r->bloques_leidos++;
+        resultado = buscar_en_region(q, mapa + entradas[i].desde, entradas[i].largo, r);
+    }
+    free(entradas);
+    if (resultado == 0) resultado = buscar_en_region(q, mapa + indexado, tam - indexado, r);
+    return resultado;
+}
+
+// Agrega una línea con el formato de texto del logger, reconstruida desde un registro binario
+static int agregar_registro_binario(resultados_audit_t *r, const cabecera_segmento_t *c, const registro_binlog_t *reg,
+                                    time_t segundo, const char *origen) {
+    struct tm tm;
+    char fecha[32], perf[LOG_MAX_PERF] = "";
+    localtime_r(&segundo, &tm);
+    strftime(fecha, sizeof(fecha), "%Y-%m-%d %H:%M:%S", &tm);
+    const char *datos = (const char *)(reg + 1);
+    if (reg->banderas & BINLOG_CON_PERF) {
+        perf_evento_t p;
+        memcpy(&p, datos, sizeof(p));
+        formatear_perf(perf, sizeof(perf), &p);
+        datos += sizeof(p);
+    }
+    size_t maximo = LOG_MAX_CMD + LOG_MAX_MSG + LOG_MAX_PERF + 256;
+    if (reservar_vector((void **)&r->formateadas, &r->cap_f, r->usado_f + maximo, 1) != 0) return -1;
+    const char *usuario = usuario_de_registro(c, reg);
+    int n = snprintf(r->formateadas + r->usado_f, maximo, "[%s] [%s] SRC:%s | USER:%.*s | CMD:%.*s | MSG:%.*s%s\n",
+                     fecha, nombres_nivel_binlog[reg->nivel <= BINLOG_CRITICAL ? reg->nivel : BINLOG_INFO], origen,
+                     (int)strnlen(usuario, sizeof(c->usuario)), usuario, (int)reg->largo_cmd, datos,
+                     (int)reg->largo_msg, datos + reg->largo_cmd, perf);
+    if (n < 0) return 0;
+    if ((size_t)n >= maximo) n = (int)maximo - 1;
+    if (agregar_coincidencia(r, empaquetar_fecha(&tm), NULL, r->usado_f, (size_t)n) != 0) return -1;
+    r->usado_f += (size_t)n;
+    return 0;
+}
+
+/*
+ * Consulta los segmentos binarios del directorio de logs. No tienen índice lateral: la cabecera fija de
+ * cada registro se filtra sin parsear texto, y un segmento entero se salta por usuario o si empezó
+ * después de 'hasta'. Solo se formatean los registros que coinciden.
+ */
+static int auditar_segmentos(const consulta_auditoria_t *q, resultados_audit_t *r) {
+    DIR *d = opendir(logger.directorio);
+    if (d == NULL) return 0;
+    struct dirent *de;
+    int resultado = 0;
+    while (resultado == 0 && (de = readdir(d)) != NULL) {
+        if (secuencia_de_segmento(de->d_name) == 0) continue;
+        int fd = openat(dirfd(d), de->d_name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) continue;
+        struct stat st;
+        char *mapa = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(cabecera_segmento_t))
+            mapa = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapa == MAP_FAILED) continue;
+        size_t tam = (size_t)st.st_size;
+        const cabecera_segmento_t *c = (const cabecera_segmento_t *)mapa;
+        int multiusuario = strncmp(c->usuario, BINLOG_MULTIUSUARIO, sizeof(c->usuario)) == 0;
+        if (memcmp(c->magico, BINLOG_MAGICO, 8) != 0 || c->version != BINLOG_VERSION || c->tam_cabecera > tam ||
+            (q->usuario && !multiusuario && strncmp(c->usuario, q->usuario, sizeof(c->usuario)) != 0) ||
+            (time_t)(c->base_real_ns / 1000000000ULL) > q->hasta_epoch) {
+            munmap(mapa, tam);
+            continue;
+        }
+        size_t fin = (c->cerrado && c->usado <= tam) ? c->usado : tam;
+        for (size_t pos = c->tam_cabecera; resultado == 0 && pos + sizeof(registro_binlog_t) <= fin;) {
+            const registro_binlog_t *reg = (const registro_binlog_t *)(mapa + pos);
+            size_t largo = __atomic_load_n(&reg->largo, __ATOMIC_ACQUIRE);
+            if (largo == 0 || largo % BINLOG_ALINEACION != 0 || largo > fin - pos) break;
+            pos += largo;
+            time_t segundo = (time_t)((c->base_real_ns + (reg->instante_ns - c->base_mono_ns)) / 1000000000ULL);
+            if (segundo < q->desde_epoch || segundo > q->hasta_epoch) continue;
+            if (q->niveles && !(q->niveles >> reg->nivel & 1)) continue;
+            if (q->usuario && multiusuario && strcmp(usuario_de_registro(c, reg), q->usuario) != 0) continue;
+            if (q->comando && !campo_igual(q->comando, (const char *)(reg + 1) +
+                                           ((reg->banderas & BINLOG_CON_PERF) ? sizeof(perf_evento_t) : 0), reg->largo_cmd)) continue;
+            char ip[INET_ADDRSTRLEN];
+            const char *origen = c->origen;
+            if (reg->ip != 0) origen = inet_ntop(AF_INET, &reg->ip, ip, sizeof(ip));
+            if (q->origen && strcmp(q->origen, origen) != 0) continue;
+            resultado = agregar_registro_binario(r, c, reg, segundo, origen);
+        }
+        munmap(mapa, tam);
+    }
+    closedir(d);
+    return resultado;
+}
+
+static int comparar_coincidencias(const void *a, const void *b) {
+    const coincidencia_audit_t *x = a, *y = b;
+    if (x->fecha != y->fecha) return (x->fecha > y->fecha) - (x->fecha < y->fecha);
+    return (x->orden > y->orden) - (x->orden < y->orden);
+}
+
+// Regla de acceso: root y el grupo 'adm' (el que lee /var/log en Debian/Ubuntu) ven todos los registros
+static int auditoria_sin_restricciones(void) {
+    if (geteuid() == 0) return 1;
+    struct group *g = getgrnam("adm");
+    if (g == NULL) return 0;
+    if (getegid() == g->gr_gid) return 1;
+    gid_t grupos[256];
+    int n = getgroups(256, grupos);
+    for (int i = 0; i < n; i++) if (grupos[i] == g->gr_gid) return 1;
+    return 0;
+}
+
+/*
+ * Consulta la auditoría sin recorrerla entera.
+ * Uso: audit [-d DESDE] [-h HASTA] [-n NIVEL[,NIVEL]] [-u USUARIO] [-s IP] [-c COMANDO]
+ * Funcionalidad:
+ * 1. Fuentes: 'shell.log' y 'sistema_error.log' (con su índice disperso) y los segmentos binarios
+ * del directorio de logs. Las líneas salen ordenadas por fecha, con el formato de texto del logger.
+ * 2. Filtros: ventana de tiempo (fechas absolutas o '-7d', '-12h', '-30m'), niveles, y coincidencia
+ * exacta de usuario, IP de origen ('SRC:') y comando.
+ * 3. Acceso (Seguridad): root y el grupo 'adm' consultan cualquier usuario. El resto solo ve sus propios
+ * registros: el usuario sale de getpwuid (no de $USER), y pedir otro se rechaza y se registra como WARNING.
+ * 4. Sandbox: solo lee el directorio de logs que resolvió el logger, nunca rutas del usuario.
+ * 5. Estado: 1 si no hubo coincidencias, como grep.
+ */
+void ejecutar_audit(char **args) {
+    consulta_auditoria_t q;
+    memset(&q, 0, sizeof(q));
+    q.hasta = 99991231235959ULL;
+    for (int i = 1; args[i]; i += 2) {
+        const char *opcion = args[i], *valor = args[i + 1];
+        if (opcion[0] != '-' || opcion[1] == '\0' || opcion[2] != '\0' || !valor) {
+            fprintf(stderr, "uso: audit [-d DESDE] [-h HASTA] [-n NIVEL[,NIVEL]] [-u USUARIO] [-s IP] [-c COMANDO]\n");
+            estado_builtin = 2;
+            return;
+        }
+        int valido = 1;
+        switch (opcion[1]) {
+            case 'd': valido = parsear_fecha_audit(valor, 0, &q.desde) == 0; break;
+            case 'h': valido = parsear_fecha_audit(valor, 1, &q.hasta) == 0; break;
+            case 'u': q.usuario = valor; break;
+            case 's': q.origen = valor; break;
+            case 'c': q.comando = valor; break;
+            case 'n':
+                for (const char *p = valor; *p && valido;) {
+                    size_t largo = strcspn(p, ",");
+                    int nivel = -1;
+                    for (int k = BINLOG_INFO; k <= BINLOG_CRITICAL; k++)
+                        if (strlen(nombres_nivel_binlog[k]) == largo && strncasecmp(p, nombres_nivel_binlog[k], largo) == 0) nivel = k;
+                    if (nivel < 0) valido = 0;
+                    else q.niveles |= 1u << nivel;
+                    p += largo + (p[largo] == ',');
+                }
+                break;
+            default: valido = 0;
+        }
+        if (!valido) { fprintf(stderr, "audit: valor inválido para %s: %s\n", opcion, valor); estado_builtin = 2; return; }
+    }
+
+    struct passwd *pw = getpwuid(getuid());
+    const char *propio = pw ? pw->pw_name : "unknown";
+    if (!auditoria_sin_restricciones()) {
+        if (q.usuario && strcmp(q.usuario, propio) != 0) {
+            char msg[160];
+            snprintf(msg, sizeof(msg), "Consulta de registros ajenos denegada (usuario: %s)", q.usuario);
+            log_shell("audit", msg, "WARNING");
+            fprintf(stderr, "[flsh_sec]: audit: solo root y el grupo adm consultan registros de otros usuarios.\n");
+            estado_builtin = 1;
+            return;
+        }
+        q.usuario = propio;
+    }
+    if (q.usuario) q.h_usuario = hash_campo(q.usuario, strlen(q.usuario));
+    logger_vaciar(); // Los comandos anteriores de esta sesión pueden seguir en el anillo
+    if (q.origen) q.h_origen = hash_campo(q.origen, strlen(q.origen));
+    if (q.comando) q.h_comando = hash_campo(q.comando, strlen(q.comando));
+    q.desde_epoch = q.desde ? fecha_a_epoch(q.desde) : 0;
+    q.hasta_epoch = q.hasta < 99991231235959ULL ? fecha_a_epoch(q.hasta) : (time_t)INT64_MAX;
+
+    // Los niveles ERROR/CRITICAL solo viven en 'sistema_error.log' y el resto en 'shell.log'
+    resultados_audit_t r;
+    memset(&r, 0, sizeof(r));
+    uint32_t errores = (1u << BINLOG_ERROR) | (1u << BINLOG_CRITICAL);
+    static const char *const nombres[2] = { "shell.log", "sistema_error.log" };
+    int resultado = 0;
+    for (int i = 0; i < 2 && resultado == 0; i++) {
+        if (q.niveles && !(q.niveles & (i ? errores : ~errores))) continue;
+        char ruta[PATH_MAX + 32];
+        snprintf(ruta, sizeof(ruta), "%s/%s", logger.directorio, nombres[i]);
+        resultado = auditar_log(ruta, &q, &r, i);
+    }
+    if (resultado == 0) resultado = auditar_segmentos(&q, &r);
+
+    if (resultado == 0) {
+        qsort(r.v, r.n, sizeof(*r.v), comparar_coincidencias);
+        for (size_t i = 0; i < r.n; i++)
+            salida_escribir(r.v[i].texto ? r.v[i].texto : r.formateadas + r.v[i].desplazamiento, r.v[i].largo);
+    }
+    for (int i = 0; i < 2; i++) if (r.logs[i].mapa) munmap(r.logs[i].mapa, r.logs[i].tam);
+    free(r.v);
+    free(r.formateadas);
+    if (resultado != 0) { reportar_error_sistema("audit"); return; }
+
+    estado_builtin = (r.n == 0);
+    char msg[160];
+    snprintf(msg, sizeof(msg), "Registros: %zu, bloques leidos: %ld de %ld", r.n, r.bloques_leidos, r.bloques_totales);
+    log_shell("audit", msg, "INFO");
+}
+
+// --- Despacho de Comandos Internos ---
+
+// Adaptadores a la firma del registro para los built-ins de un solo argumento
+static void builtin_pwd(char **args) {
+    (void)args;
+    char cwd[1024];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) { reportar_error_sistema("pwd"); return; }
+    salida_printf("%s\n", cwd);
+}
+static void builtin_echo(char **args) {
+    for (int i = 1; args[i]; i++) {
+        if (i > 1) salida_escribir(" ", 1);
+        salida_texto(args[i]);
+    }
+    salida_escribir("\n", 1);
+}
+static void builtin_cd(char **args) { ejecutar_cd(args[1]); }
+static void builtin_cat(char **args) { ejecutar_cat_archivos(args + 1); }
+
+/*
+ * Registro de built-ins generado desde flsh_builtins.def, en el mismo orden que los índices de
+ * la tabla de hash perfecto (flsh_builtins_hash.h, producida por tools/gen_hash_builtins).
+ */
+static const builtin_t registro_builtins[] = {
+#define BUILTIN(nombre, manejador, min_args, max_args, politica, nivel_log) \
+    { nombre, manejador, min_args, max_args, politica, nivel_log },
+#include "flsh_builtins.def"
+#undef BUILTIN
+};
+
+#include "flsh_builtins_hash.h"
+_Static_assert(sizeof(registro_builtins) / sizeof(registro_builtins[0]) == BUILTIN_HASH_CANTIDAD,
+               "flsh_builtins_hash.h desactualizado: regenerar con tools/gen_hash_builtins");
+
+/*
+ * Búsqueda O(1): un hash, una lectura de la tabla y un strcmp que confirma (los comandos externos
+ * casi siempre caen en una ranura vacía o fallan en el primer carácter).
+ */
+const builtin_t *buscar_builtin(const char *nombre) {
+    int i = builtin_ranura[hash_builtin(nombre, BUILTIN_HASH_SEMILLA) & (BUILTIN_HASH_TAM - 1)];
+    if (i < 0 || strcmp(registro_builtins[i].nombre, nombre) != 0) return NULL;
+    return &registro_builtins[i];
+}
+
+static int es_builtin(const char *nombre) {
+    return buscar_builtin(nombre) != NULL;
+}
+
+// Posición en el registro (y en 'comandos_politica'), o -1 si no es un built-in
+static int indice_builtin(const char *nombre) {
+    const builtin_t *b = buscar_builtin(nombre);
+    return b ? (int)(b - registro_builtins) : -1;
+}
+
+/*
+ * Despacho de los comandos internos a través del registro. Retorna 1 si 'args[0]' era un built-in
+ * (su resultado queda en 'estado_builtin'), o 0 si debe ejecutarse como comando externo.
+ * Funcionalidad:
+ * 1. Aridad: Se valida contra el descriptor antes de llamar al manejador (error de uso = estado 2).
+ * 2. Auditoría: Si el descriptor declara 'nivel_log', el despachador registra el éxito con ese nivel.
+ */
+int ejecutar_builtin(char **args) {
+    const builtin_t *b = buscar_builtin(args[0]);
+    if (!b) return 0;
+    estado_builtin = 0;
+    int n = 0;
+    while (args[n + 1]) n++;
+    if (n < b->min_args || (b->max_args >= 0 && n > b->max_args)) {
+        fprintf(stderr, "%s: %s\n", b->nombre, n < b->min_args ? "faltan argumentos" : "demasiados argumentos");
+        estado_builtin = 2;
+        return 1;
+    }
+    b->manejador(args);
+    if (b->nivel_log && estado_builtin == 0) log_shell((char *)b->nombre, "Exito", (char *)b->nivel_log);
+    return 1;
+}
+
+/*
+ * Validaciones SandBox para comandos externos (ej. /bin/ls o ../script.sh): cada ruta debe tener al
+ * menos lectura para 'externo' en la política.
+ * - Se revisan las rutas absolutas y las que suben ('..'); si la política tiene reglas dentro de una
+ * raíz (ej. 'denegar ~/.ssh'), también las relativas ('wc .ssh/id_rsa').
+ * - Con Landlock activo es el kernel quien restringe al hijo y no se revisan argumentos, salvo esas
+ * reglas internas, que el ruleset no puede expresar.
+ * Retorna 1 si se puede ejecutar.
+ */
+int validar_argumentos_externos(char **args) {
+    politica_t *p = politica_adquirir();
+    int internas = p && p->reglas_internas;
+    politica_soltar(p);
+    int con_landlock = landlock.ruleset_fd >= 0;
+    if (con_landlock && !internas) return 1;
+    int violacion = 0;
+    if (strchr(args[0], '/') != NULL && !validar_ruta_en_politica(args[0], COMANDO_EXTERNO, con_landlock)) violacion = 1;
+    for (int k = 1; args[k] != NULL; k++) {
+        int es_ruta = args[k][0] == '/' || (args[k][0] == '.' && args[k][1] == '.') || (internas && args[k][0] != '-');
+        if (es_ruta && !validar_ruta_en_politica(args[k], COMANDO_EXTERNO, con_landlock)) violacion = 1;
+    }
+    if (violacion) {
+        fprintf(stderr, "[flsh_sec]: Ruta fuera de la política del Sandbox prohibida.\n");
+        log_shell(args[0], "Intento escape sandbox", "CRITICAL");
+    }
+    return !violacion;
+}
+
+// --- Tuberías (Pipelines) ---
+
+/*
+ * Ejecuta 'etapa1 | etapa2 | ... | etapaN' con todas las etapas corriendo a la vez.
+ * Funcionalidad:
+ * 1. Conexión: Cada par de etapas se une con 'pipe2(O_CLOEXEC)'; el hijo recibe sus extremos como
+ * stdin/stdout vía dup2 y el resto de descriptores de pipe se cierran solos en exec.
+ * 2. Built-ins: Corren en un hijo de 'fork' para no bloquear el REPL (cat mueve datos con 'splice').
+ * Los cambios de estado que hagan (ej. 'cd') no afectan al shell, igual que en otros shells.
+ * 3. Externos: Se lanzan con 'lanzar_proceso' tras pasar las validaciones del Sandbox.
+ * 4. Auditoría: Se recogen todos los estados con 'waitpid' y se registra UN evento para todo el
+ * pipeline (las etapas solo registran advertencias y errores propios).
+ * 5. Redirecciones: Cada etapa resuelve las suyas sobre la terna (stdin, stdout, stderr) que le da
+ * el pipeline; un '>' reemplaza al pipe hacia la etapa siguiente, que recibe EOF de inmediato.
+ */
+/*
+ * Terna de descriptores de un comando tras aplicar sus redirecciones. 'propios' son los archivos
+ * abiertos al resolverlas: quien lanza el comando los cierra con 'cerrar_destinos'.
+ */
+typedef struct {
+    int fds[3];
+    int propios[3];
+} destinos_t;
+
+void cerrar_destinos(destinos_t *d) {
+    for (int k = 0; k < 3; k++) if (d->propios[k] >= 0) { close(d->propios[k]); d->propios[k] = -1; }
+}
+
+// Cierra un archivo propio que ya ningún descriptor de la terna usa (ej. '>a >b': 'a' queda libre)
+static void soltar_destino(destinos_t *d, int fd) {
+    for (int k = 0; k < 3; k++) if (d->fds[k] == fd) return;
+    for (int k = 0; k < 3; k++) if (d->propios[k] == fd) { close(fd); d->propios[k] = -1; }
+}
+
+/*
+ * Aplica las redirecciones de 'c' sobre 'd->fds' (que llega con la terna por defecto), en orden y
+ * con la semántica de sh: '2>&1 >archivo' deja stderr en el stdout anterior, '>archivo 2>&1' manda
+ * ambos al archivo. Los archivos se abren a través del Sandbox.
+ * Retorna 0, o -1 si alguna falló (ya informado y sin descriptores abiertos).
+ */
+int resolver_redirecciones(const comando_t *c, destinos_t *d) {
+    for (int k = 0; k < 3; k++) d->propios[k] = -1;
+    for (const redireccion_t *r = c->redirecciones; r; r = r->sig) {
+        int anterior = d->fds[r->fd];
+        if (r->tipo == REDIR_DUPLICAR) {
+            d->fds[r->fd] = d->fds[r->origen];
+            soltar_destino(d, anterior);
+            continue;
+        }
+        // 0644 = rw-r--r--
+        int fd = (r->tipo == REDIR_ENTRADA) ? abrir_en_sandbox(r->destino, O_RDONLY, 0, "<")
+               : (r->tipo == REDIR_ANEXAR) ? abrir_en_sandbox(r->destino, O_WRONLY | O_CREAT | O_APPEND, 0644, ">>")
+               : abrir_en_sandbox(r->destino, O_WRONLY | O_CREAT | O_TRUNC, 0644, ">");
+        if (fd < 0) {
+            if (fd != SANDBOX_DENEGADO) reportar_error_sistema("redireccion");
+            cerrar_destinos(d);
+            return -1;
+        }
+        d->fds[r->fd] = fd;
+        soltar_destino(d, anterior);
+        for (int k = 0; k < 3; k++) if (d->propios[k] < 0) { d->propios[k] = fd; break; }
+    }
+    return 0;
+}
+
+/*
+ * Instala la terna de 'd' como 0/1/2 del propio shell (comando simple en primer plano: los built-ins
+ * corren aquí). Guarda en 'respaldo' copias de los descriptores reemplazados (-2: estaba cerrado) y
+ * toma de ellas las fuentes que son descriptores estándar ya pisados.
+ */
+void aplicar_destinos(destinos_t *d, int respaldo[3]) {
+    salida_volcar(); // Lo pendiente pertenece a comandos anteriores, no al destino nuevo
+    for (int k = 0; k < 3; k++) {
+        respaldo[k] = -1;
+        if (d->fds[k] != k && (respaldo[k] = fcntl(k, F_DUPFD_CLOEXEC, 10)) < 0) respaldo[k] = -2;
+    }
+    for (int k = 0; k < 3; k++) {
+        int origen = d->fds[k];
+        if (origen == k) continue;
+        if (origen <= STDERR_FILENO && respaldo[origen] >= 0) origen = respaldo[origen];
+        if (dup2(origen, k) < 0) reportar_error_sistema("redireccion");
+    }
+    cerrar_destinos(d);
+    entrada_redirigida = (respaldo[STDIN_FILENO] != -1);
+    salida_configurar();
+}
+
+void restaurar_destinos(const int respaldo[3]) {
+    salida_volcar();
+    for (int k = 0; k < 3; k++) {
+        if (respaldo[k] == -2) close(k);
+        else if (respaldo[k] >= 0) { dup2(respaldo[k], k); close(respaldo[k]); }
+    }
+    entrada_redirigida = 0;
+    salida_configurar();
+}
+
+/*
+ * 'ajeno' es el extremo de lectura del pipe de su propia salida (o -1): sin exec, O_CLOEXEC no lo cierra,
+ * y si el hijo lo conservara nunca recibiría EPIPE cuando el lector termina antes (ej. 'cat f | head').
+ */
+static pid_t lanzar_builtin(char **args, const int fds[3], pid_t grupo, int ajeno) {
+    salida_volcar(); // El hijo no debe heredar (y duplicar) salida pendiente del shell
+    pid_t pid = fork();
+    if (pid != 0) {
+        if (pid < 0) reportar_error_sistema(args[0]);
+        else if (grupo >= 0) setpgid(pid, grupo ? grupo : pid);
+        return pid;
+    }
+    if (ajeno >= 0) close(ajeno);
+    if (instalar_descriptores(fds) != 0) _exit(126);
+    salida_configurar();
+    if (grupo >= 0) setpgid(0, grupo);
+    signal(SIGTTOU, SIG_DFL);
+    logger.omitir_info = 1;
+    // Fuera del proceso del shell, los built-ins que abren rutas quedan bajo el mismo Landlock que los externos
+    const builtin_t *b = buscar_builtin(args[0]);
+    if (b && b->politica == SB_RUTAS && landlock.ruleset_fd >= 0 && aplicar_landlock_en_hijo() != 0) _exit(126);
+    ejecutar_builtin(args);
+    salida_volcar();
+    _exit(estado_builtin);
+}
+
+/*
+ * Valida el Sandbox de las etapas externas antes de lanzar ninguna.
+ * Retorna la cantidad de etapas, o -1 si la línea no debe ejecutarse.
+ */
+static int preparar_etapas(const linea_t *linea) {
+    int n = linea->n_comandos;
+    for (int i = 0; i < n; i++) {
+        char **args = linea->comandos[i].argv;
+        if (!es_builtin(args[0]) && !validar_argumentos_externos(args)) return -1;
+    }
+    return n;
+}
+
+/*
+ * Lanza las 'n' etapas conectadas. 'entrada' es el stdin de la primera etapa y 'grupo' el grupo de
+ * procesos (-1 = el del shell, 0 = nuevo grupo liderado por la primera etapa). Deja los pids en
+ * 'pids' (-1 si una etapa no pudo lanzarse) y retorna cuántas etapas se intentaron lanzar.
+ */
+static int lanzar_etapas(const linea_t *linea, int entrada, pid_t grupo, pid_t *pids) {
+    int lanzadas = 0, n = linea->n_comandos;
+    for (int i = 0; i < n; i++) {
+        int canal[2] = { -1, -1 }, salida = STDOUT_FILENO;
+        if (i < n - 1) {
+            if (pipe2(canal, O_CLOEXEC) != 0) { reportar_error_sistema("pipeline"); break; }
+            salida = canal[1];
+        }
+        char **args = linea->comandos[i].argv;
+        destinos_t d = { .fds = { entrada, salida, STDERR_FILENO } };
+        pids[i] = -1;
+        if (resolver_redirecciones(&linea->comandos[i], &d) == 0) {
+            pids[i] = es_builtin(args[0]) ? lanzar_builtin(args, d.fds, grupo, canal[0])
+                                          : lanzar_proceso(args, d.fds, grupo);
+            cerrar_destinos(&d);
+        }
+        // Las demás etapas se unen al grupo de la primera
+        if (grupo == 0 && pids[i] > 0) grupo = pids[i];
+        lanzadas++;
+        // El padre no conserva extremos: así cada lector ve EOF cuando su escritor termina
+        if (entrada != STDIN_FILENO) close(entrada);
+        if (salida != STDOUT_FILENO) close(salida);
+        entrada = canal[0];
+    }
+    if (entrada != STDIN_FILENO && entrada >= 0) close(entrada);
+    return lanzadas;
+}
+
+// Estado de salida a partir del status de waitpid (128 + señal si terminó por una señal)
+static int codigo_salida(int status) {
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/*
+ * Ejecuta un pipeline en primer plano. Retorna el estado de la última etapa.
+ */
+int ejecutar_pipeline(const linea_t *linea) {
+    int n = preparar_etapas(linea);
+    if (n < 0) return 2;
+
+    // Sin tope de etapas: los pids se dimensionan con la línea
+    pid_t *pids = malloc((size_t)n * sizeof(pid_t));
+    if (!pids) { reportar_error_sistema("pipeline"); return 1; }
+    int lanzadas = lanzar_etapas(linea, STDIN_FILENO, -1, pids);
+
+    // Un solo registro de auditoría con los estados de todas las etapas
+    char msg[LOG_MAX_MSG];
+    size_t usado = 0;
+    int fallos = 0, estado = 127;
+    for (int i = 0; i < lanzadas; i++) {
+        estado = 127; // No se pudo lanzar (el lanzador ya informó el motivo)
+        if (pids[i] > 0) {
+            int st;
+            struct rusage ru;
+            wait4(pids[i], &st, 0, &ru);
+            telemetria_hijo(&ru);
+            estado = codigo_salida(st);
+        }
+        // SIGPIPE en una etapa intermedia es el cierre normal (ej. 'yes | head'), no un fallo
+        if (estado != 0 && !(estado == 128 + SIGPIPE && i < n - 1)) fallos++;
+        int escrito = snprintf(msg + usado, sizeof(msg) - usado, "%s%s=%d", i ? " | " : "Etapas: ", linea->comandos[i].argv[0], estado);
+        if (escrito > 0) usado = ((size_t)escrito < sizeof(msg) - usado) ? usado + (size_t)escrito : sizeof(msg) - 1;
+    }
+    free(pids);
+    if (lanzadas < n) fallos++;
+    log_shell("pipeline", msg, fallos ? "ERROR" : "INFO");
+    return (lanzadas == n) ? estado : 1;
+}
+
+// --- Control de Trabajos (Segundo Plano) ---
+
+/*
+ * Tabla de trabajos lanzados con '&'. Cada trabajo (un comando o un pipeline completo) corre en su
+ * propio grupo de procesos, de modo que 'fg', 'bg' y 'kill %N' señalizan todas sus etapas.
+ * Recolección sin bloqueo:
+ * - El manejador de SIGCHLD solo escribe un byte en un self-pipe no bloqueante (async-signal-safe).
+ * - Antes de cada prompt, 'recoger_trabajos' vacía el pipe y, solo si hubo avisos, recoge con
+ * waitpid(-1, WNOHANG | WUNTRACED | WCONTINUED). Los comandos en primer plano ya fueron esperados
+ * por pid, así que aquí solo quedan hijos de trabajos.
+ * - Cada trabajo terminado se anuncia en consola y se registra con su código de salida y tiempo real.
+ */
+#define TRABAJOS_MAX 64
+#define TRABAJO_MAX_COMANDO 256
+
+typedef enum { TRABAJO_LIBRE, TRABAJO_EJECUTANDO, TRABAJO_DETENIDO, TRABAJO_TERMINADO } estado_trabajo_t;
+
+typedef struct {
+    int id;
+    estado_trabajo_t estado;
+    pid_t pgid;
+    pid_t *pids;                      // Uno por etapa (-1 = ya terminó); se libera con el trabajo
+    int n_pids, vivos;
+    int codigo;                       // Estado de la última etapa
+    struct timespec inicio;
+    char comando[TRABAJO_MAX_COMANDO];
+} trabajo_t;
+
+static struct {
+    trabajo_t tabla[TRABAJOS_MAX];
+    int aviso[2];                     // Self-pipe de SIGCHLD
+    int ultimo;                       // Índice del trabajo actual ('+') o -1
+} trabajos = { .aviso = { -1, -1 }, .ultimo = -1 };
+
+static void manejador_sigchld(int senal) {
+    (void)senal;
+    int errno_guardado = errno;
+    char c = 0;
+    if (write(trabajos.aviso[1], &c, 1) < 0) {} // Pipe lleno: ya hay avisos pendientes
+    errno = errno_guardado;
+}
+
+/*
+ * Instala el self-pipe y el manejador de SIGCHLD. SIGTTOU se ignora para que el shell pueda
+ * recuperar la terminal con 'tcsetpgrp' después de un 'fg'.
+ */
+void iniciar_trabajos(void) {
+    if (pipe2(trabajos.aviso, O_CLOEXEC | O_NONBLOCK) != 0) { reportar_error_sistema("jobs"); return; }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = manejador_sigchld;
+    sa.sa_flags = SA_RESTART; // fgets/waitpid del REPL se reanudan solos
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+    signal(SIGTTOU, SIG_IGN);
+}
+
+static double segundos_desde(const struct timespec *inicio) {
+    struct timespec ahora;
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    return (ahora.tv_sec - inicio->tv_sec) + (ahora.tv_nsec - inicio->tv_nsec) / 1e9;
+}
+
+// Aplica un status de waitpid al trabajo dueño de 'pid' (los pids desconocidos se ignoran)
+static void actualizar_trabajo(pid_t pid, int status) {
+    for (int i = 0; i < TRABAJOS_MAX; i++) {
+        trabajo_t *t = &trabajos.tabla[i];
+        if (t->estado == TRABAJO_LIBRE || t->estado == TRABAJO_TERMINADO) continue;
+        for (int k = 0; k < t->n_pids; k++) {
+            if (t->pids[k] != pid) continue;
+            if (WIFSTOPPED(status)) { t->estado = TRABAJO_DETENIDO; return; }
+            if (WIFCONTINUED(status)) { t->estado = TRABAJO_EJECUTANDO; return; }
+            t->pids[k] = -1;
+            if (k == t->n_pids - 1) t->codigo = codigo_salida(status);
+            if (--t->vivos == 0) t->estado = TRABAJO_TERMINADO;
+            return;
+        }
+    }
+}
+
+// Registra y libera los trabajos terminados. 'anunciar' imprime la línea "[N] Hecho" en consola.
+static void cerrar_trabajos_terminados(int anunciar) {
+    for (int i = 0; i < TRABAJOS_MAX; i++) {
+        trabajo_t *t = &trabajos.tabla[i];
+        if (t->estado != TRABAJO_TERMINADO) continue;
+        double segundos = segundos_desde(&t->inicio);
+        if (anunciar) {
+            if (t->codigo == 0) fprintf(stderr, "[%d]  Hecho\t\t%s\n", t->id, t->comando);
+            else fprintf(stderr, "[%d]  Salida %d\t%s\n", t->id, t->codigo, t->comando);
+        }
+        char msg[LOG_MAX_MSG];
+        snprintf(msg, sizeof(msg), "Trabajo [%d] finalizado (Code: %d) en %.3f s: %s", t->id, t->codigo, segundos, t->comando);
+        log_shell("jobs", msg, t->codigo == 0 ? "INFO" : "ERROR");
+        free(t->pids);
+        t->pids = NULL;
+        t->estado = TRABAJO_LIBRE;
+        if (trabajos.ultimo == i) trabajos.ultimo = -1;
+    }
+    if (trabajos.ultimo < 0) {
+        for (int i = TRABAJOS_MAX - 1; i >= 0; i--) {
+            if (trabajos.tabla[i].estado != TRABAJO_LIBRE && (trabajos.ultimo < 0 || trabajos.tabla[i].id > trabajos.tabla[trabajos.ultimo].id)) trabajos.ultimo = i;
+        }
+    }
+}
+
+/*
+ * Recolección no bloqueante (antes de cada prompt). Sin avisos de SIGCHLD no hace syscalls extra
+ * más allá de un read() sobre el self-pipe.
+ */
+void recoger_trabajos(void) {
+    if (trabajos.aviso[0] < 0) return;
+    char basura[64];
+    int hubo_aviso = 0;
+    while (read(trabajos.aviso[0], basura, sizeof(basura)) > 0) hubo_aviso = 1;
+    if (!hubo_aviso) return;
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) actualizar_trabajo(pid, status);
+    cerrar_trabajos_terminados(1);
+}
+
+// Texto del trabajo para 'jobs' y el log, reconstruido del árbol (palabras ya sin comillas)
+static void describir_linea(const linea_t *linea, char *destino, size_t tam) {
+    size_t usado = 0;
+    destino[0] = '\0';
+    for (int i = 0; i < linea->n_comandos && usado < tam - 1; i++) {
+        const comando_t *c = &linea->comandos[i];
+        for (int k = 0; k < c->argc && usado < tam - 1; k++) {
+            int escrito = snprintf(destino + usado, tam - usado, "%s%s", (i && !k) ? " | " : (k ? " " : ""), c->argv[k]);
+            if (escrito > 0) usado += (size_t)escrito;
+        }
+        for (const redireccion_t *r = c->redirecciones; r && usado < tam - 1; r = r->sig) {
+            static const char *simbolos[] = { [REDIR_SALIDA] = ">", [REDIR_ANEXAR] = ">>", [REDIR_ENTRADA] = "<", [REDIR_DUPLICAR] = ">&" };
+            char fd[4] = "";
+            if (r->fd != (r->tipo == REDIR_ENTRADA ? STDIN_FILENO : STDOUT_FILENO)) snprintf(fd, sizeof(fd), "%d", r->fd);
+            int escrito = snprintf(destino + usado, tam - usado, " %s%s%s%s", fd, simbolos[r->tipo],
+                                   r->tipo == REDIR_DUPLICAR ? "" : " ", r->destino);
+            if (escrito > 0) usado += (size_t)escrito;
+        }
+    }
+}
+
+/*
+ * Lanza la línea (comando o pipeline) en segundo plano y la registra en la tabla de trabajos.
+ * Sin terminal interactiva, la primera etapa lee de /dev/null (como en shells sin control de trabajos).
+ */
+void ejecutar_en_segundo_plano(const linea_t *linea) {
+    int libre = -1, max_id = 0;
+    for (int i = 0; i < TRABAJOS_MAX; i++) {
+        if (trabajos.tabla[i].estado == TRABAJO_LIBRE) { if (libre < 0) libre = i; }
+        else if (trabajos.tabla[i].id > max_id) max_id = trabajos.tabla[i].id;
+    }
+    if (libre < 0) { fprintf(stderr, "flsh: demasiados trabajos en segundo plano (máx. %d)\n", TRABAJOS_MAX); estado_builtin = 1; return; }
+
+    int n = preparar_etapas(linea);
+    if (n < 0) { estado_builtin = 2; return; }
+    pid_t *pids = malloc((size_t)n * sizeof(pid_t));
+    if (!pids) { reportar_error_sistema("&"); return; }
+
+    int entrada = STDIN_FILENO;
+    if (!isatty(STDIN_FILENO)) entrada = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (entrada < 0) { reportar_error_sistema("&"); free(pids); return; }
+
+    trabajo_t *t = &trabajos.tabla[libre];
+    memset(t, 0, sizeof(*t));
+    t->pids = pids;
+    clock_gettime(CLOCK_MONOTONIC, &t->inicio);
+    int lanzadas = lanzar_etapas(linea, entrada, 0, t->pids);
+    t->id = max_id + 1;
+    t->n_pids = lanzadas;
+    t->codigo = 127;
+    describir_linea(linea, t->comando, sizeof(t->comando));
+    for (int i = 0; i < lanzadas; i++) {
+        if (t->pids[i] <= 0) continue;
+        if (!t->pgid) t->pgid = t->pids[i];
+        t->vivos++;
+    }
+    if (t->vivos == 0) { free(t->pids); t->pids = NULL; t->estado = TRABAJO_LIBRE; estado_builtin = 127; return; }
+    t->estado = TRABAJO_EJECUTANDO;
+    trabajos.ultimo = libre;
+    fprintf(stderr, "[%d] %d\n", t->id, (int)t->pgid);
+    char msg[LOG_MAX_MSG];
+    snprintf(msg, sizeof(msg), "Trabajo [%d] iniciado (pgid %d): %s", t->id, (int)t->pgid, t->comando);
+    log_shell("jobs", msg, "INFO");
+}
+
+/*
+ * Traduce "%N", "%%", "%+" o nada (trabajo actual) a un trabajo de la tabla. Informa si no existe.
+ */
+static trabajo_t *buscar_trabajo(const char *especificacion, const char *contexto) {
+    if (!especificacion || strcmp(especificacion, "%%") == 0 || strcmp(especificacion, "%+") == 0) {
+        if (trabajos.ultimo >= 0) return &trabajos.tabla[trabajos.ultimo];
+    } else {
+        const char *num = (especificacion[0] == '%') ? especificacion + 1 : especificacion;
+        int id = atoi(num);
+        for (int i = 0; i < TRABAJOS_MAX; i++) {
+            trabajo_t *t = &trabajos.tabla[i];
+            if (t->estado != TRABAJO_LIBRE && t->estado != TRABAJO_TERMINADO && t->id == id) return t;
+        }
+    }
+    fprintf(stderr, "%s: %s: no existe ese trabajo\n", contexto, especificacion ? especificacion : "actual");
+    estado_builtin = 1;
+    return NULL;
+}
+
+// Espera (bloqueando) a que el trabajo termine o se detenga
+static void esperar_trabajo(trabajo_t *t, int opciones) {
+    while (t->vivos > 0 && t->estado != TRABAJO_DETENIDO) {
+        int status;
+        struct rusage ru;
+        pid_t pid = wait4(-t->pgid, &status, opciones, &ru);
+        if (pid > 0) telemetria_hijo(&ru);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            // Sin hijos pendientes (recogidos por otra vía): damos el trabajo por terminado
+            t->vivos = 0; t->estado = TRABAJO_TERMINADO;
+            break;
+        }
+        actualizar_trabajo(pid, status);
+    }
+}
+
+// --- Comandos Built-in: jobs, fg, bg, wait, kill (Control de Trabajos) ---
+
+/*
+ * Lista los trabajos en segundo plano con su estado.
+ * Formato: [N]+  Estado  comando  ('+' marca el trabajo actual, destino por defecto de fg/bg).
+ */
+void ejecutar_jobs(char **args) {
+    (void)args;
+    recoger_trabajos();
+    for (int i = 0; i < TRABAJOS_MAX; i++) {
+        trabajo_t *t = &trabajos.tabla[i];
+        if (t->estado == TRABAJO_LIBRE || t->estado == TRABAJO_TERMINADO) continue;
+        salida_printf("[%d]%c  %-12s %s\n", t->id, i == trabajos.ultimo ? '+' : ' ',
+               t->estado == TRABAJO_DETENIDO ? "Detenido" : "Ejecutando", t->comando);
+    }
+}
+
+/*
+ * Trae un trabajo a primer plano.
+ * Funcionalidad:
+ * 1. Terminal: Si el shell controla una terminal, se la cede al grupo del trabajo ('tcsetpgrp'),
+ * de modo que Ctrl-C/Ctrl-Z afectan solo al trabajo.
+ * 2. Reanudación: Si estaba detenido, le envía SIGCONT a todo el grupo.
+ * 3. Espera: Bloquea con waitpid(WUNTRACED) hasta que termine o se vuelva a detener.
+ * 4. Restauración: Recupera la terminal para el shell.
+ */
+void ejecutar_fg(char **args) {
+    recoger_trabajos();
+    trabajo_t *t = buscar_trabajo(args[1], "fg");
+    if (!t) return;
+    salida_printf("%s\n", t->comando);
+    salida_volcar();
+
+    int terminal = isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp();
+    if (terminal) tcsetpgrp(STDIN_FILENO, t->pgid);
+    if (t->estado == TRABAJO_DETENIDO) { t->estado = TRABAJO_EJECUTANDO; kill(-t->pgid, SIGCONT); }
+    esperar_trabajo(t, WUNTRACED);
+    if (terminal) tcsetpgrp(STDIN_FILENO, getpgrp());
+
+    if (t->estado == TRABAJO_DETENIDO) {
+        fprintf(stderr, "\n[%d]+  Detenido\t%s\n", t->id, t->comando);
+        trabajos.ultimo = (int)(t - trabajos.tabla);
+        return;
+    }
+    estado_builtin = t->codigo;
+    cerrar_trabajos_terminados(0);
+}
+
+/*
+ * Reanuda en segundo plano un trabajo detenido (SIGCONT al grupo completo).
+ */
+void ejecutar_bg(char **args) {
+    recoger_trabajos();
+    trabajo_t *t = buscar_trabajo(args[1], "bg");
+    if (!t) return;
+    if (kill(-t->pgid, SIGCONT) != 0) { reportar_error_sistema("bg"); return; }
+    t->estado = TRABAJO_EJECUTANDO;
+    fprintf(stderr, "[%d]+ %s &\n", t->id, t->comando);
+    log_shell("bg", t->comando, "INFO");
+}
+
+/*
+ * Espera a que terminen todos los trabajos ('wait') o los indicados ('wait %1 %3').
+ * El estado final es el del último trabajo esperado.
+ */
+void ejecutar_wait(char **args) {
+    recoger_trabajos();
+    if (!args[1]) {
+        for (int i = 0; i < TRABAJOS_MAX; i++) {
+            trabajo_t *t = &trabajos.tabla[i];
+            if (t->estado == TRABAJO_EJECUTANDO) { esperar_trabajo(t, 0); estado_builtin = t->codigo; }
+        }
+    } else {
+        for (int a = 1; args[a]; a++) {
+            trabajo_t *t = buscar_trabajo(args[a], "wait");
+            if (t) { esperar_trabajo(t, 0); estado_builtin = t->codigo; }
+        }
+    }
+    cerrar_trabajos_terminados(1);
+}
+
+// Nombres de señales aceptados por 'kill -NOMBRE' (además del número)
+static int senal_por_nombre(const char *nombre) {
+    static const struct { const char *nombre; int senal; } tabla[] = {
+        { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "KILL", SIGKILL }, { "USR1", SIGUSR1 },
+        { "USR2", SIGUSR2 }, { "TERM", SIGTERM }, { "CONT", SIGCONT }, { "STOP", SIGSTOP }, { "TSTP", SIGTSTP },
+    };
+    if (strncmp(nombre, "SIG", 3) == 0) nombre += 3;
+    for (size_t i = 0; i < sizeof(tabla) / sizeof(tabla[0]); i++) if (strcmp(tabla[i].nombre, nombre) == 0) return tabla[i].senal;
+    char *fin;
+    long n = strtol(nombre, &fin, 10);
+    return (*fin == '\0' && n >= 0 && n < NSIG) ? (int)n : -1;
+}
+
+/*
+ * Envía una señal (por defecto SIGTERM) a trabajos ('%N', a todo su grupo) o a pids.
+ * Uso: kill [-SEÑAL] %N|PID...
+ */
+void ejecutar_kill(char **args) {
+    int senal = SIGTERM, i = 1;
+    if (args[1] && args[1][0] == '-') {
+        senal = senal_por_nombre(args[1] + 1);
+        if (senal < 0) { fprintf(stderr, "kill: señal inválida: %s\n", args[1] + 1); estado_builtin = 2; return; }
+        i = 2;
+    }
+    if (!args[i]) { fprintf(stderr, "kill: uso: kill [-SEÑAL] %%N|PID...\n"); estado_builtin = 2; return; }
+    recoger_trabajos();
+    for (; args[i]; i++) {
+        pid_t destino;
+        if (args[i][0] == '%') {
+            trabajo_t *t = buscar_trabajo(args[i], "kill");
+            if (!t) continue;
+            destino = -t->pgid;
+            if (senal == SIGCONT) t->estado = TRABAJO_EJECUTANDO;
+        } else {
+            char *fin;
+            destino = (pid_t)strtol(args[i], &fin, 10);
+            if (*fin != '\0' || destino <= 0) { fprintf(stderr, "kill: %s: argumento inválido\n", args[i]); estado_builtin = 2; continue; }
+        }
+        if (kill(destino, senal) != 0) { reportar_error_sistema("kill"); continue; }
+        char msg[96];
+        snprintf(msg, sizeof(msg), "Señal %d enviada a %s", senal, args[i]);
+        log_shell("kill", msg, "WARNING"); // Warning porque puede terminar procesos
+    }
+}
+
+// --- Editor de Línea Interactivo ---
+
+/*
+ * En una terminal, las líneas se leen con un editor propio en lugar de 'getline'. Por lotes no cambia nada.
+ * Funcionalidad:
+ * 1. Modo Crudo: La terminal pasa a modo crudo solo mientras se edita y vuelve a su modo original antes
+ * de ejecutar, así los comandos y las confirmaciones la encuentran como siempre. Cada tecla se procesa
+ * apenas llega. La línea se redibuja con una sola escritura: '\r', prompt, texto visible, borrado del
+ * resto y posición del cursor. Insertar o borrar al final y mover el cursor escriben solo lo que cambia.
+ * Una línea más ancha que la terminal se desplaza para mantener el cursor visible.
+ * 2. Teclas: flechas, Inicio/Fin, Ctrl-A/E/B/F, Alt-B/F y Ctrl-flechas (palabras), Backspace/Supr,
+ * Ctrl-K/U/W, Ctrl-L, Ctrl-C (descarta la línea), Ctrl-D (fin de la sesión con la línea vacía),
+ * arriba/abajo y Ctrl-P/N (historial), Ctrl-R (búsqueda inversa incremental) y Tab (completado).
+ * 3. Historial: '~/.flsh_historial' (o FLSH_HISTORIAL; vacío lo desactiva) es un archivo de solo agregado
+ * con una entrada por comando terminada en '\0', así admite comandos con saltos de línea. Se mapea con
+ * una reserva que cubre el crecimiento, y un índice de desplazamientos da acceso directo a cada entrada.
+ * Las entradas que agregan otras sesiones se indexan antes de cada prompt. La búsqueda recorre el mapa
+ * hacia atrás con memmem por bloques y ubica la entrada por búsqueda binaria en el índice. No se
+ * registran las líneas vacías, las repetidas ni las que empiezan con un espacio.
+ * 4. Completado: Completa built-ins y comandos de PATH en la primera palabra, y rutas en el resto. Los
+ * directorios se abren por el Sandbox con el derecho del comando que recibirá la ruta, sin avisos ni
+ * registro (un Tab no es un acceso). Sus listados quedan en una cache vigilada con inotify, o por mtime
+ * si no hay inotify: un cambio en el directorio invalida solo su listado. Recargar la política vacía la
+ * cache. Con varios candidatos se completa el prefijo común y el segundo Tab los lista.
+ */
+#define EDITOR_ENTRADA 256                      // Bytes leídos de la terminal por read()
+#define EDITOR_ESPERA_ESCAPE_MS 50              // Espera del resto de una secuencia de escape
+#define EDITOR_MAX_CONSULTA 256                 // Largo máximo de la consulta de Ctrl-R
+#define EDITOR_MAX_LISTA 200                    // Candidatos que se listan con el segundo Tab
+#define EDITOR_CACHE_DIRECTORIOS 64
+#define EDITOR_ESPECIALES " \t\\'\"|&<>*?[]#"   // Se escapan con '\' al completar fuera de comillas
+#define HISTORIAL_RESERVA (16 * 1024 * 1024)    // Crecimiento que cubre el mapeo sin volver a mapear
+#define HISTORIAL_MAX_BYTES (32 * 1024 * 1024)  // Al abrir, por encima de esto se conserva la mitad más nueva
+#define HISTORIAL_BLOQUE_BUSQUEDA (64 * 1024)
+#define COMPLETADO_EVENTOS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+enum {
+    TECLA_NINGUNA = 1000, TECLA_REDIMENSION, TECLA_ESCAPE, TECLA_IZQUIERDA, TECLA_DERECHA, TECLA_ARRIBA,
+    TECLA_ABAJO, TECLA_INICIO, TECLA_FIN, TECLA_SUPRIMIR, TECLA_PALABRA_IZQ, TECLA_PALABRA_DER,
+};
+
+// --- Historial Persistente (archivo mapeado) ---
+
+static struct {
+    int fd;                     // -1: solo en memoria (sin archivo o desactivado)
+    char *datos;                // Mapa del archivo, o buffer en memoria
+    size_t reservado;           // Bytes mapeados (o capacidad del buffer)
+    size_t usado;               // Bytes indexados (hasta el último '\0')
+    size_t *inicios;            // Desplazamiento de cada entrada
+    size_t n, cap;
+} historial = { .fd = -1 };
+
+static size_t historial_largo(size_t k) {
+    size_t fin = (k + 1 < historial.n) ? historial.inicios[k + 1] : historial.usado;
+    return fin - historial.inicios[k] - 1;
+}
+
+// Indexa las entradas completas hasta 'fin' (una entrada a medio escribir por otra sesión espera)
+static void historial_indexar(size_t fin) {
+    while (historial.usado < fin) {
+        const char *cero = memchr(historial.datos + historial.usado, '\0', fin - historial.usado);
+        if (!cero) break;
+        if (reservar_vector((void **)&historial.inicios, &historial.cap, historial.n + 1, sizeof(size_t)) != 0) break;
+        historial.inicios[historial.n++] = historial.usado;
+        historial.usado = (size_t)(cero + 1 - historial.datos);
+    }
+}
+
+// Mapea el archivo con HISTORIAL_RESERVA bytes de margen. Retorna 0 o -1.
+static int historial_mapear(size_t tam) {
+    if (historial.datos && tam <= historial.reservado) return 0;
+    size_t pagina = (size_t)sysconf(_SC_PAGESIZE);
+    size_t reserva = (tam + HISTORIAL_RESERVA + pagina - 1) & ~(pagina - 1);
+    char *mapa = mmap(NULL, reserva, PROT_READ, MAP_SHARED, historial.fd, 0);
+    if (mapa == MAP_FAILED) return -1;
+    if (historial.datos) munmap(historial.datos, historial.reservado);
+    historial.datos = mapa;
+    historial.reservado = reserva;
+    return 0;
+}
+
+// Indexa lo que se agregó al archivo desde la última vez (esta sesión u otras)
+static void historial_sincronizar(void) {
+    struct stat st;
+    if (historial.fd < 0 || fstat(historial.fd, &st) != 0 || (size_t)st.st_size <= historial.usado) return;
+    if (historial_mapear((size_t)st.st_size) == 0) historial_indexar((size_t)st.st_size);
+}
+
+/*
+ * Conserva la mitad más nueva de un historial demasiado grande. Se escribe un archivo nuevo y se
+ * renombra encima, así otra sesión abierta sigue con el anterior. Retorna el descriptor a usar.
+ */
+static int compactar_historial(int fd, const char *ruta, size_t tam) {
+    char *mapa = mmap(NULL, tam, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapa == MAP_FAILED) return fd;
+    const char *corte = memchr(mapa + tam / 2, '\0', tam - tam / 2);
+    char temporal[PATH_MAX + 40];
+    snprintf(temporal, sizeof(temporal), "%s.tmp", ruta);
+    int nuevo = corte ? open(temporal, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600) : -1;
+    if (nuevo >= 0) {
+        size_t resto = tam - (size_t)(corte + 1 - mapa);
+        escribir_todo(nuevo, corte + 1, resto);
+        if (lseek(nuevo, 0, SEEK_CUR) == (off_t)resto && rename(temporal, ruta) == 0) {
+            close(fd);
+            fd = open(ruta, O_RDWR | O_APPEND | O_CLOEXEC | O_NOFOLLOW);
+        } else {
+            unlink(temporal);
+        }
+        close(nuevo);
+    }
+    munmap(mapa, tam);
+    return fd;
+}
+
+static void historial_iniciar(void) {
+    char ruta[PATH_MAX + 32];
+    const char *opcion = getenv("FLSH_HISTORIAL");
+    if (opcion && !*opcion) return;
+    if (opcion) snprintf(ruta, sizeof(ruta), "%s", opcion);
+    else snprintf(ruta, sizeof(ruta), "%s/.flsh_historial", sandbox.home_real);
+    int fd = open(ruta, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) close(fd);
+        fprintf(stderr, "flsh: historial '%s' no disponible, se conserva solo en memoria\n", ruta);
+        return;
+    }
+    if ((size_t)st.st_size > HISTORIAL_MAX_BYTES) fd = compactar_historial(fd, ruta, (size_t)st.st_size);
+    historial.fd = fd;
+    if (fd >= 0) historial_sincronizar();
+}
+
+// Agrega una línea ejecutada (una sola escritura con O_APPEND: las sesiones no se intercalan)
+void historial_agregar(const char *linea, size_t largo) {
+    if (largo == 0 || linea[0] == ' ' || memchr(linea, '\0', largo)) return;
+    if (historial.n > 0) {
+        size_t k = historial.n - 1;
+        if (historial_largo(k) == largo && memcmp(historial.datos + historial.inicios[k], linea, largo) == 0) return;
+    }
+    if (historial.fd >= 0) {
+        struct iovec v[2] = { { (void *)linea, largo }, { "", 1 } };
+        if (writev(historial.fd, v, 2) == (ssize_t)(largo + 1)) { historial_sincronizar(); return; }
+        // Disco lleno o archivo inaccesible: el resto de la sesión sigue en memoria
+        if (historial.datos) munmap(historial.datos, historial.reservado);
+        close(historial.fd);
+        historial = (typeof(historial)){ .fd = -1 };
+    }
+    if (reservar_vector((void **)&historial.datos, &historial.reservado, historial.usado + largo + 1, 1) != 0) return;
+    memcpy(historial.datos + historial.usado, linea, largo);
+    historial.datos[historial.usado + largo] = '\0';
+    historial_indexar(historial.usado + largo + 1);
+}
+
+// Entrada más nueva con índice <= 'desde' que contiene 'q' (SIZE_MAX si no hay); '*pos' es el desplazamiento dentro de ella
+static size_t historial_buscar(const char *q, size_t nq, size_t desde, size_t *pos) {
+    if (nq == 0 || desde >= historial.n) return SIZE_MAX;
+    size_t fin = historial.inicios[desde] + historial_largo(desde);
+    // Hacia atrás por bloques; dentro de un bloque vale la última aparición
+    for (;;) {
+        size_t ini = fin > HISTORIAL_BLOQUE_BUSQUEDA ? fin - HISTORIAL_BLOQUE_BUSQUEDA : 0;
+        const char *ultima = NULL;
+        for (const char *p = historial.datos + ini; (p = memmem(p, (size_t)(historial.datos + fin - p), q, nq)); p++) ultima = p;
+        if (ultima) {
+            size_t desplazamiento = (size_t)(ultima - historial.datos), a = 0, b = historial.n;
+            while (b - a > 1) { size_t m = (a + b) / 2; if (historial.inicios[m] <= desplazamiento) a = m; else b = m; }
+            *pos = desplazamiento - historial.inicios[a];
+            return a;
+        }
+        if (ini == 0) return SIZE_MAX;
+        fin = ini + nq - 1; // Solapamiento: una aparición puede cruzar el borde del bloque
+    }
+}
+
+// --- Cache de Directorios para el Completado ---
+
+typedef struct {
+    char *ruta;                 // Absoluta y normalizada (NULL = ranura libre)
+    int comando;                // Índice en la política, o -1 para los directorios de PATH
+    int fd;
+    int vigilancia;             // inotify, o -1 (se revisa el mtime)
+    int nodo;                   // Cursor del trie si debajo hay reglas propias, o -1
+    int vigente;
+    struct timespec mtime;
+    unsigned long uso;
+    listado_t listado;
+} directorio_completado_t;
+
+typedef struct {
+    const char *nombre;         // En un listado de la cache o en la tabla de built-ins
+    int directorio;
+} candidato_t;
+
+static struct {
+    directorio_completado_t dirs[EDITOR_CACHE_DIRECTORIOS];
+    int inotify;
+    unsigned long reloj;
+    politica_t *politica;       // Política con la que se abrieron los directorios del Sandbox
+    listado_t lectura;          // Buffer de getdents64 compartido
+    candidato_t *candidatos;
+    size_t n_candidatos, cap_candidatos;
+} completado = { .inotify = -1 };
+
+static void descartar_directorio_completado(directorio_completado_t *d) {
+    if (d->vigilancia >= 0) inotify_rm_watch(completado.inotify, d->vigilancia);
+    close(d->fd);
+    liberar_listado(&d->listado);
+    free(d->ruta);
+    memset(d, 0, sizeof(*d));
+}
+
+// Aplica los eventos pendientes: un cambio invalida el listado; si el directorio desaparece, se descarta
+static void revisar_completado(void) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while (completado.inotify >= 0 && (n = read(completado.inotify, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            for (int i = 0; i < EDITOR_CACHE_DIRECTORIOS; i++) {
+                directorio_completado_t *d = &completado.dirs[i];
+                if (!d->ruta || d->vigilancia != ev->wd) continue;
+                if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) { d->vigilancia = -1; descartar_directorio_completado(d); }
+                else d->vigente = 0;
+            }
+        }
+    }
+    // Política recargada: los directorios del Sandbox se vuelven a abrir con la nueva
+    politica_t *p = politica_adquirir();
+    if (p == completado.politica) { politica_soltar(p); return; }
+    for (int i = 0; i < EDITOR_CACHE_DIRECTORIOS; i++)
+        if (completado.dirs[i].ruta && completado.dirs[i].comando >= 0) descartar_directorio_completado(&completado.dirs[i]);
+    politica_soltar(completado.politica);
+    completado.politica = p;
+}
+
+/*
+ * Listado de 'ruta' (tal como se escribió; "" = directorio actual) para el comando 'comando', desde la
+ * cache si sigue vigente. NULL si la política lo deniega o no se puede abrir.
+ */
+static directorio_completado_t *directorio_completado(const char *ruta, int comando) {
+    char absoluta[PATH_MAX];
+    if (comando >= 0 && normalizar_ruta_usuario(*ruta ? ruta : ".", absoluta, sizeof(absoluta)) != 0) return NULL;
+    if (comando < 0) snprintf(absoluta, sizeof(absoluta), "%s", ruta);
+    directorio_completado_t *d = NULL, *libre = NULL;
+    for (int i = 0; i < EDITOR_CACHE_DIRECTORIOS && !d; i++) {
+        directorio_completado_t *e = &completado.dirs[i];
+        if (e->ruta && e->comando == comando && strcmp(e->ruta, absoluta) == 0) d = e;
+        else if (!libre || (libre->ruta && (!e->ruta || e->uso < libre->uso))) libre = e;
+    }
+    if (!d) {
+        // Ranura libre o la usada hace más tiempo
+        if (libre->ruta) descartar_directorio_completado(libre);
+        int fd, nodo = -1;
+        if (comando >= 0) {
+            solicitud_sandbox_t s = { .flags = O_RDONLY | O_DIRECTORY, .comando = comando, .requerido = ACCESO_LECTURA };
+            fd = completado.politica ? resolver_en_sandbox(completado.politica, absoluta, &s, &nodo) : -1;
+        } else {
+            fd = open(absoluta, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        }
+        if (fd < 0 || !(libre->ruta = strdup(absoluta))) { if (fd >= 0) close(fd); return NULL; }
+        d = libre;
+        d->comando = comando;
+        d->fd = fd;
+        d->nodo = (nodo >= 0 && completado.politica->nodos[nodo].excepciones) ? nodo : -1;
+        d->vigilancia = completado.inotify >= 0 ? vigilar_descriptor(completado.inotify, fd, COMPLETADO_EVENTOS) : -1;
+    }
+    d->uso = ++completado.reloj;
+    struct stat st;
+    if (d->vigente && d->vigilancia < 0 && (fstat(d->fd, &st) != 0 || st.st_mtim.tv_sec != d->mtime.tv_sec || st.st_mtim.tv_nsec != d->mtime.tv_nsec)) d->vigente = 0;
+    if (!d->vigente) {
+        if (fstat(d->fd, &st) == 0) d->mtime = st.st_mtim;
+        liberar_listado(&d->listado);
+        memset(&d->listado, 0, sizeof(d->listado));
+        if (lseek(d->fd, 0, SEEK_SET) != 0 || leer_listado_compacto(d->fd, &completado.lectura, &d->listado) != 0) return NULL;
+        d->vigente = 1;
+    }
+    return d;
+}
+
+static void agregar_candidato(const char *nombre, int directorio) {
+    if (reservar_vector((void **)&completado.candidatos, &completado.cap_candidatos, completado.n_candidatos + 1, sizeof(candidato_t)) != 0) return;
+    completado.candidatos[completado.n_candidatos++] = (candidato_t){ nombre, directorio };
+}
+
+// Entradas de 'ruta' que empiezan con 'prefijo' (las ocultas solo si el prefijo empieza con '.')
+static void candidatos_de_directorio(const char *ruta, const char *prefijo, int comando) {
+    directorio_completado_t *d = directorio_completado(ruta, comando);
+    if (!d) return;
+    size_t largo = strlen(prefijo);
+    for (size_t i = 0; i < d->listado.n; i++) {
+        const struct linux_dirent64 *e = registro_ls(&d->listado, i);
+        const char *nombre = e->d_name;
+        if (strncmp(nombre, prefijo, largo) != 0 || (nombre[0] == '.' && prefijo[0] != '.')) continue;
+        if (nombre[0] == '.' && (nombre[1] == '\0' || (nombre[1] == '.' && nombre[2] == '\0'))) continue;
+        struct stat st;
+        int directorio = e->d_type == DT_DIR ||
+                         ((e->d_type == DT_LNK || e->d_type == DT_UNKNOWN) && fstatat(d->fd, nombre, &st, 0) == 0 && S_ISDIR(st.st_mode));
+        if (comando < 0) {
+            if (!directorio) agregar_candidato(nombre, 0); // PATH: archivos y enlaces
+            continue;
+        }
+        if (d->nodo >= 0) {
+            arbol_sandbox_t a = { .politica = completado.politica, .nodo = d->nodo, .comando = comando, .requerido = ACCESO_LECTURA }, hijo;
+            if (!arbol_descender(&a, nombre, &hijo)) continue;
+        }
+        agregar_candidato(nombre, directorio);
+    }
+}
+
+static int comparar_candidatos(const void *a, const void *b) {
+    return strcmp(((const candidato_t *)a)->nombre, ((const candidato_t *)b)->nombre);
+}
+
+// --- Terminal y Redibujado ---
+
+static struct {
+    int fd;                     // Terminal (stdin); el redibujado va a stdout
+    struct termios original;
+    int crudo;
+    char entrada[EDITOR_ENTRADA];   // Bytes leídos y aún no procesados
+    size_t entrada_pos, entrada_n;
+    char *buf;                  // Línea en edición (terminada en '\0')
+    size_t largo, cap, cursor;  // En bytes
+    size_t desplazamiento;      // Primer byte visible
+    int desactualizada;         // La pantalla no refleja la línea (se omitió un redibujado con bytes pendientes)
+    char prompt[PATH_MAX + EDITOR_MAX_CONSULTA + 64];
+    size_t prompt_largo;
+    int prompt_ancho;
+    int columnas;
+    size_t pos_historial;       // historial.n = la línea nueva
+    char *guardada;             // Línea nueva mientras se recorre el historial
+    int tabs;                   // Tabs seguidos sin cambios (el segundo lista los candidatos)
+    char *salida;               // Redibujado en construcción (una sola escritura)
+    size_t salida_largo, salida_cap;
+} editor = { .fd = -1 };
+
+static volatile sig_atomic_t editor_redimensionada = 1;
+
+static void manejador_redimension(int senal) {
+    (void)senal;
+    editor_redimensionada = 1;
+}
+
+static int es_continuacion_utf8(char c) { return ((unsigned char)c & 0xC0) == 0x80; }
+
+// Columnas de 'n' bytes UTF-8 (una por carácter; no contempla caracteres de doble ancho)
+static int ancho_texto(const char *s, size_t n) {
+    int ancho = 0;
+    for (size_t i = 0; i < n; i++) ancho += !es_continuacion_utf8(s[i]);
+    return ancho;
+}
+
+static size_t siguiente_caracter(const char *s, size_t largo, size_t i) {
+    if (i < largo) i++;
+    while (i < largo && es_continuacion_utf8(s[i])) i++;
+    return i;
+}
+
+static size_t anterior_caracter(const char *s, size_t i) {
+    if (i > 0) i--;
+    while (i > 0 && es_continuacion_utf8(s[i])) i--;
+    return i;
+}
+
+static void editor_agregar(const char *s, size_t n) {
+    if (reservar_vector((void **)&editor.salida, &editor.salida_cap, editor.salida_largo + n, 1) != 0) return;
+    memcpy(editor.salida + editor.salida_largo, s, n);
+    editor.salida_largo += n;
+}
+
+// Los caracteres de control (ej. un salto dentro de comillas) se muestran como '?' (una columna, como un byte)
+static void editor_agregar_visible(const char *s, size_t n) {
+    size_t inicio = 0;
+    for (size_t i = 0; i < n; i++) {
+        if ((unsigned char)s[i] >= 32 && s[i] != 127) continue;
+        editor_agregar(s + inicio, i - inicio);
+        editor_agregar("?", 1);
+        inicio = i + 1;
+    }
+    editor_agregar(s + inicio, n - inicio);
+}
+
+static void editor_volcar(void) {
+    escribir_todo(STDOUT_FILENO, editor.salida, editor.salida_largo);
+    editor.salida_largo = 0;
+}
+
+static void editor_fijar_prompt(const char *prompt) {
+    snprintf(editor.prompt, sizeof(editor.prompt), "%s", prompt);
+    editor.prompt_largo = strlen(editor.prompt);
+    editor.prompt_ancho = ancho_texto(editor.prompt, editor.prompt_largo);
+}
+
+// Columnas para el texto a la derecha del prompt visible ('*inicio_prompt': primer byte del prompt que se muestra)
+static int editor_disponible(size_t *inicio_prompt, int *ancho_prompt) {
+    if (editor_redimensionada) {
+        struct winsize ws;
+        editor_redimensionada = 0;
+        editor.columnas = (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) ? ws.ws_col : 80;
+    }
+    // Un prompt que no deja al menos 10 columnas se muestra desde su final
+    size_t p = 0;
+    int ancho = editor.prompt_ancho;
+    while (ancho > 0 && ancho + 11 > editor.columnas) { p = siguiente_caracter(editor.prompt, editor.prompt_largo, p); ancho--; }
+    *inicio_prompt = p;
+    *ancho_prompt = ancho;
+    return editor.columnas - ancho - 1 > 1 ? editor.columnas - ancho - 1 : 1;
+}
+
+static void editor_refrescar(void) {
+    size_t inicio_prompt;
+    int ancho_prompt, disponible = editor_disponible(&inicio_prompt, &ancho_prompt);
+    // Ventana que contiene al cursor
+    if (editor.cursor < editor.desplazamiento) editor.desplazamiento = editor.cursor;
+    int hasta_cursor = ancho_texto(editor.buf + editor.desplazamiento, editor.cursor - editor.desplazamiento);
+    while (hasta_cursor >= disponible) {
+        editor.desplazamiento = siguiente_caracter(editor.buf, editor.largo, editor.desplazamiento);
+        hasta_cursor--;
+    }
+    size_t fin = editor.desplazamiento;
+    for (int ancho = 0; fin < editor.largo && ancho < disponible; ancho++) fin = siguiente_caracter(editor.buf, editor.largo, fin);
+
+    char mover[24];
+    int columna = ancho_prompt + hasta_cursor;
+    editor.desactualizada = 0;
+    editor_agregar("\r", 1);
+    editor_agregar(editor.prompt + inicio_prompt, editor.prompt_largo - inicio_prompt);
+    editor_agregar_visible(editor.buf + editor.desplazamiento, fin - editor.desplazamiento);
+    editor_agregar("\x1b[K\r", 4);
+    if (columna > 0) editor_agregar(mover, (size_t)snprintf(mover, sizeof(mover), "\x1b[%dC", columna));
+    editor_volcar();
+}
+
+// Hay más bytes ya leídos: el redibujado espera al último (un pegado se dibuja una vez)
+static int editor_pendiente(void) { return editor.entrada_pos < editor.entrada_n; }
+
+// Próximo byte: -1 en EOF o error, -2 si vence 'espera_ms' (>= 0), -3 si una señal interrumpió la espera
+static int editor_byte(int espera_ms) {
+    if (!editor_pendiente()) {
+        if (espera_ms >= 0) {
+            struct pollfd p = { .fd = editor.fd, .events = POLLIN };
+            int r = poll(&p, 1, espera_ms);
+            if (r == 0) return -2;
+            if (r < 0) return errno == EINTR ? -3 : -1;
+        }
+        ssize_t n = read(editor.fd, editor.entrada, sizeof(editor.entrada));
+        if (n < 0 && errno == EINTR) return -3;
+        if (n <= 0) return -1;
+        editor.entrada_pos = 0;
+        editor.entrada_n = (size_t)n;
+    }
+    return (unsigned char)editor.entrada[editor.entrada_pos++];
+}
+
+// Próxima tecla: un byte, o TECLA_* para las secuencias de escape (CSI 'ESC [' y SS3 'ESC O')
+static int editor_tecla(void) {
+    int c = editor_byte(-1);
+    if (c == -3) return TECLA_REDIMENSION;
+    if (c != 27) return c;
+    int c1 = editor_byte(EDITOR_ESPERA_ESCAPE_MS);
+    if (c1 < 0) return TECLA_ESCAPE;
+    if (c1 == 'b' || c1 == 'B') return TECLA_PALABRA_IZQ; // Alt-B
+    if (c1 == 'f' || c1 == 'F') return TECLA_PALABRA_DER; // Alt-F
+    if (c1 != '[' && c1 != 'O') return TECLA_NINGUNA;
+    int parametros[2] = { 0, 0 }, n = 0, fin;
+    while ((fin = editor_byte(EDITOR_ESPERA_ESCAPE_MS)) >= 0 && ((fin >= '0' && fin <= '9') || fin == ';')) {
+        if (fin == ';') n = 1;
+        else if (parametros[n] < 1000) parametros[n] = parametros[n] * 10 + (fin - '0');
+    }
+    int control = parametros[1] == 5 || parametros[1] == 3; // Ctrl o Alt + flecha
+    switch (fin) {
+        case 'A': return TECLA_ARRIBA;
+        case 'B': return TECLA_ABAJO;
+        case 'C': return control ? TECLA_PALABRA_DER : TECLA_DERECHA;
+        case 'D': return control ? TECLA_PALABRA_IZQ : TECLA_IZQUIERDA;
+        case 'H': return TECLA_INICIO;
+        case 'F': return TECLA_FIN;
+        case '~':
+            if (parametros[0] == 1 || parametros[0] == 7) return TECLA_INICIO;
+            if (parametros[0] == 4 || parametros[0] == 8) return TECLA_FIN;
+            if (parametros[0] == 3) return TECLA_SUPRIMIR;
+    }
+    return TECLA_NINGUNA;
+}
+
+static int editor_reservar(size_t n) {
+    if (n + 1 <= editor.cap) return 0;
+    size_t nueva = editor.cap ? editor.cap : 256;
+    while (nueva < n + 1) nueva *= 2;
+    char *buf = realloc(editor.buf, nueva);
+    if (!buf) return -1;
+    editor.buf = buf;
+    editor.cap = nueva;
+    return 0;
+}
+
+static void editor_insertar(const char *s, size_t n) {
+    if (editor_reservar(editor.largo + n) != 0) return;
+    memmove(editor.buf + editor.cursor + n, editor.buf + editor.cursor, editor.largo - editor.cursor + 1);
+    memcpy(editor.buf + editor.cursor, s, n);
+    editor.largo += n;
+    editor.cursor += n;
+}
+
+static void editor_borrar(size_t desde, size_t hasta) {
+    memmove(editor.buf + desde, editor.buf + hasta, editor.largo - hasta + 1);
+    editor.largo -= hasta - desde;
+    editor.cursor = desde;
+}
+
+static void editor_reemplazar(const char *s, size_t n) {
+    if (editor_reservar(n) != 0) return;
+    memcpy(editor.buf, s, n);
+    editor.buf[n] = '\0';
+    editor.largo = editor.cursor = n;
+    editor.desplazamiento = 0;
+}
+
+// Columna del cursor dentro de la ventana si cabe en ella sin desplazarla, o -1
+static int editor_columna_visible(size_t cursor) {
+    size_t inicio_prompt;
+    int ancho_prompt, disponible = editor_disponible(&inicio_prompt, &ancho_prompt);
+    if (cursor < editor.desplazamiento) return -1;
+    int columna = ancho_texto(editor.buf + editor.desplazamiento, cursor - editor.desplazamiento);
+    return columna < disponible ? columna : -1;
+}
+
+// Inserta un byte tecleado; al final de una línea que entra en la ventana solo se escribe el byte
+static void editor_teclear(char c) {
+    int al_final = editor.cursor == editor.largo;
+    editor_insertar(&c, 1);
+    if (editor_pendiente()) { editor.desactualizada = 1; return; }
+    if (al_final && !editor.desactualizada && editor_columna_visible(editor.cursor) >= 0) {
+        editor_agregar_visible(&c, 1);
+        editor_volcar();
+    } else {
+        editor_refrescar();
+    }
+}
+
+static void editor_mover(size_t destino) {
+    size_t antes = editor.cursor;
+    editor.cursor = destino;
+    if (editor_pendiente()) { editor.desactualizada = 1; return; }
+    int de = editor_columna_visible(antes), a = editor_columna_visible(destino);
+    if (de < 0 || a < 0 || editor.desactualizada) { editor_refrescar(); return; }
+    if (de == a) return;
+    char mover[24];
+    editor_agregar(mover, (size_t)snprintf(mover, sizeof(mover), "\x1b[%d%c", a > de ? a - de : de - a, a > de ? 'C' : 'D'));
+    editor_volcar();
+}
+
+static size_t palabra_anterior(size_t i) {
+    while (i > 0 && es_blanco(editor.buf[i - 1])) i--;
+    while (i > 0 && !es_blanco(editor.buf[i - 1])) i--;
+    return i;
+}
+
+static size_t palabra_siguiente(size_t i) {
+    while (i < editor.largo && es_blanco(editor.buf[i])) i++;
+    while (i < editor.largo && !es_blanco(editor.buf[i])) i++;
+    return i;
+}
+
+static void editor_campana(void) { escribir_todo(STDOUT_FILENO, "\a", 1); }
+
+static void editor_cargar_historial(size_t k) {
+    if (k < historial.n) editor_reemplazar(historial.datos + historial.inicios[k], historial_largo(k));
+    else editor_reemplazar(editor.guardada ? editor.guardada : "", editor.guardada ? strlen(editor.guardada) : 0);
+}
+
+// Arriba/abajo: la línea nueva se guarda al salir de ella y se recupera al volver
+static void editor_historial(int hacia_atras) {
+    if (hacia_atras ? editor.pos_historial == 0 : editor.pos_historial >= historial.n) { editor_campana(); return; }
+    if (editor.pos_historial == historial.n) { free(editor.guardada); editor.guardada = strdup(editor.buf); }
+    editor.pos_historial += hacia_atras ? (size_t)-1 : 1;
+    editor_cargar_historial(editor.pos_historial);
+    editor_refrescar();
+}
+
+/*
+ * Ctrl-R: cada tecla amplía la consulta y busca desde la coincidencia actual hacia atrás; Ctrl-R de
+ * nuevo pasa a la anterior. Retorna la tecla que terminó la búsqueda (Enter ejecuta, una flecha deja
+ * la línea para editar), o 0 con Ctrl-G, que restaura la línea original.
+ */
+static int editor_buscar(void) {
+    char consulta[EDITOR_MAX_CONSULTA + 1] = "", anterior[sizeof(editor.prompt)], prompt[EDITOR_MAX_CONSULTA + 48];
+    size_t nq = 0, encontrada = SIZE_MAX, pos = 0;
+    int fallida = 0, tecla;
+    char *original = strdup(editor.buf);
+    snprintf(anterior, sizeof(anterior), "%s", editor.prompt);
+    for (;;) {
+        snprintf(prompt, sizeof(prompt), "(%s)`%s': ", fallida ? "búsqueda fallida" : "búsqueda inversa", consulta);
+        editor_fijar_prompt(prompt);
+        editor_refrescar();
+        tecla = editor_tecla();
+        size_t desde = historial.n - 1;
+        if (tecla == 18) { // Ctrl-R
+            if (encontrada == SIZE_MAX || encontrada == 0) { fallida = nq > 0; continue; }
+            desde = encontrada - 1;
+        } else if (tecla == 127 || tecla == 8) {
+            while (nq > 0 && es_continuacion_utf8(consulta[nq - 1])) nq--;
+            if (nq > 0) nq--;
+            consulta[nq] = '\0';
+        } else if (tecla >= 32 && tecla < 256 && tecla != 127) {
+            if (nq < EDITOR_MAX_CONSULTA) { consulta[nq++] = (char)tecla; consulta[nq] = '\0'; }
+            if (encontrada != SIZE_MAX) desde = encontrada;
+        } else if (tecla == TECLA_REDIMENSION) {
+            continue;
+        } else {
+            break;
+        }
+        size_t k = historial_buscar(consulta, nq, desde, &pos);
+        fallida = nq > 0 && k == SIZE_MAX;
+        if (k == SIZE_MAX) continue; // Se sigue mostrando la última coincidencia
+        encontrada = k;
+        editor_cargar_historial(k);
+        editor.cursor = pos;
+    }
+    editor_fijar_prompt(anterior);
+    if (tecla == 7 || tecla == 3) { // Ctrl-G / Ctrl-C: vuelve la línea original
+        if (original) editor_reemplazar(original, strlen(original));
+        tecla = tecla == 7 ? 0 : tecla;
+    }
+    free(original);
+    editor_refrescar();
+    return tecla;
+}
+
+// --- Completado (Tab) ---
+
+/*
+ * Palabra bajo el cursor, con las mismas reglas de comillas que el lexer. Deja en 'prefijo' su texto
+ * sin comillas ni escapes, en '*comilla' la comilla abierta (o 0) y en 'comando' la primera palabra
+ * del comando actual (vacía si la palabra bajo el cursor es la primera).
+ */
+static void palabra_bajo_cursor(char *prefijo, size_t tam, char *comilla, char *comando, size_t tam_comando) {
+    size_t n = 0, nc = 0;
+    int palabras = 0;                // Palabras completas del comando actual
+    *comilla = 0;
+    comando[0] = '\0';
+    for (size_t i = 0; i < editor.cursor; i++) {
+        char c = editor.buf[i];
+        if (!*comilla && (es_blanco(c) || es_operador(c))) {
+            if (n > 0) {
+                if (palabras == 0) { nc = n < tam_comando - 1 ? n : tam_comando - 1; memcpy(comando, prefijo, nc); comando[nc] = '\0'; }
+                palabras++;
+            }
+            if (c == '|' || c == '&') { palabras = 0; comando[0] = '\0'; }
+            if (c == '<' || c == '>') palabras += !palabras; // Tras una redirección se completan rutas
+            n = 0;
+            continue;
+        }
+        if (*comilla == '\'') { if (c == '\'') *comilla = 0; else if (n < tam - 1) prefijo[n++] = c; continue; }
+        if (c == '\\' && i + 1 < editor.cursor && (*comilla != '"' || strchr("\"\\$`", editor.buf[i + 1]))) c = editor.buf[++i];
+        else if (c == '"' || (c == '\'' && !*comilla)) { *comilla = (*comilla == c) ? 0 : c; continue; }
+        if (n < tam - 1) prefijo[n++] = c;
+    }
+    prefijo[n] = '\0';
+    if (palabras == 0) comando[0] = '\0';
+    else if (!comando[0]) snprintf(comando, tam_comando, "%s", "-");
+}
+
+// Inserta 'texto' escapado según el contexto (fuera de comillas, cada especial lleva '\')
+static void editor_insertar_escapado(const char *texto, size_t n, char comilla) {
+    for (size_t i = 0; i < n; i++) {
+        int escapar = comilla == '"' ? strchr("\"\\$`", texto[i]) != NULL : !comilla && strchr(EDITOR_ESPECIALES, texto[i]) != NULL;
+        if (escapar) editor_insertar("\\", 1);
+        editor_insertar(texto + i, 1);
+    }
+}
+
+// Lista los candidatos en columnas debajo de la línea y vuelve a dibujar el prompt
+static void editor_listar_candidatos(void) {
+    size_t n = completado.n_candidatos, ancho = 0;
+    editor_agregar("\r\n", 2);
+    if (n > EDITOR_MAX_LISTA) {
+        char aviso[96];
+        editor_agregar(aviso, (size_t)snprintf(aviso, sizeof(aviso), "(%zu posibilidades: escribí más letras)\r\n", n));
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            size_t a = (size_t)ancho_texto(completado.candidatos[i].nombre, strlen(completado.candidatos[i].nombre)) + completado.candidatos[i].directorio;
+            if (a > ancho) ancho = a;
+        }
+        ancho += 2;
+        size_t por_fila = (size_t)editor.columnas / ancho ? (size_t)editor.columnas / ancho : 1, filas = (n + por_fila - 1) / por_fila;
+        for (size_t f = 0; f < filas; f++) {
+            for (size_t k = f; k < n; k += filas) {
+                const candidato_t *c = &completado.candidatos[k];
+                size_t largo = strlen(c->nombre), a = (size_t)ancho_texto(c->nombre, largo) + c->directorio;
+                editor_agregar_visible(c->nombre, largo);
+                if (c->directorio) editor_agregar("/", 1);
+                for (; k + filas < n && a < ancho; a++) editor_agregar(" ", 1);
+            }
+            editor_agregar("\r\n", 2);
+        }
+    }
+    editor_volcar();
+    editor_refrescar();
+}
+
+static void editor_completar(void) {
+    char prefijo[PATH_MAX], comilla, comando[NAME_MAX + 1];
+    palabra_bajo_cursor(prefijo, sizeof(prefijo), &comilla, comando, sizeof(comando));
+    revisar_completado();
+    completado.n_candidatos = 0;
+    const char *nombre = prefijo;
+    if (!comando[0] && !strchr(prefijo, '/')) {
+        // Primera palabra: built-ins y comandos de PATH
+        size_t largo = strlen(prefijo);
+        for (int i = 0; i < COMANDO_EXTERNO; i++) if (strncmp(comandos_politica[i], prefijo, largo) == 0) agregar_candidato(comandos_politica[i], 0);
+        if (strncmp("exit", prefijo, largo) == 0) agregar_candidato("exit", 0);
+        verificar_vigencia_rutas();
+        for (int i = 0; i < rutas.n_directorios; i++) candidatos_de_directorio(rutas.directorios[i], prefijo, -1);
+    } else {
+        int b = indice_builtin(comando);
+        char *barra = strrchr(prefijo, '/');
+        char directorio[PATH_MAX] = "";
+        if (barra) {
+            memcpy(directorio, prefijo, (size_t)(barra - prefijo) + 1);
+            directorio[barra - prefijo + 1] = '\0';
+            nombre = barra + 1;
+        }
+        candidatos_de_directorio(directorio, nombre, b >= 0 ? b : COMANDO_EXTERNO);
+    }
+    size_t n = completado.n_candidatos;
+    if (n == 0) { editor_campana(); return; }
+    qsort(completado.candidatos, n, sizeof(candidato_t), comparar_candidatos);
+    size_t unicos = 1; // Un comando puede estar en varios directorios de PATH
+    for (size_t i = 1; i < n; i++)
+        if (strcmp(completado.candidatos[i].nombre, completado.candidatos[unicos - 1].nombre) != 0) completado.candidatos[unicos++] = completado.candidatos[i];
+    completado.n_candidatos = n = unicos;
+
+    const char *primero = completado.candidatos[0].nombre;
+    size_t ya = strlen(nombre), comun = strlen(primero);
+    for (size_t i = 1; i < n; i++) {
+        size_t k = 0;
+        while (k < comun && primero[k] == completado.candidatos[i].nombre[k]) k++;
+        comun = k;
+    }
+    if (comun > ya || n == 1) {
+        editor_insertar_escapado(primero + ya, comun - ya, comilla);
+        if (n == 1 && completado.candidatos[0].directorio) editor_insertar("/", 1);
+        else if (n == 1) {
+            if (comilla) editor_insertar(&comilla, 1);
+            editor_insertar(" ", 1);
+        }
+        editor.tabs = 0;
+        editor_refrescar();
+        return;
+    }
+    if (editor.tabs++ == 0) { editor_campana(); return; }
+    editor_listar_candidatos();
+}
+
+// --- Lectura de una Línea ---
+
+static int editor_modo_crudo(void) {
+    struct termios t = editor.original;
+    t.c_iflag &= ~(tcflag_t)(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    t.c_cflag |= CS8;
+    t.c_lflag &= ~(tcflag_t)(ECHO | ICANON | IEXTEN | ISIG);
+    t.c_cc[VMIN] = 1;
+    t.c_cc[VTIME] = 0;
+    if (tcsetattr(editor.fd, TCSADRAIN, &t) != 0) return -1;
+    editor.crudo = 1;
+    return 0;
+}
+
+static void editor_restaurar(void) {
+    if (!editor.crudo) return;
+    tcsetattr(editor.fd, TCSADRAIN, &editor.original);
+    editor.crudo = 0;
+}
+
+/*
+ * Activa el editor si stdin y stdout son terminales (TERM=dumb o FLSH_EDITOR=0 lo desactivan) y abre
+ * el historial. Retorna 1 si quedó activo.
+ */
+int editor_iniciar(void) {
+    const char *term = getenv("TERM"), *opcion = getenv("FLSH_EDITOR");
+    if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO) || (term && strcmp(term, "dumb") == 0) || (opcion && strcmp(opcion, "0") == 0)) return 0;
+    if (tcgetattr(STDIN_FILENO, &editor.original) != 0) return 0;
+    editor.fd = STDIN_FILENO;
+    historial_iniciar();
+    completado.inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    atexit(editor_restaurar);
+    return 1;
+}
+
+/*
+ * Lee una línea física con el editor ('prompt' NULL = prompt principal). Retorna el largo, -1 en EOF
+ * (Ctrl-D con la línea vacía) o -3 si se descartó con Ctrl-C.
+ */
+ssize_t editor_leer_linea(const char *prompt, char **linea, size_t *capacidad) {
+    char principal[PATH_MAX + 32];
+    if (!prompt) { componer_prompt(principal, sizeof(principal)); prompt = principal; }
+    fflush(stdout);
+    historial_sincronizar();
+    // El modo de la terminal se toma en cada línea: un programa pudo cambiarlo (ej. stty)
+    if (tcgetattr(editor.fd, &editor.original) != 0 || editor_modo_crudo() != 0 || editor_reservar(0) != 0) {
+        printf("%s", prompt);
+        fflush(stdout);
+        ssize_t n = getline(linea, capacidad, stdin);
+        if (n > 0 && (*linea)[n - 1] == '\n') (*linea)[--n] = '\0';
+        return n;
+    }
+    // Sin SA_RESTART: un cambio de tamaño interrumpe la espera y se redibuja enseguida
+    struct sigaction sa, anterior;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = manejador_redimension;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGWINCH, &sa, &anterior);
+
+    editor_fijar_prompt(prompt);
+    editor.buf[0] = '\0';
+    editor.largo = editor.cursor = editor.desplazamiento = 0;
+    editor.pos_historial = historial.n;
+    free(editor.guardada);
+    editor.guardada = NULL;
+    editor.tabs = 0;
+    editor_redimensionada = 1; // Una sesión de 'flsh --servidor' no recibe SIGWINCH de la terminal del cliente
+    editor_refrescar();
+
+    ssize_t resultado = 0;
+    for (int terminado = 0; !terminado;) {
+        int tecla = editor_tecla();
+        if (tecla == 18) tecla = editor_buscar(); // Ctrl-R
+        if (tecla != 9) editor.tabs = 0;
+        switch (tecla) {
+            case -1:  // EOF o terminal cerrada
+                resultado = editor.largo ? (ssize_t)editor.largo : -1;
+                terminado = 1;
+                break;
+            case '\r': case '\n':
+                editor.cursor = editor.largo;
+                editor_refrescar();
+                resultado = (ssize_t)editor.largo;
+                terminado = 1;
+                break;
+            case 3:   // Ctrl-C
+                escribir_todo(STDOUT_FILENO, "^C", 2);
+                resultado = -3;
+                terminado = 1;
+                break;
+            case 4:   // Ctrl-D
+                if (editor.largo == 0) { resultado = -1; terminado = 1; }
+                else if (editor.cursor < editor.largo) { editor_borrar(editor.cursor, siguiente_caracter(editor.buf, editor.largo, editor.cursor)); editor_refrescar(); }
+                break;
+            case TECLA_SUPRIMIR:
+                if (editor.cursor < editor.largo) { editor_borrar(editor.cursor, siguiente_caracter(editor.buf, editor.largo, editor.cursor)); editor_refrescar(); }
+                break;
+            case 127: case 8:  // Backspace
+                if (editor.cursor == 0) break;
+                editor_borrar(anterior_caracter(editor.buf, editor.cursor), editor.cursor);
+                if (editor_pendiente()) editor.desactualizada = 1;
+                else if (editor.cursor == editor.largo && editor.desplazamiento == 0 && !editor.desactualizada) { editor_agregar("\b\x1b[K", 4); editor_volcar(); }
+                else editor_refrescar();
+                break;
+            case 1: case TECLA_INICIO: editor_mover(0); break;
+            case 5: case TECLA_FIN: editor_mover(editor.largo); break;
+            case 2: case TECLA_IZQUIERDA: editor_mover(anterior_caracter(editor.buf, editor.cursor)); break;
+            case 6: case TECLA_DERECHA: editor_mover(siguiente_caracter(editor.buf, editor.largo, editor.cursor)); break;
+            case TECLA_PALABRA_IZQ: editor_mover(palabra_anterior(editor.cursor)); break;
+            case TECLA_PALABRA_DER: editor_mover(palabra_siguiente(editor.cursor)); break;
+            case 11: editor.largo = editor.cursor; editor.buf[editor.largo] = '\0'; editor_refrescar(); break;  // Ctrl-K
+            case 21: editor_borrar(0, editor.cursor); editor_refrescar(); break;                               // Ctrl-U
+            case 23: editor_borrar(palabra_anterior(editor.cursor), editor.cursor); editor_refrescar(); break;  // Ctrl-W
+            case 12: editor_agregar("\x1b[H\x1b[2J", 7); editor_refrescar(); break;                           // Ctrl-L
+            case 16: case TECLA_ARRIBA: editor_historial(1); break;
+            case 14: case TECLA_ABAJO: editor_historial(0); break;
+            case 9: editor_completar(); break;
+            case TECLA_REDIMENSION: editor_refrescar(); break;
+            default:
+                if (tecla >= 32 && tecla < 256 && tecla != 127) editor_teclear((char)tecla);
+                else if (editor.desactualizada && !editor_pendiente()) editor_refrescar(); // Un pegado terminó en una tecla ignorada
+        }
+    }
+    escribir_todo(STDOUT_FILENO, "\r\n", 2);
+    sigaction(SIGWINCH, &anterior, NULL);
+    editor_restaurar();
+    if (resultado < 0) return resultado;
+    if (*capacidad < editor.largo + 1) {
+        char *copia = realloc(*linea, editor.largo + 1);
+        if (!copia) return -1;
+        *linea = copia;
+        *capacidad = editor.largo + 1;
+    }
+    memcpy(*linea, editor.buf, editor.largo + 1);
+    return resultado;
+}
+
+// --- MAIN: Bucle Principal de Ejecución (REPL) ---
+
+/*
+ * Orquestador del Shell. Implementa el ciclo de vida "Read-Eval-Print Loop" de una sesión ya inicializada
+ * (Sandbox, logger, trabajos): lo corren 'main' y cada sesión de 'flsh --servidor'.
+ * Arquitectura y Flujo:
+ * 1. Inicialización ('main' o 'iniciar_sesion_servidor'): Valida el HOME de la sesión para garantizar la
+ * integridad del Sandbox.
+ * 2. Captura de Entrada: En una terminal, el editor de línea dibuja el prompt y lee la línea con edición,
+ * historial y completado (sin editor, p. ej. TERM=dumb, imprime el prompt y lee con 'getline'). En modo por lotes ('flsh -c', 'flsh script' o stdin no interactivo) no hay prompt:
+ * las líneas salen del lector por bloques / mmap y 'set -e' corta ante el primer fallo.
+ * 3. Procesamiento de Redirección (I/O Redirection):
+ * - Resuelve '>', '>>', '<' y 'n>&m' en orden sobre la terna stdin/stdout/stderr ('resolver_redirecciones').
+ * - Valida la seguridad de cada archivo (Sandbox) en la misma apertura.
+ * - Manipula la tabla de descriptores de archivo (File Descriptors) guardando copias de los originales
+ * y reemplazándolos con 'dup2'. Esto permite que la salida de CUALQUIER comando (built-in o externo)
+ * se escriba en el archivo de forma transparente.
+ * 4. Despacho de Comandos (Dispatcher):
+ * - Si la línea contiene '|', la ejecuta como pipeline ('ejecutar_pipeline').
+ * - Despacho de comandos internos (built-ins) por el registro con hash perfecto ('ejecutar_builtin').
+ * 5. Ejecución de Comandos Externos (Process Creation):
+ * - Si no es interno, verifica violaciones de seguridad en los argumentos (o, con Landlock activo,
+ * restringe al hijo desde el kernel antes de 'execvp').
+ * - Lanza el proceso con 'lanzar_proceso':
+ * a. Resolución: la ruta del comando sale de la tabla hash de PATH (sin 'execve' fallidos por directorio).
+ * b. Creación: posix_spawn / clone(CLONE_VM|CLONE_VFORK), sin copiar el espacio de direcciones del shell.
+ * c. Parent: Usa 'wait4' para bloquearse hasta que el hijo termine, recogiendo su estado de salida (exit code)
+ * y su consumo de recursos (CPU, RSS) para la telemetría.
+ * - Con '&' al final, el comando o pipeline se lanza como trabajo en segundo plano y el prompt vuelve
+ * de inmediato; los trabajos terminados se recogen y anuncian antes de cada prompt.
+ * 6. Restauración: Al final del ciclo vacía la capa de salida y recupera los descriptores originales
+ * para volver a mostrar el prompt en pantalla.
+ */
+int ejecutar_sesion(const char *cadena, const char *script, int interactivo) {
+    char *entrada = NULL;     // Línea lógica: crece según haga falta y se reutiliza entre comandos
+    size_t capacidad_entrada = 0;
+    arena_t arena = { 0 };    // Árbol de cada línea; se reinicia por comando (sin malloc en régimen estable)
+
+    lector_t lector;
+    if (cadena) lector_desde_cadena(&lector, cadena);
+    else if (script) {
+        // El script también se abre a través del Sandbox
+        int fd = abrir_en_sandbox(script, O_RDONLY, 0, "flsh");
+        if (fd == SANDBOX_DENEGADO) return 126;
+        if (fd < 0 || lector_desde_fd(&lector, fd) != 0) { reportar_error_sistema("flsh"); return 127; }
+    } else if (!interactivo) {
+        if (lector_desde_fd(&lector, STDIN_FILENO) != 0) { reportar_error_sistema("flsh"); return 1; }
+        lector_stdin = &lector;
+    }
     
+    // Capa de salida de los built-ins: tamaño de buffer y vaciado según stdout sea terminal, pipe o archivo
+    salida_configurar();
+    if (interactivo) editor_activo = editor_iniciar();
+
+    int ultimo_estado = 0;
     while (1) {
-        imprimir_prompt();
-        if (!fgets(input, MAX_INPUT_SIZE, stdin)) break;
-        
-        size_t len = strlen(input);
-        if (len > 0 && input[len-1] == '\n') input[len-1] = '\0';
-        // Asumimos que parsear_comando divide input en tokens y devuelve cont
-        if (parsear_comando(input, args) == 0) continue; 
+        // set -e: el comando anterior falló
+        if (opciones_shell.salir_en_error && ultimo_estado != 0) {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "Abortado por comando fallido (Code: %d)", ultimo_estado);
+            log_shell("set -e", msg, "WARNING");
+            break;
+        }
+        recoger_trabajos(); // Anuncia y registra los trabajos terminados desde el último prompt
+        anunciar_recarga_politica();
+        if (interactivo && !editor_activo) imprimir_prompt();
+        ssize_t largo = leer_linea_logica(interactivo ? NULL : &lector, &entrada, &capacidad_entrada);
+        if (largo == -1) break;
+        if (largo == -2) {
+            fprintf(stderr, "flsh: fin de entrada inesperado (comilla o '\\' sin cerrar)\n");
+            ultimo_estado = 2;
+            break;
+        }
+
+        arena_reiniciar(&arena);
+        linea_t linea;
+        if (parsear_linea(&arena, entrada, &linea) != 0) { ultimo_estado = 2; continue; }
+        if (linea.n_comandos == 0) continue;
+        // Cada comando se mide de punta a punta: comodines, redirecciones y vaciado de salida incluidos
+        telemetria_iniciar();
+        int expandida = expandir_comodines(&arena, &linea);
+        char **args = linea.comandos[0].argv;
+        const char *nombre_medido = (linea.n_comandos > 1) ? "pipeline" : args[0];
+        if (expandida != 0) { ultimo_estado = 1; telemetria_cerrar(nombre_medido); continue; }
 
         // --- Redirección ---
-        int stdout_backup = -1, redir_pos = -1;
-        for (int k = 0; args[k]; k++) if (strcmp(args[k], ">") == 0) redir_pos = k;
-
-        if (redir_pos != -1) {
-            // Validamos que el archivo destino sea seguro antes de abrirlo
-            if (!args[redir_pos + 1] || !validar_entorno_seguro(args[redir_pos + 1], ">")) continue;
-            
-            stdout_backup = dup(STDOUT_FILENO); // Guardamos la terminal original
-            
-            // 0644 = rw-r--r--
-            int fd = open(args[redir_pos + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
-            if (fd < 0) { reportar_error_sistema("redireccion"); continue; }
-            
-            dup2(fd, STDOUT_FILENO); // Reemplazamos stdout con el archivo
-            close(fd);
-            args[redir_pos] = NULL; // Cortamos los argumentos para que el comando no vea el '>'
+        // Comando simple en primer plano: se aplica sobre los descriptores del shell (los built-ins corren aquí).
+        // Los pipelines y los trabajos resuelven las redirecciones de cada etapa al lanzarla.
+        int respaldo[3] = { -1, -1, -1 };
+        int redirigido = linea.n_comandos == 1 && !linea.segundo_plano && linea.comandos[0].redirecciones;
+        if (redirigido) {
+            destinos_t d = { .fds = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO } };
+            if (resolver_redirecciones(&linea.comandos[0], &d) != 0) { ultimo_estado = 1; telemetria_cerrar(nombre_medido); continue; }
+            aplicar_destinos(&d, respaldo);
         }
 
         // --- Ejecución ---
-        if (strcmp(args[0], "exit") == 0) { 
+        if (strcmp(args[0], "exit") == 0 && linea.n_comandos == 1 && !linea.segundo_plano) { 
+            if (args[1]) ultimo_estado = atoi(args[1]) & 0xff;
             log_shell("exit", "Sesion finalizada", "INFO"); 
+            telemetria_cerrar(nombre_medido);
             break; 
         }
-        else if (strcmp(args[0], "pwd") == 0) {
-             char cwd[1024]; getcwd(cwd, sizeof(cwd)); printf("%s\n", cwd);
-             log_shell("pwd", "Exito", "INFO");
-        }
-        else if (strcmp(args[0], "ls") == 0) ejecutar_ls(args[1]);
-        else if (strcmp(args[0], "cd") == 0) ejecutar_cd(args[1]);
-        else if (strcmp(args[0], "mkdir") == 0) ejecutar_mkdir(args[1]);
-        else if (strcmp(args[0], "rm") == 0) ejecutar_rm(args[1]);
-        else if (strcmp(args[0], "cp") == 0) ejecutar_cp(args[1], args[2]);
-        else if (strcmp(args[0], "cat") == 0) ejecutar_cat(args[1]);
-        else if (strcmp(args[0], "echo") == 0) { 
-            // Implementación inline de echo
-            for(int i=1; args[i]; i++) printf("%s ", args[i]); printf("\n");
-            log_shell("echo", "Exito", "INFO");
-        }
-        else if (strcmp(args[0], "grep") == 0) ejecutar_grep(args[1], args[2]);
+        else if (linea.segundo_plano) { estado_builtin = 0; ejecutar_en_segundo_plano(&linea); ultimo_estado = estado_builtin; }
+        else if (linea.n_comandos > 1) ultimo_estado = ejecutar_pipeline(&linea);
+        else if (ejecutar_builtin(args)) ultimo_estado = estado_builtin;
         else {
             // --- Comandos Externos ---
-            int violacion = 0;
-            // Validaciones SandBox para comandos externos (ej. /bin/ls o ../script.sh)
-            if (strchr(args[0], '/') != NULL && !validar_ruta_en_home(args[0])) violacion = 1;
-            for (int k = 1; args[k] != NULL; k++) {
-                if ((args[k][0] == '/' || (args[k][0] == '.' && args[k][1] == '.')) && !validar_ruta_en_home(args[k])) violacion = 1;
-            }
-
-            if (violacion) {
-                fprintf(stderr, "[flsh_sec]: Ruta externa a HOME prohibida.\n");
-                log_shell(args[0], "Intento escape sandbox", "CRITICAL");
-            } else {
-                pid_t pid = fork();
-                if (pid == 0) {
-                    // Proceso Hijo
-                    execvp(args[0], args);
-                    // Si execvp retorna, hubo error (ej. comando no encontrado)
-                    perror("[flsh_error]"); 
-                    exit(127);
-                } else {
+            ultimo_estado = 1;
+            if (validar_argumentos_externos(args)) {
+                pid_t pid = lanzar_proceso(args, descriptores_estandar, -1);
+                ultimo_estado = 127;
+                if (pid > 0) {
                     // Proceso Padre
                     int status;
-                    wait(&status);
+                    struct rusage ru;
+                    wait4(pid, &status, 0, &ru);
+                    telemetria_hijo(&ru);
+                    ultimo_estado = codigo_salida(status);
                     if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
                         log_shell(args[0], "Ejecucion externa OK", "INFO");
                     } else {
-                        char msg[64];
-                        snprintf(msg, sizeof(msg), "Fallo externo (Code: %d)", WEXITSTATUS(status));
+                        // Bajo Landlock un fallo puede ser un acceso denegado por el kernel (EACCES dentro del programa)
+                        char msg[96];
+                        snprintf(msg, sizeof(msg), "Fallo externo (Code: %d)%s", WEXITSTATUS(status),
+                                 landlock.ruleset_fd >= 0 ? " [landlock activo]" : "");
                         log_shell(args[0], msg, "ERROR");
                     }
                 }
             }
         }
 
-        // Restaurar stdout si hubo redirección
-        if (stdout_backup != -1) {
-            fflush(stdout); dup2(stdout_backup, STDOUT_FILENO); close(stdout_backup);
+        // Fin del comando: su salida sale ahora, y se restauran los descriptores si hubo redirección
+        // Por lotes la salida se acumula entre comandos (se vacía al llenarse, antes de un hijo y al salir)
+        if (redirigido) restaurar_destinos(respaldo);
+        else if (interactivo) salida_volcar();
+        telemetria_cerrar(nombre_medido);
+    }
+    if (!interactivo) lector_cerrar(&lector);
+    salida_volcar();
+    return ultimo_estado;
+}
+
+// --- Servidor Multi-Sesión (flsh --servidor) ---
+
+/*
+ * Un daemon de larga vida atiende las sesiones de muchos usuarios sobre un socket Unix (protocolo en
+ * flsh_servidor.h; cliente en tools/flsh_cliente.c).
+ * Funcionalidad:
+ * 1. Bucle de Eventos: un único hilo con epoll atiende el socket de escucha, las conexiones de los
+ * clientes, el canal de log de cada sesión y las señales del daemon (signalfd, sin manejadores).
+ * 2. Sesiones: cada solicitud se atiende con un fork del daemon ya inicializado (sin exec ni nueva carga
+ * del binario). El hijo recibe los descriptores 0-2 del cliente, toma la identidad de SO_PEERCRED (uid,
+ * grupos y HOME de passwd, nunca del entorno del cliente), abre su propio grupo de sesión y corre el REPL
+ * con su cwd, su tabla de trabajos y la política compilada para su HOME. Credenciales, cwd y descriptores
+ * son atributos del proceso: por eso una sesión es un proceso y no un hilo del daemon.
+ * 3. Registro Compartido: las sesiones no abren los archivos de log. Cada evento viaja por un socketpair
+ * al único escritor (el del daemon), que le sobrescribe fecha, usuario, uid y origen con los de la sesión
+ * (una sesión no puede registrar a nombre de otra) y acusa los errores una vez escritos.
+ * 4. Política Compartida: todas las sesiones compilan el mismo archivo (FLSH_POLITICA o /etc/flsh/politica)
+ * con su HOME. SIGHUP al daemon la recarga en todas (SIGUSR1 a cada sesión; ahí SIGHUP es la desconexión).
+ * 5. Ciclo de Vida: al terminar una sesión el cliente recibe su código de salida; si el cliente se
+ * desconecta, el grupo de la sesión recibe SIGHUP. SIGTERM/SIGINT cuelgan todas las sesiones, esperan
+ * hasta SERVIDOR_GRACIA_MS y terminan con SIGKILL las que queden.
+ * Un daemon sin privilegios solo atiende a su propio usuario. FLSH_SERVIDOR_MAX limita las sesiones.
+ */
+#define SERVIDOR_MAX_DEFECTO 1024
+#define SERVIDOR_GRACIA_MS 5000
+#define SERVIDOR_EVENTOS 256
+
+typedef enum { EXTREMO_ESCUCHA, EXTREMO_SENALES, EXTREMO_CLIENTE, EXTREMO_CANAL } tipo_extremo_t;
+
+typedef struct sesion_servidor sesion_servidor_t;
+
+// Lo que se registra en epoll: 'data.ptr' apunta a uno de estos
+typedef struct {
+    tipo_extremo_t tipo;
+    int fd;                            // -1 = cerrado
+    sesion_servidor_t *sesion;
+} extremo_t;
+
+struct sesion_servidor {
+    pid_t pid;                         // 0 = conexión todavía sin solicitud
+    uid_t uid;
+    uint32_t ip;
+    char usuario[32];
+    char origen[48];
+    extremo_t cliente, canal;
+    int siguiente_libre;
+};
+
+static struct {
+    int epoll;
+    int max, ocupadas;                 // Ranuras con conexión (con o sin sesión)
+    int libre;                         // Primera ranura libre (-1 = ninguna)
+    sesion_servidor_t *sesiones;
+    extremo_t escucha, senales;
+    char ruta[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    int terminando, forzado;
+    struct timespec inicio_cierre;
+} servidor = { .epoll = -1, .libre = -1 };
+
+static int servidor_vigilar(extremo_t *e) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = e };
+    return epoll_ctl(servidor.epoll, EPOLL_CTL_ADD, e->fd, &ev);
+}
+
+static void servidor_cerrar(extremo_t *e) {
+    if (e->fd < 0) return;
+    epoll_ctl(servidor.epoll, EPOLL_CTL_DEL, e->fd, NULL);
+    close(e->fd);
+    e->fd = -1;
+}
+
+static void liberar_ranura(sesion_servidor_t *s) {
+    servidor_cerrar(&s->cliente);
+    servidor_cerrar(&s->canal);
+    s->pid = 0;
+    s->siguiente_libre = servidor.libre;
+    servidor.libre = (int)(s - servidor.sesiones);
+    servidor.ocupadas--;
+}
+
+// Responde RECHAZO con el motivo y lo registra con el uid del cliente
+static void rechazar_conexion(int fd, const char *motivo) {
+    struct ucred cred = { .uid = (uid_t)-1 };
+    socklen_t largo = sizeof(cred);
+    getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &largo);
+    enviar_mensaje_servidor(fd, MENSAJE_RECHAZO, 0, NULL, motivo, NULL, 0);
+    char msg[LOG_MAX_MSG];
+    snprintf(msg, sizeof(msg), "Conexion rechazada (uid %d): %s", (int)cred.uid, motivo);
+    log_shell("servidor", msg, "WARNING");
+}
+
+static void aceptar_conexiones(void) {
+    for (;;) {
+        int fd = accept4(servidor.escucha.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) reportar_error_sistema("servidor");
+            return;
+        }
+        if (servidor.libre < 0) {
+            rechazar_conexion(fd, "límite de sesiones alcanzado (FLSH_SERVIDOR_MAX)");
+            close(fd);
+            continue;
+        }
+        sesion_servidor_t *s = &servidor.sesiones[servidor.libre];
+        servidor.libre = s->siguiente_libre;
+        servidor.ocupadas++;
+        s->cliente.fd = fd;
+        if (servidor_vigilar(&s->cliente) != 0) { reportar_error_sistema("servidor"); liberar_ranura(s); }
+    }
+}
+
+/*
+ * Recibe un mensaje del cliente con sus descriptores adjuntos (a lo sumo 3; el resto lo descarta el
+ * kernel). Un mensaje malformado queda con 'tipo' 0. Retorna lo mismo que recvmsg.
+ */
+static ssize_t recibir_mensaje(int fd, mensaje_servidor_t *m, int *fds, int *n_fds) {
+    union { char buf[CMSG_SPACE(3 * sizeof(int))]; struct cmsghdr alineado; } control;
+    struct iovec iov = { .iov_base = m, .iov_len = sizeof(*m) - 1 };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf, .msg_controllen = sizeof(control.buf) };
+    *n_fds = 0;
+    ssize_t n = recvmsg(fd, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    if (n <= 0) return n;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+        int k = (int)((c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        for (int i = 0; i < k; i++) {
+            int recibido;
+            memcpy(&recibido, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+            if (*n_fds < 3) fds[(*n_fds)++] = recibido;
+            else close(recibido);
+        }
+    }
+    size_t cabecera = offsetof(mensaje_servidor_t, texto);
+    if ((size_t)n < cabecera || m->largo > (size_t)n - cabecera || (msg.msg_flags & MSG_TRUNC)) m->tipo = 0;
+    else m->texto[m->largo] = '\0';
+    m->origen[sizeof(m->origen) - 1] = '\0';
+    return n;
+}
+
+/*
+ * Proceso de la sesión (hijo del daemon). No retorna.
+ * 1. Descriptores: 0-2 pasan a ser los del cliente y el canal de log queda en 3; todo lo demás del daemon
+ * (escucha, epoll, otras sesiones, archivos de log) se cierra.
+ * 2. Identidad: grupo de sesión propio (las señales del cliente van a él), grupos/gid/uid del usuario si
+ * el daemon es root, y HOME/USER/LOGNAME de passwd.
+ * 3. Inicialización de una sesión local con ese HOME: Sandbox y política, Landlock, trabajos, telemetría
+ * y recarga de la política por SIGUSR1 (bloqueada hasta tener el manejador: el daemon la puede enviar
+ * apenas existe el proceso).
+ */
+static void iniciar_sesion_servidor(const struct passwd *pw, const mensaje_servidor_t *m, const int fds[3], int canal) {
+    for (int i = 0; i < 3; i++) dup2(fds[i], i);
+    if (canal != 3) dup2(canal, 3);
+    close_range(4, ~0U, 0);
+    fcntl(3, F_SETFD, FD_CLOEXEC);
+    logger.fd_servidor = 3;
+    logger.fd_shell = logger.fd_error = -1;
+    logger.binario = 0;
+
+    sigset_t recarga;
+    sigemptyset(&recarga);
+    sigaddset(&recarga, SIGUSR1);
+    pthread_sigmask(SIG_SETMASK, &recarga, NULL);
+    signal(SIGPIPE, SIG_DFL);
+    setsid();
+
+    if (geteuid() == 0 && (initgroups(pw->pw_name, pw->pw_gid) != 0 || setgid(pw->pw_gid) != 0 || setuid(pw->pw_uid) != 0)) {
+        fprintf(stderr, "flsh: no se pudo adoptar la identidad de %s: %s\n", pw->pw_name, strerror(errno));
+        exit(1);
+    }
+    setenv("HOME", pw->pw_dir, 1);
+    setenv("USER", pw->pw_name, 1);
+    setenv("LOGNAME", pw->pw_name, 1);
+    identificar_sesion_log(pw->pw_uid, pw->pw_name, m->origen);
+    if (chdir(pw->pw_dir) != 0) { fprintf(stderr, "ERROR FATAL: HOME inaccesible.\n"); exit(1); }
+    setenv("PWD", pw->pw_dir, 1);
+
+    int sandbox_listo = iniciar_sandbox(pw->pw_dir);
+    if (sandbox_listo == -1) { fprintf(stderr, "ERROR FATAL: HOME inaccesible.\n"); exit(1); }
+    if (sandbox_listo != 0) exit(1); // Política inválida: fail-closed
+    iniciar_landlock();
+    iniciar_trabajos();
+    iniciar_telemetria();
+    iniciar_recarga_politica(SIGUSR1);
+    pthread_sigmask(SIG_UNBLOCK, &recarga, NULL);
+
+    char msg[96];
+    snprintf(msg, sizeof(msg), "Sesion iniciada por el servidor (pid %d)", (int)getpid());
+    log_shell("flsh", msg, "INFO");
+    const char *cadena = m->largo ? m->texto : NULL;
+    exit(ejecutar_sesion(cadena, NULL, !cadena && isatty(STDIN_FILENO)));
+}
+
+// Identifica al cliente y lanza su sesión. Retorna 0, o -1 si la conexión fue rechazada.
+static int lanzar_sesion(sesion_servidor_t *s, const mensaje_servidor_t *m, const int fds[3]) {
+    struct ucred cred;
+    socklen_t largo = sizeof(cred);
+    if (getsockopt(s->cliente.fd, SOL_SOCKET, SO_PEERCRED, &cred, &largo) != 0) {
+        rechazar_conexion(s->cliente.fd, "no se pudo identificar al cliente");
+        return -1;
+    }
+    if (geteuid() != 0 && cred.uid != geteuid()) {
+        rechazar_conexion(s->cliente.fd, "el servidor corre sin privilegios: solo atiende a su propio usuario");
+        return -1;
+    }
+    struct passwd pw, *resultado = NULL;
+    char buffer[4096];
+    if (getpwuid_r(cred.uid, &pw, buffer, sizeof(buffer), &resultado) != 0 || resultado == NULL) {
+        rechazar_conexion(s->cliente.fd, "usuario sin entrada en passwd");
+        return -1;
+    }
+    int canal[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, canal) != 0) {
+        reportar_error_sistema("servidor");
+        rechazar_conexion(s->cliente.fd, "sin recursos para una sesión nueva");
+        return -1;
+    }
+
+    s->uid = cred.uid;
+    snprintf(s->usuario, sizeof(s->usuario), "%s", pw.pw_name);
+    snprintf(s->origen, sizeof(s->origen), "%s", m->origen[0] ? m->origen : "LOCAL/CONSOLE");
+    struct in_addr ip;
+    s->ip = inet_pton(AF_INET, s->origen, &ip) == 1 ? ip.s_addr : 0;
+    fflush(NULL); // Nada pendiente en los FILE del daemon debe salir por los descriptores de la sesión
+    pid_t pid = fork();
+    if (pid == 0) iniciar_sesion_servidor(&pw, m, fds, canal[1]);
+    close(canal[1]);
+    if (pid < 0) {
+        reportar_error_sistema("servidor");
+        close(canal[0]);
+        rechazar_conexion(s->cliente.fd, "sin recursos para una sesión nueva");
+        return -1;
+    }
+    s->pid = pid;
+    s->canal.fd = canal[0];
+    fcntl(canal[0], F_SETFL, O_NONBLOCK);
+    if (servidor_vigilar(&s->canal) != 0) reportar_error_sistema("servidor");
+    return 0;
+}
+
+static void atender_cliente(sesion_servidor_t *s) {
+    mensaje_servidor_t m;
+    int fds[3], n_fds;
+    ssize_t n = recibir_mensaje(s->cliente.fd, &m, fds, &n_fds);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+    if (n <= 0) {
+        // Desconexión: para la sesión es una terminal colgada
+        if (s->pid == 0) { liberar_ranura(s); return; }
+        kill(-s->pid, SIGHUP);
+        servidor_cerrar(&s->cliente);
+        return;
+    }
+    if (s->pid == 0) {
+        int valida = m.tipo == MENSAJE_SOLICITUD && m.version == SERVIDOR_VERSION && n_fds == 3;
+        if (!valida) rechazar_conexion(s->cliente.fd, "solicitud inválida (se esperan los descriptores 0, 1 y 2)");
+        if (!valida || lanzar_sesion(s, &m, fds) != 0) liberar_ranura(s);
+    } else if (m.tipo == MENSAJE_SENAL && (m.valor == SIGINT || m.valor == SIGQUIT || m.valor == SIGTERM)) {
+        kill(-s->pid, m.valor);
+    }
+    for (int i = 0; i < n_fds; i++) close(fds[i]);
+}
+
+/*
+ * Escribe los eventos pendientes del canal de una sesión con el escritor compartido. La identidad y la
+ * fecha las pone el daemon; los textos se terminan aquí (vienen de un proceso del usuario).
+ */
+static void drenar_canal(sesion_servidor_t *s) {
+    evento_log_t ev;
+    ssize_t n;
+    while (s->canal.fd >= 0 && (n = recv(s->canal.fd, &ev, sizeof(ev), MSG_DONTWAIT)) != 0) {
+        if (n < 0) { if (errno == EINTR) continue; return; }
+        if (n != (ssize_t)sizeof(ev)) continue;
+        clock_gettime(logger.binario ? CLOCK_MONOTONIC : CLOCK_REALTIME, &ev.instante);
+        ev.nivel[sizeof(ev.nivel) - 1] = ev.cmd[sizeof(ev.cmd) - 1] = ev.msg[sizeof(ev.msg) - 1] = '\0';
+        ev.uid = s->uid;
+        ev.ip = s->ip;
+        memcpy(ev.usuario, s->usuario, sizeof(ev.usuario));
+        memcpy(ev.origen, s->origen, sizeof(ev.origen));
+        publicar_evento(&ev);
+        if (es_nivel_error(ev.nivel)) send(s->canal.fd, "", 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+}
+
+static sesion_servidor_t *buscar_sesion(pid_t pid) {
+    for (int i = 0; i < servidor.max; i++) if (servidor.sesiones[i].pid == pid) return &servidor.sesiones[i];
+    return NULL;
+}
+
+// Recoge las sesiones terminadas: sus últimos eventos, el FIN con el código de salida y la ranura
+static void recoger_sesiones(void) {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        sesion_servidor_t *s = buscar_sesion(pid);
+        if (!s) continue;
+        drenar_canal(s);
+        if (s->cliente.fd >= 0) enviar_mensaje_servidor(s->cliente.fd, MENSAJE_FIN, codigo_salida(status), NULL, NULL, NULL, 0);
+        liberar_ranura(s);
+    }
+}
+
+// Deja de aceptar conexiones y cuelga todas las sesiones; las que sigan vivas tras la gracia reciben SIGKILL
+static void iniciar_cierre(const char *motivo) {
+    servidor.terminando = 1;
+    clock_gettime(CLOCK_MONOTONIC, &servidor.inicio_cierre);
+    servidor_cerrar(&servidor.escucha);
+    unlink(servidor.ruta);
+    int colgadas = 0;
+    for (int i = 0; i < servidor.max; i++) {
+        sesion_servidor_t *s = &servidor.sesiones[i];
+        if (s->pid > 0) { kill(-s->pid, SIGHUP); colgadas++; }
+        else if (s->cliente.fd >= 0) liberar_ranura(s);
+    }
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Cierre por %s: %d sesiones colgadas", motivo, colgadas);
+    log_shell("servidor", msg, "INFO");
+}
+
+static void atender_senales(void) {
+    struct signalfd_siginfo info;
+    while (read(servidor.senales.fd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+        if (info.ssi_signo == SIGCHLD) recoger_sesiones();
+        else if (info.ssi_signo == SIGHUP) {
+            int avisadas = 0;
+            for (int i = 0; i < servidor.max; i++) if (servidor.sesiones[i].pid > 0 && kill(servidor.sesiones[i].pid, SIGUSR1) == 0) avisadas++;
+            char msg[96];
+            snprintf(msg, sizeof(msg), "Recarga de la politica enviada a %d sesiones", avisadas);
+            log_shell("servidor", msg, "INFO");
+        } else if ((info.ssi_signo == SIGTERM || info.ssi_signo == SIGINT) && !servidor.terminando) {
+            iniciar_cierre(info.ssi_signo == SIGTERM ? "SIGTERM" : "SIGINT");
+        }
+    }
+}
+
+// Crea el socket de escucha. Un socket huérfano (daemon caído) se reemplaza; uno con un daemon vivo, no.
+static int abrir_escucha(const struct sockaddr_un *dir) {
+    int sonda = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sonda >= 0 && connect(sonda, (const struct sockaddr *)dir, sizeof(*dir)) == 0) {
+        fprintf(stderr, "flsh: ya hay un servidor escuchando en %s\n", dir->sun_path);
+        close(sonda);
+        return -1;
+    }
+    struct stat st;
+    if (errno == ECONNREFUSED && lstat(dir->sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(dir->sun_path);
+    if (sonda >= 0) close(sonda);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (const struct sockaddr *)dir, sizeof(*dir)) != 0 ||
+        chmod(dir->sun_path, 0666) != 0 || listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "flsh: %s: %s\n", dir->sun_path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Bucle del daemon: 'flsh --servidor [socket]' (por defecto FLSH_SOCKET o SERVIDOR_SOCKET_DEFECTO).
+ * Retorna el código de salida del daemon.
+ */
+int ejecutar_servidor(const char *ruta) {
+    if (!ruta) ruta = getenv("FLSH_SOCKET");
+    if (!ruta || !*ruta) ruta = SERVIDOR_SOCKET_DEFECTO;
+    struct sockaddr_un dir;
+    if (direccion_servidor(ruta, &dir) != 0) { fprintf(stderr, "flsh: ruta de socket demasiado larga: %s\n", ruta); return 2; }
+    snprintf(servidor.ruta, sizeof(servidor.ruta), "%s", ruta);
+
+    // 0-2 siempre ocupados: los descriptores que llegan de los clientes nunca caen ahí
+    for (int fd = 0; fd < 3; fd++) if (fcntl(fd, F_GETFD) < 0 && open("/dev/null", O_RDWR) != fd) return 1;
+    // Dos descriptores por sesión (cliente y canal): el límite blando sube hasta el duro
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) { rl.rlim_cur = rl.rlim_max; setrlimit(RLIMIT_NOFILE, &rl); }
+
+    const char *max = getenv("FLSH_SERVIDOR_MAX");
+    servidor.max = (max && atoi(max) > 0) ? atoi(max) : SERVIDOR_MAX_DEFECTO;
+    servidor.sesiones = calloc((size_t)servidor.max, sizeof(sesion_servidor_t));
+    if (!servidor.sesiones) { reportar_error_sistema("servidor"); return 1; }
+    for (int i = servidor.max - 1; i >= 0; i--) {
+        sesion_servidor_t *s = &servidor.sesiones[i];
+        s->cliente = (extremo_t){ EXTREMO_CLIENTE, -1, s };
+        s->canal = (extremo_t){ EXTREMO_CANAL, -1, s };
+        s->siguiente_libre = servidor.libre;
+        servidor.libre = i;
+    }
+
+    // Las señales se atienden en el bucle: se bloquean antes de que el logger cree su hilo escritor
+    sigset_t senales;
+    sigemptyset(&senales);
+    sigaddset(&senales, SIGCHLD);
+    sigaddset(&senales, SIGHUP);
+    sigaddset(&senales, SIGTERM);
+    sigaddset(&senales, SIGINT);
+    sigaddset(&senales, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &senales, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    logger.compartido = 1;
+    iniciar_logger(1);
+    struct passwd *pw = getpwuid(geteuid());
+    char origen[sizeof(logger.ip_origen)];
+    memcpy(origen, logger.ip_origen, sizeof(origen));
+    if (pw) identificar_sesion_log((uint32_t)pw->pw_uid, pw->pw_name, origen);
+
+    sigdelset(&senales, SIGUSR1);
+    servidor.escucha = (extremo_t){ EXTREMO_ESCUCHA, abrir_escucha(&dir), NULL };
+    servidor.senales = (extremo_t){ EXTREMO_SENALES, signalfd(-1, &senales, SFD_NONBLOCK | SFD_CLOEXEC), NULL };
+    servidor.epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (servidor.escucha.fd < 0) return 1;
+    if (servidor.senales.fd < 0 || servidor.epoll < 0 || servidor_vigilar(&servidor.escucha) != 0 ||
+        servidor_vigilar(&servidor.senales) != 0) {
+        reportar_error_sistema("servidor");
+        unlink(servidor.ruta);
+        return 1;
+    }
+    resolver_archivo_politica();
+    char msg[LOG_MAX_MSG];
+    snprintf(msg, sizeof(msg), "Escuchando en %.200s (hasta %d sesiones, politica %.200s)", ruta, servidor.max,
+             politicas.archivo[0] ? politicas.archivo : "por defecto");
+    log_shell("servidor", msg, "INFO");
+
+    struct epoll_event eventos[SERVIDOR_EVENTOS];
+    while (!servidor.terminando || servidor.ocupadas > 0) {
+        int espera = -1;
+        if (servidor.terminando) {
+            struct timespec ahora;
+            clock_gettime(CLOCK_MONOTONIC, &ahora);
+            long transcurrido = (ahora.tv_sec - servidor.inicio_cierre.tv_sec) * 1000 +
+                                (ahora.tv_nsec - servidor.inicio_cierre.tv_nsec) / 1000000;
+            if (transcurrido >= SERVIDOR_GRACIA_MS && !servidor.forzado) {
+                for (int i = 0; i < servidor.max; i++) if (servidor.sesiones[i].pid > 0) kill(-servidor.sesiones[i].pid, SIGKILL);
+                servidor.forzado = 1;
+            }
+            espera = servidor.forzado ? -1 : (int)(SERVIDOR_GRACIA_MS - transcurrido);
+        }
+        int n = epoll_wait(servidor.epoll, eventos, SERVIDOR_EVENTOS, espera);
+        if (n < 0 && errno != EINTR) { reportar_error_sistema("servidor"); break; }
+        for (int i = 0; i < n; i++) {
+            extremo_t *e = eventos[i].data.ptr;
+            if (e->fd < 0) continue; // Cerrado por un evento anterior del mismo lote
+            switch (e->tipo) {
+                case EXTREMO_ESCUCHA: aceptar_conexiones(); break;
+                case EXTREMO_SENALES: atender_senales(); break;
+                case EXTREMO_CLIENTE: atender_cliente(e->sesion); break;
+                case EXTREMO_CANAL:
+                    drenar_canal(e->sesion);
+                    // La sesión cerró su extremo: lo que quede se lee al recogerla (SIGCHLD)
+                    if (eventos[i].events & (EPOLLHUP | EPOLLERR)) epoll_ctl(servidor.epoll, EPOLL_CTL_DEL, e->fd, NULL);
+                    break;
+            }
         }
     }
+    if (!servidor.terminando) unlink(servidor.ruta);
+    log_shell("servidor", "Servidor detenido", "INFO");
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * Punto de entrada: 'flsh --servidor [socket]' arranca el daemon multi-sesión; cualquier otra invocación
+ * inicializa una sesión local (HOME del entorno) y entra al REPL ('ejecutar_sesion').
+ */
+#ifndef FLSH_SIN_MAIN
+int main(int argc, char **argv) {
+    // 'flsh --servidor [socket]': daemon multi-sesión (no usa el HOME del entorno)
+    if (argc > 1 && strcmp(argv[1], "--servidor") == 0) return ejecutar_servidor(argc > 2 ? argv[2] : NULL);
+    char *home = getenv("HOME");
+
+    // --- Modo de ejecución ---
+    // 'flsh -c "cmd"', 'flsh script' o stdin no interactivo: modo por lotes (sin prompt, lectura en bloques)
+    const char *cadena = NULL, *script = NULL;
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) { fprintf(stderr, "flsh: -c requiere un argumento\n"); return 2; }
+        cadena = argv[2];
+    } else if (argc > 1) script = argv[1];
+    int interactivo = !cadena && !script && isatty(STDIN_FILENO);
+
+    if (!home) { fprintf(stderr, "ERROR FATAL: HOME no definido.\n"); return 1; }
+    // El Sandbox compila la política (por defecto, solo HOME): toda ruta de usuario se resuelve bajo sus raíces
+    int sandbox_listo = iniciar_sandbox(home);
+    if (sandbox_listo == -1) { fprintf(stderr, "ERROR FATAL: HOME inaccesible.\n"); return 1; }
+    if (sandbox_listo != 0) return 1; // Política inválida: fail-closed
+
+    // El logger resuelve rutas y abre los archivos una sola vez por sesión (por lotes si no es interactivo)
+    iniciar_logger(!interactivo);
+    // Ruleset Landlock para comandos externos (opcional, FLSH_LANDLOCK=1), construido una sola vez
+    iniciar_landlock();
+    // Self-pipe de SIGCHLD para recoger trabajos en segundo plano sin bloquear
+    iniciar_trabajos();
+    // Histogramas por comando y exportación a FLSH_METRICS_FILE
+    iniciar_telemetria();
+    // SIGHUP recompila la política en un hilo aparte
+    iniciar_recarga_politica(SIGHUP);
+
+    return ejecutar_sesion(cadena, script, interactivo);
+}
+#endif
+
@@ -0,0 +1,35 @@
+# Utilidades de las pruebas de flsh. Cada prueba es un script que lo incluye con:
+#   . "$(dirname "$0")/comun.sh"
+# y recibe el binario como primer argumento (por defecto build/release/flsh).
+# - Copia el binario a un directorio temporal: sin /var/log/shell escribible, los logs quedan en su 'logs/'.
+# - Deja el directorio actual en un HOME temporal (el shell arranca en el directorio actual).
+# - flsh LÍNEAS...: corre las líneas por lotes en ese HOME (stdout y stderr juntos).
+# - log_nuevo: lo que se agregó a shell.log desde que empezó la prueba.
+PRUEBA=$(basename "$0" .sh)
+FLSH_ORIGEN=${1:-build/release/flsh}
+[ -x "$FLSH_ORIGEN" ] || { echo "$PRUEBA: no existe $FLSH_ORIGEN (make release)"; exit 1; }
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/flsh_prueba.XXXXXX")
+trap 'rm -rf "$DIR"' EXIT
+cp "$FLSH_ORIGEN" "$DIR/flsh"
+FLSH=$DIR/flsh
+if [ -w /var/log/shell ]; then LOGS=/var/log/shell; else LOGS=$DIR/logs; fi
+LOG_INICIO=$( { wc -c < "$LOGS/shell.log"; } 2>/dev/null || echo 0)
+mkdir "$DIR/home"
+cd "$DIR/home" || exit 1
+
+flsh() {
+    printf '%s\n' "$@" | env HOME="$DIR/home" timeout 20 "$FLSH" 2>&1
+}
+
+log_nuevo() {
+    tail -c +$((LOG_INICIO + 1)) "$LOGS/shell.log" 2>/dev/null
+}
+
+fallar() {
+    echo "FALLA $PRUEBA: $*"
+    exit 1
+}
+
+ok() {
+    echo "ok    $PRUEBA"
+}
@@ -0,0 +1,22 @@
+#!/bin/sh
+# El usuario de los registros sale de getpwuid, no de $USER: con un USER falso el registro lleva el nombre
+# real y 'audit' (que a quien no es root ni de 'adm' lo limita a sus registros) sigue encontrándolos.
+# Como root la prueba corre como 'nobody' para pasar por esa restricción. Con la política por lotes
+# (intervalo:200) el 'echo' sigue en el anillo al consultar: audit lo vuelca antes de leer los logs.
+. "$(dirname "$0")/comun.sh"
+[ "$LOGS" = "$DIR/logs" ] || { echo "omitida $PRUEBA: /var/log/shell compartido"; exit 0; }
+
+como=""
+if [ "$(id -u)" -eq 0 ]; then
+    command -v setpriv > /dev/null || { echo "omitida $PRUEBA: falta setpriv para correr sin root"; exit 0; }
+    chown -R 65534:65534 "$DIR"
+    como="setpriv --reuid=65534 --regid=65534 --clear-groups"
+fi
+nombre=$($como id -un)
+
+salida=$(printf 'echo marca_audit\naudit -c echo\n' |
+         $como env HOME="$DIR/home" USER=root timeout 20 "$FLSH" 2>&1)
+log_nuevo | grep "CMD:echo" | grep -q "USER:$nombre " || fallar "el registro no lleva USER:$nombre: $(log_nuevo | grep CMD:echo)"
+log_nuevo | grep -q "USER:root " && fallar "se registró con el USER falso"
+echo "$salida" | grep -q "USER:$nombre | CMD:echo" || fallar "audit no encontró el registro propio: '$salida'"
+ok
@@ -0,0 +1,12 @@
+#!/bin/sh
+# Retención del registro binario: con FLSH_LOG_SEGMENTOS=3 y segmentos de 64 KB, una sesión que rota
+# varias veces deja exactamente 3 segmentos (el siguiente que prepara el escritor no cuenta).
+. "$(dirname "$0")/comun.sh"
+[ "$LOGS" = "$DIR/logs" ] || { echo "omitida $PRUEBA: /var/log/shell compartido"; exit 0; }
+
+awk 'BEGIN { for (i = 0; i < 3000; i++) print "echo evento_" i }' > lote
+env HOME="$DIR/home" FLSH_LOG_FORMATO=binario FLSH_LOG_SEGMENTOS=3 FLSH_LOG_SEGMENTO=64K \
+    timeout 20 "$FLSH" < lote > /dev/null 2>&1 || fallar "el lote terminó con error"
+segmentos=$(ls "$LOGS"/shell-*.flsl 2>/dev/null | wc -l)
+[ "$segmentos" -eq 3 ] || fallar "quedaron $segmentos segmentos (se esperaban 3)"
+ok
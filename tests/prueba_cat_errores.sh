@@ -0,0 +1,20 @@
+#!/bin/sh
+# cat sobre algo que se abre pero no se lee (un directorio: read() da EISDIR) informa el error y termina
+# con estado 1, en el ciclo sincrónico, con io_uring y hacia un pipe. No registra "Lectura exitosa".
+. "$(dirname "$0")/comun.sh"
+
+mkdir d
+echo hola > a.txt
+for io in sync uring; do
+    salida=$(printf 'cat d\n' | env HOME="$DIR/home" FLSH_IO=$io timeout 20 "$FLSH" 2>&1)
+    estado=$?
+    [ "$estado" -eq 1 ] || fallar "$io: 'cat d' terminó con $estado"
+    echo "$salida" | grep -q "cat: Is a directory" || fallar "$io: falta el error: '$salida'"
+    salida=$(printf 'cat a.txt d\n' | env HOME="$DIR/home" FLSH_IO=$io timeout 20 "$FLSH" 2>&1)
+    [ $? -eq 1 ] || fallar "$io: 'cat a.txt d' no terminó con 1"
+    echo "$salida" | grep -q "^hola" || fallar "$io: 'cat a.txt d' no mostró a.txt"
+done
+salida=$(flsh "cat d | cat")
+echo "$salida" | grep -q "cat: Is a directory" || fallar "pipe: falta el error: '$salida'"
+log_nuevo | grep "CMD:cat" | grep -q "Lectura exitosa$\|Lectura exitosa |" && fallar "se registró una lectura exitosa"
+ok
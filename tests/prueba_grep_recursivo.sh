@@ -0,0 +1,21 @@
+#!/bin/sh
+# grep -r antepone a cada línea el operando tal como se escribió unido a la ruta relativa ('.' -> './a.txt',
+# 'd/' -> 'd/b.txt'); sin operando busca en '.' y muestra la ruta relativa sola, como grep(1).
+. "$(dirname "$0")/comun.sh"
+
+mkdir -p d/e
+echo hola > a.txt
+echo hola > d/b.txt
+echo hola > d/e/c.txt
+
+esperar() {
+    salida=$(flsh "$1" | sort)
+    [ "$salida" = "$(printf "$2")" ] || fallar "'$1' mostró '$salida'"
+}
+esperar "grep -r hola ." './a.txt:hola\n./d/b.txt:hola\n./d/e/c.txt:hola'
+esperar "grep -r hola d" 'd/b.txt:hola\nd/e/c.txt:hola'
+esperar "grep -r hola d/" 'd/b.txt:hola\nd/e/c.txt:hola'
+esperar "grep -r hola ./d" './d/b.txt:hola\n./d/e/c.txt:hola'
+esperar "grep -r hola" 'a.txt:hola\nd/b.txt:hola\nd/e/c.txt:hola'
+esperar "grep -rc hola d/e" 'd/e/c.txt:1'
+ok
@@ -0,0 +1,13 @@
+#!/bin/sh
+# Errores de uso y de sintaxis de grep terminan con estado 2, como grep(1): con 'set -e' el lote se corta.
+. "$(dirname "$0")/comun.sh"
+
+echo hola > x
+muchos=$(awk 'BEGIN { for (i = 0; i < 33; i++) printf "-e p%d ", i }')
+for linea in "grep -e" "grep $muchos x" "grep -E ( x" "grep -z hola x" "grep"; do
+    salida=$(printf 'set -e\n%s\necho siguio\n' "$linea" | env HOME="$DIR/home" timeout 20 "$FLSH" 2>&1)
+    estado=$?
+    [ "$estado" -eq 2 ] || fallar "'$linea' terminó con $estado"
+    echo "$salida" | grep -q siguio && fallar "'$linea': set -e no cortó el lote"
+done
+ok
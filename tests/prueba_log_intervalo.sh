@@ -0,0 +1,16 @@
+#!/bin/sh
+# Logger con FLUSH_INTERVALO: en un lote largo los eventos llegan a shell.log mientras el lote sigue
+# corriendo. Cada evento encolado despierta al escritor; el plazo de volcado no debe correrse por eso.
+. "$(dirname "$0")/comun.sh"
+
+awk 'BEGIN { for (i = 0; i < 30; i++) print "sleep 0.1" }' > lote
+env HOME="$DIR/home" FLSH_LOG_FLUSH=intervalo:200 timeout 20 "$FLSH" < lote > /dev/null 2>&1 &
+pid=$!
+sleep 1.5
+en_disco=$(log_nuevo | grep -c "CMD:sleep")
+kill -0 "$pid" 2>/dev/null || fallar "el lote terminó antes de medir"
+wait "$pid"
+# A 1,5 s corrieron ~14 'sleep 0.1'; con un intervalo de 200 ms deben estar casi todos en disco
+[ "$en_disco" -ge 8 ] || fallar "$en_disco eventos en disco a 1,5 s del lote (se esperaban >= 8)"
+[ "$(log_nuevo | grep -c "CMD:sleep")" -eq 30 ] || fallar "faltan eventos al terminar el lote"
+ok
@@ -0,0 +1,19 @@
+#!/bin/sh
+# Modo por lotes sin FLSH_LOG_FLUSH: la política por defecto es intervalo:200, así que shell.log va a lo
+# sumo un intervalo detrás de los comandos. Cada 'mkdir paso_N' deja una marca en disco: los mkdir que ya
+# corrieron en un instante deben estar todos en el log poco más de un intervalo después.
+. "$(dirname "$0")/comun.sh"
+
+awk 'BEGIN { for (i = 0; i < 20; i++) { print "mkdir paso_" i; print "sleep 0.1" } }' > lote
+env -u FLSH_LOG_FLUSH HOME="$DIR/home" timeout 20 "$FLSH" < lote > /dev/null 2>&1 &
+pid=$!
+sleep 1
+corridos=$(ls -d paso_* 2>/dev/null | wc -l)
+sleep 0.35
+en_disco=$(log_nuevo | grep -c "CMD:mkdir")
+kill -0 "$pid" 2>/dev/null || fallar "el lote terminó antes de medir"
+wait "$pid"
+[ "$corridos" -ge 5 ] || fallar "solo corrieron $corridos mkdir en 1 s"
+[ "$en_disco" -ge "$corridos" ] || fallar "$corridos mkdir corridos pero $en_disco en el log 350 ms después"
+[ "$(log_nuevo | grep -c "CMD:mkdir")" -eq 20 ] || fallar "faltan eventos al terminar el lote"
+ok
@@ -0,0 +1,13 @@
+#!/bin/sh
+# ls con un operando que no existe nombra ese operando en el error, lista los demás y termina con 1.
+. "$(dirname "$0")/comun.sh"
+
+mkdir d
+touch d/x a.txt
+salida=$(printf 'ls d nada a.txt\n' | env HOME="$DIR/home" timeout 20 "$FLSH" 2>&1)
+estado=$?
+[ "$estado" -eq 1 ] || fallar "terminó con $estado"
+echo "$salida" | grep -q "ls: nada: No such file or directory" || fallar "el error no nombra el operando: '$salida'"
+echo "$salida" | grep -q "^x$" || fallar "no listó d"
+echo "$salida" | grep -q "^a.txt$" || fallar "no listó a.txt"
+ok
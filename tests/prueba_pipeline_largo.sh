@@ -0,0 +1,13 @@
+#!/bin/sh
+# Pipelines sin tope de etapas: 100 etapas en primer plano y en segundo plano (los pids del trabajo
+# se dimensionan con la línea).
+. "$(dirname "$0")/comun.sh"
+
+tuberia="echo hola$(awk 'BEGIN { for (i = 0; i < 98; i++) printf " | cat" }') | grep hola"
+salida=$(flsh "$tuberia")
+[ "$salida" = "hola" ] || fallar "primer plano: '$salida'"
+log_nuevo | grep -q "CMD:pipeline.*Etapas: echo=0 | cat=0" || fallar "primer plano: falta el registro del pipeline"
+
+salida=$(flsh "$tuberia > fondo.txt &" "wait" "cat fondo.txt" "jobs")
+echo "$salida" | grep -q "^hola$" || fallar "segundo plano: '$salida'"
+ok
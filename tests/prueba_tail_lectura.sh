@@ -0,0 +1,23 @@
+#!/bin/sh
+# tail -n sobre un archivo regular lee cada byte una sola vez: imprime desde los bloques que ya leyó hacia
+# atrás (el log registra los bytes leídos). También compara la salida con tail(1) en archivos de varios
+# bloques, incluido uno más largo que lo que se retiene en memoria.
+. "$(dirname "$0")/comun.sh"
+
+printf 'uno\ndos\ntres\n' > chico
+[ "$(flsh "tail -n 2 chico")" = "$(printf 'dos\ntres')" ] || fallar "salida de tail -n 2"
+log_nuevo | grep "CMD:tail" | grep -q "MSG:Lectura exitosa: 13 bytes leidos" ||
+    fallar "se leyeron bytes de más: $(log_nuevo | grep CMD:tail)"
+[ "$(flsh "tail -n 5 chico")" = "$(printf 'uno\ndos\ntres')" ] || fallar "salida de tail -n 5"
+
+# ~6 MB: más que los 16 bloques de 256 KB que quedan en memoria
+awk 'BEGIN { for (i = 0; i < 400000; i++) printf "linea %d abcdefgh\n", i }' > grande
+for n in 1 20000 150000 330000 400000 500000; do
+    flsh "tail -n $n grande" > obtenido
+    tail -n "$n" grande > esperado
+    cmp -s obtenido esperado || fallar "tail -n $n grande difiere de tail(1)"
+done
+flsh "tail -c 300000 grande" > obtenido
+tail -c 300000 grande > esperado
+cmp -s obtenido esperado || fallar "tail -c 300000 grande difiere de tail(1)"
+ok
@@ -0,0 +1,87 @@
+/*
+ * flsh-cliente: conecta la terminal (o los descriptores 0-2 que tenga) a una sesión de 'flsh --servidor'.
+ * Los descriptores viajan al daemon con SCM_RIGHTS: la sesión lee y escribe directamente en ellos, sin
+ * pasar por el cliente. El cliente solo reenvía SIGINT/SIGQUIT/SIGTERM al grupo de la sesión y termina
+ * con el código de salida de la sesión. Un SIGHUP (terminal colgada) cierra la conexión, y el daemon
+ * cuelga la sesión.
+ * La identidad y el HOME los fija el daemon desde SO_PEERCRED: del entorno solo se envía SSH_CONNECTION,
+ * como origen para el registro.
+ *
+ * Compilación: gcc -O2 tools/flsh_cliente.c -o flsh-cliente
+ * Uso:         ./flsh-cliente [-s socket] [-c comando]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include "../flsh_servidor.h"
+
+int main(int argc, char **argv) {
+    const char *ruta = getenv("FLSH_SOCKET"), *comando = NULL;
+    if (!ruta || !*ruta) ruta = SERVIDOR_SOCKET_DEFECTO;
+    int opcion;
+    while ((opcion = getopt(argc, argv, "s:c:")) != -1) {
+        if (opcion == 's') ruta = optarg;
+        else if (opcion == 'c') comando = optarg;
+        else { fprintf(stderr, "uso: %s [-s socket] [-c comando]\n", argv[0]); return 2; }
+    }
+    if (comando && strlen(comando) >= SERVIDOR_MAX_TEXTO) { fprintf(stderr, "flsh-cliente: comando demasiado largo\n"); return 2; }
+
+    struct sockaddr_un dir;
+    if (direccion_servidor(ruta, &dir) != 0) { fprintf(stderr, "flsh-cliente: ruta de socket demasiado larga\n"); return 2; }
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&dir, sizeof(dir)) != 0) {
+        fprintf(stderr, "flsh-cliente: %s: %s\n", ruta, strerror(errno));
+        return 1;
+    }
+
+    // Las señales se leen junto con el socket: se bloquean antes de enviar la solicitud
+    sigset_t senales;
+    sigemptyset(&senales);
+    sigaddset(&senales, SIGINT);
+    sigaddset(&senales, SIGQUIT);
+    sigaddset(&senales, SIGTERM);
+    sigaddset(&senales, SIGHUP);
+    sigprocmask(SIG_BLOCK, &senales, NULL);
+    int fd_senales = signalfd(-1, &senales, SFD_CLOEXEC);
+
+    char origen[48] = "LOCAL/CONSOLE";
+    const char *ssh = getenv("SSH_CONNECTION");
+    if (ssh) sscanf(ssh, "%47s", origen);
+    int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    if (enviar_mensaje_servidor(fd, MENSAJE_SOLICITUD, 0, origen, comando, fds, 3) != 0) {
+        fprintf(stderr, "flsh-cliente: %s\n", strerror(errno));
+        return 1;
+    }
+
+    struct pollfd p[2] = { { .fd = fd, .events = POLLIN }, { .fd = fd_senales, .events = POLLIN } };
+    for (;;) {
+        if (poll(p, fd_senales >= 0 ? 2 : 1, -1) < 0) { if (errno == EINTR) continue; break; }
+        if (p[1].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            if (read(fd_senales, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+                if (info.ssi_signo == SIGHUP) return 129;
+                enviar_mensaje_servidor(fd, MENSAJE_SENAL, (int)info.ssi_signo, NULL, NULL, NULL, 0);
+            }
+        }
+        if (p[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            mensaje_servidor_t m;
+            ssize_t n = recv(fd, &m, sizeof(m) - 1, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < (ssize_t)offsetof(mensaje_servidor_t, texto)) break;
+            if (m.tipo == MENSAJE_FIN) return m.valor;
+            if (m.tipo == MENSAJE_RECHAZO) {
+                size_t largo = m.largo < (size_t)n - offsetof(mensaje_servidor_t, texto) ? m.largo : (size_t)n - offsetof(mensaje_servidor_t, texto);
+                fprintf(stderr, "flsh-cliente: sesión rechazada: %.*s\n", (int)largo, m.texto);
+                return 1;
+            }
+        }
+    }
+    fprintf(stderr, "flsh-cliente: el servidor cerró la conexión\n");
+    return 1;
+}
@@ -0,0 +1,140 @@
+/*
+ * flsh-logdump: convierte segmentos del registro binario (FLSH_LOG_FORMATO=binario) al formato de texto
+ * de 'shell.log'/'sistema_error.log', línea por línea idéntico al que habría escrito el shell.
+ * Los segmentos abiertos (sesión en curso o interrumpida) se leen hasta el último registro completo.
+ * Dentro de cada segmento los registros salen ordenados por instante.
+ * Con -i solo se emiten los niveles de 'shell.log' (INFO/WARNING) y con -e los de 'sistema_error.log'.
+ *
+ * Compilación: gcc -O2 tools/flsh_logdump.c -o flsh-logdump
+ * Uso:         ./flsh-logdump [-i|-e] logs/shell-*.flsl
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include "../flsh_binlog.h"
+
+typedef enum { TODOS, SOLO_SHELL, SOLO_ERRORES } filtro_t;
+
+typedef struct {
+    uint64_t instante_ns;
+    size_t pos;
+} orden_t;
+
+// Los errores se escriben al instante y el resto al drenar el anillo: se reordena por instante
+static int comparar_orden(const void *a, const void *b) {
+    const orden_t *x = a, *y = b;
+    if (x->instante_ns != y->instante_ns) return (x->instante_ns > y->instante_ns) - (x->instante_ns < y->instante_ns);
+    return (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+static void emitir(const cabecera_segmento_t *c, const registro_binlog_t *r, const char *datos) {
+    uint64_t ns = c->base_real_ns + (r->instante_ns - c->base_mono_ns);
+    time_t segundo = (time_t)(ns / 1000000000ULL);
+    struct tm tm;
+    char fecha[32];
+    localtime_r(&segundo, &tm);
+    strftime(fecha, sizeof(fecha), "%Y-%m-%d %H:%M:%S", &tm);
+
+    char origen[INET_ADDRSTRLEN];
+    const char *src = c->origen;
+    if (r->ip != 0) src = inet_ntop(AF_INET, &r->ip, origen, sizeof(origen));
+
+    char perf[160] = "";
+    if (r->banderas & BINLOG_CON_PERF) {
+        perf_evento_t p;
+        memcpy(&p, datos, sizeof(p));
+        formatear_perf(perf, sizeof(perf), &p);
+        datos += sizeof(p);
+    }
+    const char *nivel = r->nivel <= BINLOG_CRITICAL ? nombres_nivel_binlog[r->nivel] : "INFO";
+    const char *usuario = usuario_de_registro(c, r);
+    printf("[%s] [%s] SRC:%s | USER:%.*s | CMD:%.*s | MSG:%.*s%s\n", fecha, nivel, src,
+           (int)strnlen(usuario, sizeof(c->usuario)), usuario,
+           (int)r->largo_cmd, datos, (int)r->largo_msg, datos + r->largo_cmd, perf);
+}
+
+// Recorre los registros de un segmento; retorna la cantidad emitida o -1 si no es un segmento válido
+static long volcar_segmento(const char *ruta, filtro_t filtro) {
+    int fd = open(ruta, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { perror(ruta); return -1; }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(cabecera_segmento_t)) {
+        fprintf(stderr, "%s: no es un segmento de flsh\n", ruta);
+        close(fd);
+        return -1;
+    }
+    size_t tam = (size_t)st.st_size;
+    const char *mapa = mmap(NULL, tam, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapa == MAP_FAILED) { perror(ruta); return -1; }
+
+    const cabecera_segmento_t *c = (const cabecera_segmento_t *)mapa;
+    if (memcmp(c->magico, BINLOG_MAGICO, sizeof(c->magico)) != 0 || c->version != BINLOG_VERSION ||
+        c->tam_cabecera < sizeof(*c) || c->tam_cabecera > tam) {
+        fprintf(stderr, "%s: no es un segmento de flsh (o es de otra versión)\n", ruta);
+        munmap((void *)mapa, tam);
+        return -1;
+    }
+    // Un segmento cerrado declara su largo; uno abierto se recorre hasta el primer 'largo' 0
+    size_t fin = (c->cerrado && c->usado <= tam) ? c->usado : tam;
+    size_t pos = c->tam_cabecera, n = 0, cap = 0;
+    orden_t *orden = NULL;
+    while (pos + sizeof(registro_binlog_t) <= fin) {
+        const registro_binlog_t *r = (const registro_binlog_t *)(mapa + pos);
+        size_t largo = __atomic_load_n(&r->largo, __ATOMIC_ACQUIRE);
+        size_t datos = (size_t)r->largo_cmd + r->largo_msg + ((r->banderas & BINLOG_CON_PERF) ? sizeof(perf_evento_t) : 0);
+        if (largo == 0) break;
+        if (largo % BINLOG_ALINEACION != 0 || largo > fin - pos || sizeof(*r) + datos > largo) {
+            fprintf(stderr, "%s: registro corrupto en el byte %zu\n", ruta, pos);
+            break;
+        }
+        int error = r->nivel == BINLOG_ERROR || r->nivel == BINLOG_CRITICAL;
+        if (filtro == TODOS || (filtro == SOLO_ERRORES) == error) {
+            if (n == cap) {
+                size_t nueva = cap ? cap * 2 : 1024;
+                orden_t *v = realloc(orden, nueva * sizeof(*v));
+                if (v == NULL) { perror("realloc"); break; }
+                orden = v;
+                cap = nueva;
+            }
+            orden[n++] = (orden_t){ r->instante_ns, pos };
+        }
+        pos += largo;
+    }
+    qsort(orden, n, sizeof(*orden), comparar_orden);
+    for (size_t i = 0; i < n; i++) {
+        const registro_binlog_t *r = (const registro_binlog_t *)(mapa + orden[i].pos);
+        emitir(c, r, (const char *)(r + 1));
+    }
+    free(orden);
+    munmap((void *)mapa, tam);
+    return (long)n;
+}
+
+int main(int argc, char **argv) {
+    filtro_t filtro = TODOS;
+    int opt;
+    while ((opt = getopt(argc, argv, "ie")) != -1) {
+        if (opt == 'i') filtro = SOLO_SHELL;
+        else if (opt == 'e') filtro = SOLO_ERRORES;
+        else {
+            fprintf(stderr, "uso: %s [-i|-e] segmento...\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "uso: %s [-i|-e] segmento...\n", argv[0]);
+        return 2;
+    }
+    int estado = 0;
+    for (int i = optind; i < argc; i++)
+        if (volcar_segmento(argv[i], filtro) < 0) estado = 1;
+    return estado;
+}
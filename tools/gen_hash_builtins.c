@@ -0,0 +1,57 @@
+/*
+ * Generador de la tabla de hash perfecto de los built-ins (flsh_builtins_hash.h).
+ * Toma los nombres de flsh_builtins.def y busca la semilla más chica con la que 'hash_builtin'
+ * no produce colisiones en una tabla de potencia de 2: empieza por el menor tamaño >= la cantidad
+ * de built-ins y lo duplica si ninguna semilla sirve. En el shell la búsqueda queda en un hash,
+ * una lectura de la tabla y un único strcmp de confirmación.
+ *
+ * Compilación: gcc -O2 tools/gen_hash_builtins.c -o gen_hash_builtins
+ * Uso:         ./gen_hash_builtins > flsh_builtins_hash.h
+ */
+#include <stdio.h>
+#include <string.h>
+#include "../flsh_builtins.h"
+
+static const char *const nombres[] = {
+#define BUILTIN(nombre, ...) nombre,
+#include "../flsh_builtins.def"
+#undef BUILTIN
+};
+#define CANTIDAD ((int)(sizeof(nombres) / sizeof(nombres[0])))
+#define SEMILLAS_MAX 1000000u
+#define TAM_MAX 4096u
+
+int main(void) {
+    static int16_t ranura[TAM_MAX];
+    uint32_t tam = 1;
+    while (tam < (uint32_t)CANTIDAD) tam <<= 1;
+    for (; tam <= TAM_MAX; tam <<= 1) {
+        for (uint32_t semilla = 0; semilla < SEMILLAS_MAX; semilla++) {
+            int colision = 0;
+            for (uint32_t k = 0; k < tam; k++) ranura[k] = -1;
+            for (int i = 0; i < CANTIDAD && !colision; i++) {
+                uint32_t h = hash_builtin(nombres[i], semilla) & (tam - 1);
+                if (ranura[h] >= 0) colision = 1;
+                else ranura[h] = (int16_t)i;
+            }
+            if (colision) continue;
+
+            printf("/* Generado por tools/gen_hash_builtins a partir de flsh_builtins.def. No editar a mano. */\n");
+            printf("#define BUILTIN_HASH_CANTIDAD %d\n", CANTIDAD);
+            printf("#define BUILTIN_HASH_SEMILLA %uu\n", semilla);
+            printf("#define BUILTIN_HASH_TAM %uu\n\n", tam);
+            printf("// Ranura -> índice en el registro (-1 = vacía)\n");
+            printf("static const int16_t builtin_ranura[BUILTIN_HASH_TAM] = {");
+            for (uint32_t k = 0; k < tam; k++) {
+                if (k % 8 == 0) printf("\n   ");
+                printf(" %2d,", ranura[k]);
+                if (ranura[k] >= 0) printf(" /* %-5s */", nombres[ranura[k]]);
+                else if (k % 8 != 7) printf("            ");
+            }
+            printf("\n};\n");
+            return 0;
+        }
+    }
+    fprintf(stderr, "gen_hash_builtins: no se encontró una semilla sin colisiones\n");
+    return 1;
+}